@@ -27,14 +27,57 @@ typedef struct {
   const char *value;
 } request_item_t;
 
+// Request headers that get_header_id() finds without a search
+typedef enum {
+  HEADER_HOST,
+  HEADER_CONNECTION,
+  HEADER_CONTENT_TYPE,
+  HEADER_CONTENT_LENGTH,
+  HEADER_CONTENT_ENCODING,
+  HEADER_TRANSFER_ENCODING,
+  HEADER_ACCEPT,
+  HEADER_ACCEPT_ENCODING,
+  HEADER_ACCEPT_LANGUAGE,
+  HEADER_AUTHORIZATION,
+  HEADER_COOKIE,
+  HEADER_USER_AGENT,
+  HEADER_REFERER,
+  HEADER_ORIGIN,
+  HEADER_CACHE_CONTROL,
+  HEADER_PRAGMA,
+  HEADER_IF_NONE_MATCH,
+  HEADER_IF_MODIFIED_SINCE,
+  HEADER_IF_RANGE,
+  HEADER_RANGE,
+  HEADER_EXPECT,
+  HEADER_UPGRADE,
+  HEADER_SEC_WEBSOCKET_KEY,
+  HEADER_SEC_WEBSOCKET_VERSION,
+  HEADER_LAST_EVENT_ID,
+  HEADER_X_FORWARDED_FOR,
+  HEADER_X_REQUEST_ID,
+  HEADER_ACCESS_CONTROL_REQUEST_METHOD,
+  HEADER_ACCESS_CONTROL_REQUEST_HEADERS,
+  HEADER_TRACEPARENT,
+  HEADER_COUNT
+} header_id_t;
+
 // Internal struct, do not use it
 typedef struct {
   request_item_t *items;
   uint16_t count;
   uint16_t capacity;
+
+  // Read buffer the items may still point into, see http.c
+  const char *view_begin;
+  const char *view_end;
+
+  // Index + 1 of the first item of each header_id_t, 0 if absent
+  uint8_t known[HEADER_COUNT];
 } request_t;
 
 typedef struct context_t context_t;
+typedef struct item_index_s item_index_t;
 
 typedef struct {
   Arena *arena;
@@ -44,19 +87,29 @@ typedef struct {
   char *body;
   size_t body_len;
   request_t headers;
-  request_t query;
+  request_t query; // Filled on the first get_query(), see request.c
   request_t params;
   context_t *ctx;
   uint8_t http_major;
   uint8_t http_minor;
   bool is_head_request;
   void *chain;
+
+  // Undecoded query string, NULL once it is parsed
+  char *query_string;
+  size_t query_len;
+  item_index_t *query_index;
+
+  // Header names that are not a header_id_t, built on the first lookup
+  item_index_t *header_index;
 } Req;
 
 // Internal struct, do not use it
 typedef struct {
   const char *name;
   const char *value;
+  size_t name_len;
+  size_t value_len;
 } http_header_t;
 
 typedef struct {
@@ -72,6 +125,7 @@ typedef struct {
   uint16_t header_capacity;
   bool replied;
   bool is_head_request;
+  void *exchange;
 } Res;
 
 typedef enum {
@@ -158,6 +212,8 @@ typedef void (*timer_callback_t)(void *user_data);
 // SERVER FUNCTIONS
 int server_init(void);
 int server_listen(uint16_t port);
+int server_listen_threads(uint16_t port, uint16_t thread_count);
+int server_listen_unix(const char *path, int mode);
 void server_run(void);
 void server_shutdown(void);
 void server_atexit(shutdown_callback_t callback);
@@ -170,12 +226,35 @@ void clear_timer(Timer *timer);
 // REQUEST FUNCTIONS
 const char *get_param(const Req *req, const char *key);
 const char *get_query(const Req *req, const char *key);
+
+// Values of a repeated query key in order, up to max of them.
+// Returns how many there are, empty values are NULL.
+size_t get_query_all(const Req *req, const char *key, const char **values, size_t max);
 const char *get_header(const Req *req, const char *key);
+const char *get_header_id(const Req *req, header_id_t id);
 
 // RESPONSE FUNCTIONS
 void reply(Res *res, int status, const void *body, size_t body_len);
 void redirect(Res *res, int status, const char *url);
 
+// Sends buf without copying it, free_cb releases it once it is written
+typedef void (*reply_free_t)(void *buf);
+void reply_owned(Res *res, int status, void *buf, size_t len, reply_free_t free_cb);
+
+// Streams a file with sendfile(), answers Range requests with 206
+void send_file(Res *res, const char *path, const char *content_type);
+
+// Streams a body of unknown length with Transfer-Encoding: chunked.
+// res_write() returns 1 when the handler should wait for the drain
+// callback before writing more, -1 once the connection is closed
+// or when the response has no body (HEAD, 1xx, 204, 304).
+// res_end() must be called in every case, it releases the response.
+typedef void (*res_drain_t)(Res *res, void *data);
+int res_begin(Res *res, int status);
+int res_write(Res *res, const void *buf, size_t len);
+void res_on_drain(Res *res, res_drain_t drain_cb, void *data);
+int res_end(Res *res);
+
 // set_header DOES NOT check for duplicates!
 // User is responsible for avoiding duplicate headers.
 // Multiple calls with same name will add multiple headers.
@@ -217,6 +296,60 @@ void use(MiddlewareHandler middleware_handler);
 void set_context(Req *req, const char *key, void *data);
 void *get_context(Req *req, const char *key);
 
+// RESPONSE CACHE
+typedef struct {
+  size_t max_bytes; // Memory budget of all cached responses
+  uint32_t default_ttl; // Seconds, for responses without max-age, 0 skips them
+  uint32_t stale_while_revalidate; // Seconds, unless the response sets its own
+} CacheConfig;
+
+int response_cache_enable(const CacheConfig *config);
+void response_cache_purge(const char *url);
+
+// COMPRESSION
+typedef struct {
+  int level; // zlib level 1-9, 0 for the default
+  size_t min_size; // Smaller bodies are sent as they are, 0 for the default
+  size_t spawn_threshold; // Larger bodies are compressed off the loop, 0 for the default
+} CompressionConfig;
+
+int compression_enable(const CompressionConfig *config);
+
+// SERVER-SENT EVENTS
+// Turns the connection into an event stream of the channel and replays
+// the events a reconnecting client missed. Do not reply after it succeeds.
+int sse_subscribe(Req *req, Res *res, const char *channel);
+
+// Sends an event to every subscriber of the channel on every loop,
+// event may be NULL for the default "message" event
+int sse_publish(const char *channel, const char *event, const char *data, size_t data_len);
+
+// WEBSOCKET
+typedef struct websocket_s WebSocket;
+
+typedef void (*ws_open_cb)(WebSocket *ws);
+typedef void (*ws_message_cb)(WebSocket *ws, const void *data, size_t len, bool binary);
+typedef void (*ws_close_cb)(WebSocket *ws, uint16_t code);
+
+typedef struct {
+  ws_open_cb on_open;
+  ws_message_cb on_message; // data is only valid during the call
+  ws_close_cb on_close; // Called once, ws is freed after it
+  void *user_data;
+} WebSocketConfig;
+
+// Answers the handshake with 101 and takes the connection over.
+// Returns -1 without replying if the request is not a valid handshake.
+int ws_upgrade(Req *req, Res *res, const WebSocketConfig *config);
+int ws_send(WebSocket *ws, const void *data, size_t len, bool binary);
+void ws_close(WebSocket *ws, uint16_t code);
+void *ws_user_data(WebSocket *ws);
+
+// Groups span every loop, a broadcast is framed once for all members
+int ws_join(WebSocket *ws, const char *group);
+void ws_leave(WebSocket *ws, const char *group);
+int ws_broadcast(const char *group, const void *data, size_t len, bool binary);
+
 // TASK SPAWN
 typedef void (*spawn_handler_t)(void *context);
 int spawn(void *context, spawn_handler_t work_fn, spawn_handler_t done_fn);
@@ -243,6 +376,11 @@ void register_del(const char *path, int mw_count, ...);
 void register_head(const char *path, int mw_count, ...);
 void register_options(const char *path, int mw_count, ...);
 
+// Serialized once and answered to GET and HEAD on the exact path
+// without Req, Res, middleware or a handler. The body is copied.
+int register_static(const char *path, int status, const char *content_type,
+                    const void *body, size_t body_len);
+
 #define get(path, ...) \
   register_get(path, MW(__VA_ARGS__), __VA_ARGS__)
 
@@ -282,8 +420,17 @@ uv_tcp_t *get_client_handle(Res *res);
 // DEBUG FUNCTIONS
 bool server_is_running(void);
 int get_active_connections(void);
+
+// Admission control at MAX_CONNECTIONS, summed across loops
+bool server_accept_paused(void);
+uint64_t get_accept_paused_ms(void);
+uint64_t get_rejected_connections(void);
 int get_pending_async_work(void);
 
+// Response writes and the buffers they carried, summed across loops
+uint64_t get_write_calls(void);
+uint64_t get_write_buffers(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -24,8 +24,7 @@
 #define ARENA_POOL_GROW_BATCH 8 /* Allocate 8 at a time */
 #endif
 
-typedef struct
-{
+struct arena_pool_s {
   Arena *arenas[ARENA_POOL_SIZE];
   uint16_t head;
   uint16_t peak_usage;
@@ -34,18 +33,26 @@ typedef struct
   uint16_t shrink_count;
   uv_mutex_t mutex;
   bool initialized;
-} arena_pool_t;
+};
 
+// Global pool, used by the main loop and by threads without a bound pool
 static arena_pool_t arena_pool = { 0 };
 
+// Pool of the event loop running on this thread (see arena_pool_bind)
+static _Thread_local arena_pool_t *thread_pool = NULL;
+
+static arena_pool_t *current_pool(void) {
+  return thread_pool ? thread_pool : &arena_pool;
+}
+
 // Called when acquiring
-static void arena_pool_try_grow(void) {
+static void arena_pool_try_grow(arena_pool_t *pool) {
   // Already at mutex lock when called
 
-  if (arena_pool.head > ARENA_POOL_LOW_WATERMARK)
+  if (pool->head > ARENA_POOL_LOW_WATERMARK)
     return;
 
-  uint16_t space_available = ARENA_POOL_SIZE - arena_pool.head;
+  uint16_t space_available = ARENA_POOL_SIZE - pool->head;
   if (space_available == 0)
     return;
 
@@ -67,42 +74,42 @@ static void arena_pool_try_grow(void) {
     }
 
     arena->begin = arena->end;
-    arena_pool.arenas[arena_pool.head++] = arena;
-    arena_pool.total_allocated++;
+    pool->arenas[pool->head++] = arena;
+    pool->total_allocated++;
     allocated++;
   }
 
   if (allocated > 0) {
-    arena_pool.grow_count++;
+    pool->grow_count++;
     LOG_DEBUG("Arena pool grew: +%d arenas (now %d/%d available)",
               allocated,
-              arena_pool.head,
+              pool->head,
               ARENA_POOL_SIZE);
   }
 }
 
 // Called when releasing
-static void arena_pool_try_shrink(void) {
+static void arena_pool_try_shrink(arena_pool_t *pool) {
   // Already at mutex lock when called
 
-  if (arena_pool.head < ARENA_POOL_HIGH_WATERMARK)
+  if (pool->head < ARENA_POOL_HIGH_WATERMARK)
     return;
 
   // Keep some reserve, don't shrink below initial size
   uint8_t target = PREALLOCATED_ARENA + ARENA_POOL_GROW_BATCH;
-  if (arena_pool.head <= target)
+  if (pool->head <= target)
     return;
 
   // Shrink by half of excess
-  uint16_t excess = arena_pool.head - target;
+  uint16_t excess = pool->head - target;
   uint16_t to_free = excess / 2;
   if (to_free < ARENA_POOL_GROW_BATCH)
     to_free = ARENA_POOL_GROW_BATCH;
 
   uint16_t freed = 0;
-  while (to_free > 0 && arena_pool.head > target) {
-    Arena *arena = arena_pool.arenas[--arena_pool.head];
-    arena_pool.arenas[arena_pool.head] = NULL;
+  while (to_free > 0 && pool->head > target) {
+    Arena *arena = pool->arenas[--pool->head];
+    pool->arenas[pool->head] = NULL;
 
     if (arena) {
       arena_free(arena);
@@ -114,23 +121,23 @@ static void arena_pool_try_shrink(void) {
   }
 
   if (freed > 0) {
-    arena_pool.shrink_count++;
+    pool->shrink_count++;
     LOG_DEBUG("Arena pool shrunk: -%d arenas (now %d/%d available)",
-              freed, arena_pool.head, ARENA_POOL_SIZE);
+              freed, pool->head, ARENA_POOL_SIZE);
   }
 }
 
-void arena_pool_init(void) {
-  if (arena_pool.initialized)
+static void pool_init(arena_pool_t *pool) {
+  if (pool->initialized)
     return;
 
-  arena_pool.head = 0;
-  arena_pool.peak_usage = 0;
-  arena_pool.total_allocated = 0;
-  arena_pool.grow_count = 0;
-  arena_pool.shrink_count = 0;
+  pool->head = 0;
+  pool->peak_usage = 0;
+  pool->total_allocated = 0;
+  pool->grow_count = 0;
+  pool->shrink_count = 0;
 
-  if (uv_mutex_init(&arena_pool.mutex) != 0) {
+  if (uv_mutex_init(&pool->mutex) != 0) {
     LOG_ERROR("Failed to initialize arena pool mutex");
     abort();
   }
@@ -182,15 +189,15 @@ void arena_pool_init(void) {
     }
 
     arena->begin = arena->end;
-    arena_pool.arenas[arena_pool.head++] = arena;
-    arena_pool.total_allocated++;
+    pool->arenas[pool->head++] = arena;
+    pool->total_allocated++;
 
 #ifdef ECEWO_DEBUG
     allocated++;
 #endif
   }
 
-  arena_pool.initialized = true;
+  pool->initialized = true;
 
 #ifdef ECEWO_DEBUG
   double allocated_mb = (allocated * ARENA_REGION_SIZE) / (1024.0 * 1024.0);
@@ -201,86 +208,117 @@ void arena_pool_init(void) {
 #endif
 }
 
-void arena_pool_destroy(void) {
-  if (!arena_pool.initialized)
+static void pool_destroy(arena_pool_t *pool) {
+  if (!pool->initialized)
     return;
 
-  uv_mutex_lock(&arena_pool.mutex);
+  uv_mutex_lock(&pool->mutex);
 
 #ifdef ECEWO_DEBUG
   // Statistics before destruction
-  if (arena_pool.grow_count > 0 || arena_pool.shrink_count > 0) {
+  if (pool->grow_count > 0 || pool->shrink_count > 0) {
     LOG_DEBUG("Arena pool statistics:");
-    LOG_DEBUG("  Total allocated: %d arenas", arena_pool.total_allocated);
-    LOG_DEBUG("  Peak usage: %d arenas", arena_pool.peak_usage);
-    LOG_DEBUG("  Grow operations: %d", arena_pool.grow_count);
-    LOG_DEBUG("  Shrink operations: %d", arena_pool.shrink_count);
+    LOG_DEBUG("  Total allocated: %d arenas", pool->total_allocated);
+    LOG_DEBUG("  Peak usage: %d arenas", pool->peak_usage);
+    LOG_DEBUG("  Grow operations: %d", pool->grow_count);
+    LOG_DEBUG("  Shrink operations: %d", pool->shrink_count);
   }
 #endif
 
-  for (int i = 0; i < arena_pool.head; i++) {
-    if (arena_pool.arenas[i]) {
-      arena_free(arena_pool.arenas[i]);
-      free(arena_pool.arenas[i]);
-      arena_pool.arenas[i] = NULL;
+  for (int i = 0; i < pool->head; i++) {
+    if (pool->arenas[i]) {
+      arena_free(pool->arenas[i]);
+      free(pool->arenas[i]);
+      pool->arenas[i] = NULL;
     }
   }
 
-  arena_pool.head = 0;
-  arena_pool.initialized = false;
+  pool->head = 0;
+  pool->initialized = false;
 
-  uv_mutex_unlock(&arena_pool.mutex);
-  uv_mutex_destroy(&arena_pool.mutex);
+  uv_mutex_unlock(&pool->mutex);
+  uv_mutex_destroy(&pool->mutex);
 
   LOG_DEBUG("Arena pool destroyed");
 }
 
+void arena_pool_init(void) {
+  pool_init(&arena_pool);
+}
+
+void arena_pool_destroy(void) {
+  pool_destroy(&arena_pool);
+}
+
+arena_pool_t *arena_pool_create(void) {
+  arena_pool_t *pool = calloc(1, sizeof(arena_pool_t));
+  if (!pool)
+    return NULL;
+
+  pool_init(pool);
+  return pool;
+}
+
+void arena_pool_free(arena_pool_t *pool) {
+  if (!pool || pool == &arena_pool)
+    return;
+
+  pool_destroy(pool);
+  free(pool);
+}
+
+void arena_pool_bind(arena_pool_t *pool) {
+  thread_pool = pool;
+}
+
 Arena *arena_borrow(void) {
-  if (!arena_pool.initialized) {
+  arena_pool_t *pool = current_pool();
+
+  if (!pool->initialized) {
     // Fallback: direct allocation
     LOG_DEBUG("Arena pool not initialized, falling back to direct allocation");
     Arena *arena = calloc(1, sizeof(Arena));
     return arena;
   }
 
-  uv_mutex_lock(&arena_pool.mutex);
+  uv_mutex_lock(&pool->mutex);
 
   Arena *arena = NULL;
 
-  if (arena_pool.head > 0) {
+  if (pool->head > 0) {
     // Take from pool
-    arena = arena_pool.arenas[--arena_pool.head];
-    arena_pool.arenas[arena_pool.head] = NULL;
+    arena = pool->arenas[--pool->head];
+    pool->arenas[pool->head] = NULL;
 
     // Update peak usage
-    int in_use = arena_pool.total_allocated - arena_pool.head;
-    if (in_use > arena_pool.peak_usage)
-      arena_pool.peak_usage = in_use;
+    int in_use = pool->total_allocated - pool->head;
+    if (in_use > pool->peak_usage)
+      pool->peak_usage = in_use;
 
     // Try to grow if running low
-    arena_pool_try_grow();
+    arena_pool_try_grow(pool);
 
-    uv_mutex_unlock(&arena_pool.mutex);
+    uv_mutex_unlock(&pool->mutex);
     arena_reset(arena);
     return arena;
   }
 
   // Pool is empty, check if we can grow
-  if (arena_pool.total_allocated < ARENA_POOL_SIZE) {
+  if (pool->total_allocated < ARENA_POOL_SIZE) {
     // Allocate new arena
     arena = calloc(1, sizeof(Arena));
     if (arena) {
       arena->end = new_region(ARENA_REGION_SIZE);
       if (arena->end) {
         arena->begin = arena->end;
-        arena_pool.total_allocated++;
+        pool->total_allocated++;
 
-        int in_use = arena_pool.total_allocated - arena_pool.head;
-        if (in_use > arena_pool.peak_usage)
-          arena_pool.peak_usage = in_use;
+        int in_use = pool->total_allocated - pool->head;
+        if (in_use > pool->peak_usage)
+          pool->peak_usage = in_use;
 
         LOG_DEBUG("Arena pool: allocated new arena (total=%d/%d)",
-                  arena_pool.total_allocated, ARENA_POOL_SIZE);
+                  pool->total_allocated, ARENA_POOL_SIZE);
       } else {
         free(arena);
         arena = NULL;
@@ -290,7 +328,7 @@ Arena *arena_borrow(void) {
     LOG_DEBUG("Arena pool exhausted! (max %d reached)", ARENA_POOL_SIZE);
   }
 
-  uv_mutex_unlock(&arena_pool.mutex);
+  uv_mutex_unlock(&pool->mutex);
   return arena;
 }
 
@@ -298,7 +336,9 @@ void arena_return(Arena *arena) {
   if (!arena)
     return;
 
-  if (!arena_pool.initialized) {
+  arena_pool_t *pool = current_pool();
+
+  if (!pool->initialized) {
     arena_free(arena);
     free(arena);
     return;
@@ -322,19 +362,19 @@ void arena_return(Arena *arena) {
     arena->end = arena->begin;
   }
 
-  uv_mutex_lock(&arena_pool.mutex);
+  uv_mutex_lock(&pool->mutex);
 
-  if (arena_pool.head < ARENA_POOL_SIZE) {
+  if (pool->head < ARENA_POOL_SIZE) {
     // Return to pool
-    arena_pool.arenas[arena_pool.head++] = arena;
+    pool->arenas[pool->head++] = arena;
 
     // Try to shrink if too many available
-    arena_pool_try_shrink();
+    arena_pool_try_shrink(pool);
 
-    uv_mutex_unlock(&arena_pool.mutex);
+    uv_mutex_unlock(&pool->mutex);
   } else {
     // Pool is full, free
-    uv_mutex_unlock(&arena_pool.mutex);
+    uv_mutex_unlock(&pool->mutex);
     arena_free(arena);
     free(arena);
   }
@@ -342,28 +382,30 @@ void arena_return(Arena *arena) {
 
 #ifdef ECEWO_DEBUG
 void arena_pool_stats(void) {
-  if (!arena_pool.initialized) {
+  arena_pool_t *pool = current_pool();
+
+  if (!pool->initialized) {
     LOG_DEBUG("Arena pool not initialized");
     return;
   }
 
-  uv_mutex_lock(&arena_pool.mutex);
+  uv_mutex_lock(&pool->mutex);
 
-  uint16_t available = arena_pool.head;
-  uint16_t in_use = arena_pool.total_allocated - available;
+  uint16_t available = pool->head;
+  uint16_t in_use = pool->total_allocated - available;
   double available_mb = (available * ARENA_REGION_SIZE) / (1024.0 * 1024.0);
-  double total_mb = (arena_pool.total_allocated * ARENA_REGION_SIZE) / (1024.0 * 1024.0);
+  double total_mb = (pool->total_allocated * ARENA_REGION_SIZE) / (1024.0 * 1024.0);
 
   LOG_DEBUG("Arena Pool Statistics:");
   LOG_DEBUG("  Available: %d/%d arenas (%.2f MB)",
-            available, arena_pool.total_allocated, available_mb);
+            available, pool->total_allocated, available_mb);
   LOG_DEBUG("  In use: %d arenas", in_use);
-  LOG_DEBUG("  Peak usage: %d arenas", arena_pool.peak_usage);
+  LOG_DEBUG("  Peak usage: %d arenas", pool->peak_usage);
   LOG_DEBUG("  Total allocated: %.2f MB", total_mb);
-  LOG_DEBUG("  Grow operations: %d", arena_pool.grow_count);
-  LOG_DEBUG("  Shrink operations: %d", arena_pool.shrink_count);
+  LOG_DEBUG("  Grow operations: %d", pool->grow_count);
+  LOG_DEBUG("  Shrink operations: %d", pool->shrink_count);
 
-  uv_mutex_unlock(&arena_pool.mutex);
+  uv_mutex_unlock(&pool->mutex);
 }
 
 #endif
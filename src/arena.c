@@ -153,6 +153,23 @@ void arena_free(Arena *a) {
   a->end = NULL;
 }
 
+bool arena_contains(const Arena *a, const void *ptr, size_t len) {
+  if (!a || !ptr)
+    return false;
+
+  uintptr_t start = (uintptr_t)ptr;
+
+  for (const ArenaRegion *r = a->begin; r; r = r->next) {
+    uintptr_t begin = (uintptr_t)r->data;
+    uintptr_t end = (uintptr_t)(r->data + r->count);
+
+    if (start >= begin && start <= end && len <= end - start)
+      return true;
+  }
+
+  return false;
+}
+
 void arena_reset(Arena *a) {
   if (!a || !a->begin)
     return;
@@ -15,11 +15,22 @@ struct ArenaRegion {
 };
 
 void arena_reset(Arena *a);
+
+// True if [ptr, ptr + len) was allocated from the arena
+bool arena_contains(const Arena *a, const void *ptr, size_t len);
 ArenaRegion *new_region(size_t capacity);
 
 // Pool
+typedef struct arena_pool_s arena_pool_t;
+
 void arena_pool_init(void);
 void arena_pool_destroy(void);
 bool arena_pool_is_initialized(void);
 
+// Per-loop pools, arena_borrow() and arena_return()
+// use the pool bound to the calling thread
+arena_pool_t *arena_pool_create(void);
+void arena_pool_free(arena_pool_t *pool);
+void arena_pool_bind(arena_pool_t *pool);
+
 #endif
@@ -0,0 +1,411 @@
+#include <stdlib.h>
+#include "channel.h"
+#include "logger.h"
+
+#define CHANNEL_BUCKETS 64
+
+typedef struct channel_s channel_t;
+typedef struct channel_loop_s channel_loop_t;
+typedef struct channel_delivery_s channel_delivery_t;
+
+// Members of a channel on one loop, only that loop touches the list
+struct channel_local_s {
+  channel_local_t *next; // Next loop of the channel
+  channel_loop_t *loop;
+  channel_member_t *members;
+  uint32_t count; // Under the lock, publishers skip empty loops
+};
+
+// Channels live until the server is cleaned up
+struct channel_s {
+  channel_t *next;
+  channel_kind_t kind;
+  uint32_t hash;
+  uint64_t last_id;
+  channel_msg_t **history; // Indexed by id, history_size of them
+  size_t history_size;
+  channel_local_t *locals;
+  char name[];
+};
+
+struct channel_delivery_s {
+  channel_delivery_t *next;
+  channel_local_t *local;
+  channel_msg_t *msg;
+};
+
+// Messages published on another loop are queued
+// in the inbox and written by the loop itself
+struct channel_loop_s {
+  channel_loop_t *next;
+  server_loop_t *owner;
+  uv_async_t async;
+
+  // Under the lock
+  channel_delivery_t *inbox_head;
+  channel_delivery_t *inbox_tail;
+  bool closed;
+};
+
+static struct {
+  uv_mutex_t lock;
+  channel_t *buckets[CHANNEL_BUCKETS];
+  channel_loop_t *loops;
+} channels;
+
+static uv_once_t channels_once = UV_ONCE_INIT;
+
+static void channels_init(void) {
+  if (uv_mutex_init(&channels.lock) != 0)
+    abort();
+}
+
+static uint32_t hash_name(const char *name) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+    hash ^= *p;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+channel_msg_t *channel_msg_create(size_t capacity) {
+  channel_msg_t *msg = malloc(sizeof(channel_msg_t) + capacity);
+  if (!msg)
+    return NULL;
+
+  atomic_init(&msg->refs, 1);
+  msg->id = 0;
+  msg->len = 0;
+  return msg;
+}
+
+void channel_msg_unref(channel_msg_t *msg) {
+  if (atomic_fetch_sub_explicit(&msg->refs, 1, memory_order_acq_rel) == 1)
+    free(msg);
+}
+
+// Under the lock
+static channel_t *channel_get(channel_kind_t kind, const char *name) {
+  uint32_t hash = hash_name(name);
+  channel_t **bucket = &channels.buckets[hash % CHANNEL_BUCKETS];
+
+  for (channel_t *channel = *bucket; channel; channel = channel->next) {
+    if (channel->hash == hash && channel->kind == kind && strcmp(channel->name, name) == 0)
+      return channel;
+  }
+
+  size_t name_len = strlen(name);
+
+  channel_t *channel = calloc(1, sizeof(channel_t) + name_len + 1);
+  if (!channel)
+    return NULL;
+
+  memcpy(channel->name, name, name_len + 1);
+  channel->kind = kind;
+  channel->hash = hash;
+  channel->next = *bucket;
+  *bucket = channel;
+
+  return channel;
+}
+
+// Under the lock
+static channel_local_t *local_get(channel_t *channel, channel_loop_t *loop) {
+  for (channel_local_t *local = channel->locals; local; local = local->next) {
+    if (local->loop == loop)
+      return local;
+  }
+
+  channel_local_t *local = calloc(1, sizeof(channel_local_t));
+  if (!local)
+    return NULL;
+
+  local->loop = loop;
+  local->next = channel->locals;
+  channel->locals = local;
+
+  return local;
+}
+
+// Writes the queued messages of the loop in publishing order
+static void loop_deliver(channel_loop_t *loop) {
+  uv_mutex_lock(&channels.lock);
+  channel_delivery_t *delivery = loop->inbox_head;
+  loop->inbox_head = NULL;
+  loop->inbox_tail = NULL;
+  uv_mutex_unlock(&channels.lock);
+
+  while (delivery) {
+    channel_delivery_t *next = delivery->next;
+    channel_msg_t *msg = delivery->msg;
+
+    channel_member_t *member = delivery->local->members;
+    while (member) {
+      // A delivery may close the connection and unlink the member
+      channel_member_t *after = member->next;
+
+      // Already replayed, or the member joined after it
+      if (msg->id > member->last_id) {
+        member->last_id = msg->id;
+        member->deliver(member, msg);
+      }
+
+      member = after;
+    }
+
+    channel_msg_unref(msg);
+    free(delivery);
+    delivery = next;
+  }
+}
+
+static void on_deliver(uv_async_t *handle) {
+  loop_deliver((channel_loop_t *)handle->data);
+}
+
+// Created on the thread of the loop by its first member
+static channel_loop_t *loop_get(server_loop_t *sl) {
+  if (sl->channels)
+    return sl->channels;
+
+  channel_loop_t *loop = calloc(1, sizeof(channel_loop_t));
+  if (!loop)
+    return NULL;
+
+  if (uv_async_init(sl->loop, &loop->async, on_deliver) != 0) {
+    free(loop);
+    return NULL;
+  }
+
+  // Members keep the loop alive, not the inbox
+  uv_unref((uv_handle_t *)&loop->async);
+
+  loop->async.data = loop;
+  loop->owner = sl;
+
+  uv_mutex_lock(&channels.lock);
+  loop->next = channels.loops;
+  channels.loops = loop;
+  uv_mutex_unlock(&channels.lock);
+
+  sl->channels = loop;
+  return loop;
+}
+
+int channel_join(channel_kind_t kind, const char *name, channel_member_t *member,
+                 const uint64_t *replay_after, channel_msg_t **missed,
+                 size_t max_missed, size_t *missed_count) {
+  if (missed_count)
+    *missed_count = 0;
+
+  if (!name || !member || !member->deliver)
+    return -1;
+
+  uv_once(&channels_once, channels_init);
+
+  channel_loop_t *loop = loop_get(get_server_loop());
+  if (!loop)
+    return -1;
+
+  uv_mutex_lock(&channels.lock);
+
+  channel_t *channel = channel_get(kind, name);
+  channel_local_t *local = channel ? local_get(channel, loop) : NULL;
+
+  if (!local) {
+    uv_mutex_unlock(&channels.lock);
+    return -1;
+  }
+
+  member->local = local;
+  member->prev = NULL;
+  member->next = local->members;
+  if (local->members)
+    local->members->prev = member;
+  local->members = member;
+  local->count++;
+
+  // Later messages reach the member through the inbox
+  member->last_id = channel->last_id;
+
+  if (replay_after && channel->history && *replay_after < channel->last_id) {
+    uint64_t first = *replay_after + 1;
+    if (channel->last_id - *replay_after > channel->history_size)
+      first = channel->last_id - channel->history_size + 1;
+
+    for (uint64_t id = first; id <= channel->last_id && *missed_count < max_missed; id++) {
+      channel_msg_t *msg = channel->history[id % channel->history_size];
+      if (!msg || msg->id != id)
+        continue;
+
+      channel_msg_ref(msg);
+      missed[(*missed_count)++] = msg;
+    }
+  }
+
+  uv_mutex_unlock(&channels.lock);
+  return 0;
+}
+
+void channel_leave(channel_member_t *member) {
+  channel_local_t *local = member ? member->local : NULL;
+  if (!local)
+    return;
+
+  if (member->prev)
+    member->prev->next = member->next;
+  else
+    local->members = member->next;
+  if (member->next)
+    member->next->prev = member->prev;
+
+  uv_mutex_lock(&channels.lock);
+  local->count--;
+  uv_mutex_unlock(&channels.lock);
+
+  member->local = NULL;
+  member->prev = NULL;
+  member->next = NULL;
+}
+
+int channel_publish(channel_kind_t kind, const char *name, size_t history_size,
+                    channel_build_t build, void *context) {
+  if (!name || !build)
+    return -1;
+
+  uv_once(&channels_once, channels_init);
+
+  server_loop_t *sl = get_server_loop();
+  channel_loop_t *own = sl ? sl->channels : NULL;
+  bool own_pending = false;
+
+  uv_mutex_lock(&channels.lock);
+
+  // Also without members, for the ones that join later with a replay
+  channel_t *channel = channel_get(kind, name);
+  channel_msg_t *msg = channel ? build(channel->last_id + 1, context) : NULL;
+
+  if (!msg) {
+    uv_mutex_unlock(&channels.lock);
+    return -1;
+  }
+
+  msg->id = ++channel->last_id;
+
+  if (history_size > 0 && !channel->history) {
+    channel->history = calloc(history_size, sizeof(channel_msg_t *));
+    if (channel->history)
+      channel->history_size = history_size;
+  }
+
+  // The publisher's reference goes to the history, or is dropped below
+  bool kept = false;
+  if (channel->history) {
+    channel_msg_t **slot = &channel->history[msg->id % channel->history_size];
+    if (*slot)
+      channel_msg_unref(*slot);
+    *slot = msg;
+    kept = true;
+  }
+
+  // Queued under the lock, so every loop writes the messages in id order
+  for (channel_local_t *local = channel->locals; local; local = local->next) {
+    channel_loop_t *loop = local->loop;
+    if (local->count == 0 || loop->closed)
+      continue;
+
+    channel_delivery_t *delivery = malloc(sizeof(channel_delivery_t));
+    if (!delivery)
+      continue;
+
+    channel_msg_ref(msg);
+    delivery->next = NULL;
+    delivery->local = local;
+    delivery->msg = msg;
+
+    if (loop->inbox_tail)
+      loop->inbox_tail->next = delivery;
+    else
+      loop->inbox_head = delivery;
+    loop->inbox_tail = delivery;
+
+    if (loop == own)
+      own_pending = true;
+    else
+      uv_async_send(&loop->async);
+  }
+
+  uv_mutex_unlock(&channels.lock);
+
+  if (!kept)
+    channel_msg_unref(msg);
+
+  if (own_pending)
+    loop_deliver(own);
+
+  return 0;
+}
+
+void channel_loop_close(server_loop_t *sl) {
+  channel_loop_t *loop = sl->channels;
+  if (!loop || loop->closed)
+    return;
+
+  uv_mutex_lock(&channels.lock);
+  loop->closed = true;
+  channel_delivery_t *delivery = loop->inbox_head;
+  loop->inbox_head = NULL;
+  loop->inbox_tail = NULL;
+  uv_mutex_unlock(&channels.lock);
+
+  while (delivery) {
+    channel_delivery_t *next = delivery->next;
+    channel_msg_unref(delivery->msg);
+    free(delivery);
+    delivery = next;
+  }
+
+  uv_close((uv_handle_t *)&loop->async, NULL);
+}
+
+// The loops are stopped, nothing publishes anymore
+void channel_destroy(void) {
+  for (int i = 0; i < CHANNEL_BUCKETS; i++) {
+    channel_t *channel = channels.buckets[i];
+
+    while (channel) {
+      channel_t *next = channel->next;
+
+      for (size_t j = 0; j < channel->history_size; j++) {
+        if (channel->history[j])
+          channel_msg_unref(channel->history[j]);
+      }
+
+      free(channel->history);
+
+      channel_local_t *local = channel->locals;
+      while (local) {
+        channel_local_t *after = local->next;
+        free(local);
+        local = after;
+      }
+
+      free(channel);
+      channel = next;
+    }
+
+    channels.buckets[i] = NULL;
+  }
+
+  channel_loop_t *loop = channels.loops;
+  while (loop) {
+    channel_loop_t *next = loop->next;
+    loop->owner->channels = NULL;
+    free(loop);
+    loop = next;
+  }
+
+  channels.loops = NULL;
+}
@@ -0,0 +1,68 @@
+#ifndef ECEWO_CHANNEL_H
+#define ECEWO_CHANNEL_H
+
+#include <stdatomic.h>
+#include "server.h"
+
+// Named groups of connections spread over the loops, used by SSE
+// channels and WebSocket groups. A message is serialized once, every
+// loop writes it to its own members in publishing order.
+
+typedef enum {
+  CHANNEL_SSE,
+  CHANNEL_WEBSOCKET
+} channel_kind_t;
+
+// Queued deliveries, the history and pending writes hold a reference each
+typedef struct
+{
+  atomic_uint refs;
+  uint64_t id; // Sequence number in the channel
+  size_t len;
+  char data[];
+} channel_msg_t;
+
+typedef struct channel_local_s channel_local_t;
+typedef struct channel_member_s channel_member_t;
+
+// Writes the message to one member, may close its connection
+typedef void (*channel_deliver_t)(channel_member_t *member, channel_msg_t *msg);
+
+// Embedded in a subscriber, only touched on the loop of its connection
+struct channel_member_s {
+  channel_member_t *prev;
+  channel_member_t *next;
+  channel_local_t *local;
+  channel_deliver_t deliver;
+  uint64_t last_id; // Newest message delivered, older ones are skipped
+};
+
+// Called under the channel lock with the id of the new message
+typedef channel_msg_t *(*channel_build_t)(uint64_t id, void *context);
+
+channel_msg_t *channel_msg_create(size_t capacity);
+
+static inline void channel_msg_ref(channel_msg_t *msg) {
+  atomic_fetch_add_explicit(&msg->refs, 1, memory_order_relaxed);
+}
+
+void channel_msg_unref(channel_msg_t *msg);
+
+// Adds the member on the loop of the caller. Unless replay_after is NULL,
+// the kept messages after that id are returned with a reference each.
+int channel_join(channel_kind_t kind, const char *name, channel_member_t *member,
+                 const uint64_t *replay_after, channel_msg_t **missed,
+                 size_t max_missed, size_t *missed_count);
+
+void channel_leave(channel_member_t *member);
+
+// The last history_size messages are kept for channel_join() replays
+int channel_publish(channel_kind_t kind, const char *name, size_t history_size,
+                    channel_build_t build, void *context);
+
+// Stops the cross-loop deliveries of a loop
+void channel_loop_close(server_loop_t *sl);
+
+void channel_destroy(void);
+
+#endif
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+#include "client-pool.h"
+#include "server.h"
+
+struct client_slab_s {
+  client_slab_t *next;
+  void *memory; // Unaligned block returned by malloc
+};
+
+static int client_pool_grow(client_pool_t *pool) {
+  client_slab_t *slab = malloc(sizeof(client_slab_t));
+  if (!slab)
+    return -1;
+
+  // Clients are cache-line aligned, see client_t
+  slab->memory = malloc(CLIENT_SLAB_SIZE * sizeof(client_t) + CACHE_LINE_SIZE);
+  if (!slab->memory) {
+    free(slab);
+    return -1;
+  }
+
+  uintptr_t base = ((uintptr_t)slab->memory + CACHE_LINE_SIZE - 1)
+      & ~(uintptr_t)(CACHE_LINE_SIZE - 1);
+
+  client_t *clients = (client_t *)base;
+
+  for (uint32_t i = 0; i < CLIENT_SLAB_SIZE; i++) {
+    clients[i].lru_next = pool->free_list;
+    pool->free_list = &clients[i];
+  }
+
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+  pool->free_count += CLIENT_SLAB_SIZE;
+  pool->capacity += CLIENT_SLAB_SIZE;
+
+  return 0;
+}
+
+int client_pool_reserve(client_pool_t *pool, uint32_t count) {
+  if (!pool)
+    return -1;
+
+  while (pool->free_count < count) {
+    if (client_pool_grow(pool) != 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+void client_pool_destroy(client_pool_t *pool) {
+  if (!pool)
+    return;
+
+  client_slab_t *slab = pool->slabs;
+  while (slab) {
+    client_slab_t *next = slab->next;
+    free(slab->memory);
+    free(slab);
+    slab = next;
+  }
+
+  memset(pool, 0, sizeof(client_pool_t));
+}
+
+client_t *client_pool_acquire(client_pool_t *pool) {
+  if (!pool->free_list && client_pool_grow(pool) != 0)
+    return NULL;
+
+  client_t *client = pool->free_list;
+  pool->free_list = client->lru_next;
+  pool->free_count--;
+
+  // A per-connection read buffer is overwritten before
+  // it is read, only the state in front of it is reset
+  memset(client, 0, CLIENT_STATE_SIZE);
+
+  return client;
+}
+
+void client_pool_release(client_pool_t *pool, client_t *client) {
+  if (!client)
+    return;
+
+  client->lru_next = pool->free_list;
+  pool->free_list = client;
+  pool->free_count++;
+}
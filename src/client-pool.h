@@ -0,0 +1,41 @@
+#ifndef ECEWO_CLIENT_POOL_H
+#define ECEWO_CLIENT_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// Connections carved out of each slab allocation
+#ifndef CLIENT_SLAB_SIZE
+#define CLIENT_SLAB_SIZE 32
+#endif
+
+// Connections allocated when a loop starts listening
+#ifndef CLIENT_POOL_PREWARM
+#define CLIENT_POOL_PREWARM 64
+#endif
+
+typedef struct client_s client_t;
+typedef struct client_slab_s client_slab_t;
+
+// Free list of client_t, one per loop and never shared between threads.
+// Memory is kept until the loop is torn down.
+typedef struct
+{
+  client_t *free_list;
+  client_slab_t *slabs;
+  uint32_t free_count;
+  uint32_t capacity;
+} client_pool_t;
+
+int client_pool_reserve(client_pool_t *pool, uint32_t count);
+void client_pool_destroy(client_pool_t *pool);
+
+// Returns a client with its connection state zeroed
+client_t *client_pool_acquire(client_pool_t *pool);
+void client_pool_release(client_pool_t *pool, client_t *client);
+
+#endif
@@ -0,0 +1,430 @@
+#include <stdlib.h>
+#include "compression.h"
+#include "static-route.h"
+#include "arena.h"
+#include "logger.h"
+
+#ifdef ECEWO_COMPRESSION
+#include <zlib.h>
+#endif
+
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#define strncasecmp _strnicmp
+#else
+#include <strings.h>
+#endif
+
+extern void queue_response(Res *res, int status, const void *body, size_t body_len, bool in_place);
+
+// zlib counts in unsigned int, and so does uv_buf_t
+#define MAX_COMPRESS_INPUT (UINT32_MAX / 2)
+
+static struct {
+  bool enabled;
+  int level;
+  size_t min_size;
+  size_t spawn_threshold;
+} settings = { 0 };
+
+static const char *const encoding_names[ENCODING_COUNT] = {
+  [ENCODING_IDENTITY] = "",
+  [ENCODING_GZIP] = "gzip",
+  [ENCODING_DEFLATE] = "deflate",
+};
+
+bool compression_enabled(void) {
+  return settings.enabled;
+}
+
+const char *compression_name(content_encoding_t encoding) {
+  return encoding_names[encoding];
+}
+
+static bool token_is(const char *token, size_t len, const char *name) {
+  return strlen(name) == len && strncasecmp(token, name, len) == 0;
+}
+
+// "q=0.5" in thousandths, 1000 without a q parameter
+static int parse_quality(const char *params, const char *end) {
+  const char *q = params;
+
+  while (q < end && (*q == ';' || *q == ' ' || *q == '\t'))
+    q++;
+
+  if (end - q < 3 || (q[0] != 'q' && q[0] != 'Q') || q[1] != '=')
+    return 1000;
+
+  q += 2;
+  if (*q == '1')
+    return 1000;
+
+  int value = 0;
+  int scale = 100;
+
+  if (*q == '0' && q + 1 < end && q[1] == '.') {
+    for (q += 2; q < end && *q >= '0' && *q <= '9' && scale > 0; q++) {
+      value += (*q - '0') * scale;
+      scale /= 10;
+    }
+  }
+
+  return value;
+}
+
+content_encoding_t compression_negotiate(const char *accept_encoding) {
+  if (!accept_encoding)
+    return ENCODING_IDENTITY;
+
+  // -1 while not listed
+  int quality[ENCODING_COUNT] = { -1, -1, -1 };
+  int wildcard = -1;
+
+  const char *p = accept_encoding;
+
+  while (*p) {
+    while (*p == ' ' || *p == '\t' || *p == ',')
+      p++;
+
+    const char *start = p;
+    while (*p && *p != ',')
+      p++;
+
+    const char *end = p;
+    const char *name_end = start;
+    while (name_end < end && *name_end != ';' && *name_end != ' ' && *name_end != '\t')
+      name_end++;
+
+    size_t len = (size_t)(name_end - start);
+    if (len == 0)
+      continue;
+
+    int q = parse_quality(name_end, end);
+
+    if (token_is(start, len, "gzip") || token_is(start, len, "x-gzip"))
+      quality[ENCODING_GZIP] = q;
+    else if (token_is(start, len, "deflate"))
+      quality[ENCODING_DEFLATE] = q;
+    else if (token_is(start, len, "*"))
+      wildcard = q;
+  }
+
+  int gzip = quality[ENCODING_GZIP] >= 0 ? quality[ENCODING_GZIP] : wildcard;
+  int deflate = quality[ENCODING_DEFLATE] >= 0 ? quality[ENCODING_DEFLATE] : wildcard;
+
+  // gzip wins a tie, it is the one every client decodes the same way
+  if (gzip > 0 && gzip >= deflate)
+    return ENCODING_GZIP;
+
+  if (deflate > 0)
+    return ENCODING_DEFLATE;
+
+  return ENCODING_IDENTITY;
+}
+
+static bool has_suffix(const char *s, size_t len, const char *suffix) {
+  size_t suffix_len = strlen(suffix);
+  return len >= suffix_len && strncasecmp(s + len - suffix_len, suffix, suffix_len) == 0;
+}
+
+static bool is_compressible_type(const char *type) {
+  if (!type)
+    return false;
+
+  // Without parameters like "; charset=utf-8"
+  size_t len = strcspn(type, ";");
+  while (len > 0 && (type[len - 1] == ' ' || type[len - 1] == '\t'))
+    len--;
+
+  if (len > 5 && strncasecmp(type, "text/", 5) == 0)
+    return true;
+
+  static const char *const types[] = {
+    "application/json",
+    "application/javascript",
+    "application/xml",
+    "application/wasm",
+    "image/svg+xml",
+  };
+
+  for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    if (token_is(type, len, types[i]))
+      return true;
+  }
+
+  return has_suffix(type, len, "+json") || has_suffix(type, len, "+xml");
+}
+
+bool compression_eligible(const char *content_type, size_t len) {
+  return settings.enabled && len >= settings.min_size && len <= MAX_COMPRESS_INPUT
+      && is_compressible_type(content_type);
+}
+
+#ifdef ECEWO_COMPRESSION
+
+static int find_response_header(const Res *res, const char *name) {
+  for (uint16_t i = 0; i < res->header_count; i++) {
+    if (res->headers[i].name && strcasecmp(res->headers[i].name, name) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+static bool contains_token(const char *value, const char *token) {
+  size_t token_len = strlen(token);
+
+  for (const char *p = value; *p; p++) {
+    if (strncasecmp(p, token, token_len) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+// Caches have to keep one response per encoding
+static void add_vary(Res *res) {
+  int index = find_response_header(res, "Vary");
+
+  if (index < 0) {
+    set_header(res, "Vary", "Accept-Encoding");
+    return;
+  }
+
+  http_header_t *vary = &res->headers[index];
+  if (contains_token(vary->value, "accept-encoding") || contains_token(vary->value, "*"))
+    return;
+
+  char *value = arena_sprintf(res->arena, "%s, Accept-Encoding", vary->value);
+  if (value) {
+    vary->value = value;
+    vary->value_len = strlen(value);
+  }
+}
+
+typedef struct
+{
+  Res *res;
+  int status;
+  z_stream stream;
+  const unsigned char *in;
+  size_t in_len;
+  bool in_place;
+  unsigned char *out;
+  size_t out_cap;
+  size_t out_len;
+  content_encoding_t encoding;
+  bool ok;
+} compress_task_t;
+
+static int deflate_start(z_stream *stream, content_encoding_t encoding) {
+  memset(stream, 0, sizeof(z_stream));
+
+  // gzip adds its header and trailer to the raw stream, deflate is the zlib format
+  int window_bits = encoding == ENCODING_GZIP ? 15 + 16 : 15;
+
+  return deflateInit2(stream, settings.level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+}
+
+// Streams the input through zlib in chunks, out holds deflateBound() bytes
+static bool deflate_run(z_stream *stream, const unsigned char *in, size_t len,
+                        unsigned char *out, size_t out_cap, size_t *out_len) {
+  stream->next_out = out;
+  stream->avail_out = (uInt)out_cap;
+
+  int result;
+
+  do {
+    size_t chunk = len < COMPRESSION_CHUNK ? len : COMPRESSION_CHUNK;
+
+    stream->next_in = (Bytef *)in;
+    stream->avail_in = (uInt)chunk;
+    in += chunk;
+    len -= chunk;
+
+    result = deflate(stream, len == 0 ? Z_FINISH : Z_NO_FLUSH);
+  } while (len > 0 && result == Z_OK);
+
+  *out_len = stream->total_out;
+  deflateEnd(stream);
+
+  return result == Z_STREAM_END;
+}
+
+void *compress_buffer(content_encoding_t encoding, const void *in, size_t len, size_t *out_len) {
+  if (encoding == ENCODING_IDENTITY || len > MAX_COMPRESS_INPUT)
+    return NULL;
+
+  z_stream stream;
+  if (deflate_start(&stream, encoding) != Z_OK)
+    return NULL;
+
+  size_t cap = deflateBound(&stream, (uLong)len);
+  unsigned char *out = malloc(cap);
+
+  if (!out) {
+    deflateEnd(&stream);
+    return NULL;
+  }
+
+  // Not worth it if it does not get smaller
+  if (!deflate_run(&stream, in, len, out, cap, out_len) || *out_len >= len) {
+    free(out);
+    return NULL;
+  }
+
+  return out;
+}
+
+// Runs on the thread pool for large bodies, touches nothing but the task
+static void compress_work(void *context) {
+  compress_task_t *task = (compress_task_t *)context;
+
+  task->ok = deflate_run(&task->stream, task->in, task->in_len,
+                         task->out, task->out_cap, &task->out_len)
+      && task->out_len < task->in_len;
+}
+
+static void compress_done(void *context) {
+  compress_task_t *task = (compress_task_t *)context;
+  Res *res = task->res;
+
+  if (!task->ok) {
+    queue_response(res, task->status, task->in, task->in_len, task->in_place);
+    return;
+  }
+
+  set_header(res, "Content-Encoding", compression_name(task->encoding));
+
+  // Another representation, a strong ETag would claim the same bytes
+  int etag = find_response_header(res, "ETag");
+  if (etag >= 0 && res->headers[etag].value[0] == '"') {
+    char *weak = arena_sprintf(res->arena, "W/%s", res->headers[etag].value);
+    if (weak) {
+      res->headers[etag].value = weak;
+      res->headers[etag].value_len = strlen(weak);
+    }
+  }
+
+  queue_response(res, task->status, task->out, task->out_len, true);
+}
+
+bool compress_reply(Res *res, int status, const void *body, size_t body_len, bool in_place) {
+  if (!settings.enabled || !body || res->is_head_request)
+    return false;
+
+  if (status < 200 || status == 204 || status == 304)
+    return false;
+
+  int content_type = find_response_header(res, "Content-Type");
+  if (content_type < 0 || !compression_eligible(res->headers[content_type].value, body_len))
+    return false;
+
+  if (find_response_header(res, "Content-Encoding") >= 0)
+    return false;
+
+  int cache_control = find_response_header(res, "Cache-Control");
+  if (cache_control >= 0 && contains_token(res->headers[cache_control].value, "no-transform"))
+    return false;
+
+  add_vary(res);
+
+  exchange_t *exchange = (exchange_t *)res->exchange;
+  const char *accept_encoding = get_header_id(exchange->req, HEADER_ACCEPT_ENCODING);
+
+  content_encoding_t encoding = compression_negotiate(accept_encoding);
+  if (encoding == ENCODING_IDENTITY)
+    return false;
+
+  compress_task_t *task = arena_alloc(res->arena, sizeof(compress_task_t));
+  if (!task)
+    return false;
+
+  memset(task, 0, sizeof(compress_task_t));
+
+  if (deflate_start(&task->stream, encoding) != Z_OK)
+    return false;
+
+  task->out_cap = deflateBound(&task->stream, (uLong)body_len);
+  task->out = arena_alloc(res->arena, task->out_cap);
+
+  if (!task->out) {
+    deflateEnd(&task->stream);
+    return false;
+  }
+
+  task->res = res;
+  task->status = status;
+  task->encoding = encoding;
+  task->in = body;
+  task->in_len = body_len;
+  task->in_place = in_place;
+
+  if (body_len >= settings.spawn_threshold) {
+    // The body has to outlive reply()
+    if (!in_place && !arena_contains(res->arena, body, body_len)) {
+      unsigned char *copy = arena_alloc(res->arena, body_len);
+      if (copy) {
+        memcpy(copy, body, body_len);
+        task->in = copy;
+        task->in_place = true;
+      }
+    } else {
+      task->in_place = true;
+    }
+
+    // The exchange stays in the handling state until it is done
+    if (task->in_place && spawn(task, compress_work, compress_done) == 0)
+      return true;
+  }
+
+  compress_work(task);
+  compress_done(task);
+  return true;
+}
+
+int compression_enable(const CompressionConfig *config) {
+  int level = config && config->level > 0 ? config->level : Z_DEFAULT_COMPRESSION;
+  if (level > 9) {
+    LOG_ERROR("Invalid compression level: %d", level);
+    return -1;
+  }
+
+  settings.level = level;
+  settings.min_size = config && config->min_size > 0 ? config->min_size : COMPRESSION_MIN_SIZE;
+  settings.spawn_threshold = config && config->spawn_threshold > 0
+      ? config->spawn_threshold
+      : COMPRESSION_SPAWN_THRESHOLD;
+  settings.enabled = true;
+
+  // Routes registered before keep their compressed bodies too
+  static_routes_compress();
+  return 0;
+}
+
+#else
+
+void *compress_buffer(content_encoding_t encoding, const void *in, size_t len, size_t *out_len) {
+  (void)encoding;
+  (void)in;
+  (void)len;
+  (void)out_len;
+  return NULL;
+}
+
+bool compress_reply(Res *res, int status, const void *body, size_t body_len, bool in_place) {
+  (void)res;
+  (void)status;
+  (void)body;
+  (void)body_len;
+  (void)in_place;
+  return false;
+}
+
+int compression_enable(const CompressionConfig *config) {
+  (void)config;
+  LOG_ERROR("ecewo was built without zlib, compression is not available");
+  return -1;
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef ECEWO_COMPRESSION_H
+#define ECEWO_COMPRESSION_H
+
+#include "server.h"
+
+// Smaller bodies are sent as they are
+#ifndef COMPRESSION_MIN_SIZE
+#define COMPRESSION_MIN_SIZE 1024
+#endif
+
+// Larger bodies are compressed on the thread pool
+#ifndef COMPRESSION_SPAWN_THRESHOLD
+#define COMPRESSION_SPAWN_THRESHOLD 65536
+#endif
+
+// Input passed to zlib at once
+#ifndef COMPRESSION_CHUNK
+#define COMPRESSION_CHUNK 65536
+#endif
+
+typedef enum {
+  ENCODING_IDENTITY,
+  ENCODING_GZIP,
+  ENCODING_DEFLATE,
+  ENCODING_COUNT
+} content_encoding_t;
+
+bool compression_enabled(void);
+
+// Best encoding an Accept-Encoding value allows
+content_encoding_t compression_negotiate(const char *accept_encoding);
+
+// Content-Encoding token, empty for identity
+const char *compression_name(content_encoding_t encoding);
+
+// The body is large enough and its type is worth compressing
+bool compression_eligible(const char *content_type, size_t len);
+
+// Compresses a whole buffer, the result is allocated with malloc()
+void *compress_buffer(content_encoding_t encoding, const void *in, size_t len, size_t *out_len);
+
+// Compresses the body of a reply if the client accepts it. Returns
+// true if the response was queued here, right away or once a spawned
+// compression finished, false if the caller queues it unchanged.
+bool compress_reply(Res *res, int status, const void *body, size_t body_len, bool in_place);
+
+#endif
@@ -4,6 +4,12 @@
 #include "http.h"
 #include "logger.h"
 
+#ifdef _WIN32
+#define strncasecmp _strnicmp
+#else
+#include <strings.h>
+#endif
+
 #define MIN_BUFFER_SIZE 64
 #define GROWTH_FACTOR 1.5
 #define MAX_SINGLE_ALLOCATION (10UL * 1024UL * 1024UL)
@@ -23,6 +29,107 @@
 #define ERROR_REASON_MEMORY_ALLOCATION "Memory allocation failed"
 #define ERROR_REASON_INVALID_METHOD "Invalid HTTP method"
 
+// Names of header_id_t, matched case-insensitively
+static const struct {
+  const char *name;
+  size_t len;
+} known_headers[HEADER_COUNT] = {
+  [HEADER_HOST] = { "Host", 4 },
+  [HEADER_CONNECTION] = { "Connection", 10 },
+  [HEADER_CONTENT_TYPE] = { "Content-Type", 12 },
+  [HEADER_CONTENT_LENGTH] = { "Content-Length", 14 },
+  [HEADER_CONTENT_ENCODING] = { "Content-Encoding", 16 },
+  [HEADER_TRANSFER_ENCODING] = { "Transfer-Encoding", 17 },
+  [HEADER_ACCEPT] = { "Accept", 6 },
+  [HEADER_ACCEPT_ENCODING] = { "Accept-Encoding", 15 },
+  [HEADER_ACCEPT_LANGUAGE] = { "Accept-Language", 15 },
+  [HEADER_AUTHORIZATION] = { "Authorization", 13 },
+  [HEADER_COOKIE] = { "Cookie", 6 },
+  [HEADER_USER_AGENT] = { "User-Agent", 10 },
+  [HEADER_REFERER] = { "Referer", 7 },
+  [HEADER_ORIGIN] = { "Origin", 6 },
+  [HEADER_CACHE_CONTROL] = { "Cache-Control", 13 },
+  [HEADER_PRAGMA] = { "Pragma", 6 },
+  [HEADER_IF_NONE_MATCH] = { "If-None-Match", 13 },
+  [HEADER_IF_MODIFIED_SINCE] = { "If-Modified-Since", 17 },
+  [HEADER_IF_RANGE] = { "If-Range", 8 },
+  [HEADER_RANGE] = { "Range", 5 },
+  [HEADER_EXPECT] = { "Expect", 6 },
+  [HEADER_UPGRADE] = { "Upgrade", 7 },
+  [HEADER_SEC_WEBSOCKET_KEY] = { "Sec-WebSocket-Key", 17 },
+  [HEADER_SEC_WEBSOCKET_VERSION] = { "Sec-WebSocket-Version", 21 },
+  [HEADER_LAST_EVENT_ID] = { "Last-Event-ID", 13 },
+  [HEADER_X_FORWARDED_FOR] = { "X-Forwarded-For", 15 },
+  [HEADER_X_REQUEST_ID] = { "X-Request-ID", 12 },
+  [HEADER_ACCESS_CONTROL_REQUEST_METHOD] = { "Access-Control-Request-Method", 29 },
+  [HEADER_ACCESS_CONTROL_REQUEST_HEADERS] = { "Access-Control-Request-Headers", 30 },
+  [HEADER_TRACEPARENT] = { "Traceparent", 11 },
+};
+
+// Perfect hash of the names in known_headers, see known_header_hash().
+// Holds header_id_t + 1, 0 for an unused slot.
+static const uint8_t known_header_slots[64] = {
+  [1] = HEADER_USER_AGENT + 1,
+  [2] = HEADER_LAST_EVENT_ID + 1,
+  [4] = HEADER_HOST + 1,
+  [5] = HEADER_ORIGIN + 1,
+  [9] = HEADER_EXPECT + 1,
+  [10] = HEADER_SEC_WEBSOCKET_KEY + 1,
+  [15] = HEADER_SEC_WEBSOCKET_VERSION + 1,
+  [16] = HEADER_X_FORWARDED_FOR + 1,
+  [20] = HEADER_X_REQUEST_ID + 1,
+  [21] = HEADER_PRAGMA + 1,
+  [23] = HEADER_IF_NONE_MATCH + 1,
+  [25] = HEADER_RANGE + 1,
+  [28] = HEADER_ACCESS_CONTROL_REQUEST_HEADERS + 1,
+  [29] = HEADER_CACHE_CONTROL + 1,
+  [34] = HEADER_REFERER + 1,
+  [35] = HEADER_CONTENT_LENGTH + 1,
+  [36] = HEADER_IF_MODIFIED_SINCE + 1,
+  [37] = HEADER_AUTHORIZATION + 1,
+  [38] = HEADER_TRACEPARENT + 1,
+  [40] = HEADER_ACCEPT_LANGUAGE + 1,
+  [42] = HEADER_IF_RANGE + 1,
+  [43] = HEADER_ACCESS_CONTROL_REQUEST_METHOD + 1,
+  [45] = HEADER_TRANSFER_ENCODING + 1,
+  [46] = HEADER_CONTENT_ENCODING + 1,
+  [49] = HEADER_CONNECTION + 1,
+  [52] = HEADER_CONTENT_TYPE + 1,
+  [53] = HEADER_ACCEPT + 1,
+  [56] = HEADER_COOKIE + 1,
+  [58] = HEADER_ACCEPT_ENCODING + 1,
+  [60] = HEADER_UPGRADE + 1,
+};
+
+// Length, first and last character are enough to tell the known names apart.
+// | 0x20 lowercases letters, anything else only has to hash consistently.
+static inline size_t known_header_hash(const char *name, size_t len) {
+  return (len * 42 + (size_t)(name[0] | 0x20) * 5 + (size_t)(name[len - 1] | 0x20) * 9) & 63;
+}
+
+header_id_t http_header_id(const char *name, size_t len) {
+  if (!name || len == 0)
+    return HEADER_COUNT;
+
+  uint8_t slot = known_header_slots[known_header_hash(name, len)];
+  if (slot == 0)
+    return HEADER_COUNT;
+
+  header_id_t id = (header_id_t)(slot - 1);
+
+  if (known_headers[id].len != len || strncasecmp(known_headers[id].name, name, len) != 0)
+    return HEADER_COUNT;
+
+  return id;
+}
+
+const char *http_header_find(const request_t *headers, header_id_t id) {
+  if (!headers || id >= HEADER_COUNT || headers->known[id] == 0)
+    return NULL;
+
+  return headers->items[headers->known[id] - 1].value;
+}
+
 static size_t calculate_next_size(size_t current, size_t needed) {
   if (needed > ABSOLUTE_MAX_REQUEST) {
     LOG_DEBUG("Request too large: %zu bytes", needed);
@@ -81,81 +188,158 @@ static int ensure_buffer_capacity(Arena *arena, char **buffer, size_t *capacity,
   return 0;
 }
 
-static void parse_query(Arena *arena, const char *query_start, size_t query_len, request_t *query) {
-  if (!arena || !query)
-    return;
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
 
-  memset(query, 0, sizeof(request_t));
+// Decodes %XX and + in place and returns the new length.
+// A % without two hex digits is kept as it is.
+static size_t percent_decode(char *s, size_t len) {
+  size_t out = 0;
 
-  if (!query_start || query_len == 0)
-    return;
+  for (size_t i = 0; i < len; i++) {
+    char c = s[i];
+
+    if (c == '+') {
+      c = ' ';
+    } else if (c == '%' && i + 2 < len) {
+      int hi = hex_digit(s[i + 1]);
+      int lo = hex_digit(s[i + 2]);
 
-  int param_count = 1;
-  for (size_t i = 0; i < query_len; i++) {
-    if (query_start[i] == '&') {
-      param_count++;
-      if (param_count > MAX_QUERY_PARAMS) {
-        param_count = MAX_QUERY_PARAMS;
-        break;
+      if (hi >= 0 && lo >= 0) {
+        c = (char)((hi << 4) | lo);
+        i += 2;
       }
     }
+
+    s[out++] = c;
   }
 
-  query->capacity = param_count;
-  query->items = arena_alloc(arena, query->capacity * sizeof(request_item_t));
-  if (!query->items) {
-    query->capacity = 0;
-    return;
+  return out;
+}
+
+int http_parse_query(Arena *arena, char *query_start, size_t query_len, request_t *query) {
+  if (!arena || !query)
+    return -1;
+
+  memset(query, 0, sizeof(request_t));
+
+  if (!query_start || query_len == 0)
+    return 0;
+
+  char *end = query_start + query_len;
+
+  size_t param_count = 1;
+  for (char *amp = query_start; (amp = memchr(amp, '&', (size_t)(end - amp))); amp++) {
+    if (++param_count >= MAX_QUERY_PARAMS)
+      break;
   }
 
-  const char *p = query_start;
-  const char *end = query_start + query_len;
+  query->items = arena_alloc(arena, param_count * sizeof(request_item_t));
+  if (!query->items)
+    return -1;
+
+  query->capacity = (uint16_t)param_count;
+
+  char *p = query_start;
 
   while (p < end && query->count < query->capacity) {
-    const char *key_start = p;
-    const char *eq = NULL;
-    const char *amp = NULL;
-
-    // Find = and &
-    for (const char *s = p; s < end; s++) {
-      if (*s == '=' && !eq)
-        eq = s;
-      if (*s == '&') {
-        amp = s;
-        break;
-      }
+    char *pair_end = memchr(p, '&', (size_t)(end - p));
+    if (!pair_end)
+      pair_end = end;
+
+    // Pairs without = are skipped
+    char *eq = memchr(p, '=', (size_t)(pair_end - p));
+
+    if (eq) {
+      // Decoding never grows a string, so the terminators
+      // go where = and & were, or on the one after the query
+      size_t key_len = percent_decode(p, (size_t)(eq - p));
+      size_t val_len = percent_decode(eq + 1, (size_t)(pair_end - eq - 1));
+      p[key_len] = '\0';
+      eq[1 + val_len] = '\0';
+
+      query->items[query->count].key = p;
+      query->items[query->count].value = val_len > 0 ? eq + 1 : NULL;
+      query->count++;
     }
 
-    const char *pair_end = amp ? amp : end;
+    p = pair_end + 1;
+  }
 
-    if (eq && eq < pair_end) {
-      size_t key_len = eq - key_start;
-      size_t val_len = pair_end - (eq + 1);
+  return 0;
+}
 
-      char *key = arena_alloc(arena, key_len + 1);
-      if (key) {
-        memcpy(key, key_start, key_len);
-        key[key_len] = '\0';
-        query->items[query->count].key = key;
-      }
+// Turns a view into an arena copy
+static int span_copy(Arena *arena, char **str, size_t length, size_t *capacity) {
+  char *copy = NULL;
+  size_t copy_capacity = 0;
 
-      if (val_len > 0) {
-        char *value = arena_alloc(arena, val_len + 1);
-        if (value) {
-          memcpy(value, eq + 1, val_len);
-          value[val_len] = '\0';
-          query->items[query->count].value = value;
-        }
-      } else {
-        query->items[query->count].value = NULL;
-      }
+  int result = ensure_buffer_capacity(arena, &copy, &copy_capacity, 0, length);
+  if (result != 0)
+    return result;
 
-      if (query->items[query->count].key)
-        query->count++;
+  memcpy(copy, *str, length);
+  copy[length] = '\0';
+
+  *str = copy;
+  *capacity = copy_capacity;
+  return 0;
+}
+
+// A span that continues a view in the same read extends it,
+// anything else makes the string an arena copy first
+static int span_append(Arena *arena, char **str, size_t *length, size_t *capacity,
+                       const char *at, size_t n) {
+  if (!*str) {
+    // The read buffer is writable, llhttp only passes it as const
+    *str = (char *)at;
+    *length = n;
+    *capacity = 0;
+    return 0;
+  }
+
+  if (*capacity == 0) {
+    if (*str + *length == at) {
+      *length += n;
+      return 0;
     }
 
-    p = amp ? amp + 1 : end;
+    int result = span_copy(arena, str, *length, capacity);
+    if (result != 0)
+      return result;
   }
+
+  int result = ensure_buffer_capacity(arena, str, capacity, *length, n);
+  if (result != 0)
+    return result;
+
+  memcpy(*str + *length, at, n);
+  *length += n;
+  (*str)[*length] = '\0';
+  return 0;
+}
+
+// Only once the parser is past the byte after the view
+static void span_terminate(char *str, size_t length, size_t capacity) {
+  if (str && capacity == 0)
+    str[length] = '\0';
+}
+
+static int span_error(llhttp_t *parser, int result, const char *too_large_reason) {
+  if (result == -2) {
+    llhttp_set_error_reason(parser, too_large_reason);
+    return HPE_USER;
+  }
+
+  llhttp_set_error_reason(parser, ERROR_REASON_MEMORY_ALLOCATION);
+  return HPE_INTERNAL;
 }
 
 int on_url_cb(llhttp_t *parser, const char *at, size_t length) {
@@ -169,22 +353,10 @@ int on_url_cb(llhttp_t *parser, const char *at, size_t length) {
     return HPE_USER;
   }
 
-  int result = ensure_buffer_capacity(context->arena,
-                                      &context->url,
-                                      &context->url_capacity,
-                                      context->url_length,
-                                      length);
-  if (result == -2) {
-    llhttp_set_error_reason(parser, ERROR_REASON_URL_TOO_LONG);
-    return HPE_USER;
-  } else if (result != 0) {
-    llhttp_set_error_reason(parser, ERROR_REASON_MEMORY_ALLOCATION);
-    return HPE_INTERNAL;
-  }
-
-  memmove(context->url + context->url_length, at, length);
-  context->url_length += length;
-  context->url[context->url_length] = '\0';
+  int result = span_append(context->arena, &context->url, &context->url_length,
+                           &context->url_capacity, at, length);
+  if (result != 0)
+    return span_error(parser, result, ERROR_REASON_URL_TOO_LONG);
 
   return HPE_OK;
 }
@@ -200,26 +372,16 @@ int on_header_field_cb(llhttp_t *parser, const char *at, size_t length) {
     return HPE_USER;
   }
 
-  if (length > MAX_HEADER_SIZE) {
+  // A field split across reads arrives in several calls
+  if (context->header_field_length + length > MAX_HEADER_SIZE) {
     llhttp_set_error_reason(parser, ERROR_REASON_HEADER_TOO_LARGE);
     return HPE_USER;
   }
 
-  context->header_field_length = 0;
-
-  int result = ensure_buffer_capacity(context->arena, &context->current_header_field,
-                                      &context->header_field_capacity, 0, length);
-  if (result == -2) {
-    llhttp_set_error_reason(parser, ERROR_REASON_HEADER_TOO_LARGE);
-    return HPE_USER;
-  } else if (result != 0) {
-    llhttp_set_error_reason(parser, ERROR_REASON_MEMORY_ALLOCATION);
-    return HPE_INTERNAL;
-  }
-
-  memmove(context->current_header_field, at, length);
-  context->header_field_length = length;
-  context->current_header_field[length] = '\0';
+  int result = span_append(context->arena, &context->header_field, &context->header_field_length,
+                           &context->header_field_capacity, at, length);
+  if (result != 0)
+    return span_error(parser, result, ERROR_REASON_HEADER_TOO_LARGE);
 
   return HPE_OK;
 }
@@ -270,32 +432,68 @@ int on_header_value_cb(llhttp_t *parser, const char *at, size_t length) {
     return HPE_USER;
   }
 
-  if (ensure_array_capacity(context->arena, &context->headers) != 0) {
-    llhttp_set_error_reason(parser, ERROR_REASON_MEMORY_ALLOCATION);
-    return HPE_INTERNAL;
+  if (context->header_value_length + length > MAX_HEADER_SIZE) {
+    llhttp_set_error_reason(parser, ERROR_REASON_HEADER_TOO_LARGE);
+    return HPE_USER;
   }
 
-  char *key_copy = arena_alloc(context->arena, context->header_field_length + 1);
-  if (!key_copy) {
-    llhttp_set_error_reason(parser, ERROR_REASON_MEMORY_ALLOCATION);
-    return HPE_INTERNAL;
-  }
+  int result = span_append(context->arena, &context->header_value, &context->header_value_length,
+                           &context->header_value_capacity, at, length);
+  if (result != 0)
+    return span_error(parser, result, ERROR_REASON_HEADER_TOO_LARGE);
 
-  memcpy(key_copy, context->current_header_field, context->header_field_length);
-  key_copy[context->header_field_length] = '\0';
+  return HPE_OK;
+}
 
-  char *value_copy = arena_alloc(context->arena, length + 1);
-  if (!value_copy) {
-    llhttp_set_error_reason(parser, ERROR_REASON_MEMORY_ALLOCATION);
+static void terminate_last_value(http_context_t *context) {
+  if (context->last_value_view && context->headers.count > 0)
+    ((char *)context->headers.items[context->headers.count - 1].value)[context->last_value_length] = '\0';
+
+  context->last_value_view = false;
+}
+
+int on_header_value_complete_cb(llhttp_t *parser) {
+  if (!parser || !parser->data)
     return HPE_INTERNAL;
+
+  http_context_t *context = (http_context_t *)parser->data;
+
+  // The parser is at the end of this value, the previous one is behind it
+  terminate_last_value(context);
+
+  if (context->header_field_length == 0) {
+    llhttp_set_error_reason(parser, ERROR_REASON_INVALID_HEADER_FIELD);
+    return HPE_USER;
   }
 
-  memcpy(value_copy, at, length);
-  value_copy[length] = '\0';
+  // Headers without a value are skipped
+  if (context->header_value_length > 0) {
+    if (ensure_array_capacity(context->arena, &context->headers) != 0) {
+      llhttp_set_error_reason(parser, ERROR_REASON_MEMORY_ALLOCATION);
+      return HPE_INTERNAL;
+    }
+
+    span_terminate(context->header_field, context->header_field_length,
+                   context->header_field_capacity);
+
+    request_item_t *item = &context->headers.items[context->headers.count++];
+    item->key = context->header_field;
+    item->value = context->header_value;
+
+    header_id_t id = http_header_id(context->header_field, context->header_field_length);
+    if (id != HEADER_COUNT && context->headers.known[id] == 0)
+      context->headers.known[id] = (uint8_t)context->headers.count;
 
-  context->headers.items[context->headers.count].key = key_copy;
-  context->headers.items[context->headers.count].value = value_copy;
-  context->headers.count++;
+    context->last_value_length = context->header_value_length;
+    context->last_value_view = context->header_value_capacity == 0;
+  }
+
+  context->header_field = NULL;
+  context->header_field_length = 0;
+  context->header_field_capacity = 0;
+  context->header_value = NULL;
+  context->header_value_length = 0;
+  context->header_value_capacity = 0;
 
   return HPE_OK;
 }
@@ -311,22 +509,10 @@ int on_method_cb(llhttp_t *parser, const char *at, size_t length) {
     return HPE_USER;
   }
 
-  int result = ensure_buffer_capacity(context->arena,
-                                      &context->method,
-                                      &context->method_capacity,
-                                      context->method_length,
-                                      length);
-  if (result == -2) {
-    llhttp_set_error_reason(parser, ERROR_REASON_METHOD_TOO_LONG);
-    return HPE_USER;
-  } else if (result != 0) {
-    llhttp_set_error_reason(parser, ERROR_REASON_MEMORY_ALLOCATION);
-    return HPE_INTERNAL;
-  }
-
-  memmove(context->method + context->method_length, at, length);
-  context->method_length += length;
-  context->method[context->method_length] = '\0';
+  int result = span_append(context->arena, &context->method, &context->method_length,
+                           &context->method_capacity, at, length);
+  if (result != 0)
+    return span_error(parser, result, ERROR_REASON_METHOD_TOO_LONG);
 
   return HPE_OK;
 }
@@ -353,6 +539,7 @@ int on_body_cb(llhttp_t *parser, const char *at, size_t length) {
 
   memmove(context->body + context->body_length, at, length);
   context->body_length += length;
+  context->body[context->body_length] = '\0';
 
   return HPE_OK;
 }
@@ -369,6 +556,11 @@ int on_headers_complete_cb(llhttp_t *parser) {
   context->keep_alive = llhttp_should_keep_alive(parser);
   context->headers_complete = 1;
 
+  // The whole header block is behind the parser now
+  terminate_last_value(context);
+  span_terminate(context->url, context->url_length, context->url_capacity);
+  span_terminate(context->method, context->method_length, context->method_capacity);
+
   return HPE_OK;
 }
 
@@ -381,16 +573,17 @@ int on_message_complete_cb(llhttp_t *parser) {
 
   if (context->url && context->url_length > 0) {
     const char *qmark = memchr(context->url, '?', context->url_length);
+    // The query is parsed when the handler asks for it, see request.c
     if (qmark) {
       context->path_length = qmark - context->url;
-      size_t query_len = context->url_length - context->path_length - 1;
-      parse_query(context->arena, qmark + 1, query_len, &context->query_params);
     } else {
       context->path_length = context->url_length;
     }
   }
 
-  return HPE_OK;
+  // Stop after each message, so pipelined requests
+  // that follow in the same buffer get their own context
+  return HPE_PAUSED;
 }
 
 void http_context_init(http_context_t *context,
@@ -408,47 +601,95 @@ void http_context_init(http_context_t *context,
 
   context->parser->data = context;
 
-  context->url_capacity = 512;
-  context->url = arena_alloc(arena, context->url_capacity);
-  context->url_length = 0;
-  if (context->url)
-    context->url[0] = '\0';
+  // Strings are views or grow on demand, see http.h
+  context->keep_alive = 1;
+  context->message_complete = 0;
+  context->headers_complete = 0;
+  context->last_error = HPE_OK;
+  context->error_reason = NULL;
+}
 
-  context->method_capacity = 32;
-  context->method = arena_alloc(arena, context->method_capacity);
-  context->method_length = 0;
-  if (context->method)
-    context->method[0] = '\0';
+static bool in_view(const request_t *items, const char *p) {
+  return p && p >= items->view_begin && p < items->view_end;
+}
 
-  context->header_field_capacity = 128;
-  context->current_header_field = arena_alloc(arena, context->header_field_capacity);
-  context->header_field_length = 0;
-  if (context->current_header_field)
-    context->current_header_field[0] = '\0';
+int http_context_keep(http_context_t *context) {
+  if (!context || !context->arena)
+    return -1;
 
-  context->body_capacity = 1024;
-  context->body = arena_alloc(arena, context->body_capacity);
-  context->body_length = 0;
-  if (context->body)
-    context->body[0] = '\0';
+  Arena *arena = context->arena;
 
-  context->headers.count = 0;
-  context->headers.capacity = 32;
-  context->headers.items = arena_alloc(arena, context->headers.capacity * sizeof(request_item_t));
-  if (context->headers.items)
-    memset(context->headers.items, 0, context->headers.capacity * sizeof(request_item_t));
+  if (context->url && context->url_capacity == 0
+      && span_copy(arena, &context->url, context->url_length, &context->url_capacity) != 0)
+    return -1;
 
-  memset(&context->query_params, 0, sizeof(request_t));
-  memset(&context->url_params, 0, sizeof(request_t));
+  if (context->method && context->method_capacity == 0
+      && span_copy(arena, &context->method, context->method_length, &context->method_capacity) != 0)
+    return -1;
 
-  context->keep_alive = 1;
-  context->message_complete = 0;
-  context->headers_complete = 0;
-  context->last_error = HPE_OK;
-  context->error_reason = NULL;
+  if (context->header_field && context->header_field_capacity == 0
+      && span_copy(arena, &context->header_field, context->header_field_length,
+                   &context->header_field_capacity)
+          != 0)
+    return -1;
+
+  if (context->header_value && context->header_value_capacity == 0
+      && span_copy(arena, &context->header_value, context->header_value_length,
+                   &context->header_value_capacity)
+          != 0)
+    return -1;
+
+  // Not terminated yet, the others are
+  if (context->last_value_view && context->headers.count > 0) {
+    request_item_t *last = &context->headers.items[context->headers.count - 1];
+    char *value = (char *)last->value;
+    size_t capacity = 0;
+
+    if (span_copy(arena, &value, context->last_value_length, &capacity) != 0)
+      return -1;
+
+    last->value = value;
+    context->last_value_view = false;
+  }
+
+  return http_headers_keep(arena, &context->headers);
 }
 
-parse_result_t http_parse_request(http_context_t *context, const char *data, size_t len) {
+const char *http_header_keep(Arena *arena, request_t *headers, request_item_t *item) {
+  if (!in_view(headers, item->value))
+    return item->value;
+
+  char *value = arena_strdup(arena, item->value);
+  if (!value)
+    return NULL;
+
+  item->value = value;
+  return value;
+}
+
+int http_headers_keep(Arena *arena, request_t *headers) {
+  if (!headers || !headers->view_begin)
+    return 0;
+
+  for (uint16_t i = 0; i < headers->count; i++) {
+    request_item_t *item = &headers->items[i];
+
+    if (in_view(headers, item->key)) {
+      item->key = arena_strdup(arena, item->key);
+      if (!item->key)
+        return -1;
+    }
+
+    if (in_view(headers, item->value) && !http_header_keep(arena, headers, item))
+      return -1;
+  }
+
+  headers->view_begin = NULL;
+  headers->view_end = NULL;
+  return 0;
+}
+
+parse_result_t http_parse_request(http_context_t *context, const char *data, size_t len, size_t *consumed) {
   if (!context || !data || len == 0)
     return PARSE_ERROR;
 
@@ -457,6 +698,9 @@ parse_result_t http_parse_request(http_context_t *context, const char *data, siz
   context->last_error = err;
   context->error_reason = llhttp_get_error_reason(context->parser);
 
+  if (consumed)
+    *consumed = len;
+
   switch (err) {
   case HPE_OK:
     if (context->message_complete)
@@ -464,9 +708,11 @@ parse_result_t http_parse_request(http_context_t *context, const char *data, siz
     return PARSE_INCOMPLETE;
 
   case HPE_PAUSED:
-    return PARSE_INCOMPLETE;
-
   case HPE_PAUSED_UPGRADE:
+    // The bytes after the pause belong to the next message
+    if (consumed)
+      *consumed = (size_t)(llhttp_get_error_pos(context->parser) - data);
+
     if (context->message_complete)
       return PARSE_SUCCESS;
     return PARSE_INCOMPLETE;
@@ -487,6 +733,14 @@ bool http_message_needs_eof(const http_context_t *context) {
   return llhttp_message_needs_eof(context->parser) != 0;
 }
 
+void http_resume_parsing(http_context_t *context) {
+  if (!context)
+    return;
+
+  if (llhttp_get_errno(context->parser) == HPE_PAUSED)
+    llhttp_resume(context->parser);
+}
+
 parse_result_t http_finish_parsing(http_context_t *context) {
   if (!context)
     return PARSE_ERROR;
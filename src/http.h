@@ -11,13 +11,17 @@ typedef enum {
   PARSE_OVERFLOW = -2 // Buffer overflow or size limit exceeded
 } parse_result_t;
 
+// While a request arrives in one read, its method, URL and headers
+// point into the read buffer instead of being copied. A zero capacity
+// marks such a view. Views are NUL-terminated in place once the parser
+// is past them, and copied into the arena by http_context_keep() and
+// http_headers_keep() before the read buffer is reused.
 typedef struct
 {
   Arena *arena;
   llhttp_t *parser;
   llhttp_settings_t *settings;
 
-  // Dynamic URL parsing state
   char *url;
   size_t url_length;
   size_t url_capacity;
@@ -28,7 +32,6 @@ typedef struct
   size_t method_capacity;
 
   request_t headers;
-  request_t query_params;
   request_t url_params;
 
   char *body;
@@ -43,19 +46,45 @@ typedef struct
   bool keep_alive;
   bool headers_complete;
 
-  char *current_header_field;
+  // Header being parsed
+  char *header_field;
   size_t header_field_length;
   size_t header_field_capacity;
+  char *header_value;
+  size_t header_value_length;
+  size_t header_value_capacity;
+
+  // The value of the last added header is terminated after the parser leaves it
+  size_t last_value_length;
+  bool last_value_view;
 
   llhttp_errno_t last_error;
   const char *error_reason;
 } http_context_t;
 
 // Using in router.c
-parse_result_t http_parse_request(http_context_t *context, const char *data, size_t len);
+parse_result_t http_parse_request(http_context_t *context, const char *data, size_t len, size_t *consumed);
+void http_resume_parsing(http_context_t *context);
 bool http_message_needs_eof(const http_context_t *context);
 parse_result_t http_finish_parsing(http_context_t *context);
 
+// Copies the views of a request that continues in the next read
+int http_context_keep(http_context_t *context);
+
+// Copies the header values that still point into the read buffer
+int http_headers_keep(Arena *arena, request_t *headers);
+const char *http_header_keep(Arena *arena, request_t *headers, request_item_t *item);
+
+// Classifies a header name, HEADER_COUNT if it is not a known one
+header_id_t http_header_id(const char *name, size_t len);
+
+// Value of the first header with that id, without copying views
+const char *http_header_find(const request_t *headers, header_id_t id);
+
+// Using in request.c
+// Splits a NUL-terminated query string into items, decoding it in place
+int http_parse_query(Arena *arena, char *query_start, size_t query_len, request_t *query);
+
 // Using in server.c
 void http_context_init(http_context_t *context,
                        Arena *arena,
@@ -64,6 +93,7 @@ void http_context_init(http_context_t *context,
 int on_url_cb(llhttp_t *parser, const char *at, size_t length);
 int on_header_field_cb(llhttp_t *parser, const char *at, size_t length);
 int on_header_value_cb(llhttp_t *parser, const char *at, size_t length);
+int on_header_value_complete_cb(llhttp_t *parser);
 int on_method_cb(llhttp_t *parser, const char *at, size_t length);
 int on_body_cb(llhttp_t *parser, const char *at, size_t length);
 int on_headers_complete_cb(llhttp_t *parser);
@@ -0,0 +1,495 @@
+#include <stdlib.h>
+#include "pipeline.h"
+#include "send-file.h"
+#include "response-stream.h"
+#include "response-cache.h"
+#include "arena.h"
+#include "logger.h"
+
+typedef struct
+{
+  uv_write_t req;
+  client_t *client;
+  size_t bytes; // Queued by uv_write, after what uv_try_write took
+  uint16_t count; // Exchanges, each has one or two buffers
+  uv_buf_t bufs[];
+} pipeline_write_t;
+
+exchange_t *exchange_create(client_t *client) {
+  if (!client)
+    return NULL;
+
+  Arena *arena;
+  bool borrowed;
+
+  // The connection arena serves the connection while nothing
+  // else is queued, pipelined exchanges borrow their own
+  if (!client->exchange_head && client->connection_arena) {
+    arena = client->connection_arena;
+    borrowed = false;
+  } else {
+    arena = arena_borrow();
+    if (!arena)
+      return NULL;
+    borrowed = true;
+  }
+
+  exchange_t *exchange = arena_alloc(arena, sizeof(exchange_t));
+  if (!exchange) {
+    if (borrowed)
+      arena_return(arena);
+    return NULL;
+  }
+
+  memset(exchange, 0, sizeof(exchange_t));
+  exchange->client = client;
+  exchange->arena = arena;
+  exchange->borrowed = borrowed;
+  exchange->state = EXCHANGE_PARSING;
+  exchange->keep_alive = true;
+
+  if (client->exchange_tail)
+    client->exchange_tail->next = exchange;
+  else
+    client->exchange_head = exchange;
+
+  client->exchange_tail = exchange;
+
+  if (!client->exchange_unsent)
+    client->exchange_unsent = exchange;
+
+  client->exchange_count++;
+
+  return exchange;
+}
+
+void exchange_release(exchange_t *exchange) {
+  if (!exchange)
+    return;
+
+  if (exchange->file)
+    file_transfer_close(exchange->file);
+
+  if (exchange->stream)
+    response_stream_close(exchange->stream);
+
+  if (exchange->owned_free && exchange->owned_body)
+    exchange->owned_free(exchange->owned_body);
+
+  if (exchange->cache_refresh)
+    response_cache_refresh_done(exchange->cache_refresh);
+
+  // The exchange lives in its own arena
+  if (exchange->borrowed)
+    arena_return(exchange->arena);
+  else
+    arena_reset(exchange->arena);
+}
+
+static void pipeline_pop(client_t *client) {
+  exchange_t *exchange = client->exchange_head;
+  if (!exchange)
+    return;
+
+  client->exchange_head = exchange->next;
+  if (!client->exchange_head)
+    client->exchange_tail = NULL;
+
+  if (client->exchange_unsent == exchange)
+    client->exchange_unsent = exchange->next;
+
+  client->exchange_count--;
+  exchange_release(exchange);
+}
+
+// All received requests are answered
+static void pipeline_idle(client_t *client) {
+  if (client->close_after_write) {
+    close_client(client);
+    return;
+  }
+
+  client_set_read_timeout(client, TIMEOUT_IDLE);
+}
+
+// Continues after the responses at the front were written
+static void pipeline_advance(client_t *client) {
+  client_touch(client);
+
+  if (client->read_paused && client->exchange_count < MAX_PIPELINE_DEPTH / 2) {
+    client->read_paused = false;
+    client_resume_reading(client);
+  }
+
+  if (!client->exchange_head) {
+    pipeline_idle(client);
+  } else if (client->read_phase == TIMEOUT_REQUEST) {
+    // Answered requests restart the deadline of the waiting ones
+    client->request_start = uv_now(client->owner->loop);
+    client_set_read_timeout(client, TIMEOUT_REQUEST);
+  }
+}
+
+// Pops the `count` exchanges of a finished write
+static void pipeline_written(client_t *client, uint16_t count, int status) {
+  bool keep_alive = true;
+
+  for (uint16_t i = 0; i < count && client->exchange_head; i++) {
+    // Only the headers of a file or streamed response are written yet
+    if (client->exchange_head == client->body_exchange)
+      break;
+
+    if (!client->exchange_head->keep_alive)
+      keep_alive = false;
+
+    pipeline_pop(client);
+  }
+
+  if (status < 0 || !keep_alive) {
+    close_client(client);
+    return;
+  }
+
+  if (client->body_exchange && client->exchange_head == client->body_exchange) {
+    if (client->body_exchange->file)
+      file_transfer_start(client->body_exchange);
+    else
+      response_stream_start(client->body_exchange);
+    return;
+  }
+
+  pipeline_advance(client);
+}
+
+static void on_pipeline_write(uv_write_t *req, int status) {
+  pipeline_write_t *write = (pipeline_write_t *)req;
+
+  // The write request lives in the arena of its first exchange
+  client_t *client = write->client;
+
+  if (status < 0)
+    LOG_ERROR("Write error: %s", uv_strerror(status));
+
+  client->write_bytes_pending -= write->bytes;
+
+  if (client->write_paused && client->write_bytes_pending <= WRITE_LOW_WATERMARK) {
+    client->write_paused = false;
+    client_resume_reading(client);
+  }
+
+  client_write_finished(client);
+  pipeline_written(client, write->count, status);
+}
+
+void pipeline_body_done(client_t *client, bool ok) {
+  exchange_t *exchange = client->body_exchange;
+  client->body_exchange = NULL;
+
+  bool keep_alive = exchange && exchange->keep_alive;
+  pipeline_pop(client);
+
+  if (!ok || !keep_alive) {
+    close_client(client);
+    return;
+  }
+
+  pipeline_advance(client);
+
+  // Responses that became ready during the transfer
+  pipeline_flush(client);
+}
+
+// Writes the ready responses at the front of the queue with one write.
+// Unless the caller is a handler, uv_try_write() is tried first and a
+// response that fits the socket buffer is completed inline.
+static void pipeline_write(client_t *client, bool complete_inline) {
+  // A file or streamed body is being sent, the next responses follow it
+  if (!client || client->reading_batch || client->closing || client->body_exchange)
+    return;
+
+  if (!client->exchange_head) {
+    if (client->close_after_write)
+      close_client(client);
+    return;
+  }
+
+  exchange_t *first = client->exchange_unsent;
+  uint16_t count = 0;
+
+  exchange_t *body_exchange = NULL;
+
+  for (exchange_t *ex = first; ex && ex->state == EXCHANGE_READY; ex = ex->next) {
+    count++;
+
+    // Nothing is written after a file or a stream until its body is sent
+    if (ex->file || ex->stream) {
+      body_exchange = ex;
+      break;
+    }
+  }
+
+  // The response at the front is still being handled
+  if (count == 0)
+    return;
+
+  pipeline_write_t *write = arena_alloc(first->arena,
+                                        sizeof(pipeline_write_t) + 2 * count * sizeof(uv_buf_t));
+  if (!write) {
+    close_client(client);
+    return;
+  }
+
+  memset(&write->req, 0, sizeof(uv_write_t));
+  write->client = client;
+  write->bytes = 0;
+  write->count = count;
+
+  unsigned int nbufs = 0;
+
+  exchange_t *ex = first;
+  for (uint16_t i = 0; i < count; i++) {
+    write->bufs[nbufs++] = ex->response;
+    if (ex->body.len > 0)
+      write->bufs[nbufs++] = ex->body;
+
+    ex->state = EXCHANGE_WRITING;
+    ex = ex->next;
+  }
+
+  client->exchange_unsent = ex;
+
+  uv_buf_t *bufs = write->bufs;
+
+  // A small response usually fits the empty socket buffer, writing it
+  // right away saves the callback and frees the arena sooner. Only done
+  // when no earlier write is waiting for its callback: libuv may have sent
+  // its bytes already, but it is still at the head of the queue.
+  server_loop_t *sl = client->owner;
+
+  if (complete_inline && first == client->exchange_head) {
+    sl->write_calls++;
+    sl->write_buffers += nbufs;
+
+    int written = uv_try_write((uv_stream_t *)&client->handle, bufs, nbufs);
+
+    if (written < 0 && written != UV_EAGAIN) {
+      LOG_DEBUG("Write error: %s", uv_strerror(written));
+      close_client(client);
+      return;
+    }
+
+    size_t left = written > 0 ? (size_t)written : 0;
+    while (nbufs > 0 && left >= bufs->len) {
+      left -= bufs->len;
+      bufs++;
+      nbufs--;
+    }
+
+    if (nbufs == 0) {
+      client->body_exchange = body_exchange;
+      pipeline_written(client, count, 0);
+      return;
+    }
+
+    // Only the rest is queued
+    bufs->base += left;
+    bufs->len -= left;
+  }
+
+  sl->write_calls++;
+  sl->write_buffers += nbufs;
+
+  int result = uv_write(&write->req, (uv_stream_t *)&client->handle,
+                        bufs, nbufs, on_pipeline_write);
+
+  if (result < 0) {
+    LOG_DEBUG("Write error: %s", uv_strerror(result));
+    close_client(client);
+    return;
+  }
+
+  client_write_started(client);
+  client->body_exchange = body_exchange;
+
+  for (unsigned int i = 0; i < nbufs; i++)
+    write->bytes += bufs[i].len;
+
+  client->write_bytes_pending += write->bytes;
+
+  // Stop taking requests from a peer that does not read its responses
+  if (!client->write_paused && client->write_bytes_pending > WRITE_HIGH_WATERMARK)
+    client_pause_for_output(client);
+}
+
+#if COALESCE_WRITES
+static void on_flush_idle(uv_idle_t *handle) {
+  (void)handle;
+}
+
+static void on_flush_check(uv_check_t *handle) {
+  server_loop_t *sl = (server_loop_t *)handle->data;
+
+  // The handlers have returned, the writes may complete inline
+  while (sl->flush_queue) {
+    client_t *client = sl->flush_queue;
+    sl->flush_queue = client->flush_next;
+    client->flush_queued = false;
+    client->flush_next = NULL;
+
+    pipeline_flush(client);
+  }
+
+  uv_check_stop(&sl->flush_check);
+  uv_idle_stop(&sl->flush_idle);
+}
+
+static void flush_unqueue(client_t *client) {
+  server_loop_t *sl = client->owner;
+
+  for (client_t **link = &sl->flush_queue; *link; link = &(*link)->flush_next) {
+    if (*link == client) {
+      *link = client->flush_next;
+      break;
+    }
+  }
+
+  client->flush_queued = false;
+  client->flush_next = NULL;
+
+  if (!sl->flush_queue) {
+    uv_check_stop(&sl->flush_check);
+    uv_idle_stop(&sl->flush_idle);
+  }
+}
+#endif
+
+void exchange_ready(exchange_t *exchange, char *data, size_t len) {
+  if (!exchange)
+    return;
+
+  // The connection closed while the handler was running
+  if (!exchange->client) {
+    exchange_release(exchange);
+    return;
+  }
+
+  exchange->response = uv_buf_init(data, (unsigned int)len);
+  exchange->state = EXCHANGE_READY;
+
+  client_t *client = exchange->client;
+
+#if COALESCE_WRITES
+  // Written with the others of this iteration by on_flush_check()
+  if (!client->reading_batch && !client->flush_queued) {
+    server_loop_t *sl = client->owner;
+
+    if (!sl->flush_ready) {
+      pipeline_write(client, false);
+      return;
+    }
+
+    if (!sl->flush_queue) {
+      uv_check_start(&sl->flush_check, on_flush_check);
+      uv_idle_start(&sl->flush_idle, on_flush_idle);
+    }
+
+    client->flush_queued = true;
+    client->flush_next = sl->flush_queue;
+    sl->flush_queue = client;
+  }
+#else
+  // The handler may still use Req and Res after replying,
+  // so the exchange must not be released before it returns
+  pipeline_write(client, false);
+#endif
+}
+
+void pipeline_flush(client_t *client) {
+  pipeline_write(client, true);
+}
+
+int pipeline_loop_init(server_loop_t *sl) {
+#if COALESCE_WRITES
+  if (uv_check_init(sl->loop, &sl->flush_check) != 0)
+    return -1;
+
+  if (uv_idle_init(sl->loop, &sl->flush_idle) != 0) {
+    uv_close((uv_handle_t *)&sl->flush_check, NULL);
+    return -1;
+  }
+
+  sl->flush_check.data = sl;
+  sl->flush_idle.data = sl;
+  sl->flush_ready = true;
+#else
+  (void)sl;
+#endif
+  return 0;
+}
+
+void pipeline_loop_close(server_loop_t *sl) {
+  if (!sl->flush_ready)
+    return;
+
+  sl->flush_ready = false;
+
+  // Connections are closing, nothing is flushed anymore
+  while (sl->flush_queue) {
+    client_t *client = sl->flush_queue;
+    sl->flush_queue = client->flush_next;
+    client->flush_queued = false;
+    client->flush_next = NULL;
+  }
+
+  if (!uv_is_closing((uv_handle_t *)&sl->flush_check))
+    uv_close((uv_handle_t *)&sl->flush_check, NULL);
+
+  if (!uv_is_closing((uv_handle_t *)&sl->flush_idle))
+    uv_close((uv_handle_t *)&sl->flush_idle, NULL);
+}
+
+void pipeline_release(client_t *client) {
+  if (!client)
+    return;
+
+  exchange_t *exchange = client->exchange_head;
+
+  while (exchange) {
+    exchange_t *next = exchange->next;
+
+    if (exchange->state == EXCHANGE_HANDLING || response_stream_open(exchange->stream)) {
+      // The handler still holds Req and Res, the exchange
+      // is released when it replies or ends its stream
+      exchange->client = NULL;
+      exchange->next = NULL;
+
+      if (exchange->res)
+        exchange->res->client_socket = NULL;
+
+      if (!exchange->borrowed) {
+        exchange->borrowed = true;
+        client->connection_arena = NULL;
+      }
+
+      // May end the stream and release the exchange
+      if (exchange->stream)
+        response_stream_detach(exchange->stream);
+    } else {
+      exchange_release(exchange);
+    }
+
+    exchange = next;
+  }
+
+#if COALESCE_WRITES
+  if (client->flush_queued)
+    flush_unqueue(client);
+#endif
+
+  client->exchange_head = NULL;
+  client->exchange_tail = NULL;
+  client->exchange_unsent = NULL;
+  client->body_exchange = NULL;
+  client->parsing = NULL;
+  client->exchange_count = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef ECEWO_PIPELINE_H
+#define ECEWO_PIPELINE_H
+
+#include "server.h"
+
+#ifndef MAX_PIPELINE_DEPTH
+#define MAX_PIPELINE_DEPTH 64
+#endif
+
+// Unsent response bytes at which a connection stops being read,
+// and to which they have to drop before reading resumes
+#ifndef WRITE_HIGH_WATERMARK
+#define WRITE_HIGH_WATERMARK (1024 * 1024)
+#endif
+
+#ifndef WRITE_LOW_WATERMARK
+#define WRITE_LOW_WATERMARK (256 * 1024)
+#endif
+
+// Responses completed outside a read batch, by async handlers or
+// timers, are written once per loop iteration instead of one by one
+#ifndef COALESCE_WRITES
+#define COALESCE_WRITES 0
+#endif
+
+// Appends a new exchange to the connection queue
+exchange_t *exchange_create(client_t *client);
+
+// Marks the response as serialized and writes it when its turn comes
+void exchange_ready(exchange_t *exchange, char *data, size_t len);
+
+// Frees an exchange that is no longer in a connection queue
+void exchange_release(exchange_t *exchange);
+
+// Writes the ready responses at the front of the queue, completing them
+// inline when the socket takes the whole write at once
+void pipeline_flush(client_t *client);
+
+// Pops the file or streamed response at the front once its body is sent
+void pipeline_body_done(client_t *client, bool ok);
+
+// Frees the queue of a closing connection
+void pipeline_release(client_t *client);
+
+// Flush handles of a loop, only started with COALESCE_WRITES
+int pipeline_loop_init(server_loop_t *sl);
+void pipeline_loop_close(server_loop_t *sl);
+
+#endif
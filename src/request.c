@@ -1,5 +1,6 @@
 #include "ecewo.h"
 #include "request.h"
+#include "http.h"
 
 #ifdef _WIN32
 #define strcasecmp _stricmp
@@ -7,7 +8,7 @@
 #include <strings.h>
 #endif
 
-static const char *get_req(const request_t *request, const char *key, bool case_insensitive) {
+static request_item_t *find_item(const request_t *request, const char *key, bool case_insensitive) {
   if (!request || !request->items || !key || request->count == 0)
     return NULL;
 
@@ -20,12 +21,17 @@ static const char *get_req(const request_t *request, const char *key, bool case_
     bool match = (cmp(request->items[i].key, key) == 0);
 
     if (match)
-      return request->items[i].value;
+      return &request->items[i];
   }
 
   return NULL;
 }
 
+static const char *get_req(const request_t *request, const char *key, bool case_insensitive) {
+  request_item_t *item = find_item(request, key, case_insensitive);
+  return item ? item->value : NULL;
+}
+
 const char *get_param(const Req *req, const char *key) {
   if (!req)
     return NULL;
@@ -33,18 +39,181 @@ const char *get_param(const Req *req, const char *key) {
   return get_req(&req->params, key, false);
 }
 
+// Open addressing over the query items or the header names,
+// built on the first lookup that needs it
+struct item_index_s {
+  uint16_t *slots; // Index + 1 of the first item with a key, 0 if empty
+  uint16_t *next; // Index + 1 of the next item with the same key
+  uint32_t mask;
+  bool folded; // Header names, compared without case
+};
+
+static uint32_t hash_key(const char *key, bool folded) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (const char *p = key; *p; p++) {
+    unsigned char c = (unsigned char)*p;
+    if (folded && c >= 'A' && c <= 'Z')
+      c |= 0x20;
+    hash ^= c;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static bool same_key(const char *a, const char *b, bool folded) {
+  return (folded ? strcasecmp(a, b) : strcmp(a, b)) == 0;
+}
+
+static item_index_t *item_index_build(Arena *arena, const request_t *items, bool folded) {
+  // At most half full, so a probe always ends on an empty slot
+  uint32_t size = 8;
+  while (size < (uint32_t)items->count * 2)
+    size <<= 1;
+
+  item_index_t *index = arena_alloc(arena, sizeof(item_index_t));
+  uint16_t *slots = arena_alloc(arena, size * sizeof(uint16_t));
+  uint16_t *next = arena_alloc(arena, items->count * sizeof(uint16_t));
+  if (!index || !slots || !next)
+    return NULL;
+
+  memset(slots, 0, size * sizeof(uint16_t));
+  memset(next, 0, items->count * sizeof(uint16_t));
+
+  for (uint16_t i = 0; i < items->count; i++) {
+    const char *key = items->items[i].key;
+    if (!key)
+      continue;
+
+    uint32_t slot = hash_key(key, folded) & (size - 1);
+
+    while (slots[slot] && !same_key(items->items[slots[slot] - 1].key, key, folded))
+      slot = (slot + 1) & (size - 1);
+
+    if (!slots[slot]) {
+      slots[slot] = i + 1;
+      continue;
+    }
+
+    // A repeated key goes after the ones before it
+    uint16_t last = slots[slot];
+    while (next[last - 1])
+      last = next[last - 1];
+    next[last - 1] = i + 1;
+  }
+
+  index->slots = slots;
+  index->next = next;
+  index->mask = size - 1;
+  index->folded = folded;
+  return index;
+}
+
+// Index + 1 of the first item with the key, 0 if there is none
+static uint16_t item_index_find(const item_index_t *index, const request_t *items, const char *key) {
+  uint32_t slot = hash_key(key, index->folded) & index->mask;
+
+  while (index->slots[slot]) {
+    if (same_key(items->items[index->slots[slot] - 1].key, key, index->folded))
+      return index->slots[slot];
+    slot = (slot + 1) & index->mask;
+  }
+
+  return 0;
+}
+
+// Index + 1 of the first item with the key, 0 if there is none
+static uint16_t query_lookup(const Req *req, const char *key) {
+  Req *mutable_req = (Req *)req;
+
+  if (mutable_req->query_string) {
+    char *query_string = mutable_req->query_string;
+    mutable_req->query_string = NULL;
+
+    if (http_parse_query(req->arena, query_string, req->query_len, &mutable_req->query) == 0
+        && req->query.count > 0)
+      mutable_req->query_index = item_index_build(req->arena, &req->query, false);
+  }
+
+  const request_t *query = &req->query;
+
+  // Without an index, only if it could not be allocated
+  if (!req->query_index) {
+    request_item_t *item = find_item(query, key, false);
+    return item ? (uint16_t)(item - query->items + 1) : 0;
+  }
+
+  return item_index_find(req->query_index, query, key);
+}
+
 const char *get_query(const Req *req, const char *key) {
-  if (!req)
+  if (!req || !key)
     return NULL;
 
-  return get_req(&req->query, key, false);
+  uint16_t first = query_lookup(req, key);
+  return first ? req->query.items[first - 1].value : NULL;
+}
+
+size_t get_query_all(const Req *req, const char *key, const char **values, size_t max) {
+  if (!req || !key)
+    return 0;
+
+  uint16_t item = query_lookup(req, key);
+  size_t count = 0;
+
+  while (item) {
+    if (values && count < max)
+      values[count] = req->query.items[item - 1].value;
+    count++;
+
+    // Without an index, a repeated key is only found once
+    if (!req->query_index)
+      break;
+
+    item = req->query_index->next[item - 1];
+  }
+
+  return count;
 }
 
 const char *get_header(const Req *req, const char *key) {
-  if (!req)
+  if (!req || !key)
+    return NULL;
+
+  header_id_t id = http_header_id(key, strlen(key));
+  if (id != HEADER_COUNT)
+    return get_header_id(req, id);
+
+  const request_t *headers = &req->headers;
+  if (headers->count == 0)
+    return NULL;
+
+  if (!req->header_index)
+    ((Req *)req)->header_index = item_index_build(req->arena, headers, true);
+
+  request_item_t *item;
+
+  // Without an index, only if it could not be allocated
+  if (!req->header_index) {
+    item = find_item(headers, key, true);
+  } else {
+    uint16_t first = item_index_find(req->header_index, headers, key);
+    item = first ? &headers->items[first - 1] : NULL;
+  }
+
+  if (!item)
+    return NULL;
+
+  // The value may still point into the read buffer
+  return http_header_keep(req->arena, (request_t *)headers, item);
+}
+
+const char *get_header_id(const Req *req, header_id_t id) {
+  if (!req || id >= HEADER_COUNT || req->headers.known[id] == 0)
     return NULL;
 
-  return get_req(&req->headers, key, true);
+  request_t *headers = (request_t *)&req->headers;
+  return http_header_keep(req->arena, headers, &headers->items[headers->known[id] - 1]);
 }
 
 void set_context(Req *req, const char *key, void *data) {
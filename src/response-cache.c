@@ -0,0 +1,962 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include "response-cache.h"
+#include "compression.h"
+#include "pipeline.h"
+#include "router.h"
+#include "arena.h"
+#include "utils.h"
+#include "logger.h"
+
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#define strncasecmp _strnicmp
+#else
+#include <strings.h>
+#endif
+
+extern char *serialize_headers(Res *res, int status, size_t content_length,
+                               size_t reserve, size_t *out_len);
+
+#define LITERAL_LEN(s) (sizeof(s) - 1)
+
+#define KEEP_ALIVE_TRAILER "Connection: keep-alive\r\n\r\n"
+#define CLOSE_TRAILER "Connection: close\r\n\r\n"
+#define NOT_MODIFIED_LINE "HTTP/1.1 304 Not Modified\r\n"
+
+// A response larger than this share of its shard is not cached
+#define MAX_ENTRY_SHARE 8
+
+#define INITIAL_BUCKETS 64
+
+typedef struct cache_entry_s cache_entry_t;
+
+// A serialized response, immutable once it is in the table.
+// Responses being written hold a reference, so an entry that
+// is evicted or replaced meanwhile is freed by the last write.
+struct cache_entry_s {
+  cache_entry_t *hash_next;
+  cache_entry_t *lru_prev;
+  cache_entry_t *lru_next;
+  atomic_uint refs;
+  uint32_t hash;
+  uint16_t shard;
+  bool refreshing; // A background refresh is running, under the shard lock
+  uint64_t expires; // ms, fresh until then
+  uint64_t stale_until; // ms, served while it is refreshed until then
+  size_t size;
+
+  // All of them point into data[]
+  const char *key; // URL with the query
+  size_t key_len;
+  const char *vary; // Request header names, '\0' separated
+  size_t vary_len;
+  const char *vary_values; // Their values in the stored request, '\0' separated
+  size_t vary_values_len;
+  const char *etag;
+  size_t etag_len;
+  const char *cache_control;
+  size_t cache_control_len;
+  const char *headers; // Status line to Content-Length, Connection is added per response
+  size_t headers_len;
+  size_t date_offset;
+  const char *body;
+  size_t body_len;
+
+  char data[];
+};
+
+typedef struct
+{
+  uv_mutex_t lock;
+  cache_entry_t **buckets;
+  uint32_t bucket_count;
+  uint32_t count;
+  size_t bytes;
+
+  // Most recently served first
+  cache_entry_t *lru_head;
+  cache_entry_t *lru_tail;
+} cache_shard_t;
+
+static struct {
+  bool enabled;
+  size_t shard_budget;
+  uint32_t default_ttl;
+  uint32_t stale_while_revalidate;
+  cache_shard_t shards[RESPONSE_CACHE_SHARDS];
+} cache = { 0 };
+
+typedef struct
+{
+  bool storable;
+  bool has_ttl;
+  bool has_shared_ttl; // s-maxage wins over max-age
+  uint32_t ttl;
+  bool has_swr;
+  uint32_t swr;
+} cache_policy_t;
+
+// Copy of a request that regenerates a stale entry
+typedef struct
+{
+  exchange_t *exchange;
+  http_context_t ctx;
+  llhttp_t parser;
+} cache_refresh_t;
+
+// Same clock on every loop thread
+static uint64_t cache_now_ms(void) {
+  return uv_hrtime() / 1000000;
+}
+
+static uint32_t hash_key(const char *key, size_t len) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static uint64_t hash_body(const void *body, size_t len) {
+  // FNV-1a, 64 bit
+  const unsigned char *p = body;
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+static cache_shard_t *shard_of(uint32_t hash) {
+  return &cache.shards[(hash >> 24) % RESPONSE_CACHE_SHARDS];
+}
+
+static void entry_unref(void *ptr) {
+  cache_entry_t *entry = (cache_entry_t *)ptr;
+
+  if (atomic_fetch_sub(&entry->refs, 1) == 1)
+    free(entry);
+}
+
+// Next comma separated element of a header value, trimmed
+static const char *next_token(const char **cursor, size_t *len) {
+  const char *p = *cursor;
+
+  while (*p == ' ' || *p == '\t' || *p == ',')
+    p++;
+
+  if (!*p)
+    return NULL;
+
+  const char *start = p;
+  while (*p && *p != ',')
+    p++;
+
+  const char *end = p;
+  while (end > start && (end[-1] == ' ' || end[-1] == '\t'))
+    end--;
+
+  *cursor = p;
+  *len = (size_t)(end - start);
+  return start;
+}
+
+static const char *find_header(const request_t *headers, const char *name, size_t name_len) {
+  header_id_t id = http_header_id(name, name_len);
+  if (id != HEADER_COUNT)
+    return http_header_find(headers, id);
+
+  for (uint16_t i = 0; i < headers->count; i++) {
+    const char *key = headers->items[i].key;
+
+    if (key && strncasecmp(key, name, name_len) == 0 && key[name_len] == '\0')
+      return headers->items[i].value;
+  }
+
+  return NULL;
+}
+
+// Accept-Encoding is compared by the encoding it selects, not verbatim
+static const char *vary_value(const request_t *headers, const char *name, size_t name_len) {
+  const char *value = find_header(headers, name, name_len);
+
+  if (compression_enabled() && name_len == 15 && strncasecmp(name, "Accept-Encoding", 15) == 0)
+    return compression_name(compression_negotiate(value));
+
+  return value;
+}
+
+// Heuristically cacheable status codes of RFC 9111
+static bool is_cacheable_status(int status) {
+  switch (status) {
+  case 200:
+  case 203:
+  case 204:
+  case 300:
+  case 301:
+  case 404:
+  case 405:
+  case 410:
+  case 414:
+  case 501:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool directive_is(const char *token, size_t len, const char *name) {
+  size_t name_len = strlen(name);
+  return len >= name_len && strncasecmp(token, name, name_len) == 0
+      && (len == name_len || token[name_len] == '=' || token[name_len] == ' ');
+}
+
+static bool directive_seconds(const char *token, size_t len, uint32_t *out) {
+  const char *eq = memchr(token, '=', len);
+  if (!eq)
+    return false;
+
+  const char *p = eq + 1;
+  const char *end = token + len;
+
+  while (p < end && (*p == ' ' || *p == '"'))
+    p++;
+
+  if (p >= end || *p < '0' || *p > '9')
+    return false;
+
+  uint64_t value = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    value = value * 10 + (uint64_t)(*p - '0');
+    if (value > UINT32_MAX)
+      value = UINT32_MAX;
+    p++;
+  }
+
+  *out = (uint32_t)value;
+  return true;
+}
+
+static void parse_cache_control(const char *value, cache_policy_t *policy) {
+  const char *cursor = value;
+  const char *token;
+  size_t len;
+  uint32_t seconds;
+
+  while ((token = next_token(&cursor, &len))) {
+    if (directive_is(token, len, "no-store") || directive_is(token, len, "private")
+        || directive_is(token, len, "no-cache")) {
+      policy->storable = false;
+    } else if (directive_is(token, len, "s-maxage")) {
+      if (directive_seconds(token, len, &seconds)) {
+        policy->ttl = seconds;
+        policy->has_ttl = true;
+        policy->has_shared_ttl = true;
+      }
+    } else if (directive_is(token, len, "max-age")) {
+      if (!policy->has_shared_ttl && directive_seconds(token, len, &seconds)) {
+        policy->ttl = seconds;
+        policy->has_ttl = true;
+      }
+    } else if (directive_is(token, len, "stale-while-revalidate")) {
+      if (directive_seconds(token, len, &seconds)) {
+        policy->swr = seconds;
+        policy->has_swr = true;
+      }
+    }
+  }
+}
+
+// The stored request had the same values for the Vary headers
+static bool vary_matches(const cache_entry_t *entry, const request_t *headers) {
+  const char *name = entry->vary;
+  const char *value = entry->vary_values;
+  const char *names_end = entry->vary + entry->vary_len;
+
+  while (name < names_end) {
+    size_t name_len = strlen(name);
+    size_t value_len = strlen(value);
+
+    const char *current = vary_value(headers, name, name_len);
+    if (!current)
+      current = "";
+
+    if (strlen(current) != value_len || memcmp(current, value, value_len) != 0)
+      return false;
+
+    name += name_len + 1;
+    value += value_len + 1;
+  }
+
+  return true;
+}
+
+static bool same_variant(const cache_entry_t *a, const cache_entry_t *b) {
+  return a->key_len == b->key_len && memcmp(a->key, b->key, a->key_len) == 0
+      && a->vary_len == b->vary_len && memcmp(a->vary, b->vary, a->vary_len) == 0
+      && a->vary_values_len == b->vary_values_len
+      && memcmp(a->vary_values, b->vary_values, a->vary_values_len) == 0;
+}
+
+static void lru_unlink(cache_shard_t *shard, cache_entry_t *entry) {
+  if (entry->lru_prev)
+    entry->lru_prev->lru_next = entry->lru_next;
+  else
+    shard->lru_head = entry->lru_next;
+
+  if (entry->lru_next)
+    entry->lru_next->lru_prev = entry->lru_prev;
+  else
+    shard->lru_tail = entry->lru_prev;
+
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+static void lru_push_head(cache_shard_t *shard, cache_entry_t *entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = shard->lru_head;
+
+  if (shard->lru_head)
+    shard->lru_head->lru_prev = entry;
+  else
+    shard->lru_tail = entry;
+
+  shard->lru_head = entry;
+}
+
+// Drops the reference of the table, the shard lock is held
+static void shard_remove(cache_shard_t *shard, cache_entry_t *entry) {
+  cache_entry_t **link = &shard->buckets[entry->hash & (shard->bucket_count - 1)];
+
+  while (*link && *link != entry)
+    link = &(*link)->hash_next;
+
+  if (*link)
+    *link = entry->hash_next;
+
+  lru_unlink(shard, entry);
+  shard->count--;
+  shard->bytes -= entry->size;
+
+  entry_unref(entry);
+}
+
+static int shard_grow(cache_shard_t *shard) {
+  uint32_t count = shard->bucket_count ? shard->bucket_count * 2 : INITIAL_BUCKETS;
+
+  cache_entry_t **buckets = calloc(count, sizeof(cache_entry_t *));
+  if (!buckets)
+    return -1;
+
+  for (uint32_t i = 0; i < shard->bucket_count; i++) {
+    cache_entry_t *entry = shard->buckets[i];
+
+    while (entry) {
+      cache_entry_t *next = entry->hash_next;
+      cache_entry_t **bucket = &buckets[entry->hash & (count - 1)];
+
+      entry->hash_next = *bucket;
+      *bucket = entry;
+      entry = next;
+    }
+  }
+
+  free(shard->buckets);
+  shard->buckets = buckets;
+  shard->bucket_count = count;
+
+  return 0;
+}
+
+static cache_entry_t *shard_find(cache_shard_t *shard, uint32_t hash,
+                                 const char *key, size_t key_len,
+                                 const request_t *headers) {
+  if (!shard->buckets)
+    return NULL;
+
+  cache_entry_t *entry = shard->buckets[hash & (shard->bucket_count - 1)];
+
+  for (; entry; entry = entry->hash_next) {
+    if (entry->hash == hash && entry->key_len == key_len
+        && memcmp(entry->key, key, key_len) == 0 && vary_matches(entry, headers))
+      return entry;
+  }
+
+  return NULL;
+}
+
+static void shard_insert(cache_shard_t *shard, cache_entry_t *entry) {
+  uv_mutex_lock(&shard->lock);
+
+  if (shard->count >= shard->bucket_count && shard_grow(shard) != 0 && !shard->buckets) {
+    uv_mutex_unlock(&shard->lock);
+    entry_unref(entry);
+    return;
+  }
+
+  // A refresh or a new variant replaces the same one
+  cache_entry_t **bucket = &shard->buckets[entry->hash & (shard->bucket_count - 1)];
+
+  for (cache_entry_t *old = *bucket; old; old = old->hash_next) {
+    if (old->hash == entry->hash && same_variant(old, entry)) {
+      shard_remove(shard, old);
+      break;
+    }
+  }
+
+  entry->hash_next = *bucket;
+  *bucket = entry;
+  lru_push_head(shard, entry);
+  shard->count++;
+  shard->bytes += entry->size;
+
+  // Coldest first
+  while (shard->bytes > cache.shard_budget && shard->lru_tail != entry)
+    shard_remove(shard, shard->lru_tail);
+
+  uv_mutex_unlock(&shard->lock);
+}
+
+static bool etag_matches(const char *if_none_match, const char *etag, size_t etag_len) {
+  // Weak comparison, W/ is ignored on both sides
+  if (etag_len > 2 && etag[0] == 'W' && etag[1] == '/') {
+    etag += 2;
+    etag_len -= 2;
+  }
+
+  const char *cursor = if_none_match;
+  const char *token;
+  size_t len;
+
+  while ((token = next_token(&cursor, &len))) {
+    if (len == 1 && token[0] == '*')
+      return true;
+
+    if (len > 2 && token[0] == 'W' && token[1] == '/') {
+      token += 2;
+      len -= 2;
+    }
+
+    if (len == etag_len && memcmp(token, etag, len) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+static char *append(char *p, const char *data, size_t len) {
+  memcpy(p, data, len);
+  return p + len;
+}
+
+// Queues the entry as the response of the exchange, which keeps a reference
+static bool cache_serve(exchange_t *exchange, cache_entry_t *entry,
+                        bool head, bool keep_alive, bool not_modified) {
+  const char *trailer = keep_alive ? KEEP_ALIVE_TRAILER : CLOSE_TRAILER;
+  size_t trailer_len = keep_alive ? LITERAL_LEN(KEEP_ALIVE_TRAILER) : LITERAL_LEN(CLOSE_TRAILER);
+
+  size_t len;
+  if (not_modified) {
+    len = LITERAL_LEN(NOT_MODIFIED_LINE) + DATE_LINE_LEN + 6 + entry->etag_len + 2 + trailer_len;
+    if (entry->cache_control)
+      len += 15 + entry->cache_control_len + 2;
+  } else {
+    len = entry->headers_len + trailer_len;
+  }
+
+  char *response = arena_alloc(exchange->arena, len);
+  if (!response)
+    return false;
+
+  char *p = response;
+
+  if (not_modified) {
+    p = append(p, NOT_MODIFIED_LINE, LITERAL_LEN(NOT_MODIFIED_LINE));
+    p = append(p, get_date_line(), DATE_LINE_LEN);
+    p = append(p, "ETag: ", 6);
+    p = append(p, entry->etag, entry->etag_len);
+    p = append(p, "\r\n", 2);
+
+    if (entry->cache_control) {
+      p = append(p, "Cache-Control: ", 15);
+      p = append(p, entry->cache_control, entry->cache_control_len);
+      p = append(p, "\r\n", 2);
+    }
+  } else {
+    p = append(p, entry->headers, entry->headers_len);
+    memcpy(response + entry->date_offset, get_date_line(), DATE_LINE_LEN);
+
+    if (!head && entry->body_len > 0)
+      exchange->body = uv_buf_init((char *)entry->body, (unsigned int)entry->body_len);
+  }
+
+  append(p, trailer, trailer_len);
+
+  exchange->owned_body = entry;
+  exchange->owned_free = entry_unref;
+
+  exchange_ready(exchange, response, len);
+  return true;
+}
+
+static bool copy_string(Arena *arena, char **out, const char *src, size_t len) {
+  if (!src) {
+    *out = NULL;
+    return true;
+  }
+
+  *out = arena_alloc(arena, len + 1);
+  if (!*out)
+    return false;
+
+  memcpy(*out, src, len);
+  (*out)[len] = '\0';
+  return true;
+}
+
+static bool copy_items(Arena *arena, request_t *dst, const request_t *src) {
+  memset(dst, 0, sizeof(request_t));
+
+  if (!src->items || src->count == 0)
+    return true;
+
+  dst->items = arena_alloc(arena, src->count * sizeof(request_item_t));
+  if (!dst->items)
+    return false;
+
+  for (uint16_t i = 0; i < src->count; i++) {
+    const char *key = src->items[i].key;
+    const char *value = src->items[i].value;
+    char *key_copy;
+    char *value_copy;
+
+    if (!copy_string(arena, &key_copy, key, key ? strlen(key) : 0)
+        || !copy_string(arena, &value_copy, value, value ? strlen(value) : 0))
+      return false;
+
+    dst->items[i].key = key_copy;
+    dst->items[i].value = value_copy;
+  }
+
+  dst->count = src->count;
+  dst->capacity = src->count;
+  memcpy(dst->known, src->known, sizeof(dst->known));
+  return true;
+}
+
+static void refresh_work(void *context) {
+  // Nothing to do off the loop, spawn() only defers the refresh
+  // after the stale response and keeps the loop alive until it ran
+  (void)context;
+}
+
+static void refresh_run(void *context) {
+  cache_refresh_t *refresh = (cache_refresh_t *)context;
+  router_run(refresh->exchange, &refresh->ctx, NULL);
+}
+
+// Runs the route again for a copy of the request, without a connection.
+// Its reply replaces the stale entry, see response_cache_store().
+static void start_refresh(const http_context_t *ctx, cache_entry_t *entry) {
+  Arena *arena = arena_borrow();
+  if (!arena) {
+    response_cache_refresh_done(entry);
+    return;
+  }
+
+  cache_refresh_t *refresh = arena_alloc(arena, sizeof(cache_refresh_t));
+  exchange_t *exchange = arena_alloc(arena, sizeof(exchange_t));
+
+  if (!refresh || !exchange) {
+    arena_return(arena);
+    response_cache_refresh_done(entry);
+    return;
+  }
+
+  memset(refresh, 0, sizeof(cache_refresh_t));
+  memset(exchange, 0, sizeof(exchange_t));
+
+  exchange->arena = arena;
+  exchange->borrowed = true;
+  exchange->state = EXCHANGE_HANDLING;
+  exchange->keep_alive = true;
+  exchange->cache_refresh = entry;
+
+  refresh->exchange = exchange;
+  refresh->parser = *ctx->parser;
+
+  http_context_t *copy = &refresh->ctx;
+  copy->arena = arena;
+  copy->parser = &refresh->parser;
+  copy->url_length = ctx->url_length;
+  copy->path_length = ctx->path_length;
+  copy->method_length = ctx->method_length;
+  copy->http_major = ctx->http_major;
+  copy->http_minor = ctx->http_minor;
+  copy->keep_alive = true;
+  copy->message_complete = true;
+  copy->headers_complete = true;
+
+  if (!copy_string(arena, &copy->url, ctx->url, ctx->url_length)
+      || !copy_string(arena, &copy->method, ctx->method, ctx->method_length)
+      || !copy_items(arena, &copy->headers, &ctx->headers)) {
+    exchange_release(exchange);
+    return;
+  }
+
+  exchange->cache_key = copy->url;
+  exchange->cache_key_len = copy->url_length;
+
+  if (spawn(refresh, refresh_work, refresh_run) != 0)
+    exchange_release(exchange);
+}
+
+bool response_cache_dispatch(client_t *client, exchange_t *exchange) {
+  if (!cache.enabled)
+    return false;
+
+  http_context_t *ctx = &client->persistent_context;
+
+  uint8_t method = llhttp_get_method(ctx->parser);
+  if (method != HTTP_GET && method != HTTP_HEAD)
+    return false;
+
+  if (!ctx->url || ctx->url_length == 0)
+    return false;
+
+  // Responses for one user are never shared. Hits skip the middleware
+  // that could check a session, so a cookie is treated like credentials.
+  if (http_header_find(&ctx->headers, HEADER_AUTHORIZATION)
+      || http_header_find(&ctx->headers, HEADER_COOKIE))
+    return false;
+
+  const char *key = ctx->url;
+  size_t key_len = ctx->url_length;
+
+  uint32_t hash = hash_key(key, key_len);
+  cache_shard_t *shard = shard_of(hash);
+  uint64_t now = cache_now_ms();
+  bool refresh = false;
+
+  uv_mutex_lock(&shard->lock);
+
+  cache_entry_t *entry = shard_find(shard, hash, key, key_len, &ctx->headers);
+
+  if (entry && now >= entry->stale_until) {
+    shard_remove(shard, entry);
+    entry = NULL;
+  }
+
+  if (entry) {
+    atomic_fetch_add(&entry->refs, 1);
+
+    lru_unlink(shard, entry);
+    lru_push_head(shard, entry);
+
+    // Stale, the first request to see it starts the refresh
+    if (now >= entry->expires && !entry->refreshing) {
+      entry->refreshing = true;
+      atomic_fetch_add(&entry->refs, 1);
+      refresh = true;
+    }
+  }
+
+  uv_mutex_unlock(&shard->lock);
+
+  if (!entry) {
+    // HEAD responses have no body to store
+    if (method == HTTP_GET) {
+      exchange->cache_key = key;
+      exchange->cache_key_len = key_len;
+    }
+    return false;
+  }
+
+  const char *if_none_match = http_header_find(&ctx->headers, HEADER_IF_NONE_MATCH);
+  bool not_modified = if_none_match && entry->etag
+      && etag_matches(if_none_match, entry->etag, entry->etag_len);
+
+  bool served = cache_serve(exchange, entry, method == HTTP_HEAD,
+                            ctx->keep_alive, not_modified);
+
+  if (!served)
+    entry_unref(entry);
+
+  if (refresh)
+    start_refresh(ctx, entry);
+
+  return served;
+}
+
+void response_cache_store(exchange_t *exchange, Res *res, int status,
+                          const void *body, size_t body_len) {
+  const char *key = exchange->cache_key;
+  size_t key_len = exchange->cache_key_len;
+
+  // Stored once, whatever happens
+  exchange->cache_key = NULL;
+
+  if (!cache.enabled || !key || !exchange->req || !is_cacheable_status(status))
+    return;
+
+  if (!body)
+    body_len = 0;
+
+  const char *cache_control = NULL;
+  const char *vary = NULL;
+  const char *etag = NULL;
+
+  for (uint16_t i = 0; i < res->header_count; i++) {
+    const http_header_t *header = &res->headers[i];
+    if (!header->name || !header->value)
+      continue;
+
+    if (strcasecmp(header->name, "Set-Cookie") == 0)
+      return;
+
+    if (strcasecmp(header->name, "Cache-Control") == 0)
+      cache_control = header->value;
+    else if (strcasecmp(header->name, "Vary") == 0)
+      vary = header->value;
+    else if (strcasecmp(header->name, "ETag") == 0)
+      etag = header->value;
+  }
+
+  cache_policy_t policy = { .storable = true };
+  if (cache_control)
+    parse_cache_control(cache_control, &policy);
+
+  uint32_t ttl = policy.has_ttl ? policy.ttl : cache.default_ttl;
+  uint32_t swr = policy.has_swr ? policy.swr : cache.stale_while_revalidate;
+
+  if (!policy.storable || ttl == 0 || (vary && strchr(vary, '*')))
+    return;
+
+  // Sent with this response too, so clients can revalidate
+  if (!etag) {
+    char generated[24];
+    snprintf(generated, sizeof(generated), "W/\"%016" PRIx64 "\"", hash_body(body, body_len));
+
+    uint16_t count = res->header_count;
+    set_header(res, "ETag", generated);
+
+    if (res->header_count > count)
+      etag = res->headers[count].value;
+  }
+
+  size_t headers_len = 0;
+  char *headers = serialize_headers(res, status, body_len, 0, &headers_len);
+  if (!headers)
+    return;
+
+  // Without "Connection: ...\r\n\r\n", each response adds its own
+  size_t end = headers_len - 3;
+  while (end > 0 && headers[end - 1] != '\n')
+    end--;
+  headers_len = end;
+
+  size_t date_offset = (size_t)((const char *)memchr(headers, '\n', headers_len) - headers) + 1;
+
+  // Vary names and the values this request had for them
+  size_t vary_len = 0;
+  size_t vary_values_len = 0;
+
+  if (vary) {
+    const char *cursor = vary;
+    const char *name;
+    size_t name_len;
+
+    while ((name = next_token(&cursor, &name_len))) {
+      const char *value = vary_value(&exchange->req->headers, name, name_len);
+      vary_len += name_len + 1;
+      vary_values_len += (value ? strlen(value) : 0) + 1;
+    }
+  }
+
+  size_t key_size = key_len + 1;
+  size_t etag_len = etag ? strlen(etag) : 0;
+  size_t cache_control_len = cache_control ? strlen(cache_control) : 0;
+
+  size_t size = sizeof(cache_entry_t) + key_size + vary_len + vary_values_len
+      + etag_len + 1 + cache_control_len + 1 + headers_len + body_len;
+
+  if (size > cache.shard_budget / MAX_ENTRY_SHARE)
+    return;
+
+  cache_entry_t *entry = malloc(size);
+  if (!entry)
+    return;
+
+  memset(entry, 0, sizeof(cache_entry_t));
+  atomic_init(&entry->refs, 1);
+
+  char *p = entry->data;
+
+  entry->key = p;
+  entry->key_len = key_len;
+  memcpy(p, key, key_len);
+  p[key_len] = '\0';
+  p += key_size;
+
+  entry->vary = p;
+  entry->vary_len = vary_len;
+  entry->vary_values = p + vary_len;
+  entry->vary_values_len = vary_values_len;
+
+  if (vary) {
+    char *names = p;
+    char *values = p + vary_len;
+    const char *cursor = vary;
+    const char *name;
+    size_t name_len;
+
+    while ((name = next_token(&cursor, &name_len))) {
+      const char *value = vary_value(&exchange->req->headers, name, name_len);
+      size_t value_len = value ? strlen(value) : 0;
+
+      memcpy(names, name, name_len);
+      names[name_len] = '\0';
+      names += name_len + 1;
+
+      if (value_len > 0)
+        memcpy(values, value, value_len);
+      values[value_len] = '\0';
+      values += value_len + 1;
+    }
+  }
+  p += vary_len + vary_values_len;
+
+  if (etag) {
+    entry->etag = p;
+    entry->etag_len = etag_len;
+    memcpy(p, etag, etag_len);
+  }
+  p[etag_len] = '\0';
+  p += etag_len + 1;
+
+  if (cache_control) {
+    entry->cache_control = p;
+    entry->cache_control_len = cache_control_len;
+    memcpy(p, cache_control, cache_control_len);
+  }
+  p[cache_control_len] = '\0';
+  p += cache_control_len + 1;
+
+  entry->headers = p;
+  entry->headers_len = headers_len;
+  entry->date_offset = date_offset;
+  memcpy(p, headers, headers_len);
+  p += headers_len;
+
+  entry->body = p;
+  entry->body_len = body_len;
+  if (body_len > 0)
+    memcpy(p, body, body_len);
+
+  uint64_t now = cache_now_ms();
+  entry->expires = now + (uint64_t)ttl * 1000;
+  entry->stale_until = entry->expires + (uint64_t)swr * 1000;
+  entry->size = size;
+  entry->hash = hash_key(key, key_len);
+
+  cache_shard_t *shard = shard_of(entry->hash);
+  entry->shard = (uint16_t)(shard - cache.shards);
+
+  shard_insert(shard, entry);
+}
+
+void response_cache_refresh_done(void *ptr) {
+  cache_entry_t *entry = (cache_entry_t *)ptr;
+  cache_shard_t *shard = &cache.shards[entry->shard];
+
+  // A stale hit may start another one from now on
+  uv_mutex_lock(&shard->lock);
+  entry->refreshing = false;
+  uv_mutex_unlock(&shard->lock);
+
+  entry_unref(entry);
+}
+
+int response_cache_enable(const CacheConfig *config) {
+  if (!config || config->max_bytes == 0) {
+    LOG_ERROR("Invalid response cache configuration");
+    return -1;
+  }
+
+  // Loops may be running, only the limits change
+  if (cache.enabled) {
+    cache.shard_budget = config->max_bytes / RESPONSE_CACHE_SHARDS;
+    cache.default_ttl = config->default_ttl;
+    cache.stale_while_revalidate = config->stale_while_revalidate;
+    return 0;
+  }
+
+  for (int i = 0; i < RESPONSE_CACHE_SHARDS; i++) {
+    memset(&cache.shards[i], 0, sizeof(cache_shard_t));
+
+    if (uv_mutex_init(&cache.shards[i].lock) != 0) {
+      while (--i >= 0)
+        uv_mutex_destroy(&cache.shards[i].lock);
+      return -1;
+    }
+  }
+
+  cache.shard_budget = config->max_bytes / RESPONSE_CACHE_SHARDS;
+  cache.default_ttl = config->default_ttl;
+  cache.stale_while_revalidate = config->stale_while_revalidate;
+  cache.enabled = true;
+
+  return 0;
+}
+
+void response_cache_purge(const char *url) {
+  if (!cache.enabled || !url)
+    return;
+
+  size_t len = strlen(url);
+  uint32_t hash = hash_key(url, len);
+  cache_shard_t *shard = shard_of(hash);
+
+  uv_mutex_lock(&shard->lock);
+
+  if (shard->buckets) {
+    cache_entry_t *entry = shard->buckets[hash & (shard->bucket_count - 1)];
+
+    // Every variant of the URL
+    while (entry) {
+      cache_entry_t *next = entry->hash_next;
+
+      if (entry->hash == hash && entry->key_len == len && memcmp(entry->key, url, len) == 0)
+        shard_remove(shard, entry);
+
+      entry = next;
+    }
+  }
+
+  uv_mutex_unlock(&shard->lock);
+}
+
+void response_cache_destroy(void) {
+  if (!cache.enabled)
+    return;
+
+  for (int i = 0; i < RESPONSE_CACHE_SHARDS; i++) {
+    cache_shard_t *shard = &cache.shards[i];
+
+    while (shard->lru_head)
+      shard_remove(shard, shard->lru_head);
+
+    free(shard->buckets);
+    uv_mutex_destroy(&shard->lock);
+    memset(shard, 0, sizeof(cache_shard_t));
+  }
+
+  cache.enabled = false;
+}
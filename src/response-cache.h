@@ -0,0 +1,25 @@
+#ifndef ECEWO_RESPONSE_CACHE_H
+#define ECEWO_RESPONSE_CACHE_H
+
+#include "server.h"
+
+// Each shard has its own lock, LRU list and part of the budget
+#ifndef RESPONSE_CACHE_SHARDS
+#define RESPONSE_CACHE_SHARDS 16
+#endif
+
+// Answers a GET or HEAD request from the cache. On a miss the
+// exchange is marked so its response is stored when it replies.
+bool response_cache_dispatch(client_t *client, exchange_t *exchange);
+
+// Stores the response of a marked exchange before it is queued,
+// may add an ETag header to res
+void response_cache_store(exchange_t *exchange, Res *res, int status,
+                          const void *body, size_t body_len);
+
+// Releases the stale entry of a background refresh exchange
+void response_cache_refresh_done(void *entry);
+
+void response_cache_destroy(void);
+
+#endif
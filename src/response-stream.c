@@ -0,0 +1,375 @@
+#include <stdlib.h>
+#include "response-stream.h"
+#include "pipeline.h"
+#include "arena.h"
+#include "logger.h"
+
+extern void send_error(exchange_t *exchange, int error_code);
+extern char *serialize_headers(Res *res, int status, size_t content_length,
+                               size_t reserve, size_t *out_len);
+
+#define LITERAL_LEN(s) (sizeof(s) - 1)
+
+#define LAST_CHUNK "0\r\n\r\n"
+
+// Hex length and CRLF before the data, CRLF after it
+#define CHUNK_FRAME_MAX (16 + 2 + 2)
+
+typedef struct stream_chunk_s stream_chunk_t;
+
+// Written from the heap, so the arena of the exchange
+// does not grow with the length of the body
+struct stream_chunk_s {
+  uv_write_t req;
+  stream_chunk_t *next;
+  exchange_stream_t *stream;
+  size_t len;
+  char data[];
+};
+
+struct exchange_stream_s {
+  exchange_t *exchange;
+  Res *res;
+
+  // Chunks written before the headers, sent when the stream starts
+  stream_chunk_t *pending_head;
+  stream_chunk_t *pending_tail;
+  size_t pending_bytes;
+
+  uint32_t writes; // Chunks passed to uv_write
+  res_drain_t drain_cb;
+  void *drain_data;
+  bool chunked; // Otherwise the body ends when the connection closes
+  bool bodiless; // HEAD request, 1xx, 204 or 304, no body is sent
+  bool started; // The headers are written
+  bool ended; // res_end() was called
+  bool drain_wanted; // res_write() asked the handler to wait
+};
+
+static exchange_stream_t *stream_of(Res *res) {
+  exchange_t *exchange = res ? (exchange_t *)res->exchange : NULL;
+  return exchange ? exchange->stream : NULL;
+}
+
+// Bytes the client has not taken yet
+static size_t stream_queued(const exchange_stream_t *stream) {
+  client_t *client = stream->exchange->client;
+  size_t queued = stream->pending_bytes;
+
+  if (client && stream->started)
+    queued += uv_stream_get_write_queue_size((const uv_stream_t *)&client->handle);
+
+  return queued;
+}
+
+static char *put_hex(char *p, size_t value) {
+  char digits[16];
+  int count = 0;
+
+  do {
+    digits[count++] = "0123456789abcdef"[value & 0xf];
+    value >>= 4;
+  } while (value > 0);
+
+  while (count > 0)
+    *p++ = digits[--count];
+
+  return p;
+}
+
+static stream_chunk_t *chunk_create(exchange_stream_t *stream, const void *buf, size_t len, bool framed) {
+  stream_chunk_t *chunk = malloc(sizeof(stream_chunk_t) + len + (framed ? CHUNK_FRAME_MAX : 0));
+  if (!chunk)
+    return NULL;
+
+  char *p = chunk->data;
+
+  if (framed) {
+    p = put_hex(p, len);
+    *p++ = '\r';
+    *p++ = '\n';
+  }
+
+  memcpy(p, buf, len);
+  p += len;
+
+  if (framed) {
+    *p++ = '\r';
+    *p++ = '\n';
+  }
+
+  chunk->next = NULL;
+  chunk->stream = stream;
+  chunk->len = (size_t)(p - chunk->data);
+  return chunk;
+}
+
+static void stream_finish(exchange_stream_t *stream) {
+  // Pops and releases the exchange, the next responses follow
+  pipeline_body_done(stream->exchange->client, true);
+}
+
+static void stream_drain(exchange_stream_t *stream) {
+  if (!stream->drain_wanted || stream_queued(stream) > STREAM_LOW_WATERMARK)
+    return;
+
+  stream->drain_wanted = false;
+
+  // May write, or end and release the stream
+  if (stream->drain_cb)
+    stream->drain_cb(stream->res, stream->drain_data);
+}
+
+static void on_chunk_written(uv_write_t *req, int status) {
+  stream_chunk_t *chunk = (stream_chunk_t *)req->data;
+  exchange_stream_t *stream = chunk->stream;
+  client_t *client = stream->exchange->client;
+
+  free(chunk);
+  stream->writes--;
+
+  if (!client || client->closing)
+    return;
+
+  client_write_finished(client);
+
+  if (status < 0) {
+    LOG_DEBUG("Stream write error: %s", uv_strerror(status));
+    close_client(client);
+    return;
+  }
+
+  if (stream->ended) {
+    if (stream->writes == 0)
+      stream_finish(stream);
+    return;
+  }
+
+  stream_drain(stream);
+}
+
+static void chunk_write(exchange_stream_t *stream, stream_chunk_t *chunk) {
+  client_t *client = stream->exchange->client;
+  uv_buf_t buf = uv_buf_init(chunk->data, (unsigned int)chunk->len);
+
+  chunk->req.data = chunk;
+
+  int result = uv_write(&chunk->req, (uv_stream_t *)&client->handle, &buf, 1, on_chunk_written);
+  if (result < 0) {
+    LOG_DEBUG("Stream write error: %s", uv_strerror(result));
+    free(chunk);
+    close_client(client);
+    return;
+  }
+
+  stream->writes++;
+  client_write_started(client);
+}
+
+static void chunk_queue(exchange_stream_t *stream, stream_chunk_t *chunk) {
+  if (stream->started) {
+    chunk_write(stream, chunk);
+    return;
+  }
+
+  if (stream->pending_tail)
+    stream->pending_tail->next = chunk;
+  else
+    stream->pending_head = chunk;
+
+  stream->pending_tail = chunk;
+  stream->pending_bytes += chunk->len;
+}
+
+void response_stream_start(exchange_t *exchange) {
+  exchange_stream_t *stream = exchange->stream;
+  client_t *client = exchange->client;
+
+  stream->started = true;
+
+  // The response is under way, only the write deadline applies
+  timer_wheel_cancel(&client->owner->wheel, &client->read_timeout);
+
+  while (stream->pending_head && !client->closing) {
+    stream_chunk_t *chunk = stream->pending_head;
+
+    stream->pending_head = chunk->next;
+    if (!stream->pending_head)
+      stream->pending_tail = NULL;
+
+    stream->pending_bytes -= chunk->len;
+    chunk_write(stream, chunk);
+  }
+
+  if (client->closing)
+    return;
+
+  if (stream->ended) {
+    if (stream->writes == 0)
+      stream_finish(stream);
+    return;
+  }
+
+  stream_drain(stream);
+}
+
+bool response_stream_open(const exchange_stream_t *stream) {
+  return stream && !stream->ended;
+}
+
+void response_stream_detach(exchange_stream_t *stream) {
+  if (!stream->drain_wanted)
+    return;
+
+  stream->drain_wanted = false;
+
+  if (stream->drain_cb)
+    stream->drain_cb(stream->res, stream->drain_data);
+}
+
+void response_stream_close(exchange_stream_t *stream) {
+  stream_chunk_t *chunk = stream->pending_head;
+
+  while (chunk) {
+    stream_chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  stream->pending_head = NULL;
+  stream->pending_tail = NULL;
+  stream->pending_bytes = 0;
+}
+
+int res_begin(Res *res, int status) {
+  exchange_t *exchange = res ? (exchange_t *)res->exchange : NULL;
+
+  if (!exchange || res->replied || exchange->state >= EXCHANGE_READY)
+    return -1;
+
+  res->replied = true;
+
+  // The length is not known in advance, neither cached nor compressed
+  exchange->cache_key = NULL;
+
+  exchange_stream_t *stream = arena_alloc(res->arena, sizeof(exchange_stream_t));
+  if (!stream) {
+    send_error(exchange, 500);
+    return -1;
+  }
+
+  memset(stream, 0, sizeof(exchange_stream_t));
+  stream->exchange = exchange;
+  stream->res = res;
+  stream->bodiless = res->is_head_request || status < 200 || status == 204 || status == 304;
+
+  // The connection closed while the handler was running,
+  // the stream is released by res_end()
+  if (!exchange->client) {
+    exchange->stream = stream;
+    return -1;
+  }
+
+  // HTTP/1.0 clients do not know chunked encoding
+  const Req *req = exchange->req;
+  stream->chunked = !req || req->http_major > 1 || (req->http_major == 1 && req->http_minor >= 1);
+
+  if (!stream->chunked && !stream->bodiless)
+    res->keep_alive = false;
+
+  exchange->keep_alive = res->keep_alive;
+
+  // Without a body, neither a length nor chunked encoding is announced
+  size_t content_length = CONTENT_LENGTH_NONE;
+  if (!stream->bodiless)
+    content_length = stream->chunked ? CONTENT_LENGTH_CHUNKED : CONTENT_LENGTH_UNTIL_CLOSE;
+  size_t headers_len = 0;
+
+  char *headers = serialize_headers(res, status, content_length, 0, &headers_len);
+  if (!headers) {
+    send_error(exchange, 500);
+    return -1;
+  }
+
+  exchange->stream = stream;
+  exchange_ready(exchange, headers, headers_len);
+  return 0;
+}
+
+int res_write(Res *res, const void *buf, size_t len) {
+  exchange_stream_t *stream = stream_of(res);
+  if (!stream || stream->ended)
+    return -1;
+
+  client_t *client = stream->exchange->client;
+  if (!client || client->closing || stream->bodiless)
+    return -1;
+
+  // An empty chunk would end the body
+  if (len == 0)
+    return 0;
+
+  if (!buf)
+    return -1;
+
+  stream_chunk_t *chunk = chunk_create(stream, buf, len, stream->chunked);
+  if (!chunk)
+    return -1;
+
+  chunk_queue(stream, chunk);
+
+  if (client->closing)
+    return -1;
+
+  if (stream_queued(stream) < STREAM_HIGH_WATERMARK)
+    return 0;
+
+  stream->drain_wanted = true;
+  return 1;
+}
+
+void res_on_drain(Res *res, res_drain_t drain_cb, void *data) {
+  exchange_stream_t *stream = stream_of(res);
+  if (!stream)
+    return;
+
+  stream->drain_cb = drain_cb;
+  stream->drain_data = data;
+}
+
+int res_end(Res *res) {
+  exchange_stream_t *stream = stream_of(res);
+  if (!stream || stream->ended)
+    return -1;
+
+  stream->ended = true;
+  stream->drain_wanted = false;
+
+  exchange_t *exchange = stream->exchange;
+  client_t *client = exchange->client;
+
+  // Detached from a closed connection, nothing else refers to it
+  if (!client) {
+    exchange_release(exchange);
+    return 0;
+  }
+
+  // Released with the connection
+  if (client->closing)
+    return 0;
+
+  if (stream->chunked && !stream->bodiless) {
+    stream_chunk_t *chunk = chunk_create(stream, LAST_CHUNK, LITERAL_LEN(LAST_CHUNK), false);
+    if (!chunk) {
+      close_client(client);
+      return -1;
+    }
+
+    chunk_queue(stream, chunk);
+  }
+
+  if (stream->started && stream->writes == 0 && !client->closing)
+    stream_finish(stream);
+
+  return 0;
+}
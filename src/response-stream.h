@@ -0,0 +1,37 @@
+#ifndef ECEWO_RESPONSE_STREAM_H
+#define ECEWO_RESPONSE_STREAM_H
+
+#include "server.h"
+
+// res_write() asks the handler to wait for the drain callback
+// once this many bytes are queued and not written to the socket
+#ifndef STREAM_HIGH_WATERMARK
+#define STREAM_HIGH_WATERMARK 65536
+#endif
+
+// The drain callback runs when the queue goes down to this
+#ifndef STREAM_LOW_WATERMARK
+#define STREAM_LOW_WATERMARK 16384
+#endif
+
+// Content-Length values of serialize_headers() for a body of unknown length:
+// Transfer-Encoding: chunked, or no length at all for HTTP/1.0 clients.
+// CONTENT_LENGTH_NONE is for responses that never have a body.
+#define CONTENT_LENGTH_CHUNKED SIZE_MAX
+#define CONTENT_LENGTH_UNTIL_CLOSE (SIZE_MAX - 1)
+#define CONTENT_LENGTH_NONE (SIZE_MAX - 2)
+
+// Writes the chunks of a streamed response once its headers are written
+void response_stream_start(exchange_t *exchange);
+
+// The handler has not called res_end() yet
+bool response_stream_open(const exchange_stream_t *stream);
+
+// The connection closed, a handler waiting for the drain
+// callback gets it so that res_write() fails and it ends the stream
+void response_stream_detach(exchange_stream_t *stream);
+
+// Frees the chunks of a stream that were never written
+void response_stream_close(exchange_stream_t *stream);
+
+#endif
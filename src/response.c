@@ -3,6 +3,10 @@
 #include "utils.h"
 #include "logger.h"
 #include "server.h"
+#include "pipeline.h"
+#include "response-cache.h"
+#include "compression.h"
+#include "response-stream.h"
 #include <stdlib.h>
 #include <ctype.h>
 
@@ -14,305 +18,396 @@
 #endif
 #endif
 
-typedef struct
-{
-  uv_write_t req;
-  uv_buf_t buf;
-  char *data;
-  Arena *arena;
-  client_t *client;
-} write_req_t;
-
-static void end_request(client_t *client) {
-  client->request_in_progress = false;
-
-  if (client->request_timeout_timer) {
-    uv_timer_stop(client->request_timeout_timer);
-    uv_close((uv_handle_t *)client->request_timeout_timer, (uv_close_cb)free);
-    client->request_timeout_timer = NULL;
+typedef struct {
+  const char *line;
+  uint8_t len;
+} status_line_t;
+
+#define STATUS_LINE(code, text) \
+  [code - 100] = { "HTTP/1.1 " #code " " text "\r\n", sizeof("HTTP/1.1 " #code " " text "\r\n") - 1 }
+
+// Complete status lines of every http_status_t, indexed by status - 100
+static const status_line_t status_lines[] = {
+  STATUS_LINE(100, "Continue"),
+  STATUS_LINE(101, "Switching Protocols"),
+  STATUS_LINE(102, "Processing"),
+  STATUS_LINE(103, "Early Hints"),
+  STATUS_LINE(200, "OK"),
+  STATUS_LINE(201, "Created"),
+  STATUS_LINE(202, "Accepted"),
+  STATUS_LINE(203, "Non-Authoritative Information"),
+  STATUS_LINE(204, "No Content"),
+  STATUS_LINE(205, "Reset Content"),
+  STATUS_LINE(206, "Partial Content"),
+  STATUS_LINE(207, "Multi-Status"),
+  STATUS_LINE(208, "Already Reported"),
+  STATUS_LINE(226, "IM Used"),
+  STATUS_LINE(300, "Multiple Choices"),
+  STATUS_LINE(301, "Moved Permanently"),
+  STATUS_LINE(302, "Found"),
+  STATUS_LINE(303, "See Other"),
+  STATUS_LINE(304, "Not Modified"),
+  STATUS_LINE(305, "Use Proxy"),
+  STATUS_LINE(307, "Temporary Redirect"),
+  STATUS_LINE(308, "Permanent Redirect"),
+  STATUS_LINE(400, "Bad Request"),
+  STATUS_LINE(401, "Unauthorized"),
+  STATUS_LINE(402, "Payment Required"),
+  STATUS_LINE(403, "Forbidden"),
+  STATUS_LINE(404, "Not Found"),
+  STATUS_LINE(405, "Method Not Allowed"),
+  STATUS_LINE(406, "Not Acceptable"),
+  STATUS_LINE(407, "Proxy Authentication Required"),
+  STATUS_LINE(408, "Request Timeout"),
+  STATUS_LINE(409, "Conflict"),
+  STATUS_LINE(410, "Gone"),
+  STATUS_LINE(411, "Length Required"),
+  STATUS_LINE(412, "Precondition Failed"),
+  STATUS_LINE(413, "Payload Too Large"),
+  STATUS_LINE(414, "URI Too Long"),
+  STATUS_LINE(415, "Unsupported Media Type"),
+  STATUS_LINE(416, "Range Not Satisfiable"),
+  STATUS_LINE(417, "Expectation Failed"),
+  STATUS_LINE(418, "I'm a teapot"),
+  STATUS_LINE(421, "Misdirected Request"),
+  STATUS_LINE(422, "Unprocessable Entity"),
+  STATUS_LINE(423, "Locked"),
+  STATUS_LINE(424, "Failed Dependency"),
+  STATUS_LINE(425, "Too Early"),
+  STATUS_LINE(426, "Upgrade Required"),
+  STATUS_LINE(428, "Precondition Required"),
+  STATUS_LINE(429, "Too Many Requests"),
+  STATUS_LINE(431, "Request Header Fields Too Large"),
+  STATUS_LINE(451, "Unavailable For Legal Reasons"),
+  STATUS_LINE(500, "Internal Server Error"),
+  STATUS_LINE(501, "Not Implemented"),
+  STATUS_LINE(502, "Bad Gateway"),
+  STATUS_LINE(503, "Service Unavailable"),
+  STATUS_LINE(504, "Gateway Timeout"),
+  STATUS_LINE(505, "HTTP Version Not Supported"),
+  STATUS_LINE(506, "Variant Also Negotiates"),
+  STATUS_LINE(507, "Insufficient Storage"),
+  STATUS_LINE(508, "Loop Detected"),
+  STATUS_LINE(510, "Not Extended"),
+  STATUS_LINE(511, "Network Authentication Required"),
+};
+
+#define STATUS_LINE_COUNT (sizeof(status_lines) / sizeof(status_lines[0]))
+
+// "HTTP/1.1 " + three digits + " \r\n" for codes without a table entry
+#define CUSTOM_STATUS_LINE_LEN 15
+
+#define CONTENT_LENGTH_PREFIX "Content-Length: "
+#define KEEP_ALIVE_TRAILER "Connection: keep-alive\r\n\r\n"
+#define CLOSE_TRAILER "Connection: close\r\n\r\n"
+
+#define LITERAL_LEN(s) (sizeof(s) - 1)
+
+// Longest decimal uint64_t
+#define MAX_DIGITS 20
+
+static const char digit_pairs[201] = "00010203040506070809"
+                                     "10111213141516171819"
+                                     "20212223242526272829"
+                                     "30313233343536373839"
+                                     "40414243444546474849"
+                                     "50515253545556575859"
+                                     "60616263646566676869"
+                                     "70717273747576777879"
+                                     "80818283848586878889"
+                                     "90919293949596979899";
+
+// Writes v right-aligned at the end of buf, two digits per division.
+// Returns the first digit.
+static char *format_u64(char *end, uint64_t v) {
+  char *p = end;
+
+  while (v >= 100) {
+    unsigned i = (unsigned)(v % 100) * 2;
+    v /= 100;
+    *--p = digit_pairs[i + 1];
+    *--p = digit_pairs[i];
   }
+
+  if (v >= 10) {
+    unsigned i = (unsigned)v * 2;
+    *--p = digit_pairs[i + 1];
+    *--p = digit_pairs[i];
+  } else {
+    *--p = (char)('0' + v);
+  }
+
+  return p;
 }
 
-static void write_completion_cb(uv_write_t *req, int status) {
-  if (status < 0)
-    LOG_ERROR("Write error: %s", uv_strerror(status));
+static const status_line_t *find_status_line(int status) {
+  if (status < 100 || status - 100 >= (int)STATUS_LINE_COUNT)
+    return NULL;
 
-  write_req_t *write_req = (write_req_t *)req;
-  if (!write_req)
-    return;
+  const status_line_t *entry = &status_lines[status - 100];
+  return entry->line ? entry : NULL;
+}
 
-  if (write_req->client)
-    end_request(write_req->client);
+static size_t status_line_len(int status) {
+  const status_line_t *entry = find_status_line(status);
+  return entry ? entry->len : CUSTOM_STATUS_LINE_LEN;
+}
 
-  if (write_req->arena) {
-    arena_reset(write_req->arena);
-  } else {
-    // Malloc fallback
-    if (write_req->data) {
-      free(write_req->data);
-      write_req->data = NULL;
-    }
-    memset(write_req, 0, sizeof(write_req_t));
-    free(write_req);
+static char *put_status_line(char *p, int status) {
+  const status_line_t *entry = find_status_line(status);
+  if (entry) {
+    memcpy(p, entry->line, entry->len);
+    return p + entry->len;
   }
+
+  // Three digit codes outside the table keep an empty reason phrase
+  if (status < 100 || status > 999)
+    status = 500;
+
+  memcpy(p, "HTTP/1.1 ", 9);
+  format_u64(p + 12, (uint64_t)status);
+  memcpy(p + 12, " \r\n", 3);
+  return p + CUSTOM_STATUS_LINE_LEN;
 }
 
-// Sends 400 or 500
-void send_error(Arena *arena, uv_tcp_t *client_socket, int error_code) {
-  if (!client_socket) {
-    if (arena)
-      arena_reset(arena);
-    return;
+static char *put_date(char *p) {
+  memcpy(p, get_date_line(), DATE_LINE_LEN);
+  return p + DATE_LINE_LEN;
+}
+
+#define CHUNKED_LINE "Transfer-Encoding: chunked\r\n"
+
+static char *put_content_length(char *p, size_t content_length) {
+  if (content_length == CONTENT_LENGTH_CHUNKED) {
+    memcpy(p, CHUNKED_LINE, LITERAL_LEN(CHUNKED_LINE));
+    return p + LITERAL_LEN(CHUNKED_LINE);
   }
 
-  if (uv_is_closing((uv_handle_t *)client_socket)) {
-    if (arena)
-      arena_reset(arena);
-    return;
+  // The body ends when the connection closes, or there is none
+  if (content_length == CONTENT_LENGTH_UNTIL_CLOSE || content_length == CONTENT_LENGTH_NONE)
+    return p;
+
+  char digits[MAX_DIGITS];
+  char *first = format_u64(digits + MAX_DIGITS, (uint64_t)content_length);
+  size_t len = (size_t)(digits + MAX_DIGITS - first);
+
+  memcpy(p, CONTENT_LENGTH_PREFIX, LITERAL_LEN(CONTENT_LENGTH_PREFIX));
+  p += LITERAL_LEN(CONTENT_LENGTH_PREFIX);
+  memcpy(p, first, len);
+  p += len;
+  *p++ = '\r';
+  *p++ = '\n';
+  return p;
+}
+
+// Every part but the status line and the custom headers
+#define FIXED_HEADERS_LEN(keep_alive) \
+  (DATE_LINE_LEN + \
+   LITERAL_LEN(CONTENT_LENGTH_PREFIX) + MAX_DIGITS + 2 + \
+   ((keep_alive) ? LITERAL_LEN(KEEP_ALIVE_TRAILER) : LITERAL_LEN(CLOSE_TRAILER)))
+
+static char *put_connection(char *p, bool keep_alive) {
+  if (keep_alive) {
+    memcpy(p, KEEP_ALIVE_TRAILER, LITERAL_LEN(KEEP_ALIVE_TRAILER));
+    return p + LITERAL_LEN(KEEP_ALIVE_TRAILER);
   }
 
-  if (!uv_is_readable((uv_stream_t *)client_socket) || !uv_is_writable((uv_stream_t *)client_socket)) {
-    if (arena)
-      arena_reset(arena);
+  memcpy(p, CLOSE_TRAILER, LITERAL_LEN(CLOSE_TRAILER));
+  return p + LITERAL_LEN(CLOSE_TRAILER);
+}
+
+// Queues 400, 413 or 500 and closes the connection once it is written
+void send_error(exchange_t *exchange, int error_code) {
+  if (!exchange || exchange->state >= EXCHANGE_READY)
+    return;
+
+  if (exchange->res)
+    exchange->res->replied = true;
+
+  // The connection closed while the handler was running
+  if (!exchange->client) {
+    exchange_release(exchange);
     return;
   }
 
-  const char *date_str = get_cached_date();
-
-  const char *status_text = (error_code == 500) ? "Internal Server Error" : "Bad Request";
-  const char *body = status_text;
-  size_t body_len = strlen(body);
-
-  if (arena) {
-    char *response = arena_sprintf(arena,
-                                   "HTTP/1.1 %d %s\r\n"
-                                   "Date: %s\r\n"
-                                   "Content-Type: text/plain\r\n"
-                                   "Content-Length: %zu\r\n"
-                                   "Connection: close\r\n"
-                                   "\r\n"
-                                   "%s",
-                                   error_code,
-                                   status_text,
-                                   date_str,
-                                   body_len,
-                                   body);
-
-    if (!response) {
-      arena_reset(arena);
-      return;
-    }
+  if (error_code != 500 && error_code != 413)
+    error_code = 400;
 
-    size_t response_len = strlen(response);
+  // The reason phrase doubles as the body
+  const status_line_t *status = find_status_line(error_code);
+  const char *body = status->line + 13;
+  size_t body_len = status->len - 15;
 
-    write_req_t *write_req = arena_alloc(arena, sizeof(write_req_t));
-    if (!write_req) {
-      arena_reset(arena);
-      return;
-    }
+  static const char content_type[] = "Content-Type: text/plain\r\n";
 
-    memset(&write_req->req, 0, sizeof(uv_write_t));
-    write_req->data = response;
-    write_req->arena = arena;
-    write_req->client = (client_t *)client_socket->data;
+  char *response = arena_alloc(exchange->arena,
+                               status->len + LITERAL_LEN(content_type) +
+                                   FIXED_HEADERS_LEN(false) + body_len);
 
-    write_req->buf = uv_buf_init(response, (unsigned int)response_len);
+  size_t len = 0;
 
-    int res = uv_write(&write_req->req, (uv_stream_t *)client_socket,
-                       &write_req->buf, 1, write_completion_cb);
-    if (res < 0) {
-      LOG_ERROR("Write error: %s", uv_strerror(res));
-      arena_reset(arena);
+  if (response) {
+    char *p = put_status_line(response, error_code);
+    p = put_date(p);
+    memcpy(p, content_type, LITERAL_LEN(content_type));
+    p += LITERAL_LEN(content_type);
+    p = put_content_length(p, body_len);
+    p = put_connection(p, false);
+    memcpy(p, body, body_len);
+    p += body_len;
 
-      if (write_req->client)
-        end_request(write_req->client);
-    }
-  } else {
-    // Malloc path
-    // This is necessary for early errors
-    // that don't have arena yet
-    // and called send_error
-    size_t response_size = 512;
-    char *response = malloc(response_size);
-
-    if (!response)
-      return;
+    len = (size_t)(p - response);
+  }
 
-    int written = snprintf(response, response_size,
-                           "HTTP/1.1 %d %s\r\n"
-                           "Date: %s\r\n"
-                           "Content-Type: text/plain\r\n"
-                           "Content-Length: %zu\r\n"
-                           "Connection: close\r\n"
-                           "\r\n"
-                           "%s",
-                           error_code,
-                           status_text,
-                           date_str,
-                           body_len,
-                           body);
-
-    if (written < 0 || (size_t)written >= response_size) {
-      free(response);
-      return;
-    }
+  // Without a response the connection is just closed
+  exchange->keep_alive = false;
+  exchange_ready(exchange, response, len);
+}
 
-    write_req_t *write_req = malloc(sizeof(write_req_t));
-    if (!write_req) {
-      free(response);
-      return;
-    }
+// Status line and headers in the arena of the response, with room for
+// `reserve` more bytes after them. Content-Length is passed apart from
+// the body for HEAD, file and streamed responses.
+char *serialize_headers(Res *res, int status, size_t content_length,
+                        size_t reserve, size_t *out_len) {
+  size_t capacity = status_line_len(status) + FIXED_HEADERS_LEN(res->keep_alive);
 
-    memset(&write_req->req, 0, sizeof(uv_write_t));
-    write_req->data = response;
-    write_req->arena = NULL;
-    write_req->client = (client_t *)client_socket->data;
-    write_req->buf = uv_buf_init(response, (unsigned int)written);
+  for (uint16_t i = 0; i < res->header_count; i++) {
+    const http_header_t *header = &res->headers[i];
+    if (header->name && header->value)
+      capacity += header->name_len + 2 + header->value_len + 2; // "name: value\r\n"
+  }
 
-    int res = uv_write(&write_req->req, (uv_stream_t *)client_socket,
-                       &write_req->buf, 1, write_completion_cb);
-    if (res < 0) {
-      LOG_ERROR("Write error: %s", uv_strerror(res));
-      client_t *client = write_req->client;
+  char *out = arena_alloc(res->arena, capacity + reserve);
+  if (!out)
+    return NULL;
 
-      free(response);
-      free(write_req);
+  char *p = put_status_line(out, status);
+  p = put_date(p);
 
-      if (client)
-        end_request(client);
-    }
+  for (uint16_t i = 0; i < res->header_count; i++) {
+    const http_header_t *header = &res->headers[i];
+    if (!header->name || !header->value)
+      continue;
+
+    memcpy(p, header->name, header->name_len);
+    p += header->name_len;
+    *p++ = ':';
+    *p++ = ' ';
+    memcpy(p, header->value, header->value_len);
+    p += header->value_len;
+    *p++ = '\r';
+    *p++ = '\n';
   }
+
+  p = put_content_length(p, content_length);
+  p = put_connection(p, res->keep_alive);
+
+  *out_len = (size_t)(p - out);
+  return out;
 }
 
-void reply(Res *res, int status, const void *body, size_t body_len) {
-  if (!res)
-    return;
+// Queues the headers and the body of a response. The body is written
+// from where it is when it lives in the arena or is owned by the exchange,
+// anything else is copied after the headers since the caller may free it.
+void queue_response(Res *res, int status, const void *body, size_t body_len, bool in_place) {
+  exchange_t *exchange = (exchange_t *)res->exchange;
 
-  res->replied = true;
+  exchange->keep_alive = res->keep_alive;
 
-  if (!res->client_socket) {
-    if (res->arena)
-      arena_reset(res->arena);
-    return;
-  }
+  if (!body)
+    body_len = 0;
+
+  // Also for a background refresh, which has no connection
+  if (exchange->cache_key)
+    response_cache_store(exchange, res, status, body, body_len);
 
-  if (uv_is_closing((uv_handle_t *)res->client_socket) || !uv_is_readable((uv_stream_t *)res->client_socket) || !uv_is_writable((uv_stream_t *)res->client_socket)) {
-    send_error(res->arena, res->client_socket, 500);
+  if (!exchange->client) {
+    exchange_release(exchange);
     return;
   }
 
-  if (!body)
+  size_t content_length = body_len;
+  if (res->is_head_request)
     body_len = 0;
 
-  size_t original_body_len = body_len;
-  if (res->is_head_request) {
-    body = NULL;
-    body_len = 0;
-  }
+  if (body_len > 0 && !in_place)
+    in_place = arena_contains(res->arena, body, body_len);
 
-  const char *date_str = get_cached_date();
-  const char *connection = res->keep_alive ? "keep-alive" : "close";
+  size_t reserve = in_place ? 0 : body_len;
+  size_t headers_len = 0;
 
-  size_t headers_size = 0;
-  for (uint16_t i = 0; i < res->header_count; i++) {
-    if (res->headers[i].name && res->headers[i].value) {
-      headers_size += strlen(res->headers[i].name) + 2 + // "name: "
-          strlen(res->headers[i].value) + 2; // "value\r\n"
-    }
+  char *headers = serialize_headers(res, status, content_length, reserve, &headers_len);
+  if (!headers) {
+    send_error(exchange, 500);
+    return;
   }
 
-  char *all_headers = NULL;
-  if (headers_size > 0) {
-    all_headers = arena_alloc(res->arena, headers_size + 1);
-    if (!all_headers) {
-      send_error(res->arena, res->client_socket, 500);
-      return;
-    }
-
-    size_t pos = 0;
-    for (uint16_t i = 0; i < res->header_count; i++) {
-      if (res->headers[i].name && res->headers[i].value) {
-        size_t name_len = strlen(res->headers[i].name);
-        size_t value_len = strlen(res->headers[i].value);
-
-        memcpy(all_headers + pos, res->headers[i].name, name_len);
-        pos += name_len;
-        all_headers[pos++] = ':';
-        all_headers[pos++] = ' ';
-        memcpy(all_headers + pos, res->headers[i].value, value_len);
-        pos += value_len;
-        all_headers[pos++] = '\r';
-        all_headers[pos++] = '\n';
-      }
-    }
-    all_headers[pos] = '\0';
-  } else {
-    all_headers = arena_strdup(res->arena, "");
-    if (!all_headers) {
-      send_error(res->arena, res->client_socket, 500);
-      return;
+  if (body_len > 0) {
+    if (in_place) {
+      exchange->body = uv_buf_init((char *)body, (unsigned int)body_len);
+    } else {
+      memcpy(headers + headers_len, body, body_len);
+      headers_len += body_len;
     }
   }
 
-  // Build HTTP response
-  char *headers = arena_sprintf(res->arena,
-                                "HTTP/1.1 %d\r\n"
-                                "Date: %s\r\n"
-                                "%s"
-                                "Content-Length: %zu\r\n"
-                                "Connection: %s\r\n"
-                                "\r\n",
-                                status,
-                                date_str,
-                                all_headers,
-                                original_body_len,
-                                connection);
+  // Written in request order, see pipeline.c
+  exchange_ready(exchange, headers, headers_len);
+}
 
-  if (!headers) {
-    send_error(res->arena, res->client_socket, 500);
-    return;
+// Marks the response as sent, returns the exchange if it can still be queued
+static exchange_t *reply_exchange(Res *res) {
+  res->replied = true;
+
+  exchange_t *exchange = (exchange_t *)res->exchange;
+  if (!exchange || exchange->state >= EXCHANGE_READY)
+    return NULL;
+
+  // The connection closed while the handler was running,
+  // a response to store in the cache is still finished
+  if (!exchange->client && !exchange->cache_key) {
+    exchange_release(exchange);
+    return NULL;
   }
 
-  size_t headers_len = strlen(headers);
-  size_t total_len = headers_len + body_len;
+  return exchange;
+}
 
-  char *response = arena_alloc(res->arena, total_len);
-  if (!response) {
-    send_error(res->arena, res->client_socket, 500);
+void reply(Res *res, int status, const void *body, size_t body_len) {
+  if (!res)
     return;
-  }
 
-  memcpy(response, headers, headers_len);
-  if (body_len > 0 && body)
-    memcpy(response + headers_len, body, body_len);
+  if (!reply_exchange(res))
+    return;
 
-  write_req_t *write_req = arena_alloc(res->arena, sizeof(write_req_t));
-  if (!write_req) {
-    send_error(res->arena, res->client_socket, 500);
+  if (compress_reply(res, status, body, body_len, false))
     return;
-  }
 
-  memset(write_req, 0, sizeof(write_req_t));
-  write_req->data = response;
-  write_req->arena = res->arena;
-  write_req->client = (client_t *)res->client_socket->data;
-  write_req->buf = uv_buf_init(response, (unsigned int)total_len);
+  queue_response(res, status, body, body_len, false);
+}
+
+void reply_owned(Res *res, int status, void *buf, size_t len, reply_free_t free_cb) {
+  exchange_t *exchange = res ? (exchange_t *)res->exchange : NULL;
 
-  if (uv_is_closing((uv_handle_t *)res->client_socket)) {
-    arena_reset(res->arena);
+  // Released with the exchange, or right away if there is none to hand it to
+  if (!exchange || exchange->state >= EXCHANGE_READY) {
+    if (res)
+      res->replied = true;
+    if (free_cb && buf)
+      free_cb(buf);
     return;
   }
 
-  int result = uv_write(&write_req->req, (uv_stream_t *)res->client_socket,
-                        &write_req->buf, 1, write_completion_cb);
+  exchange->owned_body = buf;
+  exchange->owned_free = free_cb;
 
-  if (result < 0) {
-    LOG_DEBUG("Write error: %s", uv_strerror(result));
-    arena_reset(res->arena);
+  if (!reply_exchange(res))
+    return;
 
-    if (write_req->client)
-      end_request(write_req->client);
-  }
+  if (compress_reply(res, status, buf, len, true))
+    return;
+
+  queue_response(res, status, buf, len, true);
 }
 
 static bool is_valid_header_char(char c) {
@@ -404,14 +499,27 @@ void set_header(Res *res, const char *name, const char *value) {
     res->header_capacity = new_cap;
   }
 
-  res->headers[res->header_count].name = arena_strdup(res->arena, name);
-  res->headers[res->header_count].value = arena_strdup(res->arena, value);
+  // Lengths are kept for the serializer
+  size_t name_len = strlen(name);
+  size_t value_len = strlen(value);
+
+  char *name_copy = arena_alloc(res->arena, name_len + 1);
+  char *value_copy = arena_alloc(res->arena, value_len + 1);
 
-  if (!res->headers[res->header_count].name || !res->headers[res->header_count].value) {
+  if (!name_copy || !value_copy) {
     LOG_ERROR("Failed to allocate memory in set_header");
     return;
   }
 
+  memcpy(name_copy, name, name_len + 1);
+  memcpy(value_copy, value, value_len + 1);
+
+  http_header_t *header = &res->headers[res->header_count];
+  header->name = name_copy;
+  header->value = value_copy;
+  header->name_len = name_len;
+  header->value_len = value_len;
+
   res->header_count++;
 }
 
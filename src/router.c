@@ -1,5 +1,8 @@
 #include "router.h"
+#include "pipeline.h"
 #include "route-trie.h"
+#include "static-route.h"
+#include "response-cache.h"
 #include "middleware.h"
 #include "server.h"
 #include "arena.h"
@@ -7,7 +10,7 @@
 #include "request.h"
 #include "logger.h"
 
-extern void send_error(Arena *request_arena, uv_tcp_t *client_socket, int error_code);
+extern void send_error(exchange_t *exchange, int error_code);
 
 // Extracts URL parameters from a previously matched route
 // Example: From route /users/:id matched with /users/123, extracts parameter id=123
@@ -107,20 +110,29 @@ static int populate_req_from_context(Req *req, http_context_t *ctx, const char *
     req->is_head_request = (ctx->method_length == 4 && memcmp(ctx->method, "HEAD", 4) == 0);
   }
 
+  // The query is copied next to the path and parsed on first use
+  size_t query_len = 0;
+  if (ctx->url && ctx->url_length > ctx->path_length)
+    query_len = ctx->url_length - ctx->path_length - 1;
+
   if (path && path_len > 0) {
-    req->path = arena_alloc(arena, path_len + 1);
+    req->path = arena_alloc(arena, path_len + 1 + (query_len > 0 ? query_len + 1 : 0));
     if (!req->path)
       return -1;
     arena_memcpy(req->path, path, path_len);
     req->path[path_len] = '\0';
+
+    if (query_len > 0) {
+      req->query_string = req->path + path_len + 1;
+      req->query_len = query_len;
+      arena_memcpy(req->query_string, ctx->url + ctx->path_length + 1, query_len);
+      req->query_string[query_len] = '\0';
+    }
   }
 
+  // Already in the arena of the exchange and NUL-terminated
   if (ctx->body && ctx->body_length > 0) {
-    req->body = arena_alloc(arena, ctx->body_length + 1);
-    if (!req->body)
-      return -1;
-    arena_memcpy(req->body, ctx->body, ctx->body_length);
-    req->body[ctx->body_length] = '\0';
+    req->body = ctx->body;
     req->body_len = ctx->body_length;
   }
 
@@ -128,7 +140,6 @@ static int populate_req_from_context(Req *req, http_context_t *ctx, const char *
   req->http_minor = ctx->http_minor;
 
   req->headers = ctx->headers;
-  req->query = ctx->query_params;
 
   return 0;
 }
@@ -140,76 +151,54 @@ static void noop_route_handler(Req *req, Res *res) {
   (void)res;
 }
 
-int router(client_t *client, const char *request_data, size_t request_len) {
-  uv_tcp_t *handle = (uv_tcp_t *)&client->handle;
+// Runs the route of a parsed request
+// The response is queued on the exchange when the handler replies
+static void dispatch(client_t *client, exchange_t *exchange) {
   http_context_t *persistent_ctx = &client->persistent_context;
 
-  if (!client || !request_data || request_len == 0) {
-    if (client && client->handle.data)
-      send_error(NULL, handle, 400);
-    return REQUEST_CLOSE;
-  }
-
-  if (uv_is_closing((uv_handle_t *)&client->handle))
-    return REQUEST_CLOSE;
+  exchange->state = EXCHANGE_HANDLING;
+  exchange->keep_alive = persistent_ctx->keep_alive;
 
-  // Parse the incoming data (appends to existing parsed data if partial)
-  parse_result_t parse_result = http_parse_request(persistent_ctx, request_data, request_len);
+  // Pre-serialized responses skip Req, Res and the middleware
+  if (static_route_dispatch(client, exchange))
+    return;
 
-  switch (parse_result) {
-  case PARSE_SUCCESS:
-    break;
+  // Check if we need to finish parsing
+  if (http_message_needs_eof(persistent_ctx)) {
+    parse_result_t finish_result = http_finish_parsing(persistent_ctx);
+    if (finish_result != PARSE_SUCCESS) {
+      LOG_ERROR("HTTP finish parsing failed: %s", parse_result_to_string(finish_result));
 
-  case PARSE_INCOMPLETE:
-    // Need more data - don't create arena, don't send error
-    // Just return and wait for more data
-    LOG_DEBUG("HTTP parsing incomplete - waiting for more data");
-    return REQUEST_PENDING;
+      if (persistent_ctx->error_reason)
+        LOG_ERROR(" - %s", persistent_ctx->error_reason);
 
-  case PARSE_OVERFLOW:
-    LOG_ERROR("HTTP parsing failed: size limits exceeded");
-    if (persistent_ctx->error_reason)
-      LOG_ERROR(" - %s", persistent_ctx->error_reason);
-    send_error(NULL, handle, 413);
-    return REQUEST_CLOSE;
+      send_error(exchange, 400);
+      return;
+    }
 
-  case PARSE_ERROR:
-  default:
-    LOG_ERROR("HTTP parsing failed: %s", parse_result_to_string(parse_result));
-    if (persistent_ctx->error_reason)
-      LOG_ERROR(" - %s", persistent_ctx->error_reason);
-    send_error(NULL, handle, 400);
-    return REQUEST_CLOSE;
+    exchange->keep_alive = persistent_ctx->keep_alive;
   }
 
-  Arena *request_arena = client->connection_arena;
+  if (response_cache_dispatch(client, exchange))
+    return;
 
-  if (!request_arena) {
-    send_error(NULL, handle, 500);
-    return REQUEST_CLOSE;
-  }
+  router_run(exchange, persistent_ctx, (uv_tcp_t *)&client->handle);
+}
+
+void router_run(exchange_t *exchange, http_context_t *persistent_ctx, uv_tcp_t *handle) {
+  Arena *request_arena = exchange->arena;
 
   Req *req = create_req(request_arena, handle);
   Res *res = create_res(request_arena, handle);
 
   if (!req || !res) {
-    send_error(request_arena, handle, 500);
-    return REQUEST_CLOSE;
+    send_error(exchange, 500);
+    return;
   }
 
-  // Check if we need to finish parsing
-  if (http_message_needs_eof(persistent_ctx)) {
-    parse_result_t finish_result = http_finish_parsing(persistent_ctx);
-    if (finish_result != PARSE_SUCCESS) {
-      LOG_ERROR("HTTP finish parsing failed: %s", parse_result_to_string(finish_result));
-
-      if (persistent_ctx->error_reason)
-        LOG_ERROR(" - %s", persistent_ctx->error_reason);
-
-      send_error(request_arena, handle, 400);
-      return REQUEST_CLOSE;
-    }
-  }
+  res->exchange = exchange;
+  exchange->req = req;
+  exchange->res = res;
 
   res->keep_alive = persistent_ctx->keep_alive;
 
@@ -221,33 +210,27 @@ int router(client_t *client, const char *request_data, size_t request_len) {
     path_len = 1;
   }
 
-  if (!path) {
-    send_error(request_arena, handle, 400);
-    return REQUEST_CLOSE;
-  }
-
   if (!global_route_trie || !persistent_ctx->method) {
     LOG_DEBUG("Missing route trie (%p) or method (%s)",
               (void *)global_route_trie,
               persistent_ctx->method ? persistent_ctx->method : "NULL");
 
     // 404 but still success response
-    bool keep_alive = res->keep_alive;
     const char *not_found_msg = "404 Not Found";
     set_header(res, "Content-Type", "text/plain");
     reply(res, 404, not_found_msg, strlen(not_found_msg));
-    return keep_alive ? REQUEST_KEEP_ALIVE : REQUEST_CLOSE;
+    return;
   }
 
   tokenized_path_t tokenized_path = { 0 };
   if (tokenize_path(request_arena, path, path_len, &tokenized_path) != 0) {
-    send_error(request_arena, handle, 500);
-    return REQUEST_CLOSE;
+    send_error(exchange, 500);
+    return;
   }
 
   if (populate_req_from_context(req, persistent_ctx, path, path_len) != 0) {
-    send_error(request_arena, handle, 500);
-    return REQUEST_CLOSE;
+    send_error(exchange, 500);
+    return;
   }
 
   res->is_head_request = req->is_head_request;
@@ -272,25 +255,23 @@ int router(client_t *client, const char *request_data, size_t request_len) {
 
       chain_start(req, res, &dummy_mw);
 
-      if (res->replied) {
-        return res->keep_alive ? REQUEST_KEEP_ALIVE : REQUEST_CLOSE;
-      }
+      if (res->replied)
+        return;
     }
 
-    bool keep_alive = res->keep_alive;
     set_header(res, "Content-Type", "text/plain");
     reply(res, 404, "404 Not Found", 13);
-    return keep_alive ? REQUEST_KEEP_ALIVE : REQUEST_CLOSE;
+    return;
   }
 
   if (extract_url_params(request_arena, &match, &req->params) != 0) {
-    send_error(request_arena, handle, 500);
-    return REQUEST_CLOSE;
+    send_error(exchange, 500);
+    return;
   }
 
   if (!match.handler) {
-    send_error(request_arena, handle, 500);
-    return REQUEST_CLOSE;
+    send_error(exchange, 500);
+    return;
   }
 
   MiddlewareInfo *middleware_info = (MiddlewareInfo *)match.middleware_ctx;
@@ -298,13 +279,114 @@ int router(client_t *client, const char *request_data, size_t request_len) {
   if (!middleware_info) {
     LOG_DEBUG("No middleware info");
     match.handler(req, res);
-    return res->keep_alive ? REQUEST_KEEP_ALIVE : REQUEST_CLOSE;
+    return;
   }
 
   chain_start(req, res, middleware_info);
-  if (!res->replied)
-    return REQUEST_PENDING;
+}
+
+int router(client_t *client, const char *request_data, size_t request_len) {
+  if (!client || !request_data || request_len == 0)
+    return REQUEST_CLOSE;
+
+  if (uv_is_closing((uv_handle_t *)&client->handle))
+    return REQUEST_CLOSE;
+
+  http_context_t *persistent_ctx = &client->persistent_context;
+
+  // A read may carry several pipelined requests,
+  // the parser pauses after each of them
+  while (request_len > 0) {
+    if (!client->parsing) {
+      client->parsing = exchange_create(client);
+      if (!client->parsing) {
+        LOG_ERROR("Failed to create request exchange");
+        return REQUEST_CLOSE;
+      }
+
+      // Request buffers live in the arena of the exchange
+      http_context_init(persistent_ctx,
+                        client->parsing->arena,
+                        &client->persistent_parser,
+                        &client->persistent_settings);
+    }
+
+    // Header items point into this data until they are kept
+    persistent_ctx->headers.view_begin = request_data;
+    persistent_ctx->headers.view_end = request_data + request_len;
+
+    exchange_t *exchange = client->parsing;
+    size_t consumed = 0;
+
+    parse_result_t parse_result = http_parse_request(persistent_ctx, request_data, request_len, &consumed);
+
+    switch (parse_result) {
+    case PARSE_SUCCESS:
+      break;
+
+    case PARSE_INCOMPLETE:
+      // Need more data - keep the exchange and wait
+      LOG_DEBUG("HTTP parsing incomplete - waiting for more data");
+      return REQUEST_PENDING;
+
+    case PARSE_OVERFLOW:
+      LOG_ERROR("HTTP parsing failed: size limits exceeded");
+      if (persistent_ctx->error_reason)
+        LOG_ERROR(" - %s", persistent_ctx->error_reason);
+      client->parsing = NULL;
+      send_error(exchange, 413);
+      return REQUEST_CLOSE;
 
-  // Arena will be reset in write_completion_cb after response is sent
-  return res->keep_alive ? REQUEST_KEEP_ALIVE : REQUEST_CLOSE;
+    case PARSE_ERROR:
+    default:
+      LOG_ERROR("HTTP parsing failed: %s", parse_result_to_string(parse_result));
+      if (persistent_ctx->error_reason)
+        LOG_ERROR(" - %s", persistent_ctx->error_reason);
+      client->parsing = NULL;
+      send_error(exchange, 400);
+      return REQUEST_CLOSE;
+    }
+
+    client->parsing = NULL;
+    dispatch(client, exchange);
+
+    // Nothing after this request is answered
+    if (!exchange->keep_alive)
+      return REQUEST_CLOSE;
+
+    // The rest of the data belongs to the new protocol
+    if (client->taken_over || llhttp_get_upgrade(&client->persistent_parser))
+      return REQUEST_KEEP_ALIVE;
+
+    request_data += consumed;
+    request_len -= consumed;
+
+    http_resume_parsing(persistent_ctx);
+  }
+
+  return REQUEST_KEEP_ALIVE;
+}
+
+int router_keep_requests(client_t *client, const char *data, size_t len) {
+  const char *end = data + len;
+
+  for (exchange_t *ex = client->exchange_head; ex; ex = ex->next) {
+    if (ex->cache_key && ex->cache_key >= data && ex->cache_key < end) {
+      char *key = arena_alloc(ex->arena, ex->cache_key_len + 1);
+      if (!key)
+        return -1;
+      memcpy(key, ex->cache_key, ex->cache_key_len);
+      key[ex->cache_key_len] = '\0';
+      ex->cache_key = key;
+    }
+
+    if (ex->req && http_headers_keep(ex->arena, &ex->req->headers) != 0)
+      return -1;
+  }
+
+  // A request that continues in the next read
+  if (client->parsing && http_context_keep(&client->persistent_context) != 0)
+    return -1;
+
+  return 0;
 }
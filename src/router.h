@@ -12,4 +12,12 @@ typedef enum RouterResult {
 
 int router(client_t *client, const char *request_data, size_t request_len);
 
+// Creates Req and Res for a parsed request and runs its route.
+// handle is NULL for exchanges without a connection.
+void router_run(exchange_t *exchange, http_context_t *persistent_ctx, uv_tcp_t *handle);
+
+// Copies whatever queued requests still point into the read buffer
+// [data, data + len), called before the buffer is reused
+int router_keep_requests(client_t *client, const char *data, size_t len);
+
 #endif
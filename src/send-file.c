@@ -0,0 +1,425 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <errno.h>
+#include <sys/sendfile.h>
+#endif
+#include "send-file.h"
+#include "utils.h"
+#include "pipeline.h"
+#include "arena.h"
+#include "logger.h"
+
+extern void send_error(exchange_t *exchange, int error_code);
+extern char *serialize_headers(Res *res, int status, size_t content_length,
+                               size_t reserve, size_t *out_len);
+
+struct exchange_file_s {
+  uv_fs_t req;
+  uv_write_t write_req;
+#ifdef __linux__
+  uv_work_t work;
+  int socket_fd;
+  int64_t result; // Bytes sent or -errno, set on the thread pool
+#endif
+  exchange_t *exchange;
+  uv_file fd;
+  int64_t offset;
+  int64_t remaining;
+  char *chunk; // Allocated on the first copy
+  size_t chunk_len;
+  bool copy; // sendfile() is not usable for this connection
+};
+
+static void file_send_next(exchange_file_t *file);
+
+static void file_transfer_finish(exchange_file_t *file, bool ok) {
+  client_t *client = file->exchange->client;
+
+  client_write_finished(client);
+  pipeline_body_done(client, ok);
+}
+
+static void file_advance(exchange_file_t *file, int64_t sent) {
+  file->offset += sent;
+  file->remaining -= sent;
+
+  client_write_progress(file->exchange->client);
+  file_send_next(file);
+}
+
+static void on_file_written(uv_write_t *req, int status) {
+  exchange_file_t *file = (exchange_file_t *)req->data;
+  client_t *client = file->exchange->client;
+
+  if (client->closing)
+    return;
+
+  if (status < 0) {
+    LOG_DEBUG("File write error: %s", uv_strerror(status));
+    file_transfer_finish(file, false);
+    return;
+  }
+
+  file_advance(file, (int64_t)file->chunk_len);
+}
+
+static void on_file_read(uv_fs_t *req) {
+  exchange_file_t *file = (exchange_file_t *)req->data;
+  client_t *client = file->exchange->client;
+
+  ssize_t result = req->result;
+  uv_fs_req_cleanup(req);
+
+  if (!client_fs_done(client))
+    return;
+
+  // The file shrank after its length was sent
+  if (result <= 0) {
+    LOG_ERROR("File read error: %s", result < 0 ? uv_strerror((int)result) : "unexpected end of file");
+    file_transfer_finish(file, false);
+    return;
+  }
+
+  file->chunk_len = (size_t)result;
+  file->write_req.data = file;
+
+  uv_buf_t buf = uv_buf_init(file->chunk, (unsigned int)result);
+
+  if (uv_write(&file->write_req, (uv_stream_t *)&client->handle, &buf, 1, on_file_written) != 0)
+    file_transfer_finish(file, false);
+}
+
+// Reads a piece of the file and writes it, the write
+// completes when the socket has room for it again
+static void file_copy_chunk(exchange_file_t *file) {
+  client_t *client = file->exchange->client;
+
+  size_t len = SEND_FILE_COPY_CHUNK;
+  if ((int64_t)len > file->remaining)
+    len = (size_t)file->remaining;
+
+  if (!file->chunk) {
+    file->chunk = arena_alloc(file->exchange->arena, SEND_FILE_COPY_CHUNK);
+    if (!file->chunk) {
+      file_transfer_finish(file, false);
+      return;
+    }
+  }
+
+  uv_buf_t buf = uv_buf_init(file->chunk, (unsigned int)len);
+  file->req.data = file;
+  client->fs_busy = true;
+
+  if (uv_fs_read(client->owner->loop, &file->req, file->fd, &buf, 1, file->offset, on_file_read) != 0) {
+    client->fs_busy = false;
+    file_transfer_finish(file, false);
+  }
+}
+
+#ifdef __linux__
+// Runs on the thread pool, the socket is non-blocking so only
+// reading the file from disk can make it wait
+static void sendfile_work(uv_work_t *req) {
+  exchange_file_t *file = (exchange_file_t *)req->data;
+
+  size_t len = SEND_FILE_MAX_CHUNK;
+  if ((int64_t)len > file->remaining)
+    len = (size_t)file->remaining;
+
+  off_t offset = (off_t)file->offset;
+  ssize_t sent = sendfile(file->socket_fd, file->fd, &offset, len);
+
+  file->result = sent >= 0 ? (int64_t)sent : -errno;
+}
+
+static void on_file_sent(uv_work_t *req, int status) {
+  exchange_file_t *file = (exchange_file_t *)req->data;
+  client_t *client = file->exchange->client;
+
+  if (!client_fs_done(client))
+    return;
+
+  int64_t result = status < 0 ? status : file->result;
+
+  if (result == -EAGAIN || result == -EWOULDBLOCK) {
+    // The socket is full, libuv tells when it drains
+    file_copy_chunk(file);
+    return;
+  }
+
+  if (result < 0) {
+    LOG_DEBUG("sendfile failed (%s), copying instead", strerror((int)-result));
+    file->copy = true;
+    file_copy_chunk(file);
+    return;
+  }
+
+  if (result == 0) {
+    LOG_ERROR("File read error: unexpected end of file");
+    file_transfer_finish(file, false);
+    return;
+  }
+
+  file_advance(file, result);
+}
+#endif
+
+static void file_send_next(exchange_file_t *file) {
+  if (file->remaining <= 0) {
+    file_transfer_finish(file, true);
+    return;
+  }
+
+#ifdef __linux__
+  client_t *client = file->exchange->client;
+  uv_os_fd_t socket_fd;
+
+  if (!file->copy && uv_fileno((uv_handle_t *)&client->handle, &socket_fd) == 0) {
+    file->socket_fd = socket_fd;
+    file->work.data = file;
+    client->fs_busy = true;
+
+    if (uv_queue_work(client->owner->loop, &file->work, sendfile_work, on_file_sent) == 0)
+      return;
+
+    client->fs_busy = false;
+  }
+
+  file->copy = true;
+#endif
+
+  file_copy_chunk(file);
+}
+
+void file_transfer_start(exchange_t *exchange) {
+  client_write_started(exchange->client);
+  file_send_next(exchange->file);
+}
+
+static void close_fd(uv_file fd) {
+  uv_fs_t req;
+  uv_fs_close(get_loop(), &req, fd, NULL);
+  uv_fs_req_cleanup(&req);
+}
+
+void file_transfer_close(exchange_file_t *file) {
+  if (!file || file->fd < 0)
+    return;
+
+  close_fd(file->fd);
+  file->fd = -1;
+}
+
+static bool parse_position(const char **p, int64_t *out) {
+  const char *s = *p;
+  int64_t value = 0;
+
+  if (*s < '0' || *s > '9')
+    return false;
+
+  while (*s >= '0' && *s <= '9') {
+    if (value > (INT64_MAX - (*s - '0')) / 10)
+      return false;
+
+    value = value * 10 + (*s - '0');
+    s++;
+  }
+
+  *p = s;
+  *out = value;
+  return true;
+}
+
+// Only a single range is served, anything else gets the whole file.
+// Returns 1 for a range, 0 to ignore the header, -1 if unsatisfiable.
+static int parse_range(const char *value, int64_t size, int64_t *start, int64_t *end) {
+  if (strncmp(value, "bytes=", 6) != 0 || strchr(value, ','))
+    return 0;
+
+  const char *p = value + 6;
+  while (*p == ' ')
+    p++;
+
+  int64_t first, last;
+
+  if (*p == '-') {
+    p++;
+    if (!parse_position(&p, &last) || *p != '\0')
+      return 0;
+
+    // Suffix range, the last N bytes
+    if (last == 0 || size == 0)
+      return -1;
+
+    *start = last < size ? size - last : 0;
+    *end = size - 1;
+    return 1;
+  }
+
+  if (!parse_position(&p, &first) || *p != '-')
+    return 0;
+
+  p++;
+
+  if (*p == '\0') {
+    last = size - 1;
+  } else {
+    if (!parse_position(&p, &last) || *p != '\0' || last < first)
+      return 0;
+
+    if (last > size - 1)
+      last = size - 1;
+  }
+
+  if (first >= size)
+    return -1;
+
+  *start = first;
+  *end = last;
+  return 1;
+}
+
+static void send_open_error(Res *res, int err) {
+  switch (err) {
+  case UV_ENOENT:
+  case UV_ENOTDIR:
+    send_text(res, NOT_FOUND, "Not Found");
+    break;
+  case UV_EACCES:
+  case UV_EPERM:
+    send_text(res, FORBIDDEN, "Forbidden");
+    break;
+  default:
+    send_text(res, INTERNAL_SERVER_ERROR, "Internal Server Error");
+    break;
+  }
+}
+
+void send_file(Res *res, const char *path, const char *content_type) {
+  if (!res || !path)
+    return;
+
+  exchange_t *exchange = (exchange_t *)res->exchange;
+  if (!exchange || exchange->state >= EXCHANGE_READY) {
+    res->replied = true;
+    return;
+  }
+
+  // The connection closed while the handler was running
+  if (!exchange->client) {
+    res->replied = true;
+    exchange_release(exchange);
+    return;
+  }
+
+  uv_loop_t *loop = exchange->client->owner->loop;
+  uv_fs_t req;
+
+  int fd = uv_fs_open(loop, &req, path, UV_FS_O_RDONLY, 0, NULL);
+  uv_fs_req_cleanup(&req);
+
+  if (fd < 0) {
+    send_open_error(res, fd);
+    return;
+  }
+
+  if (uv_fs_fstat(loop, &req, fd, NULL) != 0 || (req.statbuf.st_mode & S_IFMT) != S_IFREG) {
+    uv_fs_req_cleanup(&req);
+    close_fd(fd);
+    send_text(res, NOT_FOUND, "Not Found");
+    return;
+  }
+
+  int64_t size = (int64_t)req.statbuf.st_size;
+  time_t mtime = (time_t)req.statbuf.st_mtim.tv_sec;
+  uv_fs_req_cleanup(&req);
+
+  char etag[48];
+  snprintf(etag, sizeof(etag), "\"%" PRIx64 "-%" PRIx64 "\"", (uint64_t)mtime, (uint64_t)size);
+
+  char last_modified[HTTP_DATE_LEN + 1];
+  bool has_last_modified = format_http_date(last_modified, mtime);
+
+  int64_t start = 0;
+  int64_t end = size - 1;
+  int status = OK;
+
+  const char *range = exchange->req ? get_header_id(exchange->req, HEADER_RANGE) : NULL;
+
+  if (range) {
+    // A stale If-Range means the client wants the whole new file
+    const char *if_range = get_header_id(exchange->req, HEADER_IF_RANGE);
+    bool fresh = !if_range || strcmp(if_range, etag) == 0
+        || (has_last_modified && strcmp(if_range, last_modified) == 0);
+
+    int result = fresh ? parse_range(range, size, &start, &end) : 0;
+
+    if (result < 0) {
+      char content_range[48];
+      snprintf(content_range, sizeof(content_range), "bytes */%" PRId64, size);
+      set_header(res, "Content-Range", content_range);
+      close_fd(fd);
+      reply(res, RANGE_NOT_SATISFIABLE, NULL, 0);
+      return;
+    }
+
+    if (result > 0)
+      status = PARTIAL_CONTENT;
+  }
+
+  set_header(res, "Content-Type", content_type ? content_type : "application/octet-stream");
+  set_header(res, "Accept-Ranges", "bytes");
+  set_header(res, "ETag", etag);
+
+  if (has_last_modified)
+    set_header(res, "Last-Modified", last_modified);
+
+  if (status == PARTIAL_CONTENT) {
+    char content_range[80];
+    snprintf(content_range, sizeof(content_range), "bytes %" PRId64 "-%" PRId64 "/%" PRId64,
+             start, end, size);
+    set_header(res, "Content-Range", content_range);
+  }
+
+  int64_t length = size > 0 ? end - start + 1 : 0;
+
+  res->replied = true;
+  exchange->keep_alive = res->keep_alive;
+
+  size_t headers_len = 0;
+  char *headers = serialize_headers(res, status, (size_t)length, 0, &headers_len);
+
+  // Nothing to stream for HEAD or an empty file
+  if (!headers || res->is_head_request || length == 0) {
+    close_fd(fd);
+
+    if (headers)
+      exchange_ready(exchange, headers, headers_len);
+    else
+      send_error(exchange, 500);
+
+    return;
+  }
+
+  exchange_file_t *file = arena_alloc(exchange->arena, sizeof(exchange_file_t));
+  if (!file) {
+    close_fd(fd);
+    send_error(exchange, 500);
+    return;
+  }
+
+  memset(file, 0, sizeof(exchange_file_t));
+  file->exchange = exchange;
+  file->fd = fd;
+  file->offset = start;
+  file->remaining = length;
+
+  // Closed with the exchange from here on
+  exchange->file = file;
+
+  exchange_ready(exchange, headers, headers_len);
+}
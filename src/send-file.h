@@ -0,0 +1,22 @@
+#ifndef ECEWO_SEND_FILE_H
+#define ECEWO_SEND_FILE_H
+
+#include "server.h"
+
+// Largest piece handed to one sendfile() call
+#ifndef SEND_FILE_MAX_CHUNK
+#define SEND_FILE_MAX_CHUNK (4 * 1024 * 1024)
+#endif
+
+// Buffer used where sendfile() is not available or when the socket is full
+#ifndef SEND_FILE_COPY_CHUNK
+#define SEND_FILE_COPY_CHUNK 32768
+#endif
+
+// Streams the body of a file response once its headers are written
+void file_transfer_start(exchange_t *exchange);
+
+// Closes the file of an exchange that is released
+void file_transfer_close(exchange_file_t *file);
+
+#endif
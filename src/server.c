@@ -1,11 +1,21 @@
 #include <stdlib.h>
 #include <signal.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 #include <inttypes.h>
 #include <stdatomic.h>
 #include "server.h"
 #include "route-trie.h"
 #include "middleware.h"
 #include "router.h"
+#include "static-route.h"
+#include "response-cache.h"
+#include "channel.h"
+#include "sse.h"
+#include "ws.h"
+#include "pipeline.h"
 #include "arena.h"
 #include "utils.h"
 #include "logger.h"
@@ -14,6 +24,27 @@
 #define MAX_CONNECTIONS 10000
 #endif
 
+// Close the least recently active idle connection
+// instead of refusing a new one at MAX_CONNECTIONS
+#ifndef EVICT_ON_MAX_CONNECTIONS
+#define EVICT_ON_MAX_CONNECTIONS 0
+#endif
+
+// Accepting resumes once a paused loop is back down to this many connections
+#ifndef ACCEPT_LOW_WATERMARK
+#define ACCEPT_LOW_WATERMARK (MAX_CONNECTIONS - MAX_CONNECTIONS / 10)
+#endif
+
+// Answer connections over MAX_CONNECTIONS with a 503
+// instead of leaving them in the listen backlog
+#ifndef OVERLOAD_RESPONSE
+#define OVERLOAD_RESPONSE 0
+#endif
+
+#ifndef OVERLOAD_RETRY_AFTER
+#define OVERLOAD_RETRY_AFTER 5
+#endif
+
 #ifndef LISTEN_BACKLOG
 #define LISTEN_BACKLOG 511
 #endif
@@ -22,12 +53,16 @@
 #define IDLE_TIMEOUT_MS 60000
 #endif
 
+#ifndef HEADER_TIMEOUT_MS
+#define HEADER_TIMEOUT_MS 10000
+#endif
+
 #ifndef REQUEST_TIMEOUT_MS
 #define REQUEST_TIMEOUT_MS 30000
 #endif
 
-#ifndef CLEANUP_INTERVAL_MS
-#define CLEANUP_INTERVAL_MS 30000
+#ifndef WRITE_TIMEOUT_MS
+#define WRITE_TIMEOUT_MS 30000
 #endif
 
 #ifndef SHUTDOWN_TIMEOUT_MS
@@ -54,6 +89,12 @@ typedef struct timer_data_s {
   timer_callback_t callback;
   void *user_data;
   bool is_interval;
+
+  // Listed on the loop, so that shutdown closes the timers it owns
+  uv_timer_t *timer;
+  server_loop_t *owner;
+  struct timer_data_s *prev;
+  struct timer_data_s *next;
 } timer_data_t;
 
 static struct
@@ -61,154 +102,296 @@ static struct
   bool initialized;
   bool running;
   bool shutdown_requested;
-  int active_connections;
-  atomic_uint_fast16_t pending_async_work;
 
-  uv_loop_t *loop;
-  uv_tcp_t *server;
+  server_loop_t main; // Runs on uv_default_loop()
+  server_loop_t *workers; // Extra loops started by server_listen_threads()
+  uint16_t worker_count;
+
   uv_signal_t sigint_handle;
   uv_signal_t sigterm_handle;
   uv_async_t shutdown_async;
 
   shutdown_callback_t shutdown_callback;
-
-  client_t *client_list_head;
-  uv_timer_t *cleanup_timer;
-
-  bool server_closed;
+  char *unix_path; // Socket file removed on cleanup
 } ecewo_server = { 0 };
 
 route_trie_t *global_route_trie = NULL;
 
+// Loop running on the current thread, NULL outside of worker loops
+static _Thread_local server_loop_t *current_loop = NULL;
+
+server_loop_t *get_server_loop(void) {
+  return current_loop ? current_loop : &ecewo_server.main;
+}
+
+static void lru_unlink(client_t *client) {
+  server_loop_t *sl = client->owner;
+
+  if (client->lru_prev)
+    client->lru_prev->lru_next = client->lru_next;
+  else if (sl->lru_head == client)
+    sl->lru_head = client->lru_next;
+
+  if (client->lru_next)
+    client->lru_next->lru_prev = client->lru_prev;
+  else if (sl->lru_tail == client)
+    sl->lru_tail = client->lru_prev;
+
+  client->lru_prev = NULL;
+  client->lru_next = NULL;
+}
+
+static void lru_push_head(client_t *client) {
+  server_loop_t *sl = client->owner;
+
+  client->lru_prev = NULL;
+  client->lru_next = sl->lru_head;
+
+  if (sl->lru_head)
+    sl->lru_head->lru_prev = client;
+  else
+    sl->lru_tail = client;
+
+  sl->lru_head = client;
+}
+
 static void add_client_to_list(client_t *client) {
-  client->next = ecewo_server.client_list_head;
-  ecewo_server.client_list_head = client;
+  lru_push_head(client);
 }
 
 static void remove_client_from_list(client_t *client) {
   if (!client)
     return;
 
-  if (ecewo_server.client_list_head == client) {
-    ecewo_server.client_list_head = client->next;
+  lru_unlink(client);
+}
+
+void client_touch(client_t *client) {
+  if (!client || client->closing)
     return;
-  }
 
-  client_t *current = ecewo_server.client_list_head;
-  while (current && current->next != client) {
-    current = current->next;
+  client->last_activity = uv_now(client->owner->loop);
+
+  if (client->owner->lru_head == client)
+    return;
+
+  lru_unlink(client);
+  lru_push_head(client);
+}
+
+static void client_free(client_t *client) {
+  client_pool_release(&client->owner->clients, client);
+}
+
+static void on_connection(uv_stream_t *server, int status);
+
+static uint64_t now_ms(void) {
+  return uv_hrtime() / 1000000;
+}
+
+static bool loop_accept_paused(const server_loop_t *sl) {
+  return atomic_load_explicit(&sl->accept_paused, memory_order_relaxed);
+}
+
+// Starts or ends a pause. The sequence is odd meanwhile, so that
+// loop_paused_ms() on another thread never mixes the two states.
+static void loop_set_paused(server_loop_t *sl, bool paused) {
+  uint64_t now = now_ms();
+
+  atomic_fetch_add_explicit(&sl->pause_seq, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  if (paused) {
+    atomic_store_explicit(&sl->pause_started, now, memory_order_relaxed);
+  } else {
+    uint64_t started = atomic_load_explicit(&sl->pause_started, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sl->paused_ms, now - started, memory_order_relaxed);
   }
 
-  if (current)
-    current->next = client->next;
+  atomic_store_explicit(&sl->accept_paused, paused, memory_order_relaxed);
+  atomic_fetch_add_explicit(&sl->pause_seq, 1, memory_order_release);
+}
+
+// The pending connection is still waiting in uv_accept(),
+// accepting it also restarts polling the listener
+static void loop_resume_accept(server_loop_t *sl) {
+  loop_set_paused(sl, false);
+
+  LOG_DEBUG("Accepting connections again on loop %" PRIu16, sl->id);
+
+  if (sl->server && !sl->shutdown_requested)
+    on_connection((uv_stream_t *)sl->server, 0);
+}
+
+// Takes the client out of the bookkeeping of its loop
+static void client_detach(client_t *client) {
+  server_loop_t *sl = client->owner;
+
+  remove_client_from_list(client);
+  sl->active_connections--;
+  sse_client_closed(client);
+  ws_client_closed(client);
+  pipeline_release(client);
+
+  if (loop_accept_paused(sl) && sl->active_connections <= ACCEPT_LOW_WATERMARK)
+    loop_resume_accept(sl);
 }
 
 static void on_client_closed(uv_handle_t *handle) {
   client_t *client = (client_t *)handle->data;
 
-  if (client && client->taken_over) {
-    remove_client_from_list(client);
-    ecewo_server.active_connections--;
-    free(client);
-    return;
-  }
-
   if (client) {
-    remove_client_from_list(client);
-    ecewo_server.active_connections--;
+    client_detach(client);
 
     if (client->connection_arena)
       arena_return(client->connection_arena);
 
-    free(client);
+    client_free(client);
   }
 }
 
-static void close_client(client_t *client) {
+static void client_cancel_timeouts(client_t *client) {
+  timer_wheel_t *wheel = &client->owner->wheel;
+  timer_wheel_cancel(wheel, &client->read_timeout);
+  timer_wheel_cancel(wheel, &client->write_timeout);
+}
+
+void close_client(client_t *client) {
   if (!client)
     return;
 
+  client_cancel_timeouts(client);
+
   if (client->closing || uv_is_closing((uv_handle_t *)&client->handle)) {
     // Handle is already closing/closed,
     // but client struct might still be in list
     if (!client->closing) {
       client->closing = true;
-      remove_client_from_list(client);
-      ecewo_server.active_connections--;
+      client_detach(client);
 
       if (client->connection_arena)
         arena_return(client->connection_arena);
 
-      free(client);
+      client_free(client);
     }
     return;
   }
 
   client->closing = true;
   uv_read_stop((uv_stream_t *)&client->handle);
+
+  // The thread pool may still be writing to the socket,
+  // it is closed by client_fs_done()
+  if (client->fs_busy)
+    return;
+
   uv_close((uv_handle_t *)&client->handle, on_client_closed);
 }
 
-static void cleanup_idle_connections(uv_timer_t *handle) {
-  (void)handle;
+bool client_fs_done(client_t *client) {
+  client->fs_busy = false;
 
-  if (ecewo_server.shutdown_requested)
-    return;
+  if (!client->closing)
+    return true;
 
-  uint64_t now = uv_now(ecewo_server.loop);
-  client_t *current = ecewo_server.client_list_head;
+  if (!uv_is_closing((uv_handle_t *)&client->handle))
+    uv_close((uv_handle_t *)&client->handle, on_client_closed);
 
-  while (current) {
-    client_t *next = current->next;
+  return false;
+}
 
-    if (current->taken_over) {
-      current = next;
-      continue;
-    }
+static void on_read_timeout(wheel_entry_t *entry) {
+  client_t *client = wheel_entry_owner(entry, client_t, read_timeout);
 
-    if (current->keep_alive_enabled && !current->closing) {
-      uint64_t idle_time = now - current->last_activity;
+  if (client->read_phase == TIMEOUT_IDLE)
+    LOG_DEBUG("Idle timeout - closing connection");
+  else
+    LOG_ERROR("Request timeout - closing connection");
 
-      if (idle_time > IDLE_TIMEOUT_MS)
-        close_client(current);
-    }
-    current = next;
-  }
+  close_client(client);
 }
 
-static int start_cleanup_timer(void) {
-  ecewo_server.cleanup_timer = malloc(sizeof(uv_timer_t));
-  if (!ecewo_server.cleanup_timer)
-    return -1;
+static void on_write_timeout(wheel_entry_t *entry) {
+  client_t *client = wheel_entry_owner(entry, client_t, write_timeout);
 
-  if (uv_timer_init(ecewo_server.loop, ecewo_server.cleanup_timer) != 0) {
-    free(ecewo_server.cleanup_timer);
-    ecewo_server.cleanup_timer = NULL;
-    return -1;
+  LOG_ERROR("Write timeout - closing connection");
+  close_client(client);
+}
+
+void client_set_read_timeout(client_t *client, read_timeout_t phase) {
+  if (!client || client->closing || client->taken_over)
+    return;
+
+  uint64_t timeout;
+  uint64_t now = uv_now(client->owner->loop);
+
+  switch (phase) {
+  case TIMEOUT_HEADER:
+    client->request_start = now;
+    timeout = HEADER_TIMEOUT_MS;
+    break;
+
+  case TIMEOUT_REQUEST: {
+    // Counted from the first byte of the request
+    uint64_t elapsed = now - client->request_start;
+    timeout = elapsed < REQUEST_TIMEOUT_MS ? REQUEST_TIMEOUT_MS - elapsed : 0;
+    break;
   }
 
-  if (uv_timer_start(ecewo_server.cleanup_timer, cleanup_idle_connections,
-                     CLEANUP_INTERVAL_MS, CLEANUP_INTERVAL_MS)
-      != 0) {
-    uv_close((uv_handle_t *)ecewo_server.cleanup_timer, (uv_close_cb)free);
-    ecewo_server.cleanup_timer = NULL;
-    return -1;
+  case TIMEOUT_IDLE:
+  default:
+    timeout = IDLE_TIMEOUT_MS;
+    break;
   }
 
-  return 0;
+  client->read_phase = phase;
+  timer_wheel_schedule(&client->owner->wheel, &client->read_timeout, timeout);
 }
 
-static void stop_cleanup_timer(void) {
-  if (ecewo_server.cleanup_timer) {
-    uv_timer_stop(ecewo_server.cleanup_timer);
-    uv_close((uv_handle_t *)ecewo_server.cleanup_timer, (uv_close_cb)free);
-    ecewo_server.cleanup_timer = NULL;
-  }
+// Every completed write proves the peer is reading,
+// the deadline only covers the oldest pending one
+void client_write_started(client_t *client) {
+  if (client->writes_pending++ == 0 && !client->closing)
+    timer_wheel_schedule(&client->owner->wheel, &client->write_timeout, WRITE_TIMEOUT_MS);
+}
+
+void client_write_finished(client_t *client) {
+  if (client->writes_pending > 0)
+    client->writes_pending--;
+
+  // A connection over the write high watermark has to
+  // drain within the deadline set when it was paused
+  if (client->write_paused)
+    return;
+
+  if (client->writes_pending > 0 && !client->closing)
+    timer_wheel_schedule(&client->owner->wheel, &client->write_timeout, WRITE_TIMEOUT_MS);
+  else
+    timer_wheel_cancel(&client->owner->wheel, &client->write_timeout);
+}
+
+// The peer has WRITE_TIMEOUT_MS to drain its output to WRITE_LOW_WATERMARK,
+// finished writes do not move the deadline until then
+void client_pause_for_output(client_t *client) {
+  if (client->closing || client->taken_over)
+    return;
+
+  client->write_paused = true;
+  uv_read_stop((uv_stream_t *)&client->handle);
+  timer_wheel_schedule(&client->owner->wheel, &client->write_timeout, WRITE_TIMEOUT_MS);
+}
+
+// A long transfer that keeps moving is not a slow write
+void client_write_progress(client_t *client) {
+  if (client->writes_pending > 0 && !client->closing && !client->write_paused)
+    timer_wheel_schedule(&client->owner->wheel, &client->write_timeout, WRITE_TIMEOUT_MS);
 }
 
 void increment_async_work(void) {
+  server_loop_t *sl = get_server_loop();
+
   uint_fast16_t new_val = atomic_fetch_add_explicit(
-                              &ecewo_server.pending_async_work,
+                              &sl->pending_async_work,
                               1,
                               memory_order_relaxed)
       + 1;
@@ -221,28 +404,39 @@ void increment_async_work(void) {
 }
 
 void decrement_async_work(void) {
+  server_loop_t *sl = get_server_loop();
+
   uint_fast16_t prev = atomic_fetch_sub_explicit(
-      &ecewo_server.pending_async_work,
+      &sl->pending_async_work,
       1,
       memory_order_acq_rel);
 
   if (prev == 0) {
     LOG_ERROR("Async work counter underflow!");
-    atomic_store_explicit(&ecewo_server.pending_async_work, 0, memory_order_release);
+    atomic_store_explicit(&sl->pending_async_work, 0, memory_order_release);
     return;
   }
 
-  if (prev == 1 && ecewo_server.shutdown_requested) {
+  if (prev == 1 && sl == &ecewo_server.main && ecewo_server.shutdown_requested) {
     uv_async_send(&ecewo_server.shutdown_async);
   }
 }
 
-int get_pending_async_work(void) {
+static int loop_pending_async_work(server_loop_t *sl) {
   return (int)atomic_load_explicit(
-      &ecewo_server.pending_async_work,
+      &sl->pending_async_work,
       memory_order_acquire);
 }
 
+int get_pending_async_work(void) {
+  int total = loop_pending_async_work(&ecewo_server.main);
+
+  for (uint16_t i = 0; i < ecewo_server.worker_count; i++)
+    total += loop_pending_async_work(&ecewo_server.workers[i]);
+
+  return total;
+}
+
 static int client_connection_init(client_t *client) {
   if (!client)
     return -1;
@@ -263,6 +457,7 @@ static void client_parser_init(client_t *client) {
   client->persistent_settings.on_url = on_url_cb;
   client->persistent_settings.on_header_field = on_header_field_cb;
   client->persistent_settings.on_header_value = on_header_value_cb;
+  client->persistent_settings.on_header_value_complete = on_header_value_complete_cb;
   client->persistent_settings.on_method = on_method_cb;
   client->persistent_settings.on_body = on_body_cb;
   client->persistent_settings.on_headers_complete = on_headers_complete_cb;
@@ -277,157 +472,187 @@ static void client_parser_init(client_t *client) {
   client->parser_initialized = true;
 }
 
-static void client_context_init(client_t *client) {
-  if (!client || !client->connection_arena)
-    return;
+static void timer_unlink(timer_data_t *data) {
+  if (data->prev)
+    data->prev->next = data->next;
+  else
+    data->owner->timers = data->next;
 
-  if (!client->parser_initialized) {
-    client_parser_init(client);
-  }
+  if (data->next)
+    data->next->prev = data->prev;
 
-  http_context_init(&client->persistent_context,
-                    client->connection_arena,
-                    &client->persistent_parser,
-                    &client->persistent_settings);
+  data->prev = NULL;
+  data->next = NULL;
 }
 
-static void client_context_reset(client_t *client) {
-  if (!client || !client->connection_arena)
-    return;
+// Closes the timers of set_timeout() and set_interval() left on the loop
+static void loop_close_timers(server_loop_t *sl) {
+  while (sl->timers) {
+    timer_data_t *data = sl->timers;
+    uv_timer_t *timer = data->timer;
+
+    timer_unlink(data);
+    uv_timer_stop(timer);
+    timer->data = NULL;
+    free(data);
 
-  arena_reset(client->connection_arena);
+    uv_close((uv_handle_t *)timer, (uv_close_cb)free);
+  }
+}
 
-  llhttp_reset(&client->persistent_parser);
+static bool loop_owns_handle(const server_loop_t *sl, const uv_handle_t *handle) {
+  for (const client_t *client = sl->lru_head; client; client = client->lru_next) {
+    if ((const uv_handle_t *)&client->handle == handle)
+      return true;
+  }
 
-  http_context_init(&client->persistent_context,
-                    client->connection_arena,
-                    &client->persistent_parser,
-                    &client->persistent_settings);
+  return false;
 }
 
+// The connections and timers of the loop are closed through their own
+// lists, what is left belongs to the loop itself, plugins or the application
 static void close_walk_cb(uv_handle_t *handle, void *arg) {
-  (void)arg;
+  server_loop_t *sl = (server_loop_t *)arg;
 
   if (uv_is_closing(handle))
     return;
 
-  if (handle->type == UV_TCP) {
-    if (handle != (uv_handle_t *)ecewo_server.server) {
-      client_t *client = (client_t *)handle->data;
-      if (client)
-        close_client(client);
-    }
-  } else if (handle->type == UV_TIMER) {
-    if (handle != (uv_handle_t *)ecewo_server.cleanup_timer) {
-      uv_timer_stop((uv_timer_t *)handle);
-      timer_data_t *data = (timer_data_t *)handle->data;
-      if (data)
-        free(data);
-      uv_close(handle, (uv_close_cb)free);
-    }
-  } else if (handle->type == UV_SIGNAL) {
+  if (handle == (uv_handle_t *)sl->server)
+    return;
+
+  // A client waiting for the thread pool is closed by client_fs_done()
+  if (loop_owns_handle(sl, handle))
+    return;
+
+  if (handle->type == UV_SIGNAL)
     uv_signal_stop((uv_signal_t *)handle);
-    uv_close(handle, NULL);
-  } else {
-    uv_close(handle, NULL);
-  }
+
+  uv_close(handle, NULL);
 }
 
 static void on_server_closed(uv_handle_t *handle) {
-  (void)handle;
-  if (ecewo_server.server) {
-    free(ecewo_server.server);
-    ecewo_server.server = NULL;
-    ecewo_server.server_closed = 1;
+  server_loop_t *sl = (server_loop_t *)handle->data;
+  if (sl && sl->server) {
+    free(sl->server);
+    sl->server = NULL;
+    sl->server_closed = 1;
   }
 }
 
-void server_shutdown(void) {
-  if (ecewo_server.shutdown_requested)
-    return;
-
-  ecewo_server.shutdown_requested = 1;
-  ecewo_server.running = 0;
-
-  if (ecewo_server.shutdown_callback)
-    ecewo_server.shutdown_callback();
+// Stops accepting and closes every connection of the loop
+static void loop_close_connections(server_loop_t *sl) {
+  sl->shutdown_requested = 1;
 
-  stop_cleanup_timer();
+  if (sl->server && !uv_is_closing((uv_handle_t *)sl->server))
+    uv_close((uv_handle_t *)sl->server, on_server_closed);
 
-  const char *is_worker = getenv("ECEWO_WORKER");
-  bool in_cluster = (is_worker && strcmp(is_worker, "1") == 0);
-
-  if (!in_cluster) {
-    if (!uv_is_closing((uv_handle_t *)&ecewo_server.sigint_handle)) {
-      uv_signal_stop(&ecewo_server.sigint_handle);
-      uv_close((uv_handle_t *)&ecewo_server.sigint_handle, NULL);
-    }
-
-    if (!uv_is_closing((uv_handle_t *)&ecewo_server.sigterm_handle)) {
-      uv_signal_stop(&ecewo_server.sigterm_handle);
-      uv_close((uv_handle_t *)&ecewo_server.sigterm_handle, NULL);
-    }
-  }
-
-  if (ecewo_server.server && !uv_is_closing((uv_handle_t *)ecewo_server.server))
-    uv_close((uv_handle_t *)ecewo_server.server, on_server_closed);
-
-  client_t *current = ecewo_server.client_list_head;
+  // Coldest connections first
+  client_t *current = sl->lru_tail;
   while (current) {
-    client_t *next = current->next;
+    client_t *prev = current->lru_prev;
     close_client(current);
-    current = next;
+    current = prev;
   }
 
+  channel_loop_close(sl);
+  pipeline_loop_close(sl);
+  timer_wheel_close(&sl->wheel);
+  date_cache_stop(&sl->date);
+}
+
+// Runs the loop until its async work and handles are finished
+static void loop_drain(server_loop_t *sl) {
   // STEP 1: Wait for external async work (Postgres, Redis, etc.)
-  uint64_t start = uv_now(ecewo_server.loop);
+  uint64_t start = uv_now(sl->loop);
 
-  while (get_pending_async_work() > 0) {
-    if ((uv_now(ecewo_server.loop) - start) >= SHUTDOWN_TIMEOUT_MS) {
+  while (loop_pending_async_work(sl) > 0) {
+    if ((uv_now(sl->loop) - start) >= SHUTDOWN_TIMEOUT_MS) {
       LOG_DEBUG("External async timeout: %d operations abandoned",
-                get_pending_async_work());
+                loop_pending_async_work(sl));
       break;
     }
-    uv_run(ecewo_server.loop, UV_RUN_ONCE);
+    uv_run(sl->loop, UV_RUN_ONCE);
   }
 
   // STEP 2: Close all remaining handles
-  uv_walk(ecewo_server.loop, close_walk_cb, NULL);
+  loop_close_timers(sl);
+  uv_walk(sl->loop, close_walk_cb, sl);
 
   // STEP 3: Wait for libuv cleanup (timers, work queue, etc.)
-  start = uv_now(ecewo_server.loop);
+  start = uv_now(sl->loop);
 
-  while (uv_loop_alive(ecewo_server.loop)) {
-    if ((uv_now(ecewo_server.loop) - start) >= SHUTDOWN_TIMEOUT_MS) {
+  while (uv_loop_alive(sl->loop)) {
+    if ((uv_now(sl->loop) - start) >= SHUTDOWN_TIMEOUT_MS) {
       LOG_DEBUG("libuv cleanup timeout, forcing close");
       break;
     }
-    uv_run(ecewo_server.loop, UV_RUN_ONCE);
+    uv_run(sl->loop, UV_RUN_ONCE);
   }
 
   // STEP 4: Cleanup taken-over connections
   // Some clients may have been taken over by plugins (e.g., WebSocket)
   // Their handles are already closed, but client structs are still in the list
-  current = ecewo_server.client_list_head;
+  client_t *current = sl->lru_tail;
   while (current) {
-    client_t *next = current->next;
+    client_t *prev = current->lru_prev;
 
     if (uv_is_closing((uv_handle_t *)&current->handle) && !current->closing) {
-      remove_client_from_list(current);
-      ecewo_server.active_connections--;
+      client_detach(current);
 
       if (current->connection_arena)
         arena_return(current->connection_arena);
 
-      free(current);
+      client_free(current);
+    }
+
+    current = prev;
+  }
+
+  if (sl->active_connections > 0)
+    LOG_DEBUG("Warning: %d connections not properly closed on loop %" PRIu16,
+              sl->active_connections, sl->id);
+}
+
+void server_shutdown(void) {
+  if (ecewo_server.shutdown_requested)
+    return;
+
+  // Shutdown always runs on the main loop
+  if (current_loop) {
+    uv_async_send(&ecewo_server.shutdown_async);
+    return;
+  }
+
+  ecewo_server.shutdown_requested = 1;
+  ecewo_server.running = 0;
+
+  if (ecewo_server.shutdown_callback)
+    ecewo_server.shutdown_callback();
+
+  const char *is_worker = getenv("ECEWO_WORKER");
+  bool in_cluster = (is_worker && strcmp(is_worker, "1") == 0);
+
+  if (!in_cluster) {
+    if (!uv_is_closing((uv_handle_t *)&ecewo_server.sigint_handle)) {
+      uv_signal_stop(&ecewo_server.sigint_handle);
+      uv_close((uv_handle_t *)&ecewo_server.sigint_handle, NULL);
     }
 
-    current = next;
+    if (!uv_is_closing((uv_handle_t *)&ecewo_server.sigterm_handle)) {
+      uv_signal_stop(&ecewo_server.sigterm_handle);
+      uv_close((uv_handle_t *)&ecewo_server.sigterm_handle, NULL);
+    }
   }
 
-  if (ecewo_server.active_connections > 0)
-    LOG_DEBUG("Warning: %d connections not properly closed",
-              ecewo_server.active_connections);
+  // Worker loops drain themselves on their own threads
+  for (uint16_t i = 0; i < ecewo_server.worker_count; i++)
+    uv_async_send(&ecewo_server.workers[i].stop_async);
+
+  loop_close_connections(&ecewo_server.main);
+  loop_drain(&ecewo_server.main);
+
+  for (uint16_t i = 0; i < ecewo_server.worker_count; i++)
+    uv_thread_join(&ecewo_server.workers[i].thread);
 }
 
 static void router_cleanup(void) {
@@ -437,6 +662,9 @@ static void router_cleanup(void) {
     global_route_trie = NULL;
   }
 
+  static_routes_free();
+  response_cache_destroy();
+  channel_destroy();
   reset_middleware();
 }
 
@@ -460,12 +688,19 @@ int connection_takeover(Res *res, const TakeoverConfig *config) {
   }
 
   uv_read_stop((uv_stream_t *)handle);
+  client_cancel_timeouts(client);
 
   client->taken_over = true;
   client->takeover_user_data = config->user_data;
 
   res->replied = true;
 
+  // The plugin owns the connection now, the exchange
+  // is released when the connection closes
+  exchange_t *exchange = (exchange_t *)res->exchange;
+  if (exchange)
+    exchange->state = EXCHANGE_DONE;
+
   if (config->read_cb && config->alloc_cb) {
     handle->data = config->user_data;
 
@@ -485,6 +720,17 @@ uv_tcp_t *get_client_handle(Res *res) {
   return res ? res->client_socket : NULL;
 }
 
+// Removes the file of a Unix domain socket, stale or our own
+static void remove_stale_socket(const char *path) {
+#ifndef _WIN32
+  struct stat st;
+  if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+#else
+  (void)path;
+#endif
+}
+
 static void server_cleanup(void) {
   if (!ecewo_server.initialized)
     return;
@@ -492,31 +738,50 @@ static void server_cleanup(void) {
   if (!ecewo_server.shutdown_requested)
     server_shutdown();
 
-  stop_cleanup_timer();
+  server_loop_t *sl = &ecewo_server.main;
+
   router_cleanup();
+
+  for (uint16_t i = 0; i < ecewo_server.worker_count; i++) {
+    arena_pool_free(ecewo_server.workers[i].arena_pool);
+    client_pool_destroy(&ecewo_server.workers[i].clients);
+    free(ecewo_server.workers[i].loop);
+  }
+
+  free(ecewo_server.workers);
+  ecewo_server.workers = NULL;
+  ecewo_server.worker_count = 0;
+
   arena_pool_destroy();
-  destroy_date_cache();
 
-  uint64_t start = uv_now(ecewo_server.loop);
+  uint64_t start = uv_now(sl->loop);
 
-  while (uv_loop_alive(ecewo_server.loop)) {
-    if ((uv_now(ecewo_server.loop) - start) >= CLEANUP_TIMEOUT_MS) {
+  while (uv_loop_alive(sl->loop)) {
+    if ((uv_now(sl->loop) - start) >= CLEANUP_TIMEOUT_MS) {
       LOG_DEBUG("Cleanup timeout: forcing loop close");
       break;
     }
 
-    uv_run(ecewo_server.loop, UV_RUN_NOWAIT);
+    uv_run(sl->loop, UV_RUN_NOWAIT);
   }
 
-  int result = uv_loop_close(ecewo_server.loop);
+  int result = uv_loop_close(sl->loop);
   if (result != 0) {
-    uv_walk(ecewo_server.loop, close_walk_cb, NULL);
-    uv_run(ecewo_server.loop, UV_RUN_NOWAIT);
-    uv_loop_close(ecewo_server.loop);
+    loop_close_timers(sl);
+    uv_walk(sl->loop, close_walk_cb, sl);
+    uv_run(sl->loop, UV_RUN_NOWAIT);
+    uv_loop_close(sl->loop);
   }
 
-  if (ecewo_server.server && !ecewo_server.server_closed)
-    free(ecewo_server.server);
+  if (sl->server && !sl->server_closed)
+    free(sl->server);
+
+  client_pool_destroy(&sl->clients);
+
+  if (ecewo_server.unix_path) {
+    remove_stale_socket(ecewo_server.unix_path);
+    free(ecewo_server.unix_path);
+  }
 
   memset(&ecewo_server, 0, sizeof(ecewo_server));
 }
@@ -561,8 +826,8 @@ int server_init(void) {
 
   memset(&ecewo_server, 0, sizeof(ecewo_server));
 
-  ecewo_server.loop = uv_default_loop();
-  if (!ecewo_server.loop)
+  ecewo_server.main.loop = uv_default_loop();
+  if (!ecewo_server.main.loop)
     return SERVER_INIT_FAILED;
 
   arena_pool_init();
@@ -572,13 +837,11 @@ int server_init(void) {
     return SERVER_INIT_FAILED;
   }
 
-  init_date_cache();
-
   const char *is_worker = getenv("ECEWO_WORKER");
   bool in_cluster = (is_worker && strcmp(is_worker, "1") == 0);
 
   if (!in_cluster) {
-    if (uv_signal_init(ecewo_server.loop, &ecewo_server.sigint_handle) != 0 || uv_signal_init(ecewo_server.loop, &ecewo_server.sigterm_handle) != 0) {
+    if (uv_signal_init(ecewo_server.main.loop, &ecewo_server.sigint_handle) != 0 || uv_signal_init(ecewo_server.main.loop, &ecewo_server.sigterm_handle) != 0) {
       return SERVER_INIT_FAILED;
     }
 
@@ -586,10 +849,16 @@ int server_init(void) {
     uv_signal_start(&ecewo_server.sigterm_handle, on_signal, SIGTERM);
   }
 
-  if (uv_async_init(ecewo_server.loop, &ecewo_server.shutdown_async, on_async_shutdown) != 0)
+#ifndef _WIN32
+  // A client that closes during a long write must not end the process,
+  // the write fails with EPIPE instead
+  signal(SIGPIPE, SIG_IGN);
+#endif
+
+  if (uv_async_init(ecewo_server.main.loop, &ecewo_server.shutdown_async, on_async_shutdown) != 0)
     return SERVER_INIT_FAILED;
 
-  atomic_store_explicit(&ecewo_server.pending_async_work, 0, memory_order_relaxed);
+  atomic_store_explicit(&ecewo_server.main.pending_async_work, 0, memory_order_relaxed);
 
   if (router_init() != 0)
     return SERVER_INIT_FAILED;
@@ -600,24 +869,13 @@ int server_init(void) {
   return SERVER_OK;
 }
 
-static void on_request_timeout(uv_timer_t *handle) {
-  client_t *client = (client_t *)handle->data;
-
-  LOG_ERROR("Request timeout - closing connection");
-
-  if (client->connection_arena)
-    arena_reset(client->connection_arena);
-
-  close_client(client);
-}
-
 static void on_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
   client_t *client = (client_t *)stream->data;
 
   if (!client || client->closing)
     return;
 
-  if (ecewo_server.shutdown_requested) {
+  if (client->owner->shutdown_requested) {
     close_client(client);
     return;
   }
@@ -630,62 +888,55 @@ static void on_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
   if (nread == 0)
     return; // EAGAIN/EWOULDBLOCK
 
-  client->last_activity = uv_now(ecewo_server.loop);
+  client_touch(client);
 
   // Initialize parser only once per connection
-  if (!client->parser_initialized) {
+  if (!client->parser_initialized)
     client_parser_init(client);
-    client_context_init(client);
-    client->request_in_progress = false;
-  }
-
-  // Only reset context when starting a NEW request
-  // Don't reset if we're continuing a partial request
-  if (!client->request_in_progress) {
-    client_context_reset(client);
-    client->request_in_progress = true;
-
-    if (!client->request_timeout_timer) {
-      client->request_timeout_timer = malloc(sizeof(uv_timer_t));
-      if (client->request_timeout_timer) {
-        uv_timer_init(ecewo_server.loop, client->request_timeout_timer);
-        client->request_timeout_timer->data = client;
-      }
-    }
 
-    if (client->request_timeout_timer) {
-      uv_timer_start(client->request_timeout_timer,
-                     on_request_timeout,
-                     REQUEST_TIMEOUT_MS,
-                     0 // Non-repeating
-      );
-    }
-  }
+  // First bytes of a new request
+  if (client->read_phase == TIMEOUT_IDLE)
+    client_set_read_timeout(client, TIMEOUT_HEADER);
 
   if (buf && buf->base) {
+    // Responses completed while parsing this batch
+    // are written together by pipeline_flush()
+    client->reading_batch = true;
     int result = router(client, buf->base, (size_t)nread);
+    client->reading_batch = false;
 
     switch (result) {
     case REQUEST_KEEP_ALIVE:
       client->keep_alive_enabled = true;
-      client->request_in_progress = false;
-      break;
-
-    case REQUEST_CLOSE:
-      close_client(client);
       break;
 
     case REQUEST_PENDING:
-      // It may be PARSE_INCOMPLETE, need to wait for more data
-      // or may be an async operation
-      // request_in_progress should stay true
-      // don not close, do not reset
+      // PARSE_INCOMPLETE, need to wait for more data
       break;
 
+    case REQUEST_CLOSE:
     default:
-      close_client(client);
+      // Answer what was received, then close
+      client->close_after_write = true;
+      uv_read_stop(stream);
       break;
     }
+
+    // Headers are in, the rest is bounded by the request deadline
+    if (client->read_phase == TIMEOUT_HEADER
+        && (!client->parsing || client->persistent_context.headers_complete))
+      client_set_read_timeout(client, TIMEOUT_REQUEST);
+
+    if (!client->close_after_write && !client->taken_over
+        && client->exchange_count >= MAX_PIPELINE_DEPTH) {
+      uv_read_stop(stream);
+      client->read_paused = true;
+    }
+
+    pipeline_flush(client);
+
+    if (router_keep_requests(client, buf->base, (size_t)nread) != 0)
+      close_client(client);
   }
 }
 
@@ -693,99 +944,301 @@ static void alloc_buffer(uv_handle_t *handle, size_t suggested_size, uv_buf_t *b
   (void)suggested_size;
   client_t *client = (client_t *)handle->data;
 
-  if (!client || client->closing || ecewo_server.shutdown_requested) {
+  if (!client || client->closing || client->owner->shutdown_requested) {
     buf->base = NULL;
     buf->len = 0;
     return;
   }
 
-  *buf = client->read_buf;
+#if SHARED_READ_BUFFER
+  *buf = uv_buf_init(client->owner->read_buffer, READ_BUFFER_SIZE);
+#else
+  *buf = uv_buf_init(client->buffer, READ_BUFFER_SIZE);
+#endif
+}
+
+void client_resume_reading(client_t *client) {
+  if (!client || client->closing || client->close_after_write
+      || client->read_paused || client->write_paused)
+    return;
+
+  uv_read_start((uv_stream_t *)&client->handle, alloc_buffer, on_read);
+}
+
+// Closes the least recently active connection that has no request
+// in progress. Only a few clients at the cold end are looked at.
+static bool loop_evict_idle(server_loop_t *sl) {
+#if EVICT_ON_MAX_CONNECTIONS
+  int budget = 8;
+
+  for (client_t *client = sl->lru_tail; client && budget > 0;
+       client = client->lru_prev, budget--) {
+    if (client->closing || client->taken_over || client->exchange_head
+        || client->read_phase != TIMEOUT_IDLE)
+      continue;
+
+    LOG_DEBUG("Max connections (%d) reached, evicting an idle connection", MAX_CONNECTIONS);
+    close_client(client);
+    return true;
+  }
+#else
+  (void)sl;
+#endif
+
+  return false;
 }
 
+// Prepares a handle of the same kind as the listener of the loop
+static int loop_stream_init(server_loop_t *sl, stream_handle_t *stream) {
+  if (sl->unix_socket)
+    return uv_pipe_init(sl->loop, &stream->pipe, 0);
+
+  return uv_tcp_init(sl->loop, &stream->tcp);
+}
+
+#if OVERLOAD_RESPONSE
+#define OVERLOAD_STR(x) #x
+#define OVERLOAD_XSTR(x) OVERLOAD_STR(x)
+
+static const char overload_response[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                        "Retry-After: " OVERLOAD_XSTR(OVERLOAD_RETRY_AFTER) "\r\n"
+                                        "Content-Length: 0\r\n"
+                                        "Connection: close\r\n"
+                                        "\r\n";
+
+// Accepts the connection only to answer 503 and close it,
+// the handle is not a client and is not counted
+static void reject_connection(server_loop_t *sl, uv_stream_t *server) {
+  stream_handle_t *handle = malloc(sizeof(stream_handle_t));
+  if (!handle)
+    return;
+
+  if (loop_stream_init(sl, handle) != 0) {
+    free(handle);
+    return;
+  }
+
+  ((uv_handle_t *)handle)->data = NULL;
+
+  if (uv_accept(server, (uv_stream_t *)handle) == 0) {
+    uv_buf_t buf = uv_buf_init((char *)overload_response, sizeof(overload_response) - 1);
+    uv_try_write((uv_stream_t *)handle, &buf, 1);
+    atomic_fetch_add_explicit(&sl->rejected_connections, 1, memory_order_relaxed);
+  }
+
+  uv_close((uv_handle_t *)handle, (uv_close_cb)free);
+}
+#endif
+
 static void on_connection(uv_stream_t *server, int status) {
-  (void)server;
+  server_loop_t *sl = (server_loop_t *)server->data;
 
   if (status < 0) {
     LOG_ERROR("Connection error");
     return;
   }
 
-  if (ecewo_server.shutdown_requested)
+  if (sl->shutdown_requested)
     return;
 
-  if (ecewo_server.active_connections >= MAX_CONNECTIONS) {
-    LOG_DEBUG("Max connections (%d) reached", MAX_CONNECTIONS);
+  if (loop_accept_paused(sl))
+    return;
+
+  if (sl->active_connections >= MAX_CONNECTIONS && !loop_evict_idle(sl)) {
+#if OVERLOAD_RESPONSE
+    reject_connection(sl, server);
+#else
+    // Leaving the connection unaccepted stops libuv from polling
+    // the listener, it stays in the backlog until we resume
+    LOG_DEBUG("Max connections (%d) reached, pausing accept on loop %" PRIu16,
+              MAX_CONNECTIONS, sl->id);
+    loop_set_paused(sl, true);
+#endif
     return;
   }
 
-  client_t *client = calloc(1, sizeof(client_t));
+  client_t *client = client_pool_acquire(&sl->clients);
   if (!client)
     return;
 
-  client->last_activity = uv_now(ecewo_server.loop);
+  client->owner = sl;
+  client->last_activity = uv_now(sl->loop);
   client->keep_alive_enabled = false;
-  client->next = NULL;
   client->parser_initialized = false;
-  client->request_in_progress = false;
   client->connection_arena = NULL;
+  client->read_timeout.cb = on_read_timeout;
+  client->write_timeout.cb = on_write_timeout;
 
   if (client_connection_init(client) != 0) {
-    free(client);
+    client_free(client);
     return;
   }
 
-  if (uv_tcp_init(ecewo_server.loop, &client->handle) != 0) {
+  if (loop_stream_init(sl, &client->handle) != 0) {
     if (client->connection_arena)
       arena_return(client->connection_arena);
 
-    free(client);
+    client_free(client);
     return;
   }
 
-  client->handle.data = client;
-  client->read_buf = uv_buf_init(client->buffer, READ_BUFFER_SIZE);
+  ((uv_handle_t *)&client->handle)->data = client;
+
+  // Counted before anything can fail, closing the
+  // client below takes it off the count again
+  add_client_to_list(client);
+  sl->active_connections++;
 
   if (uv_accept(server, (uv_stream_t *)&client->handle) == 0) {
-    uv_tcp_nodelay(&client->handle, 1);
+    if (!sl->unix_socket)
+      uv_tcp_nodelay(&client->handle.tcp, 1);
 
-    if (uv_read_start((uv_stream_t *)&client->handle, alloc_buffer, on_read) == 0) {
-      add_client_to_list(client);
-      ecewo_server.active_connections++;
-    } else {
+    if (uv_read_start((uv_stream_t *)&client->handle, alloc_buffer, on_read) == 0)
+      client_set_read_timeout(client, TIMEOUT_IDLE);
+    else
       close_client(client);
-    }
   } else {
     close_client(client);
   }
 }
 
-int server_listen(uint16_t port) {
-  if (port == 0) {
-    LOG_ERROR("Invalid port %" PRIu16 " (must be 1-65535)", port);
-    return SERVER_INVALID_PORT;
+// Binds a listener on the given loop, the handle data points to the loop
+// Starts accepting on the bound listener of the loop
+static int loop_start_listening(server_loop_t *sl) {
+  if (uv_listen((uv_stream_t *)sl->server, LISTEN_BACKLOG, on_connection) != 0) {
+    uv_close((uv_handle_t *)sl->server, on_server_closed);
+    return SERVER_LISTEN_FAILED;
   }
 
-  if (!ecewo_server.initialized)
-    return SERVER_NOT_INITIALIZED;
+  if (timer_wheel_init(&sl->wheel, sl->loop) != 0)
+    LOG_DEBUG("Failed to start the timer wheel");
 
-  if (ecewo_server.running)
-    return SERVER_ALREADY_RUNNING;
+  // Responses fall back to formatting the date themselves
+  if (date_cache_start(&sl->date, sl->loop) != 0)
+    LOG_DEBUG("Failed to start the date cache");
+
+  if (pipeline_loop_init(sl) != 0)
+    LOG_DEBUG("Failed to start write coalescing");
+
+  // Grows on demand when the first connections exceed it
+  if (client_pool_reserve(&sl->clients, CLIENT_POOL_PREWARM) != 0)
+    LOG_DEBUG("Failed to pre-allocate the client pool");
+
+  return SERVER_OK;
+}
 
-  ecewo_server.server = malloc(sizeof(uv_tcp_t));
-  if (!ecewo_server.server)
+// Binds a listener on the given loop, the handle data points to the loop
+static int loop_listen(server_loop_t *sl, uint16_t port, unsigned int flags) {
+  sl->server = malloc(sizeof(stream_handle_t));
+  if (!sl->server)
     return SERVER_OUT_OF_MEMORY;
 
-  if (uv_tcp_init(ecewo_server.loop, ecewo_server.server) != 0) {
-    free(ecewo_server.server);
-    ecewo_server.server = NULL;
+  if (uv_tcp_init(sl->loop, &sl->server->tcp) != 0) {
+    free(sl->server);
+    sl->server = NULL;
     return SERVER_INIT_FAILED;
   }
 
-  uv_tcp_simultaneous_accepts(ecewo_server.server, 1);
+  sl->server->tcp.data = sl;
+  uv_tcp_simultaneous_accepts(&sl->server->tcp, 1);
 
   struct sockaddr_in addr;
   uv_ip4_addr("0.0.0.0", port, &addr);
 
+  if (uv_tcp_bind(&sl->server->tcp, (const struct sockaddr *)&addr, flags) != 0) {
+    uv_close((uv_handle_t *)sl->server, on_server_closed);
+    LOG_ERROR("Failed to bind to port %" PRIu16 " (may be in use)", port);
+    return SERVER_BIND_FAILED;
+  }
+
+  int result = loop_start_listening(sl);
+  if (result != SERVER_OK)
+    LOG_ERROR("Failed to listen on port %" PRIu16, port);
+
+  return result;
+}
+
+// A leading '@' selects the Linux abstract namespace
+static int pipe_bind(uv_pipe_t *pipe, const char *path) {
+  if (path[0] != '@')
+    return uv_pipe_bind(pipe, path);
+
+#if UV_VERSION_HEX >= 0x012E00
+  char name[108];
+  size_t len = strlen(path);
+
+  if (len > sizeof(name))
+    return UV_ENAMETOOLONG;
+
+  name[0] = '\0';
+  memcpy(name + 1, path + 1, len - 1);
+
+  return uv_pipe_bind2(pipe, name, len, 0);
+#else
+  return UV_ENOTSUP;
+#endif
+}
+
+static int loop_listen_unix(server_loop_t *sl, const char *path, int mode) {
+  sl->server = malloc(sizeof(stream_handle_t));
+  if (!sl->server)
+    return SERVER_OUT_OF_MEMORY;
+
+  if (uv_pipe_init(sl->loop, &sl->server->pipe, 0) != 0) {
+    free(sl->server);
+    sl->server = NULL;
+    return SERVER_INIT_FAILED;
+  }
+
+  sl->server->pipe.data = sl;
+  sl->unix_socket = true;
+
+  bool abstract = path[0] == '@';
+  if (!abstract)
+    remove_stale_socket(path);
+
+  int result = pipe_bind(&sl->server->pipe, path);
+  if (result != 0) {
+    uv_close((uv_handle_t *)sl->server, on_server_closed);
+    LOG_ERROR("Failed to bind to %s: %s", path, uv_strerror(result));
+    return SERVER_BIND_FAILED;
+  }
+
+  // Abstract sockets have no file to protect
+  if (mode != 0 && !abstract) {
+#ifdef _WIN32
+    uv_pipe_chmod(&sl->server->pipe, UV_READABLE | UV_WRITABLE);
+#else
+    if (chmod(path, (mode_t)mode) != 0)
+      LOG_ERROR("Failed to set the permissions of %s", path);
+#endif
+  }
+
+  result = loop_start_listening(sl);
+  if (result != SERVER_OK)
+    LOG_ERROR("Failed to listen on %s", path);
+
+  return result;
+}
+
+static void print_listening(uint16_t port) {
+  const char *is_worker = getenv("ECEWO_WORKER");
+  if (!is_worker || strcmp(is_worker, "1") != 0)
+    printf("Server listening on http://localhost:%" PRIu16 "\n", port);
+}
+
+int server_listen(uint16_t port) {
+  if (port == 0) {
+    LOG_ERROR("Invalid port %" PRIu16 " (must be 1-65535)", port);
+    return SERVER_INVALID_PORT;
+  }
+
+  if (!ecewo_server.initialized)
+    return SERVER_NOT_INITIALIZED;
+
+  if (ecewo_server.running)
+    return SERVER_ALREADY_RUNNING;
+
   const char *is_test = getenv("ECEWO_TEST_MODE");
   unsigned int flags = 0;
 
@@ -794,37 +1247,206 @@ int server_listen(uint16_t port) {
     flags = UV_TCP_REUSEPORT;
 #endif
 
-  if (uv_tcp_bind(ecewo_server.server, (const struct sockaddr *)&addr, flags) != 0) {
-    uv_close((uv_handle_t *)ecewo_server.server, on_server_closed);
-    LOG_ERROR("Failed to bind to port %" PRIu16 " (may be in use)", port);
-    return SERVER_BIND_FAILED;
-  }
+  int result = loop_listen(&ecewo_server.main, port, flags);
+  if (result != SERVER_OK)
+    return result;
 
-  if (uv_listen((uv_stream_t *)ecewo_server.server, LISTEN_BACKLOG, on_connection) != 0) {
-    uv_close((uv_handle_t *)ecewo_server.server, on_server_closed);
-    LOG_ERROR("Failed to listen on port %" PRIu16, port);
-    return SERVER_LISTEN_FAILED;
+  ecewo_server.running = 1;
+  print_listening(port);
+
+  return SERVER_OK;
+}
+
+int server_listen_unix(const char *path, int mode) {
+  if (!path || path[0] == '\0') {
+    LOG_ERROR("Invalid socket path");
+    return SERVER_INVALID_PORT;
   }
 
-  if (start_cleanup_timer() != 0)
-    LOG_DEBUG("Failed to start cleanup timer");
+  if (!ecewo_server.initialized)
+    return SERVER_NOT_INITIALIZED;
+
+  if (ecewo_server.running)
+    return SERVER_ALREADY_RUNNING;
+
+  int result = loop_listen_unix(&ecewo_server.main, path, mode);
+  if (result != SERVER_OK)
+    return result;
+
+  if (path[0] != '@') {
+    size_t len = strlen(path);
+    ecewo_server.unix_path = malloc(len + 1);
+    if (ecewo_server.unix_path)
+      memcpy(ecewo_server.unix_path, path, len + 1);
+  }
 
   ecewo_server.running = 1;
 
   const char *is_worker = getenv("ECEWO_WORKER");
   if (!is_worker || strcmp(is_worker, "1") != 0)
-    printf("Server listening on http://localhost:%" PRIu16 "\n", port);
+    printf("Server listening on unix:%s\n", path);
 
   return SERVER_OK;
 }
 
+#ifndef _WIN32
+static void on_worker_stop(uv_async_t *handle) {
+  server_loop_t *sl = (server_loop_t *)handle->data;
+  loop_close_connections(sl);
+  uv_stop(sl->loop);
+}
+
+static void worker_thread_run(void *arg) {
+  server_loop_t *sl = (server_loop_t *)arg;
+
+  current_loop = sl;
+  arena_pool_bind(sl->arena_pool);
+  date_cache_bind(&sl->date);
+
+  uv_run(sl->loop, UV_RUN_DEFAULT);
+
+  loop_drain(sl);
+
+  if (uv_loop_close(sl->loop) != 0)
+    LOG_DEBUG("Loop %" PRIu16 " closed with active handles", sl->id);
+
+  date_cache_bind(NULL);
+  arena_pool_bind(NULL);
+  current_loop = NULL;
+}
+
+static int worker_init(server_loop_t *sl, uint16_t id, uint16_t port) {
+  sl->id = id;
+
+  sl->loop = malloc(sizeof(uv_loop_t));
+  if (!sl->loop)
+    return SERVER_OUT_OF_MEMORY;
+
+  if (uv_loop_init(sl->loop) != 0) {
+    free(sl->loop);
+    sl->loop = NULL;
+    return SERVER_INIT_FAILED;
+  }
+
+  sl->arena_pool = arena_pool_create();
+  if (!sl->arena_pool) {
+    uv_loop_close(sl->loop);
+    free(sl->loop);
+    sl->loop = NULL;
+    return SERVER_OUT_OF_MEMORY;
+  }
+
+  if (uv_async_init(sl->loop, &sl->stop_async, on_worker_stop) != 0) {
+    arena_pool_free(sl->arena_pool);
+    uv_loop_close(sl->loop);
+    free(sl->loop);
+    sl->loop = NULL;
+    sl->arena_pool = NULL;
+    return SERVER_INIT_FAILED;
+  }
+
+  sl->stop_async.data = sl;
+
+  int result = loop_listen(sl, port, UV_TCP_REUSEPORT);
+
+  if (result != SERVER_OK) {
+    uv_close((uv_handle_t *)&sl->stop_async, NULL);
+    uv_run(sl->loop, UV_RUN_NOWAIT);
+    uv_loop_close(sl->loop);
+    arena_pool_free(sl->arena_pool);
+    free(sl->loop);
+    sl->loop = NULL;
+    sl->arena_pool = NULL;
+    return result;
+  }
+
+  return SERVER_OK;
+}
+#endif
+
+int server_listen_threads(uint16_t port, uint16_t thread_count) {
+#ifdef _WIN32
+  (void)thread_count;
+  LOG_DEBUG("SO_REUSEPORT is not available, using a single loop");
+  return server_listen(port);
+#else
+  if (port == 0) {
+    LOG_ERROR("Invalid port %" PRIu16 " (must be 1-65535)", port);
+    return SERVER_INVALID_PORT;
+  }
+
+  if (!ecewo_server.initialized)
+    return SERVER_NOT_INITIALIZED;
+
+  if (ecewo_server.running)
+    return SERVER_ALREADY_RUNNING;
+
+  if (thread_count == 0) {
+    unsigned int available = uv_available_parallelism();
+    thread_count = available > UINT16_MAX ? UINT16_MAX : (uint16_t)available;
+  }
+
+  if (thread_count <= 1)
+    return server_listen(port);
+
+  // Every loop binds its own listener, the kernel spreads
+  // the incoming connections between them
+  int result = loop_listen(&ecewo_server.main, port, UV_TCP_REUSEPORT);
+  if (result != SERVER_OK)
+    return result;
+
+  uint16_t extra = thread_count - 1;
+  ecewo_server.workers = calloc(extra, sizeof(server_loop_t));
+  if (!ecewo_server.workers) {
+    LOG_ERROR("Failed to allocate worker loops, using a single loop");
+    extra = 0;
+  }
+
+  uint16_t started = 0;
+  for (uint16_t i = 0; i < extra; i++) {
+    server_loop_t *sl = &ecewo_server.workers[started];
+
+    if (worker_init(sl, started + 1, port) != SERVER_OK) {
+      LOG_ERROR("Failed to start loop %" PRIu16, (uint16_t)(started + 1));
+      memset(sl, 0, sizeof(*sl));
+      continue;
+    }
+
+    if (uv_thread_create(&sl->thread, worker_thread_run, sl) != 0) {
+      LOG_ERROR("Failed to create thread for loop %" PRIu16, sl->id);
+      // Never ran, drain it here
+      loop_close_connections(sl);
+      uv_close((uv_handle_t *)&sl->stop_async, NULL);
+      loop_drain(sl);
+      uv_loop_close(sl->loop);
+      arena_pool_free(sl->arena_pool);
+      free(sl->loop);
+      memset(sl, 0, sizeof(*sl));
+      continue;
+    }
+
+    started++;
+  }
+
+  ecewo_server.worker_count = started;
+  ecewo_server.running = 1;
+
+  LOG_DEBUG("Running %" PRIu16 " event loops", (uint16_t)(started + 1));
+  print_listening(port);
+
+  return SERVER_OK;
+#endif
+}
+
 void server_run(void) {
   if (!ecewo_server.initialized || !ecewo_server.running) {
     LOG_ERROR("Server not initialized or not listening");
     return;
   }
 
-  uv_run(ecewo_server.loop, UV_RUN_DEFAULT);
+  date_cache_bind(&ecewo_server.main.date);
+  uv_run(ecewo_server.main.loop, UV_RUN_DEFAULT);
+  date_cache_bind(NULL);
   server_cleanup();
 }
 
@@ -836,25 +1458,120 @@ bool server_is_running(void) {
   return ecewo_server.running;
 }
 
+// Retries while the loop is starting or ending a pause
+static uint64_t loop_paused_ms(const server_loop_t *sl) {
+  for (;;) {
+    unsigned int seq = atomic_load_explicit(&sl->pause_seq, memory_order_acquire);
+    if (seq & 1)
+      continue;
+
+    uint64_t total = atomic_load_explicit(&sl->paused_ms, memory_order_relaxed);
+    uint64_t started = atomic_load_explicit(&sl->pause_started, memory_order_relaxed);
+    bool paused = atomic_load_explicit(&sl->accept_paused, memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&sl->pause_seq, memory_order_relaxed) != seq)
+      continue;
+
+    return paused ? total + (now_ms() - started) : total;
+  }
+}
+
+bool server_accept_paused(void) {
+  if (loop_accept_paused(&ecewo_server.main))
+    return true;
+
+  for (uint16_t i = 0; i < ecewo_server.worker_count; i++) {
+    if (loop_accept_paused(&ecewo_server.workers[i]))
+      return true;
+  }
+
+  return false;
+}
+
+uint64_t get_accept_paused_ms(void) {
+  uint64_t total = loop_paused_ms(&ecewo_server.main);
+
+  for (uint16_t i = 0; i < ecewo_server.worker_count; i++)
+    total += loop_paused_ms(&ecewo_server.workers[i]);
+
+  return total;
+}
+
+uint64_t get_rejected_connections(void) {
+  uint64_t total = atomic_load_explicit(&ecewo_server.main.rejected_connections, memory_order_relaxed);
+
+  for (uint16_t i = 0; i < ecewo_server.worker_count; i++)
+    total += atomic_load_explicit(&ecewo_server.workers[i].rejected_connections, memory_order_relaxed);
+
+  return total;
+}
+
+uint64_t get_write_calls(void) {
+  uint64_t total = ecewo_server.main.write_calls;
+
+  for (uint16_t i = 0; i < ecewo_server.worker_count; i++)
+    total += ecewo_server.workers[i].write_calls;
+
+  return total;
+}
+
+uint64_t get_write_buffers(void) {
+  uint64_t total = ecewo_server.main.write_buffers;
+
+  for (uint16_t i = 0; i < ecewo_server.worker_count; i++)
+    total += ecewo_server.workers[i].write_buffers;
+
+  return total;
+}
+
 int get_active_connections(void) {
-  return ecewo_server.active_connections;
+  int total = ecewo_server.main.active_connections;
+
+  for (uint16_t i = 0; i < ecewo_server.worker_count; i++)
+    total += ecewo_server.workers[i].active_connections;
+
+  return total;
 }
 
 uv_loop_t *get_loop(void) {
-  return ecewo_server.loop;
+  return get_server_loop()->loop;
+}
+
+static void timer_link(timer_data_t *data, uv_timer_t *timer) {
+  server_loop_t *sl = get_server_loop();
+
+  data->timer = timer;
+  data->owner = sl;
+  data->prev = NULL;
+  data->next = sl->timers;
+
+  if (sl->timers)
+    sl->timers->prev = data;
+
+  sl->timers = data;
 }
 
 static void timer_callback(uv_timer_t *handle) {
   timer_data_t *data = (timer_data_t *)handle->data;
+  if (!data)
+    return;
 
-  if (data && data->callback)
-    data->callback(data->user_data);
+  timer_callback_t callback = data->callback;
+  void *user_data = data->user_data;
 
-  if (data && !data->is_interval) {
+  // Release a one-shot timer before the callback,
+  // which may shut the server down and walk the loop
+  if (!data->is_interval) {
+    handle->data = NULL;
+    timer_unlink(data);
     uv_timer_stop(handle);
     uv_close((uv_handle_t *)handle, (uv_close_cb)free);
     free(data);
   }
+
+  if (callback)
+    callback(user_data);
 }
 
 Timer *set_timeout(timer_callback_t callback, uint64_t delay_ms, void *user_data) {
@@ -874,17 +1591,17 @@ Timer *set_timeout(timer_callback_t callback, uint64_t delay_ms, void *user_data
   data->user_data = user_data;
   data->is_interval = false;
 
-  if (uv_timer_init(ecewo_server.loop, timer) != 0) {
+  if (uv_timer_init(get_loop(), timer) != 0) {
     free(timer);
     free(data);
     return NULL;
   }
 
   timer->data = data;
+  timer_link(data, timer);
 
   if (uv_timer_start(timer, timer_callback, delay_ms, 0) != 0) {
-    free(timer);
-    free(data);
+    clear_timer(timer);
     return NULL;
   }
 
@@ -908,17 +1625,17 @@ Timer *set_interval(timer_callback_t callback, uint64_t interval_ms, void *user_
   data->user_data = user_data;
   data->is_interval = true;
 
-  if (uv_timer_init(ecewo_server.loop, timer) != 0) {
+  if (uv_timer_init(get_loop(), timer) != 0) {
     free(timer);
     free(data);
     return NULL;
   }
 
   timer->data = data;
+  timer_link(data, timer);
 
   if (uv_timer_start(timer, timer_callback, interval_ms, interval_ms) != 0) {
-    free(timer);
-    free(data);
+    clear_timer(timer);
     return NULL;
   }
 
@@ -933,6 +1650,7 @@ void clear_timer(Timer *timer) {
 
   timer_data_t *data = (timer_data_t *)timer->data;
   if (data) {
+    timer_unlink(data);
     free(data);
     timer->data = NULL;
   }
@@ -1,8 +1,13 @@
 #ifndef ECEWO_SERVER_H
 #define ECEWO_SERVER_H
 
+#include <stdatomic.h>
 #include "ecewo.h"
 #include "http.h"
+#include "arena.h"
+#include "timer-wheel.h"
+#include "client-pool.h"
+#include "utils.h"
 #include "uv.h"
 #include "llhttp.h"
 
@@ -10,30 +15,194 @@
 #define READ_BUFFER_SIZE 16384
 #endif
 
+// Every connection of a loop reads into the same buffer.
+// The parser copies what it keeps into the exchange arena,
+// so nothing refers to the buffer once on_read returns.
+#ifndef SHARED_READ_BUFFER
+#define SHARED_READ_BUFFER 1
+#endif
+
+typedef struct client_s client_t;
+typedef struct exchange_s exchange_t;
+typedef struct exchange_file_s exchange_file_t;
+typedef struct exchange_stream_s exchange_stream_t;
+typedef struct sse_subscriber_s sse_subscriber_t;
+
+// Listeners and connections are TCP or Unix domain sockets,
+// the rest of the server only uses them as uv_stream_t
+typedef union {
+  uv_tcp_t tcp;
+  uv_pipe_t pipe;
+} stream_handle_t;
+
+// One event loop with its own listener, clients and arena pool.
+// The main loop runs on uv_default_loop(), the others are
+// started by server_listen_threads() on their own threads.
+typedef struct server_loop_s {
+  uv_loop_t *loop;
+  stream_handle_t *server;
+  bool unix_socket; // The listener is a uv_pipe_t
+  timer_wheel_t wheel; // Connection timeouts
+  date_cache_t date; // Date header of the responses
+  struct channel_loop_s *channels; // Deliveries from other loops, see channel.c
+  struct sse_loop_s *sse; // Event stream subscribers, see sse.c
+  client_pool_t clients; // Recycled client_t objects
+  struct timer_data_s *timers; // set_timeout() and set_interval(), see server.c
+
+  // Clients in last-activity order, the tail is the coldest
+  client_t *lru_head;
+  client_t *lru_tail;
+  int active_connections;
+  atomic_uint_fast16_t pending_async_work;
+
+  // Admission control at MAX_CONNECTIONS, written by this loop only
+  // and read from any thread, see loop_paused_ms() in server.c
+  atomic_bool accept_paused;
+  atomic_uint pause_seq; // Odd while a pause starts or ends
+  atomic_uint_fast64_t pause_started; // ms, uv_hrtime() based
+  atomic_uint_fast64_t paused_ms; // Completed pauses
+  atomic_uint_fast64_t rejected_connections; // Answered with 503
+
+  // Responses written, see pipeline.c
+  uint64_t write_calls;
+  uint64_t write_buffers;
+  uv_check_t flush_check; // Writes the queued connections, with COALESCE_WRITES
+  uv_idle_t flush_idle; // Keeps the poll from blocking while some are queued
+  client_t *flush_queue;
+  bool flush_ready;
+
+  arena_pool_t *arena_pool; // NULL on the main loop (uses the global pool)
+
+  uv_thread_t thread;
+  uv_async_t stop_async;
+
+  uint16_t id;
+  bool shutdown_requested;
+  bool server_closed;
+
+#if SHARED_READ_BUFFER
+  char read_buffer[READ_BUFFER_SIZE];
+#endif
+} server_loop_t;
+
+typedef enum {
+  TIMEOUT_IDLE, // Waiting for the next request
+  TIMEOUT_HEADER, // Receiving the request headers
+  TIMEOUT_REQUEST // Receiving the body or waiting for the responses
+} read_timeout_t;
+
+typedef enum {
+  EXCHANGE_PARSING, // Parser is still filling the request
+  EXCHANGE_HANDLING, // Dispatched, waiting for the handler to reply
+  EXCHANGE_READY, // Response serialized, waiting for its turn
+  EXCHANGE_WRITING, // Passed to uv_write
+  EXCHANGE_DONE // Taken over, released with the connection
+} exchange_state_t;
+
+// One request and its response on a connection.
+// Pipelined exchanges are queued in arrival order
+// and their responses are written in the same order.
+struct exchange_s {
+  exchange_t *next;
+  client_t *client; // NULL once the connection is gone
+  Arena *arena; // Holds the exchange, Req, Res and the response
+  Req *req;
+  Res *res;
+  uv_buf_t response; // Headers only when the body is a file
+  uv_buf_t body; // Body written in place, after response
+  void *owned_body; // Handed over by reply_owned()
+  reply_free_t owned_free;
+  const char *cache_key; // The response is stored under this URL, see response-cache.c
+  size_t cache_key_len;
+  void *cache_refresh; // Stale entry this exchange regenerates
+  exchange_file_t *file; // See send-file.c
+  exchange_stream_t *stream; // See response-stream.c
+  exchange_state_t state;
+  bool keep_alive;
+  bool borrowed; // Arena comes from the pool, not the connection
+};
+
 struct client_s {
-  uv_tcp_t handle;
-  uv_buf_t read_buf;
-  char buffer[READ_BUFFER_SIZE];
+  stream_handle_t handle;
   bool closing;
   uint64_t last_activity;
   bool keep_alive_enabled;
-  struct client_s *next;
+
+  // Links of the LRU list of the owner loop
+  client_t *lru_prev;
+  client_t *lru_next;
+
+  server_loop_t *owner; // Loop that accepted this connection
 
   Arena *connection_arena; // Lives for the duration of the connection
 
   // Connection-scoped parser and context
   llhttp_t persistent_parser;
   llhttp_settings_t persistent_settings;
-  http_context_t persistent_context; // Struct embedded in client; its buffers live in connection_arena
+  http_context_t persistent_context; // Struct embedded in client; its buffers live in the arena of the parsing exchange
   bool parser_initialized;
-  bool request_in_progress; // True while parsing a multi-packet request
+
+  // Pipelined exchanges, oldest first
+  exchange_t *exchange_head;
+  exchange_t *exchange_tail;
+  exchange_t *exchange_unsent; // First exchange not passed to uv_write yet
+  exchange_t *parsing; // Exchange the parser is filling
+  uint16_t exchange_count;
+  bool reading_batch; // Writes are deferred until the read batch is parsed
+  bool close_after_write; // Close once the queued responses are written
+  bool read_paused; // Too many pipelined requests are waiting
+  bool write_paused; // Too many response bytes are waiting for the peer
+  size_t write_bytes_pending; // Passed to uv_write by the pipeline, not written yet
+  exchange_t *body_exchange; // File or streamed response being sent, later ones wait for it
+  bool fs_busy; // A file operation on the thread pool uses the socket
+  bool flush_queued; // Waits in the flush queue of the loop
+  client_t *flush_next;
 
   bool taken_over;
   void *takeover_user_data;
+  sse_subscriber_t *sse; // Set while the connection is an event stream
+  WebSocket *ws; // Set once the connection is upgraded
+
+  // Deadlines on the timer wheel of the owner loop
+  wheel_entry_t read_timeout; // Idle, header or request deadline
+  wheel_entry_t write_timeout; // Slow-write deadline
+  read_timeout_t read_phase;
+  uint64_t request_start;
+  uint16_t writes_pending;
 
-  uv_timer_t *request_timeout_timer;
+#if !SHARED_READ_BUFFER
+  // Kept last, a recycled client only resets the fields above
+  _Alignas(CACHE_LINE_SIZE) char buffer[READ_BUFFER_SIZE];
+#endif
 };
 
-typedef struct client_s client_t;
+// Part of client_t reset when a pooled client is reused
+#if SHARED_READ_BUFFER
+#define CLIENT_STATE_SIZE sizeof(client_t)
+#else
+#define CLIENT_STATE_SIZE offsetof(client_t, buffer)
+#endif
+
+// Loop of the calling thread, or the main loop
+server_loop_t *get_server_loop(void);
+
+void close_client(client_t *client);
+
+// Starts reading again unless the pipeline depth or the output holds it back
+void client_resume_reading(client_t *client);
+
+// Marks the connection as the most recently active one, O(1)
+void client_touch(client_t *client);
+
+// Timeouts of the connection, see server.c
+void client_set_read_timeout(client_t *client, read_timeout_t phase);
+void client_write_started(client_t *client);
+void client_write_finished(client_t *client);
+void client_write_progress(client_t *client);
+void client_pause_for_output(client_t *client);
+
+// Called when a file operation of the connection completes,
+// returns false if the connection closed in the meantime
+bool client_fs_done(client_t *client);
 
 #endif
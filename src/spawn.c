@@ -54,7 +54,7 @@ int spawn(void *context, spawn_handler_t work_fn, spawn_handler_t done_fn) {
   if (!task)
     return -1;
 
-  if (uv_async_init(uv_default_loop(), &task->async_send, spawn_async_cb) != 0) {
+  if (uv_async_init(get_loop(), &task->async_send, spawn_async_cb) != 0) {
     free(task);
     return -1;
   }
@@ -66,7 +66,7 @@ int spawn(void *context, spawn_handler_t work_fn, spawn_handler_t done_fn) {
   task->result_fn = done_fn;
 
   int result = uv_queue_work(
-      uv_default_loop(),
+      get_loop(),
       &task->work,
       spawn_work_cb,
       spawn_after_work_cb);
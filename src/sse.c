@@ -0,0 +1,344 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include "sse.h"
+#include "channel.h"
+#include "response-stream.h"
+#include "logger.h"
+
+extern char *serialize_headers(Res *res, int status, size_t content_length,
+                               size_t reserve, size_t *out_len);
+
+#define LITERAL_LEN(s) (sizeof(s) - 1)
+
+typedef struct sse_loop_s sse_loop_t;
+
+// Subscribers of one loop, for the heartbeat.
+// Freed when the last one leaves.
+struct sse_loop_s {
+  server_loop_t *owner;
+  wheel_entry_t heartbeat;
+  sse_subscriber_t *subscribers;
+  uint32_t subscriber_count;
+};
+
+struct sse_subscriber_s {
+  channel_member_t member; // Kept first, see subscriber_of()
+  client_t *client;
+  sse_loop_t *loop;
+
+  // Subscribers of the loop
+  sse_subscriber_t *loop_prev;
+  sse_subscriber_t *loop_next;
+
+  char discard[64]; // Anything the client sends is ignored
+};
+
+typedef struct
+{
+  uv_write_t req;
+  channel_msg_t *msg; // NULL for the headers and heartbeats
+} sse_write_t;
+
+typedef struct
+{
+  const char *name;
+  const char *data;
+  size_t data_len;
+} sse_event_t;
+
+static char heartbeat_comment[] = ":\n\n";
+
+static sse_subscriber_t *subscriber_of(channel_member_t *member) {
+  return (sse_subscriber_t *)member;
+}
+
+// id, event and one data field per line, CR, LF and CRLF all end a line
+static channel_msg_t *event_build(uint64_t id, void *context) {
+  const sse_event_t *event = (const sse_event_t *)context;
+  const char *data = event->data;
+  size_t data_len = event->data_len;
+
+  // A line break would end the event name early
+  size_t name_len = event->name ? strcspn(event->name, "\r\n") : 0;
+  size_t lines = 1;
+
+  for (size_t i = 0; i < data_len; i++) {
+    if (data[i] == '\n' || (data[i] == '\r' && (i + 1 == data_len || data[i + 1] != '\n')))
+      lines++;
+  }
+
+  size_t size = LITERAL_LEN("id: \n") + 20
+      + (name_len > 0 ? LITERAL_LEN("event: \n") + name_len : 0)
+      + lines * LITERAL_LEN("data: \n") + data_len + 1;
+
+  channel_msg_t *msg = channel_msg_create(size);
+  if (!msg)
+    return NULL;
+
+  char *p = msg->data;
+  p += sprintf(p, "id: %" PRIu64 "\n", id);
+
+  if (name_len > 0) {
+    memcpy(p, "event: ", LITERAL_LEN("event: "));
+    p += LITERAL_LEN("event: ");
+    memcpy(p, event->name, name_len);
+    p += name_len;
+    *p++ = '\n';
+  }
+
+  size_t start = 0;
+  for (size_t i = 0; i <= data_len; i++) {
+    if (i < data_len && data[i] != '\n' && data[i] != '\r')
+      continue;
+
+    memcpy(p, "data: ", LITERAL_LEN("data: "));
+    p += LITERAL_LEN("data: ");
+    memcpy(p, data + start, i - start);
+    p += i - start;
+    *p++ = '\n';
+
+    if (i + 1 < data_len && data[i] == '\r' && data[i + 1] == '\n')
+      i++;
+
+    start = i + 1;
+  }
+
+  *p++ = '\n';
+
+  msg->len = (size_t)(p - msg->data);
+  return msg;
+}
+
+static void on_sse_written(uv_write_t *req, int status) {
+  sse_write_t *write = (sse_write_t *)req;
+  client_t *client = (client_t *)req->handle->data;
+
+  if (write->msg)
+    channel_msg_unref(write->msg);
+
+  free(write);
+
+  if (!client || client->closing)
+    return;
+
+  client_write_finished(client);
+
+  if (status < 0) {
+    LOG_DEBUG("SSE write error: %s", uv_strerror(status));
+    close_client(client);
+  }
+}
+
+// Closing the connection only marks it, the subscriber
+// is unlinked once the handle is closed
+static void subscriber_write(sse_subscriber_t *subscriber, char *data, size_t len, channel_msg_t *msg) {
+  client_t *client = subscriber->client;
+  if (client->closing)
+    return;
+
+  uv_stream_t *stream = (uv_stream_t *)&client->handle;
+
+  // Still behind on what it was sent before
+  if (uv_stream_get_write_queue_size(stream) > SSE_MAX_QUEUED) {
+    LOG_DEBUG("SSE subscriber is too slow - closing connection");
+    close_client(client);
+    return;
+  }
+
+  sse_write_t *write = malloc(sizeof(sse_write_t));
+  if (!write) {
+    close_client(client);
+    return;
+  }
+
+  write->msg = msg;
+  if (msg)
+    channel_msg_ref(msg);
+
+  uv_buf_t buf = uv_buf_init(data, (unsigned int)len);
+
+  int result = uv_write(&write->req, stream, &buf, 1, on_sse_written);
+  if (result < 0) {
+    LOG_DEBUG("SSE write error: %s", uv_strerror(result));
+    if (msg)
+      channel_msg_unref(msg);
+    free(write);
+    close_client(client);
+    return;
+  }
+
+  client_write_started(client);
+}
+
+static void subscriber_deliver(channel_member_t *member, channel_msg_t *msg) {
+  subscriber_write(subscriber_of(member), msg->data, msg->len, msg);
+}
+
+static void on_heartbeat(wheel_entry_t *entry) {
+  sse_loop_t *loop = wheel_entry_owner(entry, sse_loop_t, heartbeat);
+
+  for (sse_subscriber_t *subscriber = loop->subscribers; subscriber; subscriber = subscriber->loop_next)
+    subscriber_write(subscriber, heartbeat_comment, LITERAL_LEN(heartbeat_comment), NULL);
+
+  timer_wheel_schedule(&loop->owner->wheel, &loop->heartbeat, SSE_HEARTBEAT_MS);
+}
+
+static void on_sse_alloc(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
+  (void)suggested_size;
+  client_t *client = (client_t *)handle->data;
+  sse_subscriber_t *subscriber = client ? client->sse : NULL;
+
+  if (!subscriber) {
+    *buf = uv_buf_init(NULL, 0);
+    return;
+  }
+
+  *buf = uv_buf_init(subscriber->discard, sizeof(subscriber->discard));
+}
+
+static void on_sse_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  (void)buf;
+  client_t *client = (client_t *)stream->data;
+
+  if (nread < 0 && client && !client->closing)
+    close_client(client);
+}
+
+static uint64_t parse_last_event_id(const char *value) {
+  uint64_t id = 0;
+
+  for (const char *p = value; *p; p++) {
+    if (*p < '0' || *p > '9' || id > (UINT64_MAX - 9) / 10)
+      return 0;
+    id = id * 10 + (uint64_t)(*p - '0');
+  }
+
+  return id;
+}
+
+static void loop_add(server_loop_t *sl, sse_subscriber_t *subscriber) {
+  sse_loop_t *loop = sl->sse;
+
+  if (!loop) {
+    loop = calloc(1, sizeof(sse_loop_t));
+    if (!loop)
+      return; // Without a heartbeat
+
+    loop->owner = sl;
+    loop->heartbeat.cb = on_heartbeat;
+    sl->sse = loop;
+  }
+
+  subscriber->loop = loop;
+  subscriber->loop_next = loop->subscribers;
+  if (loop->subscribers)
+    loop->subscribers->loop_prev = subscriber;
+  loop->subscribers = subscriber;
+
+  if (loop->subscriber_count++ == 0)
+    timer_wheel_schedule(&sl->wheel, &loop->heartbeat, SSE_HEARTBEAT_MS);
+}
+
+int sse_subscribe(Req *req, Res *res, const char *channel) {
+  if (!req || !res || !channel || res->replied)
+    return -1;
+
+  exchange_t *exchange = (exchange_t *)res->exchange;
+  client_t *client = exchange ? exchange->client : NULL;
+
+  if (!client || client->closing || client->taken_over)
+    return -1;
+
+  // Earlier pipelined responses would end up after the stream
+  if (client->exchange_head != exchange || client->body_exchange)
+    return -1;
+
+  sse_subscriber_t *subscriber = calloc(1, sizeof(sse_subscriber_t));
+  if (!subscriber)
+    return -1;
+
+  set_header(res, "Content-Type", "text/event-stream");
+  set_header(res, "Cache-Control", "no-cache");
+
+  size_t headers_len = 0;
+  char *headers = serialize_headers(res, 200, CONTENT_LENGTH_UNTIL_CLOSE, 0, &headers_len);
+
+  TakeoverConfig config = { 0 };
+  if (!headers || connection_takeover(res, &config) != 0) {
+    free(subscriber);
+    return -1;
+  }
+
+  subscriber->client = client;
+  subscriber->member.deliver = subscriber_deliver;
+  client->sse = subscriber;
+
+  // Only to see the client go away
+  uv_read_start((uv_stream_t *)&client->handle, on_sse_alloc, on_sse_read);
+
+  loop_add(client->owner, subscriber);
+  subscriber_write(subscriber, headers, headers_len, NULL);
+
+  const char *last_event_id = get_header_id(req, HEADER_LAST_EVENT_ID);
+  uint64_t last_id = last_event_id ? parse_last_event_id(last_event_id) : 0;
+
+  channel_msg_t *missed[SSE_HISTORY_SIZE];
+  size_t missed_count = 0;
+
+  // Replayed before anything else is delivered, both happen on this loop
+  if (channel_join(CHANNEL_SSE, channel, &subscriber->member,
+                   last_event_id ? &last_id : NULL, missed, SSE_HISTORY_SIZE, &missed_count)
+      != 0) {
+    close_client(client);
+    return 0;
+  }
+
+  for (size_t i = 0; i < missed_count; i++) {
+    subscriber_write(subscriber, missed[i]->data, missed[i]->len, missed[i]);
+    channel_msg_unref(missed[i]);
+  }
+
+  return 0;
+}
+
+int sse_publish(const char *channel, const char *event, const char *data, size_t data_len) {
+  if (!channel || (!data && data_len > 0))
+    return -1;
+
+  sse_event_t context = {
+    .name = event,
+    .data = data,
+    .data_len = data_len
+  };
+
+  return channel_publish(CHANNEL_SSE, channel, SSE_HISTORY_SIZE, event_build, &context);
+}
+
+void sse_client_closed(client_t *client) {
+  sse_subscriber_t *subscriber = client->sse;
+  if (!subscriber)
+    return;
+
+  client->sse = NULL;
+  channel_leave(&subscriber->member);
+
+  sse_loop_t *loop = subscriber->loop;
+
+  if (loop) {
+    if (subscriber->loop_prev)
+      subscriber->loop_prev->loop_next = subscriber->loop_next;
+    else
+      loop->subscribers = subscriber->loop_next;
+    if (subscriber->loop_next)
+      subscriber->loop_next->loop_prev = subscriber->loop_prev;
+
+    if (--loop->subscriber_count == 0) {
+      timer_wheel_cancel(&loop->owner->wheel, &loop->heartbeat);
+      loop->owner->sse = NULL;
+      free(loop);
+    }
+  }
+
+  free(subscriber);
+}
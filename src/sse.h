@@ -0,0 +1,25 @@
+#ifndef ECEWO_SSE_H
+#define ECEWO_SSE_H
+
+#include "server.h"
+
+// A comment is written to every subscriber of a loop this often,
+// it keeps proxies from closing quiet streams and finds dead peers
+#ifndef SSE_HEARTBEAT_MS
+#define SSE_HEARTBEAT_MS 15000
+#endif
+
+// Events kept per channel for Last-Event-ID replay
+#ifndef SSE_HISTORY_SIZE
+#define SSE_HISTORY_SIZE 64
+#endif
+
+// A subscriber with more unsent bytes than this is disconnected
+#ifndef SSE_MAX_QUEUED
+#define SSE_MAX_QUEUED (1024 * 1024)
+#endif
+
+// Unlinks the subscriber of a closed connection
+void sse_client_closed(client_t *client);
+
+#endif
@@ -0,0 +1,328 @@
+#include <stdlib.h>
+#include "static-route.h"
+#include "compression.h"
+#include "pipeline.h"
+#include "arena.h"
+#include "utils.h"
+#include "logger.h"
+
+extern char *serialize_headers(Res *res, int status, size_t content_length,
+                               size_t reserve, size_t *out_len);
+
+// One encoding of a response, serialized at registration. Only the
+// Date line is rewritten per request, Connection picks the template.
+typedef struct
+{
+  char *headers[2]; // Connection: close, keep-alive
+  size_t headers_len[2];
+  size_t date_offset[2];
+  char *body;
+  size_t body_len;
+} static_variant_t;
+
+typedef struct
+{
+  char *path;
+  size_t path_len;
+  uint32_t hash;
+  int status;
+  char *content_type;
+  bool compressed; // Other encodings than identity, the response varies on Accept-Encoding
+  static_variant_t variants[ENCODING_COUNT]; // Without headers if not available
+} static_route_t;
+
+// Open addressing, the capacity is a power of two
+static struct {
+  static_route_t *slots;
+  uint32_t capacity;
+  uint32_t count;
+} static_routes = { 0 };
+
+static uint32_t hash_path(const char *path, size_t len) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)path[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static static_route_t *find_slot(static_route_t *slots, uint32_t capacity,
+                                 const char *path, size_t len, uint32_t hash) {
+  uint32_t mask = capacity - 1;
+
+  for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+    static_route_t *slot = &slots[i];
+
+    if (!slot->path)
+      return slot;
+
+    if (slot->hash == hash && slot->path_len == len && memcmp(slot->path, path, len) == 0)
+      return slot;
+  }
+}
+
+static int grow_table(void) {
+  uint32_t capacity = static_routes.capacity ? static_routes.capacity * 2 : 16;
+
+  static_route_t *slots = calloc(capacity, sizeof(static_route_t));
+  if (!slots)
+    return -1;
+
+  for (uint32_t i = 0; i < static_routes.capacity; i++) {
+    static_route_t *old = &static_routes.slots[i];
+    if (old->path)
+      *find_slot(slots, capacity, old->path, old->path_len, old->hash) = *old;
+  }
+
+  free(static_routes.slots);
+  static_routes.slots = slots;
+  static_routes.capacity = capacity;
+
+  return 0;
+}
+
+static void free_headers(static_variant_t *variant) {
+  free(variant->headers[0]);
+  free(variant->headers[1]);
+  variant->headers[0] = NULL;
+  variant->headers[1] = NULL;
+}
+
+static void free_route(static_route_t *route) {
+  for (int i = 0; i < ENCODING_COUNT; i++) {
+    free_headers(&route->variants[i]);
+    free(route->variants[i].body);
+  }
+
+  free(route->path);
+  free(route->content_type);
+  memset(route, 0, sizeof(static_route_t));
+}
+
+// Serializes the headers once with the regular serializer
+static int build_headers(static_route_t *route, content_encoding_t encoding, bool keep_alive) {
+  static_variant_t *variant = &route->variants[encoding];
+  Arena arena = { 0 };
+
+  Res res;
+  memset(&res, 0, sizeof(Res));
+  res.arena = &arena;
+  res.keep_alive = keep_alive;
+
+  if (route->content_type)
+    set_header(&res, "Content-Type", route->content_type);
+
+  if (encoding != ENCODING_IDENTITY)
+    set_header(&res, "Content-Encoding", compression_name(encoding));
+
+  if (route->compressed)
+    set_header(&res, "Vary", "Accept-Encoding");
+
+  size_t len = 0;
+  char *headers = serialize_headers(&res, route->status, variant->body_len, 0, &len);
+
+  int result = -1;
+
+  if (headers) {
+    variant->headers[keep_alive] = malloc(len);
+
+    if (variant->headers[keep_alive]) {
+      memcpy(variant->headers[keep_alive], headers, len);
+      variant->headers_len[keep_alive] = len;
+
+      // The Date line follows the status line
+      const char *eol = memchr(headers, '\n', len);
+      variant->date_offset[keep_alive] = (size_t)(eol - headers) + 1;
+      result = 0;
+    }
+  }
+
+  arena_free(&arena);
+  return result;
+}
+
+static int build_variant(static_route_t *route, content_encoding_t encoding) {
+  free_headers(&route->variants[encoding]);
+
+  if (build_headers(route, encoding, false) != 0 || build_headers(route, encoding, true) != 0) {
+    free_headers(&route->variants[encoding]);
+    return -1;
+  }
+
+  return 0;
+}
+
+// Compresses the body once for every encoding, identity
+// is serialized again to announce Vary: Accept-Encoding
+static void compress_route(static_route_t *route) {
+  static_variant_t *identity = &route->variants[ENCODING_IDENTITY];
+
+  if (route->compressed || !compression_eligible(route->content_type, identity->body_len))
+    return;
+
+  for (int i = ENCODING_IDENTITY + 1; i < ENCODING_COUNT; i++) {
+    static_variant_t *variant = &route->variants[i];
+    variant->body = compress_buffer((content_encoding_t)i, identity->body,
+                                    identity->body_len, &variant->body_len);
+    if (variant->body)
+      route->compressed = true;
+  }
+
+  if (!route->compressed)
+    return;
+
+  for (int i = 0; i < ENCODING_COUNT; i++) {
+    static_variant_t *variant = &route->variants[i];
+
+    if (i != ENCODING_IDENTITY && !variant->body)
+      continue;
+
+    if (build_variant(route, (content_encoding_t)i) == 0)
+      continue;
+
+    // A variant without headers is never served
+    if (i == ENCODING_IDENTITY) {
+      LOG_ERROR("Failed to serialize static route: %s", route->path);
+    } else {
+      free(variant->body);
+      variant->body = NULL;
+    }
+  }
+}
+
+void static_routes_compress(void) {
+  for (uint32_t i = 0; i < static_routes.capacity; i++) {
+    if (static_routes.slots[i].path)
+      compress_route(&static_routes.slots[i]);
+  }
+}
+
+int register_static(const char *path, int status, const char *content_type,
+                    const void *body, size_t body_len) {
+  if (!path || *path != '/' || (!body && body_len > 0)) {
+    LOG_ERROR("Invalid static route");
+    return -1;
+  }
+
+  if ((static_routes.count + 1) * 2 > static_routes.capacity && grow_table() != 0) {
+    LOG_ERROR("Failed to allocate static route: %s", path);
+    return -1;
+  }
+
+  static_route_t route = { 0 };
+  static_variant_t *identity = &route.variants[ENCODING_IDENTITY];
+
+  route.status = status;
+  route.path_len = strlen(path);
+  route.path = malloc(route.path_len + 1);
+  route.content_type = content_type ? malloc(strlen(content_type) + 1) : NULL;
+  identity->body_len = body_len;
+  identity->body = body_len > 0 ? malloc(body_len) : NULL;
+
+  if (!route.path || (content_type && !route.content_type) || (body_len > 0 && !identity->body)) {
+    LOG_ERROR("Failed to allocate static route: %s", path);
+    free_route(&route);
+    return -1;
+  }
+
+  memcpy(route.path, path, route.path_len + 1);
+  if (content_type)
+    strcpy(route.content_type, content_type);
+  if (body_len > 0)
+    memcpy(identity->body, body, body_len);
+
+  if (build_variant(&route, ENCODING_IDENTITY) != 0) {
+    LOG_ERROR("Failed to allocate static route: %s", path);
+    free_route(&route);
+    return -1;
+  }
+
+  if (compression_enabled())
+    compress_route(&route);
+
+  route.hash = hash_path(route.path, route.path_len);
+
+  static_route_t *slot = find_slot(static_routes.slots, static_routes.capacity,
+                                   route.path, route.path_len, route.hash);
+
+  // Registering a path again replaces its response
+  if (slot->path)
+    free_route(slot);
+  else
+    static_routes.count++;
+
+  *slot = route;
+  return 0;
+}
+
+bool static_route_dispatch(client_t *client, exchange_t *exchange) {
+  if (static_routes.count == 0)
+    return false;
+
+  http_context_t *ctx = &client->persistent_context;
+
+  uint8_t method = llhttp_get_method(ctx->parser);
+  if (method != HTTP_GET && method != HTTP_HEAD)
+    return false;
+
+  if (http_message_needs_eof(ctx))
+    return false;
+
+  const char *path = ctx->url;
+  size_t path_len = ctx->path_length;
+
+  if (!path || path_len == 0) {
+    path = "/";
+    path_len = 1;
+  }
+
+  uint32_t hash = hash_path(path, path_len);
+  static_route_t *route = find_slot(static_routes.slots, static_routes.capacity,
+                                    path, path_len, hash);
+  if (!route->path)
+    return false;
+
+  static_variant_t *variant = &route->variants[ENCODING_IDENTITY];
+
+  if (route->compressed) {
+    const char *accept_encoding = http_header_find(&ctx->headers, HEADER_ACCEPT_ENCODING);
+    content_encoding_t encoding = compression_negotiate(accept_encoding);
+    if (route->variants[encoding].headers[0])
+      variant = &route->variants[encoding];
+  }
+
+  bool keep_alive = ctx->keep_alive;
+  size_t len = variant->headers_len[keep_alive];
+
+  if (!variant->headers[keep_alive])
+    return false;
+
+  char *headers = arena_alloc(exchange->arena, len);
+  if (!headers)
+    return false;
+
+  memcpy(headers, variant->headers[keep_alive], len);
+  memcpy(headers + variant->date_offset[keep_alive], get_date_line(), DATE_LINE_LEN);
+
+  exchange->state = EXCHANGE_HANDLING;
+  exchange->keep_alive = keep_alive;
+
+  // Shared by every request, never freed while the server runs
+  if (method == HTTP_GET && variant->body_len > 0)
+    exchange->body = uv_buf_init(variant->body, (unsigned int)variant->body_len);
+
+  exchange_ready(exchange, headers, len);
+  return true;
+}
+
+void static_routes_free(void) {
+  for (uint32_t i = 0; i < static_routes.capacity; i++) {
+    if (static_routes.slots[i].path)
+      free_route(&static_routes.slots[i]);
+  }
+
+  free(static_routes.slots);
+  memset(&static_routes, 0, sizeof(static_routes));
+}
@@ -0,0 +1,15 @@
+#ifndef ECEWO_STATIC_ROUTE_H
+#define ECEWO_STATIC_ROUTE_H
+
+#include "server.h"
+
+// Answers a GET or HEAD request whose path has a static response,
+// returns false if the request has to go through the router
+bool static_route_dispatch(client_t *client, exchange_t *exchange);
+
+// Adds the compressed bodies to routes registered before compression was enabled
+void static_routes_compress(void);
+
+void static_routes_free(void);
+
+#endif
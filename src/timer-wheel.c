@@ -0,0 +1,171 @@
+#include <string.h>
+#include "timer-wheel.h"
+#include "logger.h"
+
+#define WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define WHEEL_MAX_DELTA ((1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+static inline uint64_t current_tick(const timer_wheel_t *wheel) {
+  return uv_now(wheel->loop) / TIMER_WHEEL_TICK_MS;
+}
+
+static void entry_link(wheel_entry_t **head, wheel_entry_t *entry) {
+  entry->next = *head;
+  if (entry->next)
+    entry->next->pprev = &entry->next;
+
+  *head = entry;
+  entry->pprev = head;
+}
+
+static void entry_unlink(wheel_entry_t *entry) {
+  *entry->pprev = entry->next;
+  if (entry->next)
+    entry->next->pprev = entry->pprev;
+
+  entry->next = NULL;
+  entry->pprev = NULL;
+}
+
+// Level 0 holds the next 64 ticks, every level above
+// covers 64 times the range of the one below
+static void wheel_insert(timer_wheel_t *wheel, wheel_entry_t *entry) {
+  uint64_t delta = entry->expires - wheel->now;
+
+  if (delta > WHEEL_MAX_DELTA) {
+    delta = WHEEL_MAX_DELTA;
+    entry->expires = wheel->now + delta;
+  }
+
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1))))
+    level++;
+
+  size_t slot = (size_t)(entry->expires >> (TIMER_WHEEL_BITS * level)) & WHEEL_MASK;
+  entry_link(&wheel->slots[level][slot], entry);
+}
+
+// Moves the entries of a higher level slot down
+// when the lower levels have wrapped around
+static void wheel_cascade(timer_wheel_t *wheel, int level) {
+  size_t slot = (size_t)(wheel->now >> (TIMER_WHEEL_BITS * level)) & WHEEL_MASK;
+
+  wheel_entry_t *list = wheel->slots[level][slot];
+  wheel->slots[level][slot] = NULL;
+
+  while (list) {
+    wheel_entry_t *entry = list;
+    list = entry->next;
+    wheel_insert(wheel, entry);
+  }
+
+  if (slot == 0 && level + 1 < TIMER_WHEEL_LEVELS)
+    wheel_cascade(wheel, level + 1);
+}
+
+static void wheel_expire(timer_wheel_t *wheel) {
+  size_t slot = (size_t)wheel->now & WHEEL_MASK;
+
+  // Detach the slot, the callbacks may cancel
+  // or reschedule any entry, including these
+  wheel_entry_t *list = wheel->slots[0][slot];
+  wheel->slots[0][slot] = NULL;
+
+  if (list)
+    list->pprev = &list;
+
+  while (list) {
+    wheel_entry_t *entry = list;
+    entry_unlink(entry);
+    wheel->count--;
+
+    if (entry->cb)
+      entry->cb(entry);
+  }
+}
+
+static void on_wheel_tick(uv_timer_t *handle) {
+  timer_wheel_t *wheel = (timer_wheel_t *)handle->data;
+  uint64_t target = current_tick(wheel);
+
+  while (wheel->now < target && wheel->count > 0) {
+    wheel->now++;
+
+    if ((wheel->now & WHEEL_MASK) == 0)
+      wheel_cascade(wheel, 1);
+
+    wheel_expire(wheel);
+  }
+
+  if (wheel->count == 0 && wheel->running) {
+    uv_timer_stop(&wheel->timer);
+    wheel->running = false;
+  }
+}
+
+int timer_wheel_init(timer_wheel_t *wheel, uv_loop_t *loop) {
+  if (!wheel || !loop)
+    return -1;
+
+  memset(wheel, 0, sizeof(timer_wheel_t));
+  wheel->loop = loop;
+
+  if (uv_timer_init(loop, &wheel->timer) != 0)
+    return -1;
+
+  wheel->timer.data = wheel;
+  wheel->now = current_tick(wheel);
+  wheel->initialized = true;
+
+  return 0;
+}
+
+void timer_wheel_close(timer_wheel_t *wheel) {
+  if (!wheel || !wheel->initialized)
+    return;
+
+  wheel->initialized = false;
+  wheel->running = false;
+
+  if (!uv_is_closing((uv_handle_t *)&wheel->timer)) {
+    uv_timer_stop(&wheel->timer);
+    uv_close((uv_handle_t *)&wheel->timer, NULL);
+  }
+}
+
+void timer_wheel_schedule(timer_wheel_t *wheel, wheel_entry_t *entry, uint64_t timeout_ms) {
+  if (!wheel || !entry || !wheel->initialized)
+    return;
+
+  if (entry->pprev)
+    entry_unlink(entry);
+  else
+    wheel->count++;
+
+  // Nothing was pending, the wheel may jump to the present
+  if (!wheel->running) {
+    wheel->now = current_tick(wheel);
+
+    if (uv_timer_start(&wheel->timer, on_wheel_tick,
+                       TIMER_WHEEL_TICK_MS, TIMER_WHEEL_TICK_MS)
+        == 0)
+      wheel->running = true;
+    else
+      LOG_ERROR("Failed to start the timer wheel");
+  }
+
+  // Round up and count from the real tick, which may be ahead
+  // of the last processed one, so an entry never fires early
+  uint64_t ticks = (timeout_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+  entry->expires = current_tick(wheel) + ticks + 1;
+
+  wheel_insert(wheel, entry);
+}
+
+void timer_wheel_cancel(timer_wheel_t *wheel, wheel_entry_t *entry) {
+  if (!wheel || !entry || !entry->pprev)
+    return;
+
+  entry_unlink(entry);
+  wheel->count--;
+}
@@ -0,0 +1,58 @@
+#ifndef ECEWO_TIMER_WHEEL_H
+#define ECEWO_TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "uv.h"
+
+#ifndef TIMER_WHEEL_TICK_MS
+#define TIMER_WHEEL_TICK_MS 100
+#endif
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+
+typedef struct wheel_entry_s wheel_entry_t;
+typedef void (*wheel_cb_t)(wheel_entry_t *entry);
+
+// Embedded in the object it times out, see wheel_entry_owner()
+struct wheel_entry_s {
+  wheel_entry_t *next;
+  wheel_entry_t **pprev; // NULL while not scheduled
+  uint64_t expires; // In ticks
+  wheel_cb_t cb;
+};
+
+// Hashed and hierarchical timing wheel, one per loop.
+// A single uv_timer_t drives every entry of the loop,
+// and it only runs while something is scheduled.
+typedef struct
+{
+  uv_timer_t timer;
+  uv_loop_t *loop;
+  uint64_t now; // Last processed tick
+  uint32_t count;
+  bool initialized;
+  bool running;
+  wheel_entry_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel_t;
+
+#define wheel_entry_owner(entry, type, member) \
+  ((type *)((char *)(entry) - offsetof(type, member)))
+
+int timer_wheel_init(timer_wheel_t *wheel, uv_loop_t *loop);
+void timer_wheel_close(timer_wheel_t *wheel);
+
+// Schedules or reschedules the entry, O(1)
+void timer_wheel_schedule(timer_wheel_t *wheel, wheel_entry_t *entry, uint64_t timeout_ms);
+
+// Safe to call on an entry that is not scheduled, O(1)
+void timer_wheel_cancel(timer_wheel_t *wheel, wheel_entry_t *entry);
+
+static inline bool wheel_entry_pending(const wheel_entry_t *entry) {
+  return entry->pprev != NULL;
+}
+
+#endif
@@ -1,50 +1,140 @@
 #include "uv.h"
-#include <stdbool.h>
-#include <time.h>
+#include "utils.h"
+#include <string.h>
 
-typedef struct
-{
-  time_t timestamp;
-  char date_str[64];
-  uv_mutex_t mutex;
-} date_cache_t;
+static const char day_names[7][4] = {
+  "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
 
-static date_cache_t g_date_cache = { 0 };
-static bool g_date_cache_initialized = false;
+static const char month_names[12][4] = {
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
 
-void init_date_cache(void) {
-  if (g_date_cache_initialized)
-    return;
+// Cache of the loop running on this thread, only that loop writes it
+static _Thread_local date_cache_t *thread_cache = NULL;
+
+// Used by threads without a running cache
+static _Thread_local time_t fallback_second = 0;
+static _Thread_local char fallback_line[DATE_LINE_LEN + 1];
 
-  uv_mutex_init(&g_date_cache.mutex);
-  g_date_cache.timestamp = 0;
-  g_date_cache_initialized = true;
+static void put_2digits(char *p, int v) {
+  p[0] = (char)('0' + v / 10);
+  p[1] = (char)('0' + v % 10);
 }
 
-void destroy_date_cache(void) {
-  if (!g_date_cache_initialized)
-    return;
+// Independent of the locale, unlike strftime("%a, %d %b ...")
+bool format_http_date(char *out, time_t t) {
+  struct tm tm;
+
+#ifdef _WIN32
+  if (gmtime_s(&tm, &t) != 0)
+    return false;
+#else
+  if (!gmtime_r(&t, &tm))
+    return false;
+#endif
+
+  int year = tm.tm_year + 1900;
+  if (year < 0 || year > 9999)
+    return false;
 
-  uv_mutex_destroy(&g_date_cache.mutex);
-  g_date_cache_initialized = false;
+  memcpy(out, day_names[tm.tm_wday], 3);
+  out[3] = ',';
+  out[4] = ' ';
+  put_2digits(out + 5, tm.tm_mday);
+  out[7] = ' ';
+  memcpy(out + 8, month_names[tm.tm_mon], 3);
+  out[11] = ' ';
+  put_2digits(out + 12, year / 100);
+  put_2digits(out + 14, year % 100);
+  out[16] = ' ';
+  put_2digits(out + 17, tm.tm_hour);
+  out[19] = ':';
+  put_2digits(out + 20, tm.tm_min);
+  out[22] = ':';
+  put_2digits(out + 23, tm.tm_sec);
+  memcpy(out + 25, " GMT", 5);
+
+  return true;
 }
 
-const char *get_cached_date(void) {
-  time_t now = time(NULL);
+// "Date: " + date + "\r\n"
+static void format_date_line(char *line, time_t t) {
+  memcpy(line, "Date: ", 6);
+  if (!format_http_date(line + 6, t))
+    memcpy(line + 6, "Thu, 01 Jan 1970 00:00:00 GMT", HTTP_DATE_LEN);
+  memcpy(line + 6 + HTTP_DATE_LEN, "\r\n", 3);
+}
+
+static void on_date_tick(uv_timer_t *timer) {
+  date_cache_t *cache = (date_cache_t *)timer->data;
+
+  uv_timeval64_t now;
+  if (uv_gettimeofday(&now) != 0) {
+    now.tv_sec = (int64_t)time(NULL);
+    now.tv_usec = 0;
+  }
+
+  if ((time_t)now.tv_sec != cache->second) {
+    format_date_line(cache->line, (time_t)now.tv_sec);
+    cache->second = (time_t)now.tv_sec;
+  }
+
+  // Fires just after the next second starts
+  uint64_t delay = 1000 - (uint64_t)now.tv_usec / 1000;
+  uv_timer_start(timer, on_date_tick, delay, 0);
+}
+
+int date_cache_start(date_cache_t *cache, uv_loop_t *loop) {
+  if (!cache || !loop)
+    return -1;
 
-  if (g_date_cache.timestamp == now)
-    return g_date_cache.date_str;
+  memset(cache, 0, sizeof(date_cache_t));
 
-  uv_mutex_lock(&g_date_cache.mutex);
+  if (uv_timer_init(loop, &cache->timer) != 0)
+    return -1;
 
-  if (g_date_cache.timestamp != now) {
-    struct tm *gmt = gmtime(&now);
-    strftime(g_date_cache.date_str, sizeof(g_date_cache.date_str),
-             "%a, %d %b %Y %H:%M:%S GMT", gmt);
-    g_date_cache.timestamp = now;
+  cache->timer.data = cache;
+  cache->running = true;
+
+  // The date alone does not keep the loop alive
+  uv_unref((uv_handle_t *)&cache->timer);
+
+  on_date_tick(&cache->timer);
+
+  return 0;
+}
+
+void date_cache_bind(date_cache_t *cache) {
+  thread_cache = cache;
+}
+
+void date_cache_stop(date_cache_t *cache) {
+  if (!cache || !cache->running)
+    return;
+
+  cache->running = false;
+
+  if (!uv_is_closing((uv_handle_t *)&cache->timer)) {
+    uv_timer_stop(&cache->timer);
+    uv_close((uv_handle_t *)&cache->timer, NULL);
+  }
+}
+
+const char *get_date_line(void) {
+  if (thread_cache && thread_cache->running)
+    return thread_cache->line;
+
+  time_t now = time(NULL);
+  if (now != fallback_second) {
+    format_date_line(fallback_line, now);
+    fallback_second = now;
   }
 
-  uv_mutex_unlock(&g_date_cache.mutex);
+  return fallback_line;
+}
 
-  return g_date_cache.date_str;
+const char *get_cached_date(void) {
+  return get_date_line() + 6;
 }
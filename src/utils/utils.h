@@ -1,8 +1,37 @@
 #ifndef ECEWO_UTILS_H
 #define ECEWO_UTILS_H
 
-void init_date_cache(void);
-void destroy_date_cache(void);
+#include <stdbool.h>
+#include <time.h>
+#include "uv.h"
+
+// "Sun, 06 Nov 1994 08:49:37 GMT"
+#define HTTP_DATE_LEN 29
+
+// "Date: " + date + "\r\n"
+#define DATE_LINE_LEN (6 + HTTP_DATE_LEN + 2)
+
+// Date of one loop, refreshed by a timer at each second.
+// Responses copy it without a syscall or a lock.
+typedef struct
+{
+  uv_timer_t timer;
+  time_t second;
+  char line[DATE_LINE_LEN + 1];
+  bool running;
+} date_cache_t;
+
+int date_cache_start(date_cache_t *cache, uv_loop_t *loop);
+void date_cache_stop(date_cache_t *cache);
+
+// Used by get_date_line() on the calling thread, NULL unbinds
+void date_cache_bind(date_cache_t *cache);
+
+// Date of the loop on this thread, formatted on demand elsewhere
+const char *get_date_line(void);
 const char *get_cached_date(void);
 
-#endif
\ No newline at end of file
+// Writes HTTP_DATE_LEN bytes and a NUL
+bool format_http_date(char *out, time_t t);
+
+#endif
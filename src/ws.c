@@ -0,0 +1,1015 @@
+#include <stdlib.h>
+#include "ws.h"
+#include "channel.h"
+#include "logger.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#define strncasecmp _strnicmp
+#else
+#include <strings.h>
+#endif
+
+#define LITERAL_LEN(s) (sizeof(s) - 1)
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_KEY_LEN 24 // Base64 of 16 bytes
+
+// A reassembly buffer larger than this is not kept between messages
+#define WS_MESSAGE_KEEP 65536
+
+#define MAX_FRAME_HEADER 14
+#define MAX_CONTROL_PAYLOAD 125
+
+enum {
+  OPCODE_CONTINUATION = 0x0,
+  OPCODE_TEXT = 0x1,
+  OPCODE_BINARY = 0x2,
+  OPCODE_CLOSE = 0x8,
+  OPCODE_PING = 0x9,
+  OPCODE_PONG = 0xA
+};
+
+enum {
+  CLOSE_NORMAL = 1000,
+  CLOSE_PROTOCOL_ERROR = 1002,
+  CLOSE_NO_STATUS = 1005,
+  CLOSE_ABNORMAL = 1006,
+  CLOSE_INVALID_DATA = 1007,
+  CLOSE_TOO_BIG = 1009
+};
+
+typedef struct ws_group_s ws_group_t;
+
+struct ws_group_s {
+  channel_member_t member; // Kept first, see group_of()
+  WebSocket *ws;
+  ws_group_t *next;
+  char name[];
+};
+
+struct websocket_s {
+  client_t *client;
+  WebSocketConfig config;
+  wheel_entry_t keepalive; // Ping interval, or the close deadline
+  ws_group_t *groups;
+
+  // Frame being parsed, the header may arrive in pieces
+  uint8_t header[MAX_FRAME_HEADER];
+  uint8_t header_len;
+  uint8_t opcode;
+  bool fin;
+  bool in_payload;
+  uint8_t mask[4];
+  uint64_t payload_len;
+  uint64_t payload_read;
+
+  // Message reassembled from fragments or from several reads
+  uint8_t message_opcode; // 0 while no message is in progress
+  uint8_t *message;
+  size_t message_len;
+  size_t message_cap;
+
+  uint8_t control[MAX_CONTROL_PAYLOAD];
+
+  uint16_t close_code;
+  bool awaiting_pong;
+  bool close_sent;
+  bool close_received;
+  bool failed; // ws_fail() was called, the rest of the read is dropped
+};
+
+typedef struct
+{
+  uv_write_t req;
+  channel_msg_t *msg; // Shared broadcast frame, otherwise data[] is written
+  bool close_after;
+  char data[];
+} ws_write_t;
+
+static ws_group_t *group_of(channel_member_t *member) {
+  return (ws_group_t *)member;
+}
+
+static uint32_t rol32(uint32_t value, int bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+static void sha1_block(uint32_t state[5], const uint8_t *block) {
+  uint32_t w[80];
+
+  for (int i = 0; i < 16; i++) {
+    w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16)
+        | ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+  }
+
+  for (int i = 16; i < 80; i++)
+    w[i] = rol32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+  for (int i = 0; i < 80; i++) {
+    uint32_t f, k;
+
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+
+    uint32_t t = rol32(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = rol32(b, 30);
+    b = a;
+    a = t;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+// Only hashes the handshake key, so the input is short
+static void sha1(const uint8_t *data, size_t len, uint8_t digest[20]) {
+  uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  uint8_t block[128];
+  size_t done = 0;
+
+  for (; done + 64 <= len; done += 64)
+    sha1_block(state, data + done);
+
+  size_t rest = len - done;
+  memcpy(block, data + done, rest);
+  block[rest] = 0x80;
+
+  size_t total = rest + 9 <= 64 ? 64 : 128;
+  memset(block + rest + 1, 0, total - rest - 1);
+
+  uint64_t bits = (uint64_t)len * 8;
+  for (int i = 0; i < 8; i++)
+    block[total - 1 - i] = (uint8_t)(bits >> (i * 8));
+
+  sha1_block(state, block);
+  if (total == 128)
+    sha1_block(state, block + 64);
+
+  for (int i = 0; i < 5; i++) {
+    digest[i * 4] = (uint8_t)(state[i] >> 24);
+    digest[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+    digest[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+    digest[i * 4 + 3] = (uint8_t)state[i];
+  }
+}
+
+static size_t base64_encode(const uint8_t *data, size_t len, char *out) {
+  static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  char *p = out;
+
+  for (size_t i = 0; i < len; i += 3) {
+    uint32_t chunk = (uint32_t)data[i] << 16;
+    if (i + 1 < len)
+      chunk |= (uint32_t)data[i + 1] << 8;
+    if (i + 2 < len)
+      chunk |= data[i + 2];
+
+    *p++ = table[(chunk >> 18) & 0x3f];
+    *p++ = table[(chunk >> 12) & 0x3f];
+    *p++ = i + 1 < len ? table[(chunk >> 6) & 0x3f] : '=';
+    *p++ = i + 2 < len ? table[chunk & 0x3f] : '=';
+  }
+
+  return (size_t)(p - out);
+}
+
+void ws_unmask(uint8_t *data, size_t len, const uint8_t mask[4], size_t offset) {
+  uint8_t key[4];
+  for (int i = 0; i < 4; i++)
+    key[i] = mask[(offset + i) & 3];
+
+  uint32_t word;
+  memcpy(&word, key, 4);
+
+  // Every step below is a multiple of 4 bytes, the key stays aligned
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  __m256i key256 = _mm256_set1_epi32((int)word);
+  for (; i + 32 <= len; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+    _mm256_storeu_si256((__m256i *)(data + i), _mm256_xor_si256(block, key256));
+  }
+#endif
+
+#ifdef WS_SSE2
+  __m128i key128 = _mm_set1_epi32((int)word);
+  for (; i + 16 <= len; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+    _mm_storeu_si128((__m128i *)(data + i), _mm_xor_si128(block, key128));
+  }
+#endif
+
+  uint64_t key64 = (uint64_t)word | ((uint64_t)word << 32);
+  for (; i + 8 <= len; i += 8) {
+    uint64_t block;
+    memcpy(&block, data + i, 8);
+    block ^= key64;
+    memcpy(data + i, &block, 8);
+  }
+
+  for (; i < len; i++)
+    data[i] ^= key[i & 3];
+}
+
+static bool utf8_valid(const uint8_t *p, size_t len) {
+  size_t i = 0;
+
+  while (i < len) {
+    // ASCII runs, 8 bytes at a time
+    while (i + 8 <= len) {
+      uint64_t block;
+      memcpy(&block, p + i, 8);
+      if (block & 0x8080808080808080ull)
+        break;
+      i += 8;
+    }
+
+    if (i >= len)
+      break;
+
+    uint8_t c = p[i];
+
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+
+    size_t count;
+    uint32_t cp;
+
+    if (c >= 0xC2 && c <= 0xDF) {
+      count = 1;
+      cp = c & 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      count = 2;
+      cp = c & 0x0F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      count = 3;
+      cp = c & 0x07;
+    } else {
+      return false;
+    }
+
+    if (count >= len - i)
+      return false; // Truncated sequence
+
+    for (size_t j = 1; j <= count; j++) {
+      if ((p[i + j] & 0xC0) != 0x80)
+        return false;
+      cp = (cp << 6) | (p[i + j] & 0x3F);
+    }
+
+    // Overlong forms, surrogates and code points past U+10FFFF
+    if ((count == 2 && cp < 0x800) || (count == 3 && cp < 0x10000)
+        || (cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF)
+      return false;
+
+    i += count + 1;
+  }
+
+  return true;
+}
+
+static size_t put_frame_header(uint8_t *p, uint8_t opcode, size_t len) {
+  p[0] = 0x80 | opcode; // Sent frames are never fragmented
+
+  if (len < 126) {
+    p[1] = (uint8_t)len;
+    return 2;
+  }
+
+  if (len <= 0xFFFF) {
+    p[1] = 126;
+    p[2] = (uint8_t)(len >> 8);
+    p[3] = (uint8_t)len;
+    return 4;
+  }
+
+  p[1] = 127;
+  for (int i = 0; i < 8; i++)
+    p[2 + i] = (uint8_t)((uint64_t)len >> ((7 - i) * 8));
+  return 10;
+}
+
+static void on_ws_written(uv_write_t *req, int status) {
+  ws_write_t *write = (ws_write_t *)req;
+  client_t *client = (client_t *)req->handle->data;
+  bool close_after = write->close_after;
+
+  if (write->msg)
+    channel_msg_unref(write->msg);
+
+  free(write);
+
+  if (!client || client->closing)
+    return;
+
+  client_write_finished(client);
+
+  if (status < 0) {
+    LOG_DEBUG("WebSocket write error: %s", uv_strerror(status));
+    close_client(client);
+    return;
+  }
+
+  if (close_after)
+    close_client(client);
+}
+
+// Writes a frame, copied after the header unless it is a shared broadcast
+static int ws_write(WebSocket *ws, uint8_t opcode, const void *payload, size_t len,
+                    channel_msg_t *msg, bool close_after) {
+  client_t *client = ws->client;
+  if (!client || client->closing)
+    return -1;
+
+  uv_stream_t *stream = (uv_stream_t *)&client->handle;
+
+  // Still behind on what it was sent before
+  if (uv_stream_get_write_queue_size(stream) > WS_MAX_QUEUED) {
+    LOG_DEBUG("WebSocket peer is too slow - closing connection");
+    close_client(client);
+    return -1;
+  }
+
+  size_t size = msg ? 0 : MAX_FRAME_HEADER + len;
+
+  ws_write_t *write = malloc(sizeof(ws_write_t) + size);
+  if (!write) {
+    close_client(client);
+    return -1;
+  }
+
+  write->msg = msg;
+  write->close_after = close_after;
+
+  uv_buf_t buf;
+
+  if (msg) {
+    channel_msg_ref(msg);
+    buf = uv_buf_init(msg->data, (unsigned int)msg->len);
+  } else {
+    size_t header_len = put_frame_header((uint8_t *)write->data, opcode, len);
+    if (len > 0)
+      memcpy(write->data + header_len, payload, len);
+    buf = uv_buf_init(write->data, (unsigned int)(header_len + len));
+  }
+
+  int result = uv_write(&write->req, stream, &buf, 1, on_ws_written);
+  if (result < 0) {
+    LOG_DEBUG("WebSocket write error: %s", uv_strerror(result));
+    if (msg)
+      channel_msg_unref(msg);
+    free(write);
+    close_client(client);
+    return -1;
+  }
+
+  client_write_started(client);
+  return 0;
+}
+
+static void send_close(WebSocket *ws, uint16_t code, bool close_after) {
+  if (ws->close_sent)
+    return;
+
+  ws->close_sent = true;
+
+  uint8_t payload[2] = { (uint8_t)(code >> 8), (uint8_t)code };
+  bool has_code = code != CLOSE_NO_STATUS;
+
+  ws_write(ws, OPCODE_CLOSE, payload, has_code ? 2 : 0, NULL, close_after);
+
+  // Waits for the peer to answer, then gives up
+  if (!close_after && ws->client && !ws->client->closing)
+    timer_wheel_schedule(&ws->client->owner->wheel, &ws->keepalive, WS_CLOSE_TIMEOUT_MS);
+}
+
+// Protocol error, nothing more is read
+static void ws_fail(WebSocket *ws, uint16_t code) {
+  LOG_DEBUG("WebSocket protocol error %u - closing connection", code);
+
+  ws->failed = true;
+
+  if (!ws->close_received)
+    ws->close_code = code;
+
+  uv_read_stop((uv_stream_t *)&ws->client->handle);
+
+  if (ws->close_sent)
+    close_client(ws->client);
+  else
+    send_close(ws, code, true);
+}
+
+static bool close_code_valid(uint16_t code) {
+  return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011)
+      || (code >= 3000 && code <= 4999);
+}
+
+static void deliver_message(WebSocket *ws, uint8_t opcode, const uint8_t *data, size_t len) {
+  if (opcode == OPCODE_TEXT && !utf8_valid(data, len)) {
+    ws_fail(ws, CLOSE_INVALID_DATA);
+    return;
+  }
+
+  if (ws->config.on_message)
+    ws->config.on_message(ws, data, len, opcode == OPCODE_BINARY);
+}
+
+static bool message_append(WebSocket *ws, const uint8_t *data, size_t len) {
+  if (ws->message_len + len > ws->message_cap) {
+    size_t cap = ws->message_cap ? ws->message_cap : 4096;
+    while (cap < ws->message_len + len)
+      cap *= 2;
+
+    uint8_t *message = realloc(ws->message, cap);
+    if (!message)
+      return false;
+
+    ws->message = message;
+    ws->message_cap = cap;
+  }
+
+  memcpy(ws->message + ws->message_len, data, len);
+  ws->message_len += len;
+  return true;
+}
+
+static void message_reset(WebSocket *ws) {
+  ws->message_opcode = 0;
+  ws->message_len = 0;
+
+  if (ws->message_cap > WS_MESSAGE_KEEP) {
+    free(ws->message);
+    ws->message = NULL;
+    ws->message_cap = 0;
+  }
+}
+
+static void control_done(WebSocket *ws) {
+  size_t len = (size_t)ws->payload_len;
+
+  switch (ws->opcode) {
+  case OPCODE_PING:
+    if (!ws->close_sent)
+      ws_write(ws, OPCODE_PONG, ws->control, len, NULL, false);
+    break;
+
+  case OPCODE_PONG:
+    break;
+
+  case OPCODE_CLOSE: {
+    uint16_t code = CLOSE_NO_STATUS;
+
+    if (len == 1) {
+      ws_fail(ws, CLOSE_PROTOCOL_ERROR);
+      return;
+    }
+
+    if (len >= 2) {
+      code = (uint16_t)((ws->control[0] << 8) | ws->control[1]);
+      if (!close_code_valid(code) || !utf8_valid(ws->control + 2, len - 2)) {
+        ws_fail(ws, CLOSE_PROTOCOL_ERROR);
+        return;
+      }
+    }
+
+    ws->close_received = true;
+    ws->close_code = code;
+
+    // Our close frame was already answered
+    if (ws->close_sent) {
+      close_client(ws->client);
+      return;
+    }
+
+    send_close(ws, code, true);
+    break;
+  }
+  }
+}
+
+// Validates a complete frame header, false once the connection is failed
+static bool header_done(WebSocket *ws) {
+  const uint8_t *h = ws->header;
+
+  ws->fin = (h[0] & 0x80) != 0;
+  ws->opcode = h[0] & 0x0F;
+
+  size_t pos = 2;
+  uint64_t len = h[1] & 0x7F;
+
+  if (len == 126) {
+    len = ((uint64_t)h[2] << 8) | h[3];
+    pos = 4;
+  } else if (len == 127) {
+    len = 0;
+    for (int i = 0; i < 8; i++)
+      len = (len << 8) | h[2 + i];
+    pos = 10;
+  }
+
+  memcpy(ws->mask, h + pos, 4);
+  ws->payload_len = len;
+  ws->payload_read = 0;
+
+  bool control = (ws->opcode & 0x08) != 0;
+
+  if ((h[0] & 0x70) || !(h[1] & 0x80)) {
+    ws_fail(ws, CLOSE_PROTOCOL_ERROR); // Extension bits, or an unmasked client frame
+    return false;
+  }
+
+  if (control) {
+    if (ws->opcode > OPCODE_PONG || !ws->fin || len > MAX_CONTROL_PAYLOAD) {
+      ws_fail(ws, CLOSE_PROTOCOL_ERROR);
+      return false;
+    }
+    return true;
+  }
+
+  if (ws->opcode > OPCODE_BINARY
+      || (ws->opcode == OPCODE_CONTINUATION) != (ws->message_opcode != 0)) {
+    ws_fail(ws, CLOSE_PROTOCOL_ERROR);
+    return false;
+  }
+
+  if (len > WS_MAX_MESSAGE || ws->message_len + len > WS_MAX_MESSAGE) {
+    ws_fail(ws, CLOSE_TOO_BIG);
+    return false;
+  }
+
+  if (ws->opcode != OPCODE_CONTINUATION)
+    ws->message_opcode = ws->opcode;
+
+  return true;
+}
+
+static void frame_done(WebSocket *ws) {
+  ws->header_len = 0;
+  ws->in_payload = false;
+
+  if (ws->opcode & 0x08) {
+    control_done(ws);
+    return;
+  }
+
+  if (!ws->fin)
+    return;
+
+  uint8_t opcode = ws->message_opcode;
+  deliver_message(ws, opcode, ws->message, ws->message_len);
+
+  if (ws->client && !ws->client->closing)
+    message_reset(ws);
+}
+
+static size_t header_size(const uint8_t *h) {
+  uint8_t len = h[1] & 0x7F;
+  size_t size = 2 + ((h[1] & 0x80) ? 4 : 0);
+
+  if (len == 126)
+    size += 2;
+  else if (len == 127)
+    size += 8;
+
+  return size;
+}
+
+// Parses as many frames as the read holds, payloads are unmasked in place
+static void ws_parse(WebSocket *ws, uint8_t *data, size_t len) {
+  client_t *client = ws->client;
+
+  while (len > 0 && !client->closing && !ws->failed && !(ws->close_received && ws->close_sent)) {
+    if (!ws->in_payload) {
+      size_t need = ws->header_len < 2 ? 2 : header_size(ws->header);
+
+      while (ws->header_len < need && len > 0) {
+        ws->header[ws->header_len++] = *data++;
+        len--;
+
+        if (ws->header_len == 2)
+          need = header_size(ws->header);
+      }
+
+      if (ws->header_len < need)
+        return;
+
+      if (!header_done(ws))
+        return;
+
+      ws->in_payload = true;
+
+      // A whole unfragmented message in this read is delivered
+      // from the read buffer without being copied
+      if (ws->fin && ws->opcode != OPCODE_CONTINUATION && !(ws->opcode & 0x08)
+          && ws->payload_len <= len) {
+        size_t size = (size_t)ws->payload_len;
+        uint8_t opcode = ws->opcode;
+
+        ws_unmask(data, size, ws->mask, 0);
+        ws->header_len = 0;
+        ws->in_payload = false;
+
+        deliver_message(ws, opcode, data, size);
+        if (client->closing || ws->failed)
+          return;
+
+        ws->message_opcode = 0;
+        data += size;
+        len -= size;
+        continue;
+      }
+
+      if (ws->payload_len == 0) {
+        frame_done(ws);
+        continue;
+      }
+    }
+
+    uint64_t remaining = ws->payload_len - ws->payload_read;
+    size_t take = remaining < len ? (size_t)remaining : len;
+
+    ws_unmask(data, take, ws->mask, (size_t)(ws->payload_read & 3));
+
+    if (ws->opcode & 0x08) {
+      memcpy(ws->control + ws->payload_read, data, take);
+    } else if (!message_append(ws, data, take)) {
+      close_client(client);
+      return;
+    }
+
+    ws->payload_read += take;
+    data += take;
+    len -= take;
+
+    if (ws->payload_read == ws->payload_len)
+      frame_done(ws);
+  }
+}
+
+static void on_ws_alloc(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
+  (void)suggested_size;
+  client_t *client = (client_t *)handle->data;
+
+  if (!client || client->closing) {
+    *buf = uv_buf_init(NULL, 0);
+    return;
+  }
+
+#if SHARED_READ_BUFFER
+  *buf = uv_buf_init(client->owner->read_buffer, READ_BUFFER_SIZE);
+#else
+  *buf = uv_buf_init(client->buffer, READ_BUFFER_SIZE);
+#endif
+}
+
+static void on_ws_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  client_t *client = (client_t *)stream->data;
+
+  if (!client || client->closing)
+    return;
+
+  if (nread < 0) {
+    close_client(client);
+    return;
+  }
+
+  WebSocket *ws = client->ws;
+  if (nread == 0 || !ws)
+    return;
+
+  client_touch(client);
+
+  // Any frame shows the peer is alive
+  ws->awaiting_pong = false;
+
+  ws_parse(ws, (uint8_t *)buf->base, (size_t)nread);
+}
+
+static void on_keepalive(wheel_entry_t *entry) {
+  WebSocket *ws = wheel_entry_owner(entry, WebSocket, keepalive);
+
+  if (ws->close_sent) {
+    LOG_DEBUG("WebSocket close handshake timed out");
+    close_client(ws->client);
+    return;
+  }
+
+  if (ws->awaiting_pong) {
+    LOG_DEBUG("WebSocket ping timed out - closing connection");
+    close_client(ws->client);
+    return;
+  }
+
+  ws->awaiting_pong = true;
+  if (ws_write(ws, OPCODE_PING, NULL, 0, NULL, false) == 0)
+    timer_wheel_schedule(&ws->client->owner->wheel, &ws->keepalive, WS_PING_INTERVAL_MS);
+}
+
+// Comma-separated header value contains the token, case-insensitively
+static bool has_token(const char *value, const char *token) {
+  size_t token_len = strlen(token);
+
+  while (value && *value) {
+    while (*value == ' ' || *value == '\t' || *value == ',')
+      value++;
+
+    const char *end = value;
+    while (*end && *end != ',')
+      end++;
+
+    const char *last = end;
+    while (last > value && (last[-1] == ' ' || last[-1] == '\t'))
+      last--;
+
+    if ((size_t)(last - value) == token_len && strncasecmp(value, token, token_len) == 0)
+      return true;
+
+    value = end;
+  }
+
+  return false;
+}
+
+int ws_upgrade(Req *req, Res *res, const WebSocketConfig *config) {
+  if (!req || !res || !config || res->replied)
+    return -1;
+
+  exchange_t *exchange = (exchange_t *)res->exchange;
+  client_t *client = exchange ? exchange->client : NULL;
+
+  if (!client || client->closing || client->taken_over)
+    return -1;
+
+  // Earlier pipelined responses would end up after the 101
+  if (client->exchange_head != exchange || client->body_exchange)
+    return -1;
+
+  const char *key = get_header_id(req, HEADER_SEC_WEBSOCKET_KEY);
+  const char *version = get_header_id(req, HEADER_SEC_WEBSOCKET_VERSION);
+
+  if (!req->method || strcmp(req->method, "GET") != 0
+      || req->http_major != 1 || req->http_minor < 1
+      || !has_token(get_header_id(req, HEADER_UPGRADE), "websocket")
+      || !has_token(get_header_id(req, HEADER_CONNECTION), "upgrade")
+      || !version || strcmp(version, "13") != 0
+      || !key || strlen(key) != WS_KEY_LEN)
+    return -1;
+
+  uint8_t input[WS_KEY_LEN + LITERAL_LEN(WS_GUID)];
+  memcpy(input, key, WS_KEY_LEN);
+  memcpy(input + WS_KEY_LEN, WS_GUID, LITERAL_LEN(WS_GUID));
+
+  uint8_t digest[20];
+  sha1(input, sizeof(input), digest);
+
+  char accept[28];
+  base64_encode(digest, sizeof(digest), accept);
+
+  static const char status_line[] = "HTTP/1.1 101 Switching Protocols\r\n"
+                                    "Upgrade: websocket\r\n"
+                                    "Connection: Upgrade\r\n"
+                                    "Sec-WebSocket-Accept: ";
+
+  // Headers of the handler, such as Sec-WebSocket-Protocol
+  size_t size = LITERAL_LEN(status_line) + sizeof(accept) + 4;
+  for (uint16_t i = 0; i < res->header_count; i++) {
+    const http_header_t *header = &res->headers[i];
+    if (header->name && header->value)
+      size += header->name_len + 2 + header->value_len + 2;
+  }
+
+  ws_write_t *write = malloc(sizeof(ws_write_t) + size);
+  WebSocket *ws = calloc(1, sizeof(WebSocket));
+
+  if (!write || !ws) {
+    free(write);
+    free(ws);
+    return -1;
+  }
+
+  write->msg = NULL;
+  write->close_after = false;
+
+  char *p = write->data;
+  memcpy(p, status_line, LITERAL_LEN(status_line));
+  p += LITERAL_LEN(status_line);
+  memcpy(p, accept, sizeof(accept));
+  p += sizeof(accept);
+  *p++ = '\r';
+  *p++ = '\n';
+
+  for (uint16_t i = 0; i < res->header_count; i++) {
+    const http_header_t *header = &res->headers[i];
+    if (!header->name || !header->value)
+      continue;
+
+    memcpy(p, header->name, header->name_len);
+    p += header->name_len;
+    *p++ = ':';
+    *p++ = ' ';
+    memcpy(p, header->value, header->value_len);
+    p += header->value_len;
+    *p++ = '\r';
+    *p++ = '\n';
+  }
+
+  *p++ = '\r';
+  *p++ = '\n';
+
+  TakeoverConfig takeover = { 0 };
+  if (connection_takeover(res, &takeover) != 0) {
+    free(write);
+    free(ws);
+    return -1;
+  }
+
+  ws->client = client;
+  ws->config = *config;
+  ws->keepalive.cb = on_keepalive;
+  client->ws = ws;
+
+  uv_buf_t buf = uv_buf_init(write->data, (unsigned int)(p - write->data));
+
+  if (uv_write(&write->req, (uv_stream_t *)&client->handle, &buf, 1, on_ws_written) < 0) {
+    free(write);
+    close_client(client);
+    return 0;
+  }
+
+  client_write_started(client);
+  uv_read_start((uv_stream_t *)&client->handle, on_ws_alloc, on_ws_read);
+  timer_wheel_schedule(&client->owner->wheel, &ws->keepalive, WS_PING_INTERVAL_MS);
+
+  if (ws->config.on_open)
+    ws->config.on_open(ws);
+
+  return 0;
+}
+
+int ws_send(WebSocket *ws, const void *data, size_t len, bool binary) {
+  if (!ws || ws->close_sent || (!data && len > 0))
+    return -1;
+
+  return ws_write(ws, binary ? OPCODE_BINARY : OPCODE_TEXT, data, len, NULL, false);
+}
+
+void ws_close(WebSocket *ws, uint16_t code) {
+  if (!ws || !ws->client || ws->client->closing)
+    return;
+
+  if (!ws->close_received)
+    ws->close_code = code;
+
+  send_close(ws, code, false);
+}
+
+void *ws_user_data(WebSocket *ws) {
+  return ws ? ws->config.user_data : NULL;
+}
+
+static void group_deliver(channel_member_t *member, channel_msg_t *msg) {
+  WebSocket *ws = group_of(member)->ws;
+
+  if (!ws->close_sent)
+    ws_write(ws, 0, NULL, 0, msg, false);
+}
+
+int ws_join(WebSocket *ws, const char *group) {
+  if (!ws || !group || !ws->client || ws->client->closing)
+    return -1;
+
+  for (ws_group_t *g = ws->groups; g; g = g->next) {
+    if (strcmp(g->name, group) == 0)
+      return 0;
+  }
+
+  size_t name_len = strlen(group);
+
+  ws_group_t *g = calloc(1, sizeof(ws_group_t) + name_len + 1);
+  if (!g)
+    return -1;
+
+  memcpy(g->name, group, name_len + 1);
+  g->ws = ws;
+  g->member.deliver = group_deliver;
+
+  if (channel_join(CHANNEL_WEBSOCKET, group, &g->member, NULL, NULL, 0, NULL) != 0) {
+    free(g);
+    return -1;
+  }
+
+  g->next = ws->groups;
+  ws->groups = g;
+  return 0;
+}
+
+void ws_leave(WebSocket *ws, const char *group) {
+  if (!ws || !group)
+    return;
+
+  for (ws_group_t **link = &ws->groups; *link; link = &(*link)->next) {
+    ws_group_t *g = *link;
+
+    if (strcmp(g->name, group) == 0) {
+      *link = g->next;
+      channel_leave(&g->member);
+      free(g);
+      return;
+    }
+  }
+}
+
+typedef struct
+{
+  const void *data;
+  size_t len;
+  uint8_t opcode;
+} ws_broadcast_t;
+
+static channel_msg_t *frame_build(uint64_t id, void *context) {
+  (void)id;
+  const ws_broadcast_t *broadcast = (const ws_broadcast_t *)context;
+
+  channel_msg_t *msg = channel_msg_create(MAX_FRAME_HEADER + broadcast->len);
+  if (!msg)
+    return NULL;
+
+  size_t header_len = put_frame_header((uint8_t *)msg->data, broadcast->opcode, broadcast->len);
+  if (broadcast->len > 0)
+    memcpy(msg->data + header_len, broadcast->data, broadcast->len);
+
+  msg->len = header_len + broadcast->len;
+  return msg;
+}
+
+int ws_broadcast(const char *group, const void *data, size_t len, bool binary) {
+  if (!group || (!data && len > 0))
+    return -1;
+
+  ws_broadcast_t context = {
+    .data = data,
+    .len = len,
+    .opcode = binary ? OPCODE_BINARY : OPCODE_TEXT
+  };
+
+  return channel_publish(CHANNEL_WEBSOCKET, group, 0, frame_build, &context);
+}
+
+void ws_client_closed(client_t *client) {
+  WebSocket *ws = client->ws;
+  if (!ws)
+    return;
+
+  timer_wheel_cancel(&client->owner->wheel, &ws->keepalive);
+
+  ws_group_t *g = ws->groups;
+  while (g) {
+    ws_group_t *next = g->next;
+    channel_leave(&g->member);
+    free(g);
+    g = next;
+  }
+
+  ws->groups = NULL;
+
+  // ws_send() and ws_close() are no-ops from here on
+  ws->close_sent = true;
+
+  if (ws->config.on_close)
+    ws->config.on_close(ws, ws->close_code ? ws->close_code : CLOSE_ABNORMAL);
+
+  client->ws = NULL;
+  free(ws->message);
+  free(ws);
+}
@@ -0,0 +1,33 @@
+#ifndef ECEWO_WS_H
+#define ECEWO_WS_H
+
+#include "server.h"
+
+// Larger messages, whole or reassembled from fragments, close the connection with 1009
+#ifndef WS_MAX_MESSAGE
+#define WS_MAX_MESSAGE (1024 * 1024)
+#endif
+
+// A ping is sent this often, a connection that has not
+// answered the previous one by the next is closed
+#ifndef WS_PING_INTERVAL_MS
+#define WS_PING_INTERVAL_MS 30000
+#endif
+
+// Time the peer has to answer our close frame
+#ifndef WS_CLOSE_TIMEOUT_MS
+#define WS_CLOSE_TIMEOUT_MS 5000
+#endif
+
+// A connection with more unsent bytes than this is closed
+#ifndef WS_MAX_QUEUED
+#define WS_MAX_QUEUED (1024 * 1024)
+#endif
+
+// XORs the masking key over a payload that starts `offset` bytes into its frame
+void ws_unmask(uint8_t *data, size_t len, const uint8_t mask[4], size_t offset);
+
+// Calls on_close and frees the WebSocket of a closed connection
+void ws_client_closed(client_t *client);
+
+#endif
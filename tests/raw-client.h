@@ -0,0 +1,211 @@
+#ifndef RAW_CLIENT_H
+#define RAW_CLIENT_H
+
+// Plain sockets for the tests that request() cannot express: several
+// requests on one connection, requests split across writes, or a client
+// that stops reading. request() always sends "Connection: close".
+
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "uv.h"
+#include "ecewo.h"
+#include "ecewo-mock.h"
+
+#define RAW_TIMEOUT_MS 5000
+
+// Route handler that replies with the port the server listens on
+static inline void raw_port_handler(Req *req, Res *res) {
+  (void)req;
+  struct sockaddr_in addr;
+  int len = sizeof(addr);
+
+  if (uv_tcp_getsockname(get_client_handle(res), (struct sockaddr *)&addr, &len) != 0) {
+    send_text(res, 500, "No address");
+    return;
+  }
+
+  send_text(res, 200, arena_sprintf(res->arena, "%d", ntohs(addr.sin_port)));
+}
+
+// Port of the mock server, asked through a route served by raw_port_handler
+static inline int raw_server_port(const char *path) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = path
+  };
+
+  MockResponse res = request(&params);
+  int port = res.status_code == 200 && res.body ? atoi(res.body) : -1;
+
+  free_request(&res);
+  return port;
+}
+
+static inline int raw_connect(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// A leading '@' names a Linux abstract socket
+static inline int raw_connect_unix(const char *path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+
+  size_t len = strlen(path);
+  if (len >= sizeof(addr.sun_path)) {
+    close(fd);
+    return -1;
+  }
+
+  memcpy(addr.sun_path, path, len);
+  if (path[0] == '@')
+    addr.sun_path[0] = '\0';
+
+  socklen_t addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len + (path[0] == '@' ? 0 : 1));
+
+  if (connect(fd, (struct sockaddr *)&addr, addr_len) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static inline bool raw_send(int fd, const char *data) {
+  size_t len = strlen(data);
+
+  while (len > 0) {
+    ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent <= 0)
+      return false;
+
+    data += sent;
+    len -= (size_t)sent;
+  }
+
+  return true;
+}
+
+// Bytes read within the timeout, 0 when the peer closed, -1 on timeout
+static inline ssize_t raw_recv(int fd, char *buf, size_t len, int timeout_ms) {
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+  int ready = poll(&pfd, 1, timeout_ms);
+  if (ready <= 0)
+    return -1;
+
+  ssize_t got = recv(fd, buf, len, 0);
+  return got < 0 ? -1 : got;
+}
+
+// The peer closed the connection within the timeout, without sending more
+static inline bool raw_closed(int fd, int timeout_ms) {
+  char byte;
+  return raw_recv(fd, &byte, 1, timeout_ms) == 0;
+}
+
+// Nothing arrives within the timeout
+static inline bool raw_silent(int fd, int timeout_ms) {
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  return poll(&pfd, 1, timeout_ms) == 0;
+}
+
+static inline size_t raw_content_length(const char *headers, size_t len) {
+  const char *p = headers;
+  const char *end = headers + len;
+
+  while (p < end) {
+    const char *line_end = memchr(p, '\n', (size_t)(end - p));
+    if (!line_end)
+      break;
+
+    if ((size_t)(line_end - p) > 15 && strncasecmp(p, "Content-Length:", 15) == 0)
+      return (size_t)strtoul(p + 15, NULL, 10);
+
+    p = line_end + 1;
+  }
+
+  return 0;
+}
+
+// Reads `count` whole Content-Length responses into buf, NUL terminated.
+// Returns the bytes read, or -1 if they did not all arrive in time.
+static inline ssize_t raw_read_responses(int fd, char *buf, size_t cap, int count) {
+  size_t len = 0;
+  size_t start = 0;
+  int complete = 0;
+
+  while (complete < count) {
+    char *headers_end = NULL;
+
+    if (len > start) {
+      buf[len] = '\0';
+      headers_end = strstr(buf + start, "\r\n\r\n");
+    }
+
+    if (headers_end) {
+      size_t header_len = (size_t)(headers_end + 4 - (buf + start));
+      size_t total = header_len + raw_content_length(buf + start, header_len);
+
+      if (len - start >= total) {
+        start += total;
+        complete++;
+        continue;
+      }
+    }
+
+    if (len + 1 >= cap)
+      return -1;
+
+    ssize_t got = raw_recv(fd, buf + len, cap - len - 1, RAW_TIMEOUT_MS);
+    if (got <= 0)
+      return -1;
+
+    len += (size_t)got;
+  }
+
+  buf[len] = '\0';
+  return (ssize_t)len;
+}
+
+static inline int raw_count(const char *haystack, const char *needle) {
+  int count = 0;
+  size_t needle_len = strlen(needle);
+
+  for (const char *p = strstr(haystack, needle); p; p = strstr(p + needle_len, needle))
+    count++;
+
+  return count;
+}
+
+#endif
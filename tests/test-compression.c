@@ -0,0 +1,153 @@
+#include "ecewo.h"
+#include "ecewo-mock.h"
+#include "tester.h"
+
+static bool compression_ok = false;
+static char large_json[8192];
+
+void handler_large(Req *req, Res *res) {
+  (void)req;
+  send_json(res, 200, large_json);
+}
+
+void handler_small(Req *req, Res *res) {
+  (void)req;
+  send_json(res, 200, "{\"ok\":true}");
+}
+
+void handler_binary(Req *req, Res *res) {
+  (void)req;
+  set_header(res, "Content-Type", "application/octet-stream");
+  reply(res, 200, large_json, sizeof(large_json) - 1);
+}
+
+static MockResponse get_with_encoding(const char *path, const char *accept_encoding) {
+  MockHeaders headers[] = {
+    { "Accept-Encoding", accept_encoding }
+  };
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = path,
+    .headers = accept_encoding ? headers : NULL,
+    .header_count = accept_encoding ? 1 : 0
+  };
+
+  return request(&params);
+}
+
+static bool is_gzip(const MockResponse *res) {
+  return res->body_len > 2 && (unsigned char)res->body[0] == 0x1f
+      && (unsigned char)res->body[1] == 0x8b;
+}
+
+int test_gzip(void) {
+  if (!compression_ok)
+    RETURN_SKIP("Built without zlib");
+
+  MockResponse res = get_with_encoding("/large", "gzip, deflate, br");
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("gzip", mock_get_header(&res, "Content-Encoding"));
+  ASSERT_EQ_STR("Accept-Encoding", mock_get_header(&res, "Vary"));
+  ASSERT_TRUE(is_gzip(&res));
+  ASSERT_TRUE(res.body_len < sizeof(large_json) - 1);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_deflate_preferred(void) {
+  if (!compression_ok)
+    RETURN_SKIP("Built without zlib");
+
+  MockResponse res = get_with_encoding("/large", "gzip;q=0.5, deflate");
+
+  ASSERT_EQ_STR("deflate", mock_get_header(&res, "Content-Encoding"));
+  ASSERT_FALSE(is_gzip(&res));
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_identity(void) {
+  if (!compression_ok)
+    RETURN_SKIP("Built without zlib");
+
+  MockResponse plain = get_with_encoding("/large", NULL);
+  MockResponse refused = get_with_encoding("/large", "gzip;q=0, identity");
+
+  ASSERT_NULL(mock_get_header(&plain, "Content-Encoding"));
+  ASSERT_EQ_STR("Accept-Encoding", mock_get_header(&plain, "Vary"));
+  ASSERT_EQ_STR(large_json, plain.body);
+  ASSERT_NULL(mock_get_header(&refused, "Content-Encoding"));
+
+  free_request(&plain);
+  free_request(&refused);
+  RETURN_OK();
+}
+
+int test_not_compressed(void) {
+  if (!compression_ok)
+    RETURN_SKIP("Built without zlib");
+
+  // Below the minimum size
+  MockResponse small = get_with_encoding("/small", "gzip");
+  ASSERT_NULL(mock_get_header(&small, "Content-Encoding"));
+  ASSERT_EQ_STR("{\"ok\":true}", small.body);
+
+  // Not a compressible type
+  MockResponse binary = get_with_encoding("/binary", "gzip");
+  ASSERT_NULL(mock_get_header(&binary, "Content-Encoding"));
+
+  free_request(&small);
+  free_request(&binary);
+  RETURN_OK();
+}
+
+int test_static_precompressed(void) {
+  if (!compression_ok)
+    RETURN_SKIP("Built without zlib");
+
+  MockResponse gzip = get_with_encoding("/static", "gzip");
+  MockResponse plain = get_with_encoding("/static", NULL);
+
+  ASSERT_EQ_STR("gzip", mock_get_header(&gzip, "Content-Encoding"));
+  ASSERT_TRUE(is_gzip(&gzip));
+  ASSERT_NULL(mock_get_header(&plain, "Content-Encoding"));
+  ASSERT_EQ_STR("Accept-Encoding", mock_get_header(&plain, "Vary"));
+  ASSERT_EQ_STR(large_json, plain.body);
+
+  free_request(&gzip);
+  free_request(&plain);
+  RETURN_OK();
+}
+
+static void setup_routes(void) {
+  // Compresses well, large enough to be worth it
+  size_t len = sizeof(large_json) - 1;
+  for (size_t i = 0; i < len; i++)
+    large_json[i] = "{\"id\":1,\"name\":\"ecewo\"},"[i % 24];
+  large_json[0] = '[';
+  large_json[len - 1] = ']';
+  large_json[len] = '\0';
+
+  register_static("/static", 200, "application/json", large_json, len);
+
+  compression_ok = compression_enable(NULL) == 0;
+
+  get("/large", handler_large);
+  get("/small", handler_small);
+  get("/binary", handler_binary);
+}
+
+int main(void) {
+  mock_init(setup_routes);
+  RUN_TEST(test_gzip);
+  RUN_TEST(test_deflate_preferred);
+  RUN_TEST(test_identity);
+  RUN_TEST(test_not_compressed);
+  RUN_TEST(test_static_precompressed);
+  mock_cleanup();
+  return 0;
+}
@@ -0,0 +1,231 @@
+#include "ecewo.h"
+#include "ecewo-mock.h"
+#include "tester.h"
+#include "raw-client.h"
+
+#define REQUEST(path) "GET " path " HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+static int server_port;
+
+void handler_hello(Req *req, Res *res) {
+  (void)req;
+  send_text(res, 200, "hello");
+}
+
+// Counts the connection of this request too
+void handler_active(Req *req, Res *res) {
+  (void)req;
+  send_text(res, 200, arena_sprintf(res->arena, "%d", get_active_connections()));
+}
+
+void handler_echo(Req *req, Res *res) {
+  reply(res, 200, req->body, req->body_len);
+}
+
+typedef struct {
+  Res *res;
+} slow_t;
+
+static void slow_work(void *context) {
+  (void)context;
+  uv_sleep(200);
+}
+
+static void slow_done(void *context) {
+  slow_t *slow = context;
+  send_text(slow->res, 200, "slow");
+}
+
+void handler_slow(Req *req, Res *res) {
+  (void)req;
+  slow_t *slow = arena_alloc(res->arena, sizeof(slow_t));
+  slow->res = res;
+  spawn(slow, slow_work, slow_done);
+}
+
+static int active_connections(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/active"
+  };
+
+  MockResponse res = request(&params);
+  int active = res.status_code == 200 && res.body ? atoi(res.body) - 1 : -1;
+
+  free_request(&res);
+  return active;
+}
+
+// Closed connections are noticed on the next loop iteration
+static bool wait_active(int expected) {
+  for (int i = 0; i < 100; i++) {
+    if (active_connections() == expected)
+      return true;
+    uv_sleep(10);
+  }
+
+  return false;
+}
+
+static bool hello(int fd) {
+  char buf[1024];
+
+  if (!raw_send(fd, REQUEST("/hello")) || raw_read_responses(fd, buf, sizeof(buf), 1) <= 0)
+    return false;
+
+  return strstr(buf, "\r\n\r\nhello") != NULL;
+}
+
+int test_connections_close_order(void) {
+  int base = active_connections();
+  ASSERT_GT(base, -1);
+
+  // Used in order, the first one is the coldest
+  int fds[5];
+  for (int i = 0; i < 5; i++) {
+    fds[i] = raw_connect(server_port);
+    ASSERT_GT(fds[i], -1);
+    ASSERT_TRUE(hello(fds[i]));
+  }
+
+  ASSERT_TRUE(wait_active(base + 5));
+
+  // Out of the middle, the hot end and the cold end of the list
+  close(fds[2]);
+  ASSERT_TRUE(wait_active(base + 4));
+  close(fds[4]);
+  ASSERT_TRUE(wait_active(base + 3));
+  close(fds[0]);
+  ASSERT_TRUE(wait_active(base + 2));
+
+  // The rest are still linked and served, idle ones are not evicted
+  ASSERT_TRUE(hello(fds[1]));
+  ASSERT_TRUE(hello(fds[3]));
+  ASSERT_EQ(0, get_rejected_connections());
+
+  close(fds[1]);
+  close(fds[3]);
+  ASSERT_TRUE(wait_active(base));
+  RETURN_OK();
+}
+
+// Connections dropped in the middle of a request hand their client
+// objects back to the pool, the next connections get them clean
+int test_connections_reused_clean(void) {
+  int base = active_connections();
+  ASSERT_GT(base, -1);
+
+  const char *dropped[] = {
+    "GET /hello HTTP/1.1\r\nHost: local",
+    "POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 10\r\n\r\nabc",
+    REQUEST("/slow") REQUEST("/hello")
+  };
+
+  for (size_t i = 0; i < sizeof(dropped) / sizeof(dropped[0]); i++) {
+    int fd = raw_connect(server_port);
+    ASSERT_GT(fd, -1);
+    ASSERT_TRUE(raw_send(fd, dropped[i]));
+    uv_sleep(20);
+    close(fd);
+  }
+
+  ASSERT_TRUE(wait_active(base));
+
+  // The slow reply of the dropped connection must not reach these
+  int fds[3];
+  for (int i = 0; i < 3; i++) {
+    fds[i] = raw_connect(server_port);
+    ASSERT_GT(fds[i], -1);
+  }
+
+  for (int i = 0; i < 3; i++) {
+    char buf[1024];
+
+    ASSERT_TRUE(raw_send(fds[i], "POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\n\r\nfresh"));
+    ASSERT_GT(raw_read_responses(fds[i], buf, sizeof(buf), 1), 0);
+    ASSERT_NOT_NULL(strstr(buf, "\r\n\r\nfresh"));
+    ASSERT_EQ(1, raw_count(buf, "HTTP/1.1"));
+  }
+
+  uv_sleep(300);
+
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(raw_silent(fds[i], 0));
+    ASSERT_TRUE(hello(fds[i]));
+    close(fds[i]);
+  }
+
+  ASSERT_TRUE(wait_active(base));
+  RETURN_OK();
+}
+
+void handler_echo_header(Req *req, Res *res) {
+  const char *value = get_header(req, "X-Value");
+  send_text(res, 200, arena_sprintf(res->arena, "%s|%.*s", value ? value : "null",
+                                    (int)req->body_len, req->body ? req->body : ""));
+}
+
+// Reads of several connections land in one shared buffer, a request
+// split across reads must keep its first part when others come between
+int test_connections_interleaved_reads(void) {
+  int first = raw_connect(server_port);
+  int second = raw_connect(server_port);
+  ASSERT_GT(first, -1);
+  ASSERT_GT(second, -1);
+
+  ASSERT_TRUE(raw_send(first, "POST /echo-header HTTP/1.1\r\nHost: localhost\r\n"
+                              "X-Value: first-value\r\nContent-Length: 12\r\n\r\nfirst-"));
+  uv_sleep(20);
+  ASSERT_TRUE(raw_send(second, "POST /echo-header HTTP/1.1\r\nHost: localhost\r\n"
+                               "X-Value: second-val"));
+  uv_sleep(20);
+
+  // Overwrites whatever the shared buffer held
+  char buf[4096];
+  int third = raw_connect(server_port);
+  ASSERT_GT(third, -1);
+  ASSERT_TRUE(raw_send(third, "POST /echo-header HTTP/1.1\r\nHost: localhost\r\n"
+                              "X-Value: xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\r\n"
+                              "Content-Length: 16\r\n\r\nyyyyyyyyyyyyyyyy"));
+  ASSERT_GT(raw_read_responses(third, buf, sizeof(buf), 1), 0);
+  uv_sleep(20);
+
+  ASSERT_TRUE(raw_send(second, "ue\r\nContent-Length: 6\r\n\r\nsecond"));
+  ASSERT_TRUE(raw_send(first, "second"));
+
+  ASSERT_GT(raw_read_responses(first, buf, sizeof(buf), 1), 0);
+  ASSERT_NOT_NULL(strstr(buf, "\r\n\r\nfirst-value|first-second"));
+
+  ASSERT_GT(raw_read_responses(second, buf, sizeof(buf), 1), 0);
+  ASSERT_NOT_NULL(strstr(buf, "\r\n\r\nsecond-value|second"));
+
+  close(first);
+  close(second);
+  close(third);
+  RETURN_OK();
+}
+
+static void setup_routes(void) {
+  get("/hello", handler_hello);
+  get("/active", handler_active);
+  post("/echo", handler_echo);
+  get("/slow", handler_slow);
+  post("/echo-header", handler_echo_header);
+  get("/port", raw_port_handler);
+}
+
+int main(void) {
+  mock_init(setup_routes);
+
+  server_port = raw_server_port("/port");
+  if (server_port <= 0) {
+    fprintf(stderr, "Failed to find the server port\n");
+    return 1;
+  }
+
+  RUN_TEST(test_connections_close_order);
+  RUN_TEST(test_connections_reused_clean);
+  RUN_TEST(test_connections_interleaved_reads);
+  mock_cleanup();
+  return 0;
+}
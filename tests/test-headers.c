@@ -1,6 +1,7 @@
 #include "ecewo.h"
 #include "ecewo-mock.h"
 #include "tester.h"
+#include "raw-client.h"
 
 void handler_echo_headers(Req *req, Res *res) {
   const char *auth = get_header(req, "Authorization");
@@ -38,6 +39,45 @@ int test_request_headers(void) {
   RETURN_OK();
 }
 
+void handler_header_ids(Req *req, Res *res) {
+  const char *auth = get_header_id(req, HEADER_AUTHORIZATION);
+  const char *accept = get_header(req, "accept");
+  const char *agent = get_header_id(req, HEADER_USER_AGENT);
+  const char *origin = get_header_id(req, HEADER_ORIGIN);
+
+  char *response = arena_sprintf(req->arena, "auth=%s,accept=%s,agent=%s,origin=%s",
+                                 auth ? auth : "null",
+                                 accept ? accept : "null",
+                                 agent ? agent : "null",
+                                 origin ? origin : "null");
+
+  send_text(res, 200, response);
+}
+
+int test_header_ids(void) {
+  MockHeaders headers[] = {
+    { "authorization", "Bearer first" },
+    { "ACCEPT", "text/html" },
+    { "Authorization", "Bearer second" },
+    { "X-Agent", "not-the-user-agent" }
+  };
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/header-ids",
+    .headers = headers,
+    .header_count = 4
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("auth=Bearer first,accept=text/html,agent=null,origin=null", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
 void handler_set_headers(Req *req, Res *res) {
   (void)req;
   set_header(res, "X-Custom-Header", "test-value");
@@ -98,17 +138,205 @@ int test_header_injection(void) {
   RETURN_OK();
 }
 
+void handler_unknown_headers(Req *req, Res *res) {
+  const char *first = get_header(req, "x-trace-id");
+  const char *again = get_header(req, "X-TRACE-ID");
+  const char *tenant = get_header(req, "X-Tenant");
+  const char *missing = get_header(req, "X-Missing");
+
+  send_text(res, 200, arena_sprintf(req->arena, "trace=%s,again=%s,tenant=%s,missing=%s",
+                                    first ? first : "null",
+                                    again ? again : "null",
+                                    tenant ? tenant : "null",
+                                    missing ? missing : "null"));
+}
+
+int test_header_unknown_names(void) {
+  MockHeaders headers[] = {
+    { "X-Trace-Id", "trace-1" },
+    { "x-tenant", "acme" },
+    { "X-TRACE-ID", "trace-2" },
+    { "X-Request-Id", "req-1" },
+    { "X-Forwarded-Host", "example.com" },
+    { "X-Api-Version", "3" }
+  };
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/unknown-headers",
+    .headers = headers,
+    .header_count = 6
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("trace=trace-1,again=trace-1,tenant=acme,missing=null", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+// Each write stops inside a header name, a value or a line ending
+int test_headers_split_reads(void) {
+  int fd = raw_connect(raw_server_port("/port"));
+  ASSERT_GT(fd, -1);
+
+  const char *parts[] = {
+    "GET /headers HTTP/1.1\r\nHost: localhost\r\nAuthor",
+    "ization: Bearer tok",
+    "en123\r",
+    "\nContent-Type: application/json\r\nX-Custom-Header: custom-value\r\n",
+    "\r\n"
+  };
+
+  for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+    ASSERT_TRUE(raw_send(fd, parts[i]));
+    uv_sleep(20);
+  }
+
+  char buf[2048];
+  ASSERT_GT(raw_read_responses(fd, buf, sizeof(buf), 1), 0);
+  ASSERT_NOT_NULL(strstr(buf, "\r\n\r\nauth=Bearer token123,ct=application/json,custom=custom-value"));
+
+  close(fd);
+  RETURN_OK();
+}
+
+typedef struct {
+  Req *req;
+  Res *res;
+} later_header_t;
+
+static void later_header_work(void *context) {
+  (void)context;
+  uv_sleep(100);
+}
+
+static void later_header_done(void *context) {
+  later_header_t *later = context;
+  const char *custom = get_header(later->req, "X-Custom-Header");
+  const char *agent = get_header_id(later->req, HEADER_USER_AGENT);
+
+  send_text(later->res, 200, arena_sprintf(later->req->arena, "custom=%s,agent=%s",
+                                           custom ? custom : "null",
+                                           agent ? agent : "null"));
+}
+
+// Asks for the headers again after the read buffer was reused
+void handler_later_header(Req *req, Res *res) {
+  later_header_t *later = arena_alloc(req->arena, sizeof(later_header_t));
+  later->req = req;
+  later->res = res;
+
+  spawn(later, later_header_work, later_header_done);
+}
+
+int test_headers_after_next_read(void) {
+  int fd = raw_connect(raw_server_port("/port"));
+  ASSERT_GT(fd, -1);
+
+  ASSERT_TRUE(raw_send(fd, "GET /later-header HTTP/1.1\r\nHost: localhost\r\n"
+                           "X-Custom-Header: first\r\nUser-Agent: agent-1\r\n\r\n"));
+  uv_sleep(20);
+  ASSERT_TRUE(raw_send(fd, "GET /later-header HTTP/1.1\r\nHost: localhost\r\n"
+                           "X-Custom-Header: other\r\nUser-Agent: agent-2\r\n\r\n"));
+
+  char buf[2048];
+  ASSERT_GT(raw_read_responses(fd, buf, sizeof(buf), 2), 0);
+
+  char *first = strstr(buf, "custom=first,agent=agent-1");
+  char *second = strstr(buf, "custom=other,agent=agent-2");
+  ASSERT_NOT_NULL(first);
+  ASSERT_NOT_NULL(second);
+  ASSERT_TRUE(first < second);
+
+  close(fd);
+  RETURN_OK();
+}
+
+typedef struct {
+  Res *res;
+  const char *custom;
+  const char *agent;
+  const char *unknown;
+} saved_header_t;
+
+static void saved_header_work(void *context) {
+  (void)context;
+  uv_sleep(200);
+}
+
+static void saved_header_done(void *context) {
+  saved_header_t *saved = context;
+
+  send_text(saved->res, 200, arena_sprintf(saved->res->arena, "custom=%s,agent=%s,unknown=%s",
+                                           saved->custom ? saved->custom : "null",
+                                           saved->agent ? saved->agent : "null",
+                                           saved->unknown ? saved->unknown : "null"));
+}
+
+// Keeps the pointers from before the async step
+void handler_saved_header(Req *req, Res *res) {
+  saved_header_t *saved = arena_alloc(req->arena, sizeof(saved_header_t));
+  saved->res = res;
+  saved->custom = get_header(req, "X-Custom-Header");
+  saved->agent = get_header_id(req, HEADER_USER_AGENT);
+  saved->unknown = get_header(req, "X-Unknown-Name");
+
+  spawn(saved, saved_header_work, saved_header_done);
+}
+
+int test_headers_saved_across_spawn(void) {
+  int port = raw_server_port("/port");
+  int fd = raw_connect(port);
+  int other = raw_connect(port);
+  ASSERT_GT(fd, -1);
+  ASSERT_GT(other, -1);
+
+  ASSERT_TRUE(raw_send(fd, "GET /saved-header HTTP/1.1\r\nHost: localhost\r\n"
+                           "X-Custom-Header: first\r\nUser-Agent: agent-1\r\n"
+                           "X-Unknown-Name: unknown-1\r\n\r\n"));
+  uv_sleep(20);
+
+  // Read into the same buffer while the first request waits
+  ASSERT_TRUE(raw_send(other, "GET /headers HTTP/1.1\r\nHost: localhost\r\n"
+                              "X-Custom-Header: XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX\r\n"
+                              "User-Agent: YYYYYYYYYYYYYYYYYYYYYYYYYYYYYYYYYYYYYYYYYYYY\r\n"
+                              "X-Unknown-Name: ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ\r\n\r\n"));
+
+  char buf[2048];
+  ASSERT_GT(raw_read_responses(other, buf, sizeof(buf), 1), 0);
+
+  ASSERT_GT(raw_read_responses(fd, buf, sizeof(buf), 1), 0);
+  ASSERT_NOT_NULL(strstr(buf, "\r\n\r\ncustom=first,agent=agent-1,unknown=unknown-1"));
+
+  close(fd);
+  close(other);
+  RETURN_OK();
+}
+
 static void setup_routes(void) {
   get("/headers", handler_echo_headers);
+  get("/header-ids", handler_header_ids);
   get("/custom-headers", handler_set_headers);
   get("/header-injection", handler_header_injection);
+  get("/later-header", handler_later_header);
+  get("/saved-header", handler_saved_header);
+  get("/unknown-headers", handler_unknown_headers);
+  get("/port", raw_port_handler);
 }
 
 int main(void) {
   mock_init(setup_routes);
   RUN_TEST(test_request_headers);
+  RUN_TEST(test_header_ids);
   RUN_TEST(test_set_headers);
   RUN_TEST(test_header_injection);
+  RUN_TEST(test_header_unknown_names);
+  RUN_TEST(test_headers_split_reads);
+  RUN_TEST(test_headers_after_next_read);
+  RUN_TEST(test_headers_saved_across_spawn);
   mock_cleanup();
   return 0;
 }
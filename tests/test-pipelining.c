@@ -0,0 +1,363 @@
+#include "ecewo.h"
+#include "ecewo-mock.h"
+#include "tester.h"
+#include "raw-client.h"
+
+#define REQUEST(path) "GET " path " HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+static int server_port;
+
+typedef struct {
+  Res *res;
+  int delay_ms;
+} delayed_t;
+
+static void delayed_work(void *context) {
+  delayed_t *delayed = context;
+  uv_sleep((unsigned int)delayed->delay_ms);
+}
+
+static void delayed_done(void *context) {
+  delayed_t *delayed = context;
+  send_text(delayed->res, 200, arena_sprintf(delayed->res->arena, "slow-%d", delayed->delay_ms));
+}
+
+// Replies from the thread pool after ?ms= milliseconds
+void handler_slow(Req *req, Res *res) {
+  const char *ms = get_query(req, "ms");
+
+  delayed_t *delayed = arena_alloc(res->arena, sizeof(delayed_t));
+  delayed->res = res;
+  delayed->delay_ms = ms ? atoi(ms) : 50;
+
+  spawn(delayed, delayed_work, delayed_done);
+}
+
+// Holds the event loop, so that several events are ready when it returns
+void handler_block(Req *req, Res *res) {
+  (void)req;
+  uv_sleep(300);
+  send_text(res, 200, "blocked");
+}
+
+void handler_fast(Req *req, Res *res) {
+  send_text(res, 200, arena_sprintf(res->arena, "fast-%s", req->path));
+}
+
+int test_pipeline_in_order(void) {
+  int fd = raw_connect(server_port);
+  ASSERT_GT(fd, -1);
+
+  // The first response is the last one ready
+  ASSERT_TRUE(raw_send(fd, REQUEST("/slow?ms=100") REQUEST("/fast/1") REQUEST("/slow?ms=20") REQUEST("/fast/2")));
+
+  char buf[4096];
+  ASSERT_GT(raw_read_responses(fd, buf, sizeof(buf), 4), 0);
+  ASSERT_EQ(4, raw_count(buf, "HTTP/1.1 200"));
+
+  char *slow_100 = strstr(buf, "slow-100");
+  char *fast_1 = strstr(buf, "fast-/fast/1");
+  char *slow_20 = strstr(buf, "slow-20");
+  char *fast_2 = strstr(buf, "fast-/fast/2");
+  ASSERT_NOT_NULL(slow_100);
+  ASSERT_NOT_NULL(fast_1);
+  ASSERT_NOT_NULL(slow_20);
+  ASSERT_NOT_NULL(fast_2);
+  ASSERT_TRUE(slow_100 < fast_1);
+  ASSERT_TRUE(fast_1 < slow_20);
+  ASSERT_TRUE(slow_20 < fast_2);
+
+  // Still open for more
+  ASSERT_TRUE(raw_send(fd, REQUEST("/fast/3")));
+  ASSERT_GT(raw_read_responses(fd, buf, sizeof(buf), 1), 0);
+  ASSERT_NOT_NULL(strstr(buf, "fast-/fast/3"));
+
+  close(fd);
+  RETURN_OK();
+}
+
+int test_pipeline_close(void) {
+  int fd = raw_connect(server_port);
+  ASSERT_GT(fd, -1);
+
+  ASSERT_TRUE(raw_send(fd, REQUEST("/slow?ms=50")
+                       "GET /fast/1 HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+                       REQUEST("/fast/2")));
+
+  char buf[4096];
+  ssize_t len = raw_read_responses(fd, buf, sizeof(buf), 2);
+  ASSERT_GT(len, 0);
+  ASSERT_TRUE(strstr(buf, "slow-50") < strstr(buf, "fast-/fast/1"));
+
+  // The request after "Connection: close" is not answered
+  ASSERT_NULL(strstr(buf, "fast-/fast/2"));
+  ASSERT_EQ(2, raw_count(buf, "HTTP/1.1"));
+  ASSERT_TRUE(raw_closed(fd, RAW_TIMEOUT_MS));
+
+  close(fd);
+  RETURN_OK();
+}
+
+// A body large enough to fill the start of a reused arena
+void handler_big(Req *req, Res *res) {
+  (void)req;
+  char *body = arena_alloc(res->arena, 4096);
+  memset(body, 'x', 4096);
+  reply(res, 200, body, 4096);
+}
+
+int test_pipeline_async_then_pipelined(void) {
+  int conn = raw_connect(server_port);
+  int other = raw_connect(server_port);
+  int blocker = raw_connect(server_port);
+  ASSERT_GT(conn, -1);
+  ASSERT_GT(other, -1);
+  ASSERT_GT(blocker, -1);
+
+  // Keeps the next request of this connection in a pooled arena
+  ASSERT_TRUE(raw_send(other, REQUEST("/slow?ms=1000")));
+
+  // The async reply is written while the loop is held, and the next
+  // request on the same connection is read in the same iteration,
+  // before the callback of that write. A request of another connection
+  // follows and takes an arena from the pool.
+  ASSERT_TRUE(raw_send(conn, REQUEST("/fast/0") REQUEST("/slow?ms=50")));
+  uv_sleep(20);
+  ASSERT_TRUE(raw_send(blocker, REQUEST("/block")));
+  uv_sleep(150);
+  ASSERT_TRUE(raw_send(conn, REQUEST("/fast/1")));
+  uv_sleep(20);
+  ASSERT_TRUE(raw_send(other, REQUEST("/big")));
+
+  char buf[16384];
+  ASSERT_GT(raw_read_responses(conn, buf, sizeof(buf), 3), 0);
+
+  char *first = strstr(buf, "fast-/fast/0");
+  char *slow = strstr(buf, "slow-50");
+  char *fast = strstr(buf, "fast-/fast/1");
+  ASSERT_NOT_NULL(first);
+  ASSERT_NOT_NULL(slow);
+  ASSERT_NOT_NULL(fast);
+  ASSERT_TRUE(first < slow);
+  ASSERT_TRUE(slow < fast);
+
+  // Every response is accounted for, the connection goes on
+  ASSERT_TRUE(raw_send(conn, REQUEST("/fast/3") REQUEST("/slow?ms=10")));
+  ASSERT_GT(raw_read_responses(conn, buf, sizeof(buf), 2), 0);
+  ASSERT_NOT_NULL(strstr(buf, "fast-/fast/3"));
+  ASSERT_NOT_NULL(strstr(buf, "slow-10"));
+
+  ASSERT_GT(raw_read_responses(other, buf, sizeof(buf), 2), 0);
+  ASSERT_NOT_NULL(strstr(buf, "slow-1000"));
+  ASSERT_NOT_NULL(strstr(buf, "xxxx"));
+
+  ASSERT_GT(raw_read_responses(blocker, buf, sizeof(buf), 1), 0);
+  ASSERT_NOT_NULL(strstr(buf, "blocked"));
+
+  close(conn);
+  close(other);
+  close(blocker);
+  RETURN_OK();
+}
+
+#define LARGE_BODY (1024 * 1024)
+#define LARGE_REQUESTS 100
+
+static int large_handled;
+
+void handler_large(Req *req, Res *res) {
+  (void)req;
+  char *body = arena_alloc(res->arena, LARGE_BODY);
+  memset(body, 'L', LARGE_BODY);
+
+  __atomic_add_fetch(&large_handled, 1, __ATOMIC_SEQ_CST);
+  reply(res, 200, body, LARGE_BODY);
+}
+
+static int large_handled_now(void) {
+  return __atomic_load_n(&large_handled, __ATOMIC_SEQ_CST);
+}
+
+// Reads and drops whole responses until `count` of them arrived
+static bool drain_responses(int fd, int count) {
+  static char buf[64 * 1024];
+  size_t body_left = 0;
+  size_t header_len = 0;
+  int complete = 0;
+
+  while (complete < count) {
+    ssize_t got = raw_recv(fd, buf + header_len, sizeof(buf) - header_len - 1, RAW_TIMEOUT_MS);
+    if (got <= 0)
+      return false;
+
+    size_t len = header_len + (size_t)got;
+    size_t pos = 0;
+    header_len = 0;
+
+    while (pos < len && complete < count) {
+      if (body_left > 0) {
+        size_t take = len - pos < body_left ? len - pos : body_left;
+        pos += take;
+        body_left -= take;
+        if (body_left == 0)
+          complete++;
+        continue;
+      }
+
+      buf[len] = '\0';
+      char *end = strstr(buf + pos, "\r\n\r\n");
+      if (!end) {
+        // Keep the partial headers for the next read
+        memmove(buf, buf + pos, len - pos);
+        header_len = len - pos;
+        break;
+      }
+
+      size_t headers = (size_t)(end + 4 - (buf + pos));
+      body_left = raw_content_length(buf + pos, headers);
+      pos += headers;
+
+      if (body_left == 0)
+        complete++;
+    }
+  }
+
+  return true;
+}
+
+int test_pipeline_slow_reader(void) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GT(fd, -1);
+
+  // Little room on our side, the server queue fills sooner
+  int rcvbuf = 64 * 1024;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)server_port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(0, connect(fd, (struct sockaddr *)&addr, sizeof(addr)));
+
+  // Requests keep coming while nothing is read
+  for (int i = 0; i < LARGE_REQUESTS; i++) {
+    ASSERT_TRUE(raw_send(fd, REQUEST("/large")));
+    uv_sleep(5);
+  }
+
+  uv_sleep(200);
+  int stalled = large_handled_now();
+
+  // Reading stopped once the unsent responses passed the high watermark,
+  // well before the pipeline depth limit (64 by default) would stop it
+  ASSERT_GT(stalled, 0);
+  ASSERT_GT(48, stalled);
+
+  uv_sleep(300);
+  ASSERT_EQ(stalled, large_handled_now());
+
+  // Draining below the low watermark lets the rest in
+  ASSERT_TRUE(drain_responses(fd, LARGE_REQUESTS));
+  ASSERT_EQ(LARGE_REQUESTS, large_handled_now());
+
+  close(fd);
+  RETURN_OK();
+}
+
+static void timer_done(void *context) {
+  delayed_t *delayed = context;
+  send_text(delayed->res, 200, arena_sprintf(delayed->res->arena, "timer-%d", delayed->delay_ms));
+}
+
+// Replies from a timer on the loop after ?ms= milliseconds
+void handler_timer(Req *req, Res *res) {
+  const char *ms = get_query(req, "ms");
+
+  delayed_t *delayed = arena_alloc(res->arena, sizeof(delayed_t));
+  delayed->res = res;
+  delayed->delay_ms = ms ? atoi(ms) : 20;
+
+  set_timeout(timer_done, (uint64_t)delayed->delay_ms, delayed);
+}
+
+// Async responses that become ready in the same loop iteration, after
+// the requests were read, are written in request order
+int test_pipeline_flush_order(void) {
+  int fd = raw_connect(server_port);
+  int blocker = raw_connect(server_port);
+  ASSERT_GT(fd, -1);
+  ASSERT_GT(blocker, -1);
+
+  uint64_t writes = get_write_calls();
+
+  // The timers expire while the loop is held and fire together
+  ASSERT_TRUE(raw_send(fd, REQUEST("/timer?ms=20") REQUEST("/fast/1") REQUEST("/timer?ms=40") REQUEST("/timer?ms=60")));
+  uv_sleep(2);
+  ASSERT_TRUE(raw_send(blocker, REQUEST("/block")));
+
+  char buf[4096];
+  ASSERT_GT(raw_read_responses(fd, buf, sizeof(buf), 4), 0);
+  ASSERT_EQ(4, raw_count(buf, "HTTP/1.1 200"));
+
+  char *timer_20 = strstr(buf, "timer-20");
+  char *fast_1 = strstr(buf, "fast-/fast/1");
+  char *timer_40 = strstr(buf, "timer-40");
+  char *timer_60 = strstr(buf, "timer-60");
+  ASSERT_NOT_NULL(timer_20);
+  ASSERT_NOT_NULL(fast_1);
+  ASSERT_NOT_NULL(timer_40);
+  ASSERT_NOT_NULL(timer_60);
+  ASSERT_TRUE(timer_20 < fast_1);
+  ASSERT_TRUE(fast_1 < timer_40);
+  ASSERT_TRUE(timer_40 < timer_60);
+
+  ASSERT_GT(raw_read_responses(blocker, buf, sizeof(buf), 1), 0);
+  ASSERT_NOT_NULL(strstr(buf, "blocked"));
+
+#if COALESCE_WRITES
+  // One write for the blocker and one for all four responses above,
+  // when the tests are built with the same flags as the library
+  ASSERT_EQ(2, (int)(get_write_calls() - writes));
+#else
+  // Each timer writes what became ready in order up to it
+  ASSERT_EQ(4, (int)(get_write_calls() - writes));
+#endif
+
+  // Nothing was left queued for the connection
+  ASSERT_TRUE(raw_send(fd, REQUEST("/fast/2")));
+  ASSERT_GT(raw_read_responses(fd, buf, sizeof(buf), 1), 0);
+  ASSERT_NOT_NULL(strstr(buf, "fast-/fast/2"));
+
+  close(fd);
+  close(blocker);
+  RETURN_OK();
+}
+
+static void setup_routes(void) {
+  get("/port", raw_port_handler);
+  get("/slow", handler_slow);
+  get("/block", handler_block);
+  get("/fast/:n", handler_fast);
+  get("/big", handler_big);
+  get("/large", handler_large);
+  get("/timer", handler_timer);
+}
+
+int main(void) {
+  mock_init(setup_routes);
+
+  server_port = raw_server_port("/port");
+  if (server_port <= 0) {
+    fprintf(stderr, "Failed to find the server port\n");
+    return 1;
+  }
+
+  RUN_TEST(test_pipeline_in_order);
+  RUN_TEST(test_pipeline_close);
+  RUN_TEST(test_pipeline_async_then_pipelined);
+  RUN_TEST(test_pipeline_slow_reader);
+  RUN_TEST(test_pipeline_flush_order);
+  mock_cleanup();
+  return 0;
+}
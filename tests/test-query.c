@@ -62,8 +62,66 @@ int test_query_no_params(void) {
   RETURN_OK();
 }
 
+void handler_query_decode(Req *req, Res *res) {
+  const char *q = get_query(req, "q");
+  const char *key = get_query(req, "a&b");
+
+  char *response = arena_sprintf(req->arena, "q=%s,key=%s",
+                                 q ? q : "null",
+                                 key ? key : "null");
+
+  send_text(res, 200, response);
+}
+
+int test_query_decode(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/decode?q=hello+world%21%2x&a%26b=%3D"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("q=hello world!%2x,key==", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+void handler_query_repeated(Req *req, Res *res) {
+  const char *tags[4];
+  size_t count = get_query_all(req, "tag", tags, 4);
+
+  char *response = arena_sprintf(req->arena, "count=%zu", count);
+  for (size_t i = 0; i < count && i < 4; i++)
+    response = arena_sprintf(req->arena, "%s,%s", response, tags[i] ? tags[i] : "null");
+
+  const char *first = get_query(req, "tag");
+  response = arena_sprintf(req->arena, "%s,first=%s,missing=%zu", response,
+                           first ? first : "null", get_query_all(req, "none", NULL, 0));
+
+  send_text(res, 200, response);
+}
+
+int test_query_repeated(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/repeated?tag=a&page=2&tag=&flag&tag=c"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("count=3,a,null,c,first=a,missing=0", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
 static void setup_routes(void) {
   get("/search", handler_query_params);
+  get("/decode", handler_query_decode);
+  get("/repeated", handler_query_repeated);
 }
 
 int main(void) {
@@ -72,6 +130,8 @@ int main(void) {
   RUN_TEST(test_query_multiple);
   RUN_TEST(test_query_empty_value);
   RUN_TEST(test_query_no_params);
+  RUN_TEST(test_query_decode);
+  RUN_TEST(test_query_repeated);
 
   mock_cleanup();
   return 0;
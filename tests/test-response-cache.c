@@ -0,0 +1,218 @@
+#include "ecewo.h"
+#include "ecewo-mock.h"
+#include "tester.h"
+
+static int cached_calls = 0;
+static int uncached_calls = 0;
+static int vary_calls = 0;
+
+static void reply_count(Res *res, int count) {
+  char *body = arena_sprintf(res->arena, "%d", count);
+  send_text(res, 200, body);
+}
+
+void handler_cached(Req *req, Res *res) {
+  (void)req;
+  set_header(res, "Cache-Control", "public, max-age=60");
+  reply_count(res, ++cached_calls);
+}
+
+void handler_no_store(Req *req, Res *res) {
+  (void)req;
+  set_header(res, "Cache-Control", "no-store");
+  reply_count(res, ++uncached_calls);
+}
+
+void handler_vary(Req *req, Res *res) {
+  (void)req;
+  set_header(res, "Cache-Control", "max-age=60");
+  set_header(res, "Vary", "Accept-Language");
+  reply_count(res, ++vary_calls);
+}
+
+// The page of whoever the session cookie names
+static void reply_session(Req *req, Res *res) {
+  const char *cookie = get_header(req, "Cookie");
+  send_text(res, 200, cookie ? arena_sprintf(res->arena, "page of %s", cookie) : "anonymous page");
+}
+
+// Meant for browser caches only
+void handler_session_max_age(Req *req, Res *res) {
+  set_header(res, "Cache-Control", "max-age=60");
+  reply_session(req, res);
+}
+
+// Cached for default_ttl
+void handler_session_default(Req *req, Res *res) {
+  reply_session(req, res);
+}
+
+static MockResponse get_path(const char *path, MockHeaders *headers, size_t count) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = path,
+    .headers = headers,
+    .header_count = count
+  };
+
+  return request(&params);
+}
+
+int test_cache_hit(void) {
+  MockResponse first = get_path("/cached", NULL, 0);
+  ASSERT_EQ(200, first.status_code);
+  ASSERT_EQ_STR("1", first.body);
+  ASSERT_NOT_NULL(mock_get_header(&first, "ETag"));
+
+  MockResponse second = get_path("/cached", NULL, 0);
+  ASSERT_EQ(200, second.status_code);
+  ASSERT_EQ_STR("1", second.body);
+  ASSERT_EQ_STR("public, max-age=60", mock_get_header(&second, "Cache-Control"));
+  ASSERT_EQ_STR(mock_get_header(&first, "ETag"), mock_get_header(&second, "ETag"));
+  ASSERT_NOT_NULL(mock_get_header(&second, "Date"));
+
+  // The query is part of the key
+  MockResponse other = get_path("/cached?page=2", NULL, 0);
+  ASSERT_EQ_STR("2", other.body);
+
+  free_request(&first);
+  free_request(&second);
+  free_request(&other);
+  RETURN_OK();
+}
+
+int test_cache_not_modified(void) {
+  MockResponse first = get_path("/cached", NULL, 0);
+  const char *etag = mock_get_header(&first, "ETag");
+  ASSERT_NOT_NULL(etag);
+
+  MockHeaders headers[] = {
+    { "If-None-Match", etag }
+  };
+
+  MockResponse res = get_path("/cached", headers, 1);
+
+  ASSERT_EQ(304, res.status_code);
+  ASSERT_EQ_STR(etag, mock_get_header(&res, "ETag"));
+
+  free_request(&first);
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_cache_no_store(void) {
+  MockResponse first = get_path("/no-store", NULL, 0);
+  MockResponse second = get_path("/no-store", NULL, 0);
+
+  ASSERT_EQ_STR("1", first.body);
+  ASSERT_EQ_STR("2", second.body);
+
+  free_request(&first);
+  free_request(&second);
+  RETURN_OK();
+}
+
+int test_cache_vary(void) {
+  MockHeaders en[] = { { "Accept-Language", "en" } };
+  MockHeaders tr[] = { { "Accept-Language", "tr" } };
+
+  MockResponse first = get_path("/vary", en, 1);
+  MockResponse second = get_path("/vary", tr, 1);
+  MockResponse third = get_path("/vary", en, 1);
+
+  ASSERT_EQ_STR("1", first.body);
+  ASSERT_EQ_STR("2", second.body);
+  ASSERT_EQ_STR("1", third.body);
+
+  free_request(&first);
+  free_request(&second);
+  free_request(&third);
+  RETURN_OK();
+}
+
+int test_cache_purge(void) {
+  MockHeaders en[] = { { "Accept-Language", "en" } };
+
+  response_cache_purge("/vary");
+
+  MockResponse res = get_path("/vary", en, 1);
+  ASSERT_EQ_STR("3", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_cache_skips_authorization(void) {
+  MockHeaders headers[] = { { "Authorization", "Bearer token" } };
+
+  MockResponse res = get_path("/cached", headers, 1);
+
+  // Neither answered from nor stored in the cache
+  ASSERT_EQ_STR("3", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+static int check_session_not_shared(const char *path) {
+  MockHeaders alice[] = { { "Cookie", "session=alice" } };
+  MockHeaders bob[] = { { "Cookie", "session=bob" } };
+
+  MockResponse first = get_path(path, alice, 1);
+  ASSERT_EQ_STR("page of session=alice", first.body);
+
+  // Neither a visitor without a session nor another session gets it
+  MockResponse anonymous = get_path(path, NULL, 0);
+  ASSERT_EQ_STR("anonymous page", anonymous.body);
+
+  MockResponse other = get_path(path, bob, 1);
+  ASSERT_EQ_STR("page of session=bob", other.body);
+
+  // Not answered from what anonymous visitors get either
+  MockResponse again = get_path(path, alice, 1);
+  ASSERT_EQ_STR("page of session=alice", again.body);
+
+  free_request(&first);
+  free_request(&anonymous);
+  free_request(&other);
+  free_request(&again);
+  RETURN_OK();
+}
+
+int test_cache_skips_cookie_max_age(void) {
+  return check_session_not_shared("/session-max-age");
+}
+
+int test_cache_skips_cookie_default_ttl(void) {
+  return check_session_not_shared("/session-default");
+}
+
+static void setup_routes(void) {
+  CacheConfig config = {
+    .max_bytes = 1024 * 1024,
+    .default_ttl = 60,
+    .stale_while_revalidate = 0
+  };
+
+  response_cache_enable(&config);
+
+  get("/cached", handler_cached);
+  get("/no-store", handler_no_store);
+  get("/vary", handler_vary);
+  get("/session-max-age", handler_session_max_age);
+  get("/session-default", handler_session_default);
+}
+
+int main(void) {
+  mock_init(setup_routes);
+  RUN_TEST(test_cache_hit);
+  RUN_TEST(test_cache_not_modified);
+  RUN_TEST(test_cache_no_store);
+  RUN_TEST(test_cache_vary);
+  RUN_TEST(test_cache_purge);
+  RUN_TEST(test_cache_skips_authorization);
+  RUN_TEST(test_cache_skips_cookie_max_age);
+  RUN_TEST(test_cache_skips_cookie_default_ttl);
+  mock_cleanup();
+  return 0;
+}
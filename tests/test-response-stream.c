@@ -0,0 +1,156 @@
+#include "ecewo.h"
+#include "ecewo-mock.h"
+#include "tester.h"
+#include "raw-client.h"
+
+void handler_rows(Req *req, Res *res) {
+  (void)req;
+  set_header(res, "Content-Type", "text/csv");
+
+  if (res_begin(res, 200) != 0) {
+    res_end(res);
+    return;
+  }
+
+  res_write(res, "id,name\n", 8);
+
+  for (int i = 1; i <= 3; i++) {
+    char *row = arena_sprintf(res->arena, "%d,row-%d\n", i, i);
+    res_write(res, row, strlen(row));
+  }
+
+  res_end(res);
+}
+
+typedef struct {
+  Res *res;
+  int remaining;
+} later_stream_t;
+
+static void write_later(void *data) {
+  later_stream_t *stream = (later_stream_t *)data;
+
+  res_write(stream->res, "tick\n", 5);
+
+  if (--stream->remaining > 0)
+    set_timeout(write_later, 10, stream);
+  else
+    res_end(stream->res);
+}
+
+void handler_async(Req *req, Res *res) {
+  (void)req;
+  set_header(res, "Content-Type", "text/plain");
+  res_begin(res, 200);
+
+  later_stream_t *stream = arena_alloc(res->arena, sizeof(later_stream_t));
+  stream->res = res;
+  stream->remaining = 3;
+
+  set_timeout(write_later, 10, stream);
+}
+
+static int empty_write_result;
+
+void handler_empty(Req *req, Res *res) {
+  (void)req;
+  res_begin(res, 204);
+  empty_write_result = res_write(res, "ignored", 7);
+  res_end(res);
+}
+
+int test_stream_chunked(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/rows"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("chunked", mock_get_header(&res, "Transfer-Encoding"));
+  ASSERT_NULL(mock_get_header(&res, "Content-Length"));
+  ASSERT_NOT_NULL(strstr(res.body, "id,name\n"));
+  ASSERT_NOT_NULL(strstr(res.body, "3,row-3\n"));
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_stream_async(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/async"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("chunked", mock_get_header(&res, "Transfer-Encoding"));
+  ASSERT_NOT_NULL(strstr(res.body, "tick\n"));
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_stream_head(void) {
+  MockParams params = {
+    .method = MOCK_HEAD,
+    .path = "/rows"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_NULL(mock_get_header(&res, "Transfer-Encoding"));
+  ASSERT_NULL(mock_get_header(&res, "Content-Length"));
+  ASSERT_EQ(0, (int)res.body_len);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_stream_empty(void) {
+  int port = raw_server_port("/port");
+  ASSERT_GT(port, 0);
+
+  int fd = raw_connect(port);
+  ASSERT_GT(fd, -1);
+
+  // Kept alive, so a stray last chunk would be read as the next response
+  for (int i = 0; i < 2; i++) {
+    char buf[1024];
+
+    ASSERT_TRUE(raw_send(fd, "GET /empty HTTP/1.1\r\nHost: localhost\r\n\r\n"));
+
+    ssize_t len = raw_read_responses(fd, buf, sizeof(buf), 1);
+    ASSERT_GT(len, 0);
+    ASSERT_EQ(0, strncmp(buf, "HTTP/1.1 204", 12));
+    ASSERT_NULL(strstr(buf, "Transfer-Encoding"));
+    ASSERT_NULL(strstr(buf, "Content-Length"));
+    ASSERT_EQ((int)len, (int)(strstr(buf, "\r\n\r\n") + 4 - buf));
+    ASSERT_TRUE(raw_silent(fd, 100));
+    ASSERT_EQ(-1, empty_write_result);
+  }
+
+  close(fd);
+  RETURN_OK();
+}
+
+static void setup_routes(void) {
+  get("/rows", handler_rows);
+  head("/rows", handler_rows);
+  get("/async", handler_async);
+  get("/empty", handler_empty);
+  get("/port", raw_port_handler);
+}
+
+int main(void) {
+  mock_init(setup_routes);
+  RUN_TEST(test_stream_chunked);
+  RUN_TEST(test_stream_async);
+  RUN_TEST(test_stream_head);
+  RUN_TEST(test_stream_empty);
+  mock_cleanup();
+  return 0;
+}
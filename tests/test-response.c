@@ -1,6 +1,8 @@
 #include "ecewo.h"
 #include "ecewo-mock.h"
 #include "tester.h"
+#include "raw-client.h"
+#include <time.h>
 
 // JSON
 void handler_json_response(Req *req, Res *res) {
@@ -95,6 +97,20 @@ int test_status_500(void) {
   RETURN_OK();
 }
 
+int test_status_without_reason(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/status?code=299"
+  };
+
+  MockResponse res = request(&params);
+  ASSERT_EQ(299, res.status_code);
+  ASSERT_EQ_STR("Status test", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
 int test_404_unknown_path(void) {
   MockParams params = {
     .method = MOCK_GET,
@@ -122,10 +138,157 @@ int test_404_wrong_method(void) {
   RETURN_OK();
 }
 
+// BODY WITHOUT COPY
+#define LARGE_BODY_SIZE (1024 * 1024)
+
+void handler_arena_body(Req *req, Res *res) {
+  (void)req;
+
+  char *body = arena_alloc(res->arena, LARGE_BODY_SIZE);
+  for (size_t i = 0; i < LARGE_BODY_SIZE; i++)
+    body[i] = (char)('a' + i % 26);
+
+  reply(res, 200, body, LARGE_BODY_SIZE);
+}
+
+int test_arena_body(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/arena-body"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ(LARGE_BODY_SIZE, res.body_len);
+  ASSERT_TRUE(res.body[0] == 'a' && res.body[LARGE_BODY_SIZE - 1] == 'a' + (LARGE_BODY_SIZE - 1) % 26);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+static int owned_freed = 0;
+
+static void free_owned(void *buf) {
+  owned_freed++;
+  free(buf);
+}
+
+void handler_owned_body(Req *req, Res *res) {
+  (void)req;
+
+  char *body = malloc(11);
+  memcpy(body, "owned body", 11);
+
+  reply_owned(res, 200, body, 10, free_owned);
+}
+
+void handler_owned_freed(Req *req, Res *res) {
+  (void)req;
+
+  char count[16];
+  snprintf(count, sizeof(count), "%d", owned_freed);
+  send_text(res, 200, count);
+}
+
+int test_owned_body(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/owned-body"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("owned body", res.body);
+  free_request(&res);
+
+  // Freed once the previous response is written
+  MockParams check = {
+    .method = MOCK_GET,
+    .path = "/owned-freed"
+  };
+
+  res = request(&check);
+  ASSERT_EQ_STR("1", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+// DATE
+void handler_date(Req *req, Res *res) {
+  (void)req;
+  send_text(res, 200, "date");
+}
+
+// Date header of one response on the connection, and the dates the clock
+// showed around it
+static bool read_date(int fd, char *date, size_t len, char *before, char *after) {
+  char buf[1024];
+  struct tm tm;
+  time_t now = time(NULL);
+
+  gmtime_r(&now, &tm);
+  strftime(before, 32, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+  if (!raw_send(fd, "GET /date HTTP/1.1\r\nHost: localhost\r\n\r\n") ||
+      raw_read_responses(fd, buf, sizeof(buf), 1) <= 0)
+    return false;
+
+  now = time(NULL);
+  gmtime_r(&now, &tm);
+  strftime(after, 32, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+  char *line = strstr(buf, "\r\nDate: ");
+  if (!line)
+    return false;
+
+  line += 8;
+  char *end = strstr(line, "\r\n");
+  if (!end || (size_t)(end - line) >= len)
+    return false;
+
+  memcpy(date, line, (size_t)(end - line));
+  date[end - line] = '\0';
+  return true;
+}
+
+int test_date_header(void) {
+  int port = raw_server_port("/port");
+  ASSERT_GT(port, 0);
+
+  int fd = raw_connect(port);
+  ASSERT_GT(fd, -1);
+
+  char first[64], before[32], after[32];
+  ASSERT_TRUE(read_date(fd, first, sizeof(first), before, after));
+
+  // An IMF-fixdate of the second the response was made in
+  ASSERT_EQ(29, (int)strlen(first));
+  ASSERT_TRUE(strcmp(first, before) == 0 || strcmp(first, after) == 0);
+
+  // The cached date moves on with the clock
+  uv_sleep(1100);
+
+  char second[64];
+  ASSERT_TRUE(read_date(fd, second, sizeof(second), before, after));
+  ASSERT_TRUE(strcmp(second, before) == 0 || strcmp(second, after) == 0);
+  ASSERT_NE(0, strcmp(first, second));
+
+  close(fd);
+  RETURN_OK();
+}
+
 static void setup_routes(void) {
   get("/json-response", handler_json_response);
   get("/html-response", handler_html_response);
   get("/status", handler_status_codes);
+  get("/arena-body", handler_arena_body);
+  get("/owned-body", handler_owned_body);
+  get("/owned-freed", handler_owned_freed);
+  get("/date", handler_date);
+  get("/port", raw_port_handler);
 }
 
 int main(void) {
@@ -137,8 +300,12 @@ int main(void) {
   RUN_TEST(test_status_201);
   RUN_TEST(test_status_404);
   RUN_TEST(test_status_500);
+  RUN_TEST(test_status_without_reason);
   RUN_TEST(test_404_unknown_path);
   RUN_TEST(test_404_wrong_method);
+  RUN_TEST(test_arena_body);
+  RUN_TEST(test_owned_body);
+  RUN_TEST(test_date_header);
 
   mock_cleanup();
   return 0;
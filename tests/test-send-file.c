@@ -0,0 +1,177 @@
+#include "ecewo.h"
+#include "ecewo-mock.h"
+#include "tester.h"
+
+#define TEST_FILE "ecewo-send-file-test.bin"
+#define TEST_FILE_SIZE 300000
+
+static char expected[TEST_FILE_SIZE];
+
+static int create_test_file(void) {
+  for (size_t i = 0; i < TEST_FILE_SIZE; i++)
+    expected[i] = (char)('a' + (i * 7) % 26);
+
+  FILE *f = fopen(TEST_FILE, "wb");
+  if (!f)
+    return -1;
+
+  size_t written = fwrite(expected, 1, TEST_FILE_SIZE, f);
+  fclose(f);
+
+  return written == TEST_FILE_SIZE ? 0 : -1;
+}
+
+void handler_file(Req *req, Res *res) {
+  (void)req;
+  send_file(res, TEST_FILE, "application/octet-stream");
+}
+
+void handler_missing_file(Req *req, Res *res) {
+  (void)req;
+  send_file(res, "does-not-exist.bin", NULL);
+}
+
+int test_send_file_full(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/file"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ(TEST_FILE_SIZE, res.body_len);
+  ASSERT_TRUE(memcmp(expected, res.body, TEST_FILE_SIZE) == 0);
+  ASSERT_EQ_STR("bytes", mock_get_header(&res, "Accept-Ranges"));
+  ASSERT_NOT_NULL(mock_get_header(&res, "ETag"));
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_send_file_range(void) {
+  MockHeaders headers[] = {
+    { "Range", "bytes=100-199" }
+  };
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/file",
+    .headers = headers,
+    .header_count = 1
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(206, res.status_code);
+  ASSERT_EQ(100, res.body_len);
+  ASSERT_TRUE(memcmp(expected + 100, res.body, 100) == 0);
+  ASSERT_EQ_STR("bytes 100-199/300000", mock_get_header(&res, "Content-Range"));
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_send_file_suffix_range(void) {
+  MockHeaders headers[] = {
+    { "Range", "bytes=-10" }
+  };
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/file",
+    .headers = headers,
+    .header_count = 1
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(206, res.status_code);
+  ASSERT_EQ(10, res.body_len);
+  ASSERT_TRUE(memcmp(expected + TEST_FILE_SIZE - 10, res.body, 10) == 0);
+  ASSERT_EQ_STR("bytes 299990-299999/300000", mock_get_header(&res, "Content-Range"));
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_send_file_unsatisfiable(void) {
+  MockHeaders headers[] = {
+    { "Range", "bytes=300000-" }
+  };
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/file",
+    .headers = headers,
+    .header_count = 1
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(416, res.status_code);
+  ASSERT_EQ_STR("bytes */300000", mock_get_header(&res, "Content-Range"));
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_send_file_stale_if_range(void) {
+  MockHeaders headers[] = {
+    { "Range", "bytes=0-9" },
+    { "If-Range", "\"stale\"" }
+  };
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/file",
+    .headers = headers,
+    .header_count = 2
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ(TEST_FILE_SIZE, res.body_len);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_send_file_missing(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/missing-file"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(404, res.status_code);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+static void setup_routes(void) {
+  get("/file", handler_file);
+  get("/missing-file", handler_missing_file);
+}
+
+int main(void) {
+  if (create_test_file() != 0) {
+    fprintf(stderr, "Failed to create %s\n", TEST_FILE);
+    return 1;
+  }
+
+  mock_init(setup_routes);
+  RUN_TEST(test_send_file_full);
+  RUN_TEST(test_send_file_range);
+  RUN_TEST(test_send_file_suffix_range);
+  RUN_TEST(test_send_file_unsatisfiable);
+  RUN_TEST(test_send_file_stale_if_range);
+  RUN_TEST(test_send_file_missing);
+  mock_cleanup();
+
+  remove(TEST_FILE);
+  return 0;
+}
@@ -0,0 +1,238 @@
+#include "ecewo.h"
+#include "ecewo-mock.h"
+#include "tester.h"
+#include "raw-client.h"
+
+void handler_publish(Req *req, Res *res) {
+  const char *data = get_query(req, "data");
+
+  if (sse_publish(get_param(req, "channel"), "update", data, data ? strlen(data) : 0) != 0) {
+    send_text(res, 500, "Not published");
+    return;
+  }
+
+  send_text(res, 200, "Published");
+}
+
+void handler_subscribe_invalid(Req *req, Res *res) {
+  if (sse_subscribe(req, res, NULL) != 0) {
+    send_text(res, 400, "No channel");
+    return;
+  }
+}
+
+void handler_subscribe_replied(Req *req, Res *res) {
+  send_text(res, 200, "Replied");
+
+  // The response is already queued, the connection stays HTTP
+  if (sse_subscribe(req, res, "news") == 0)
+    send_text(res, 500, "Subscribed");
+}
+
+int test_sse_publish_without_subscribers(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/publish/news?data=first"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("Published", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_sse_publish_multiline(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/publish/news?data=a%0Ab"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_sse_subscribe_invalid(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/subscribe-invalid"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(400, res.status_code);
+  ASSERT_EQ_STR("No channel", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_sse_subscribe_after_reply(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/subscribe-replied"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("Replied", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+void handler_subscribe(Req *req, Res *res) {
+  if (sse_subscribe(req, res, get_param(req, "channel")) != 0)
+    send_text(res, 500, "Not subscribed");
+}
+
+static int server_port;
+
+// Reads the stream until `until` shows up in it
+static bool read_until(int fd, char *buf, size_t cap, size_t *len, const char *until) {
+  while (!strstr(buf, until)) {
+    if (*len + 1 >= cap)
+      return false;
+
+    ssize_t got = raw_recv(fd, buf + *len, cap - *len - 1, RAW_TIMEOUT_MS);
+    if (got <= 0)
+      return false;
+
+    *len += (size_t)got;
+    buf[*len] = '\0';
+  }
+
+  return true;
+}
+
+static int subscribe(const char *channel, const char *last_event_id, char *buf, size_t cap, size_t *len) {
+  int fd = raw_connect(server_port);
+  if (fd < 0)
+    return -1;
+
+  char request_buf[256];
+  snprintf(request_buf, sizeof(request_buf),
+           "GET /subscribe/%s HTTP/1.1\r\nHost: localhost\r\n%s%s%s\r\n",
+           channel,
+           last_event_id ? "Last-Event-ID: " : "",
+           last_event_id ? last_event_id : "",
+           last_event_id ? "\r\n" : "");
+
+  buf[0] = '\0';
+  *len = 0;
+
+  if (!raw_send(fd, request_buf) || !read_until(fd, buf, cap, len, "\r\n\r\n")) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static int publish(const char *channel, const char *data) {
+  char path[256];
+  snprintf(path, sizeof(path), "/publish/%s?data=%s", channel, data);
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = path
+  };
+
+  MockResponse res = request(&params);
+  int status = res.status_code;
+
+  free_request(&res);
+  return status;
+}
+
+int test_sse_subscriber_receives(void) {
+  char buf[4096];
+  size_t len = 0;
+
+  int fd = subscribe("live", NULL, buf, sizeof(buf), &len);
+  ASSERT_GT(fd, -1);
+
+  ASSERT_EQ(0, strncmp(buf, "HTTP/1.1 200", 12));
+  ASSERT_NOT_NULL(strstr(buf, "Content-Type: text/event-stream\r\n"));
+  ASSERT_NOT_NULL(strstr(buf, "Cache-Control: no-cache\r\n"));
+  ASSERT_NULL(strstr(buf, "Content-Length"));
+  ASSERT_NULL(strstr(buf, "Transfer-Encoding"));
+
+  // Each line of the data is its own data: field
+  ASSERT_EQ(200, publish("live", "first%0Asecond%0Athird"));
+  ASSERT_TRUE(read_until(fd, buf, sizeof(buf), &len, "data: third\n\n"));
+
+  char *event = strstr(buf, "\r\n\r\n") + 4;
+  ASSERT_EQ(0, strncmp(event, "id: ", 4));
+  ASSERT_NOT_NULL(strstr(event, "\nevent: update\ndata: first\ndata: second\ndata: third\n\n"));
+
+  close(fd);
+  RETURN_OK();
+}
+
+int test_sse_replay_last_event_id(void) {
+  char buf[4096];
+  size_t len = 0;
+
+  int fd = subscribe("replay", NULL, buf, sizeof(buf), &len);
+  ASSERT_GT(fd, -1);
+
+  ASSERT_EQ(200, publish("replay", "one"));
+  ASSERT_TRUE(read_until(fd, buf, sizeof(buf), &len, "data: one\n\n"));
+
+  char *id_line = strstr(buf, "id: ");
+  ASSERT_NOT_NULL(id_line);
+
+  char last_id[24];
+  snprintf(last_id, sizeof(last_id), "%" PRIu64, (uint64_t)strtoull(id_line + 4, NULL, 10));
+  close(fd);
+
+  // Missed while disconnected
+  ASSERT_EQ(200, publish("replay", "two"));
+  ASSERT_EQ(200, publish("replay", "three"));
+
+  fd = subscribe("replay", last_id, buf, sizeof(buf), &len);
+  ASSERT_GT(fd, -1);
+  ASSERT_TRUE(read_until(fd, buf, sizeof(buf), &len, "data: three\n\n"));
+
+  ASSERT_NULL(strstr(buf, "data: one\n"));
+  char *two = strstr(buf, "data: two\n");
+  ASSERT_NOT_NULL(two);
+  ASSERT_TRUE(two < strstr(buf, "data: three\n"));
+
+  // Live events follow the replayed ones
+  ASSERT_EQ(200, publish("replay", "four"));
+  ASSERT_TRUE(read_until(fd, buf, sizeof(buf), &len, "data: four\n\n"));
+
+  close(fd);
+  RETURN_OK();
+}
+
+static void setup_routes(void) {
+  get("/publish/:channel", handler_publish);
+  get("/subscribe-invalid", handler_subscribe_invalid);
+  get("/subscribe-replied", handler_subscribe_replied);
+  get("/subscribe/:channel", handler_subscribe);
+  get("/port", raw_port_handler);
+}
+
+int main(void) {
+  mock_init(setup_routes);
+  RUN_TEST(test_sse_publish_without_subscribers);
+  RUN_TEST(test_sse_publish_multiline);
+  RUN_TEST(test_sse_subscribe_invalid);
+  RUN_TEST(test_sse_subscribe_after_reply);
+
+  server_port = raw_server_port("/port");
+  RUN_TEST(test_sse_subscriber_receives);
+  RUN_TEST(test_sse_replay_last_event_id);
+  mock_cleanup();
+  return 0;
+}
@@ -0,0 +1,114 @@
+#include "ecewo.h"
+#include "ecewo-mock.h"
+#include "tester.h"
+
+static const char health_body[] = "{\"status\":\"ok\"}";
+
+void middleware_mark(Req *req, Res *res, Next next) {
+  set_header(res, "X-Middleware", "ran");
+  next(req, res);
+}
+
+void handler_dynamic(Req *req, Res *res) {
+  (void)req;
+  send_text(res, 200, "dynamic");
+}
+
+int test_static_response(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/health"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR(health_body, res.body);
+  ASSERT_EQ_STR("application/json", mock_get_header(&res, "Content-Type"));
+  ASSERT_NOT_NULL(mock_get_header(&res, "Date"));
+
+  // Global middleware does not run for static routes
+  ASSERT_NULL(mock_get_header(&res, "X-Middleware"));
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_static_ignores_query(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/health?verbose=1"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR(health_body, res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_static_custom_status(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/gone"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(410, res.status_code);
+  ASSERT_EQ_STR("Gone", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_static_other_method(void) {
+  MockParams params = {
+    .method = MOCK_POST,
+    .path = "/health"
+  };
+
+  MockResponse res = request(&params);
+
+  // Only GET and HEAD are answered, the rest goes to the router
+  ASSERT_EQ(404, res.status_code);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_dynamic_next_to_static(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/dynamic"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("dynamic", res.body);
+  ASSERT_EQ_STR("ran", mock_get_header(&res, "X-Middleware"));
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+static void setup_routes(void) {
+  use(middleware_mark);
+  register_static("/health", 200, "application/json", health_body, strlen(health_body));
+  register_static("/gone", 410, "text/plain", "Gone", 4);
+  get("/dynamic", handler_dynamic);
+}
+
+int main(void) {
+  mock_init(setup_routes);
+  RUN_TEST(test_static_response);
+  RUN_TEST(test_static_ignores_query);
+  RUN_TEST(test_static_custom_status);
+  RUN_TEST(test_static_other_method);
+  RUN_TEST(test_dynamic_next_to_static);
+  mock_cleanup();
+  return 0;
+}
@@ -0,0 +1,82 @@
+#include "ecewo.h"
+#include "ecewo-mock.h"
+#include "tester.h"
+#include "raw-client.h"
+
+// HEADER_TIMEOUT_MS in server.c
+#define HEADER_TIMEOUT_S 10
+
+#define PARTIAL_REQUEST "GET /hello HTTP/1.1\r\nHost: localhost\r\n"
+
+static int server_port;
+
+void handler_hello(Req *req, Res *res) {
+  (void)req;
+  send_text(res, 200, "hello");
+}
+
+int test_header_deadline(void) {
+  int stalled = raw_connect(server_port);
+  int trickling = raw_connect(server_port);
+  int completed = raw_connect(server_port);
+  ASSERT_GT(stalled, -1);
+  ASSERT_GT(trickling, -1);
+  ASSERT_GT(completed, -1);
+
+  ASSERT_TRUE(raw_send(stalled, PARTIAL_REQUEST));
+  ASSERT_TRUE(raw_send(trickling, PARTIAL_REQUEST));
+  ASSERT_TRUE(raw_send(completed, PARTIAL_REQUEST));
+
+  char buf[1024];
+
+  for (int second = 1; second < HEADER_TIMEOUT_S; second++) {
+    uv_sleep(1000);
+
+    // Neither answered nor closed before the deadline
+    ASSERT_TRUE(raw_silent(stalled, 0));
+    ASSERT_TRUE(raw_silent(trickling, 0));
+
+    // More header lines do not move the deadline
+    ASSERT_TRUE(raw_send(trickling, "X-Trickle: 1\r\n"));
+
+    // A finished request cancels it
+    if (second == HEADER_TIMEOUT_S / 2) {
+      ASSERT_TRUE(raw_send(completed, "\r\n"));
+      ASSERT_GT(raw_read_responses(completed, buf, sizeof(buf), 1), 0);
+      ASSERT_NOT_NULL(strstr(buf, "\r\n\r\nhello"));
+    }
+  }
+
+  ASSERT_TRUE(raw_closed(stalled, 3000));
+  ASSERT_TRUE(raw_closed(trickling, 3000));
+
+  // Past the header deadline, the kept-alive connection still serves
+  ASSERT_TRUE(raw_silent(completed, 0));
+  ASSERT_TRUE(raw_send(completed, PARTIAL_REQUEST "\r\n"));
+  ASSERT_GT(raw_read_responses(completed, buf, sizeof(buf), 1), 0);
+  ASSERT_NOT_NULL(strstr(buf, "\r\n\r\nhello"));
+
+  close(stalled);
+  close(trickling);
+  close(completed);
+  RETURN_OK();
+}
+
+static void setup_routes(void) {
+  get("/hello", handler_hello);
+  get("/port", raw_port_handler);
+}
+
+int main(void) {
+  mock_init(setup_routes);
+
+  server_port = raw_server_port("/port");
+  if (server_port <= 0) {
+    fprintf(stderr, "Failed to find the server port\n");
+    return 1;
+  }
+
+  RUN_TEST(test_header_deadline);
+  mock_cleanup();
+  return 0;
+}
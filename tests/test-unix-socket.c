@@ -0,0 +1,171 @@
+#include "ecewo.h"
+#include "tester.h"
+#include "raw-client.h"
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define REQUEST(path) "GET " path " HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+// Exit status of a server that could not listen
+#define LISTEN_FAILED 2
+
+void handler_hello(Req *req, Res *res) {
+  (void)req;
+  send_text(res, 200, "hello");
+}
+
+static void stop_server(void *context) {
+  (void)context;
+  server_shutdown();
+}
+
+void handler_stop(Req *req, Res *res) {
+  (void)req;
+  send_text(res, 200, "stopping");
+  set_timeout(stop_server, 10, NULL);
+}
+
+// server_listen_unix() can only be called once per process, so every
+// server runs in a child of its own
+static pid_t start_server(const char *path, int mode) {
+  pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+
+  if (server_init() != 0)
+    _exit(1);
+
+  get("/hello", handler_hello);
+  get("/stop", handler_stop);
+
+  if (server_listen_unix(path, mode) != 0)
+    _exit(LISTEN_FAILED);
+
+  // In case the test fails before asking it to stop
+  set_timeout(stop_server, 10000, NULL);
+  server_run();
+  _exit(0);
+}
+
+// Connects once the child listens, -1 with its exit status if it never does
+static int wait_connect(const char *path, pid_t pid, int *exit_status) {
+  for (int i = 0; i < 200; i++) {
+    int fd = raw_connect_unix(path);
+    if (fd >= 0)
+      return fd;
+
+    int status;
+    if (waitpid(pid, &status, WNOHANG) == pid) {
+      *exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+      return -1;
+    }
+
+    uv_sleep(10);
+  }
+
+  return -1;
+}
+
+static int stop_and_wait(int fd, pid_t pid) {
+  char buf[1024];
+  int status = -1;
+
+  if (raw_send(fd, REQUEST("/stop")))
+    raw_read_responses(fd, buf, sizeof(buf), 1);
+
+  close(fd);
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static bool hello(int fd) {
+  char buf[1024];
+
+  if (!raw_send(fd, REQUEST("/hello")) || raw_read_responses(fd, buf, sizeof(buf), 1) <= 0)
+    return false;
+
+  return strstr(buf, "HTTP/1.1 200") && strstr(buf, "\r\n\r\nhello");
+}
+
+// A socket file left behind by a process that did not clean up
+static bool leave_stale_socket(const char *path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return false;
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  bool bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+  close(fd);
+  return bound;
+}
+
+int test_unix_socket_path(void) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/ecewo-test-%d.sock", (int)getpid());
+  unlink(path);
+
+  ASSERT_TRUE(leave_stale_socket(path));
+
+  pid_t pid = start_server(path, 0600);
+  ASSERT_GT(pid, 0);
+
+  int exit_status = 0;
+  int fd = wait_connect(path, pid, &exit_status);
+  ASSERT_GT(fd, -1);
+
+  struct stat st;
+  ASSERT_EQ(0, stat(path, &st));
+  ASSERT_TRUE(S_ISSOCK(st.st_mode));
+  ASSERT_EQ(0600, (int)(st.st_mode & 0777));
+
+  // Kept alive like a TCP connection
+  ASSERT_TRUE(hello(fd));
+  ASSERT_TRUE(hello(fd));
+
+  int other = raw_connect_unix(path);
+  ASSERT_GT(other, -1);
+  ASSERT_TRUE(hello(other));
+  close(other);
+
+  ASSERT_EQ(0, stop_and_wait(fd, pid));
+
+  // The socket file goes away with the server
+  ASSERT_NE(0, access(path, F_OK));
+  RETURN_OK();
+}
+
+int test_unix_socket_abstract(void) {
+  char path[64];
+  snprintf(path, sizeof(path), "@ecewo-test-%d", (int)getpid());
+
+  pid_t pid = start_server(path, 0600);
+  ASSERT_GT(pid, 0);
+
+  int exit_status = 0;
+  int fd = wait_connect(path, pid, &exit_status);
+
+  // libuv before 1.46 cannot bind abstract sockets
+  if (fd < 0 && exit_status == LISTEN_FAILED)
+    RETURN_SKIP("Abstract sockets are not supported here");
+
+  ASSERT_GT(fd, -1);
+
+  ASSERT_TRUE(hello(fd));
+  ASSERT_TRUE(hello(fd));
+
+  // Nothing is created on the filesystem
+  ASSERT_NE(0, access(path, F_OK));
+
+  ASSERT_EQ(0, stop_and_wait(fd, pid));
+  RETURN_OK();
+}
+
+int main(void) {
+  RUN_TEST(test_unix_socket_path);
+  RUN_TEST(test_unix_socket_abstract);
+  return 0;
+}
@@ -0,0 +1,420 @@
+#include "ecewo.h"
+#include "ecewo-mock.h"
+#include "tester.h"
+#include "raw-client.h"
+
+void handler_upgrade(Req *req, Res *res) {
+  WebSocketConfig config = { 0 };
+
+  if (ws_upgrade(req, res, &config) != 0) {
+    send_text(res, 400, "Not a handshake");
+    return;
+  }
+}
+
+void handler_broadcast(Req *req, Res *res) {
+  const char *data = get_query(req, "data");
+
+  if (ws_broadcast(get_param(req, "group"), data, data ? strlen(data) : 0, false) != 0) {
+    send_text(res, 500, "Not sent");
+    return;
+  }
+
+  send_text(res, 200, "Sent");
+}
+
+int test_ws_upgrade_plain_request(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/ws"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(400, res.status_code);
+  ASSERT_EQ_STR("Not a handshake", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_ws_upgrade_wrong_version(void) {
+  MockHeaders headers[] = {
+    { "Upgrade", "websocket" },
+    { "Connection", "Upgrade" },
+    { "Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==" },
+    { "Sec-WebSocket-Version", "8" }
+  };
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/ws",
+    .headers = headers,
+    .header_count = 4
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(400, res.status_code);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_ws_upgrade_post(void) {
+  MockHeaders headers[] = {
+    { "Upgrade", "websocket" },
+    { "Connection", "Upgrade" },
+    { "Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==" },
+    { "Sec-WebSocket-Version", "13" }
+  };
+
+  MockParams params = {
+    .method = MOCK_POST,
+    .path = "/ws",
+    .headers = headers,
+    .header_count = 4
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(400, res.status_code);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_ws_broadcast_without_members(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/broadcast/chat?data=hello"
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("Sent", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+static int server_port;
+
+static int messages_delivered;
+
+static void echo_message(WebSocket *ws, const void *data, size_t len, bool binary) {
+  messages_delivered++;
+  ws_send(ws, data, len, binary);
+}
+
+void handler_echo(Req *req, Res *res) {
+  WebSocketConfig config = {
+    .on_message = echo_message
+  };
+
+  if (ws_upgrade(req, res, &config) != 0)
+    send_text(res, 400, "Not a handshake");
+}
+
+#define OP_CONTINUATION 0x0
+#define OP_TEXT 0x1
+#define OP_BINARY 0x2
+#define OP_CLOSE 0x8
+#define OP_PING 0x9
+#define OP_PONG 0xA
+
+static const uint8_t test_mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+
+// Appends a masked client frame to out, returns its length
+static size_t frame_build(uint8_t *out, bool fin, uint8_t opcode, const void *payload, size_t len) {
+  size_t pos = 0;
+  out[pos++] = (uint8_t)((fin ? 0x80 : 0) | opcode);
+
+  if (len < 126) {
+    out[pos++] = (uint8_t)(0x80 | len);
+  } else if (len <= 0xFFFF) {
+    out[pos++] = 0x80 | 126;
+    out[pos++] = (uint8_t)(len >> 8);
+    out[pos++] = (uint8_t)len;
+  } else {
+    out[pos++] = 0x80 | 127;
+    for (int i = 7; i >= 0; i--)
+      out[pos++] = (uint8_t)((uint64_t)len >> (i * 8));
+  }
+
+  memcpy(out + pos, test_mask, 4);
+  pos += 4;
+
+  const uint8_t *bytes = payload;
+  for (size_t i = 0; i < len; i++)
+    out[pos + i] = bytes[i] ^ test_mask[i & 3];
+
+  return pos + len;
+}
+
+static bool send_bytes(int fd, const uint8_t *data, size_t len) {
+  while (len > 0) {
+    ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+    if (sent <= 0)
+      return false;
+    data += sent;
+    len -= (size_t)sent;
+  }
+  return true;
+}
+
+static bool send_frame(int fd, bool fin, uint8_t opcode, const void *payload, size_t len) {
+  uint8_t *frame = malloc(len + 14);
+  if (!frame)
+    return false;
+
+  bool ok = send_bytes(fd, frame, frame_build(frame, fin, opcode, payload, len));
+  free(frame);
+  return ok;
+}
+
+static bool read_exact(int fd, uint8_t *buf, size_t len) {
+  while (len > 0) {
+    ssize_t got = raw_recv(fd, (char *)buf, len, RAW_TIMEOUT_MS);
+    if (got <= 0)
+      return false;
+    buf += got;
+    len -= (size_t)got;
+  }
+  return true;
+}
+
+// Reads one unmasked server frame, returns the payload length or -1
+static ssize_t read_frame(int fd, uint8_t *opcode, uint8_t *payload, size_t cap) {
+  uint8_t header[10];
+  if (!read_exact(fd, header, 2))
+    return -1;
+
+  *opcode = header[0] & 0x0F;
+  uint64_t len = header[1] & 0x7F;
+
+  if (len == 126) {
+    if (!read_exact(fd, header + 2, 2))
+      return -1;
+    len = ((uint64_t)header[2] << 8) | header[3];
+  } else if (len == 127) {
+    if (!read_exact(fd, header + 2, 8))
+      return -1;
+    len = 0;
+    for (int i = 0; i < 8; i++)
+      len = (len << 8) | header[2 + i];
+  }
+
+  if (len > cap || !read_exact(fd, payload, (size_t)len))
+    return -1;
+
+  return (ssize_t)len;
+}
+
+// Opens a connection and completes the RFC 6455 handshake on it
+static int ws_connect(void) {
+  int fd = raw_connect(server_port);
+  if (fd < 0)
+    return -1;
+
+  raw_send(fd, "GET /echo HTTP/1.1\r\n"
+               "Host: localhost\r\n"
+               "Upgrade: websocket\r\n"
+               "Connection: Upgrade\r\n"
+               "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+               "Sec-WebSocket-Version: 13\r\n\r\n");
+
+  // Byte by byte, so no frame is read with the headers
+  char headers[1024];
+  size_t len = 0;
+
+  while (len + 1 < sizeof(headers)) {
+    if (!read_exact(fd, (uint8_t *)headers + len, 1))
+      break;
+    headers[++len] = '\0';
+    if (len >= 4 && memcmp(headers + len - 4, "\r\n\r\n", 4) == 0)
+      break;
+  }
+
+  if (strncmp(headers, "HTTP/1.1 101", 12) != 0
+      || !strstr(headers, "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n")) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+int test_ws_handshake(void) {
+  int fd = ws_connect();
+  ASSERT_GT(fd, -1);
+
+  close(fd);
+  RETURN_OK();
+}
+
+int test_ws_masked_echo(void) {
+  int fd = ws_connect();
+  ASSERT_GT(fd, -1);
+
+  // Around the 16 and 32 byte unmasking widths, and the 16-bit length
+  static const size_t lengths[] = { 1, 3, 15, 16, 17, 31, 32, 33, 47, 63, 64, 65, 125, 126, 127, 1000, 70000 };
+  size_t count = sizeof(lengths) / sizeof(lengths[0]);
+
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++)
+    total += lengths[i] + 14;
+
+  uint8_t *batch = malloc(total);
+  // Each frame takes its payload from its own offset
+  uint8_t *payload = malloc(70000 + count);
+  uint8_t *echo = malloc(70000);
+  ASSERT_NOT_NULL(batch);
+  ASSERT_NOT_NULL(payload);
+  ASSERT_NOT_NULL(echo);
+
+  for (size_t i = 0; i < 70000 + count; i++)
+    payload[i] = (uint8_t)(i * 31 + 7);
+
+  // One write, so most payloads start at an odd offset of the read
+  size_t len = 0;
+  for (size_t i = 0; i < count; i++)
+    len += frame_build(batch + len, true, OP_BINARY, payload + i, lengths[i]);
+
+  ASSERT_TRUE(send_bytes(fd, batch, len));
+
+  for (size_t i = 0; i < count; i++) {
+    uint8_t opcode = 0;
+    ASSERT_EQ((int64_t)lengths[i], read_frame(fd, &opcode, echo, 70000));
+    ASSERT_EQ(OP_BINARY, opcode);
+    ASSERT_TRUE(memcmp(echo, payload + i, lengths[i]) == 0);
+  }
+
+  // A frame split inside its payload, the rest unmasks from mask offset 3
+  len = frame_build(batch, true, OP_BINARY, payload, 40);
+  ASSERT_TRUE(send_bytes(fd, batch, 6 + 7));
+  uv_sleep(20);
+  ASSERT_TRUE(send_bytes(fd, batch + 6 + 7, len - 6 - 7));
+
+  uint8_t opcode = 0;
+  ASSERT_EQ(40, read_frame(fd, &opcode, echo, 70000));
+  ASSERT_TRUE(memcmp(echo, payload, 40) == 0);
+
+  free(batch);
+  free(payload);
+  free(echo);
+  close(fd);
+  RETURN_OK();
+}
+
+int test_ws_fragmented(void) {
+  int fd = ws_connect();
+  ASSERT_GT(fd, -1);
+
+  // A ping may arrive between the fragments of a message
+  ASSERT_TRUE(send_frame(fd, false, OP_TEXT, "Hel", 3));
+  ASSERT_TRUE(send_frame(fd, false, OP_CONTINUATION, "lo, ", 4));
+  ASSERT_TRUE(send_frame(fd, true, OP_PING, "mid", 3));
+  ASSERT_TRUE(send_frame(fd, true, OP_CONTINUATION, "world", 5));
+
+  uint8_t payload[64];
+  uint8_t opcode = 0;
+
+  ASSERT_EQ(3, read_frame(fd, &opcode, payload, sizeof(payload)));
+  ASSERT_EQ(OP_PONG, opcode);
+
+  ASSERT_EQ(12, read_frame(fd, &opcode, payload, sizeof(payload)));
+  ASSERT_EQ(OP_TEXT, opcode);
+  ASSERT_TRUE(memcmp(payload, "Hello, world", 12) == 0);
+
+  close(fd);
+  RETURN_OK();
+}
+
+int test_ws_ping_pong(void) {
+  int fd = ws_connect();
+  ASSERT_GT(fd, -1);
+
+  ASSERT_TRUE(send_frame(fd, true, OP_PING, "are you there", 13));
+
+  uint8_t payload[64];
+  uint8_t opcode = 0;
+
+  ASSERT_EQ(13, read_frame(fd, &opcode, payload, sizeof(payload)));
+  ASSERT_EQ(OP_PONG, opcode);
+  ASSERT_TRUE(memcmp(payload, "are you there", 13) == 0);
+
+  close(fd);
+  RETURN_OK();
+}
+
+int test_ws_close(void) {
+  int fd = ws_connect();
+  ASSERT_GT(fd, -1);
+
+  const uint8_t close_payload[] = { 0x03, 0xE8, 'b', 'y', 'e' }; // 1000
+  ASSERT_TRUE(send_frame(fd, true, OP_CLOSE, close_payload, sizeof(close_payload)));
+
+  uint8_t payload[64];
+  uint8_t opcode = 0;
+
+  ASSERT_EQ(2, read_frame(fd, &opcode, payload, sizeof(payload)));
+  ASSERT_EQ(OP_CLOSE, opcode);
+  ASSERT_EQ(1000, (payload[0] << 8) | payload[1]);
+  ASSERT_TRUE(raw_closed(fd, RAW_TIMEOUT_MS));
+
+  close(fd);
+  RETURN_OK();
+}
+
+int test_ws_invalid_utf8(void) {
+  int fd = ws_connect();
+  ASSERT_GT(fd, -1);
+
+  // Nothing after the invalid frame is delivered
+  messages_delivered = 0;
+
+  uint8_t batch[64];
+  size_t len = frame_build(batch, true, OP_TEXT, "ok\xC3\x28", 4);
+  len += frame_build(batch + len, true, OP_TEXT, "after", 5);
+  ASSERT_TRUE(send_bytes(fd, batch, len));
+
+  uint8_t payload[64];
+  uint8_t opcode = 0;
+
+  ASSERT_EQ(2, read_frame(fd, &opcode, payload, sizeof(payload)));
+  ASSERT_EQ(OP_CLOSE, opcode);
+  ASSERT_EQ(1007, (payload[0] << 8) | payload[1]);
+  ASSERT_TRUE(raw_closed(fd, RAW_TIMEOUT_MS));
+  ASSERT_EQ(0, messages_delivered);
+
+  close(fd);
+  RETURN_OK();
+}
+
+static void setup_routes(void) {
+  get("/ws", handler_upgrade);
+  post("/ws", handler_upgrade);
+  get("/broadcast/:group", handler_broadcast);
+  get("/echo", handler_echo);
+  get("/port", raw_port_handler);
+}
+
+int main(void) {
+  mock_init(setup_routes);
+  RUN_TEST(test_ws_upgrade_plain_request);
+  RUN_TEST(test_ws_upgrade_wrong_version);
+  RUN_TEST(test_ws_upgrade_post);
+  RUN_TEST(test_ws_broadcast_without_members);
+
+  server_port = raw_server_port("/port");
+  RUN_TEST(test_ws_handshake);
+  RUN_TEST(test_ws_masked_echo);
+  RUN_TEST(test_ws_fragmented);
+  RUN_TEST(test_ws_ping_pong);
+  RUN_TEST(test_ws_close);
+  RUN_TEST(test_ws_invalid_utf8);
+  mock_cleanup();
+  return 0;
+}